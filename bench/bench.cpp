@@ -0,0 +1,570 @@
+// Benchmarks for the main operations of the library, over synthetic files.
+// Build with `make bench`, and run as
+//   build/bench [--sizes 1,64,10240] [--depths 1,100,10000,1000000] [--filter name] [--repetitions 3]
+//               [--format text|json] [--out results.json] [--baseline earlier.json]
+// Sizes are in MiB. Results go to stdout (or --out), progress goes to stderr. With a baseline (the JSON output of
+// another build, see `make bench_compare`) each case also shows how many times faster it is.
+#include <atomic>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+
+#include "harness.hpp"
+#include "../src/herix.hpp"
+
+using namespace HerixLib;
+using namespace HerixBench;
+
+// Set by the Makefile to tell the builds apart in the results
+#ifndef HERIX_BENCH_BUILD
+#define HERIX_BENCH_BUILD "unknown"
+#endif
+
+static constexpr size_t mebibyte = 1024 * 1024;
+
+/// Heap allocations made by the whole process, counted by replacing the global operator new. For the cases that are
+/// about avoiding them.
+static std::atomic<size_t> heap_allocations{ 0 };
+
+void* operator new (size_t size) {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* data = std::malloc(size == 0 ? 1 : size)) {
+        return data;
+    }
+    throw std::bad_alloc();
+}
+void operator delete (void* data) noexcept {
+    std::free(data);
+}
+void operator delete (void* data, size_t) noexcept {
+    std::free(data);
+}
+
+static void writeFile (const std::filesystem::path& path, size_t size) {
+    std::mt19937_64 random(1234);
+    Buffer block(mebibyte);
+    std::ofstream out(path, std::ios_base::binary | std::ios_base::trunc);
+    for (size_t written = 0; written < size; written += block.size()) {
+        for (Byte& byte : block) {
+            byte = static_cast<Byte>(random());
+        }
+        out.write(reinterpret_cast<const char*>(block.data()), static_cast<std::streamsize>(std::min(block.size(), size - written)));
+    }
+    if (out.fail()) {
+        throw std::runtime_error("Failed to write benchmark file.");
+    }
+}
+
+/// Something closer to an executable than random bytes: zero padding, code-like runs that repeat with small changes,
+/// and some incompressible data, so that compression has what it would on a typical binary
+static void writeBinaryFile (const std::filesystem::path& path, size_t size) {
+    std::mt19937_64 random(4321);
+    const Byte code[] = { 0x55, 0x48, 0x89, 0xE5, 0x48, 0x83, 0xEC, 0x20, 0x89, 0x7D, 0xEC, 0x8B, 0x45, 0xEC, 0xE8, 0x00, 0x00, 0x00, 0x00, 0xC9, 0xC3 };
+    Buffer contents;
+    contents.reserve(size);
+    while (contents.size() < size) {
+        size_t kind = random() % 8;
+        size_t length = 64 + (random() % 2048);
+        for (size_t i = 0; i < length; i++) {
+            if (kind < 2) {
+                contents.push_back(0);
+            } else if (kind < 7) {
+                // Call targets and offsets differ between otherwise similar functions
+                contents.push_back(i % sizeof(code) >= 15 && i % sizeof(code) < 19 ? static_cast<Byte>(random()) : code[i % sizeof(code)]);
+            } else {
+                contents.push_back(static_cast<Byte>(random()));
+            }
+        }
+    }
+    contents.resize(size);
+
+    std::ofstream out(path, std::ios_base::binary | std::ios_base::trunc);
+    out.write(reinterpret_cast<const char*>(contents.data()), static_cast<std::streamsize>(contents.size()));
+    if (out.fail()) {
+        throw std::runtime_error("Failed to write benchmark file.");
+    }
+}
+
+static std::vector<size_t> parseList (const std::string& text) {
+    std::vector<size_t> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        values.push_back(std::strtoull(item.c_str(), nullptr, 10));
+    }
+    return values;
+}
+
+/// Keeps results from being optimized away
+static volatile size_t sink = 0;
+
+// == Reads ==
+
+static void benchReads (Bench& bench, const std::filesystem::path& path, size_t file_size) {
+    std::map<std::string, std::string> params{ { "file_mib", std::to_string(file_size / mebibyte) } };
+
+    // Byte at a time is slow, so it only covers the start of large files
+    size_t byte_count = std::min(file_size, 16 * mebibyte);
+    bench.run("read_sequential", params, byte_count, byte_count, nullptr, [&] () {
+        Herix h(path, false);
+        size_t sum = 0;
+        for (FilePosition pos = 0; pos < byte_count; pos++) {
+            sum += h.read(pos).value_or(0);
+        }
+        sink = sum;
+    });
+
+    size_t random_count = 200000;
+    bench.run("read_random", params, random_count, random_count, nullptr, [&] () {
+        Herix h(path, false);
+        std::mt19937_64 random(42);
+        size_t sum = 0;
+        for (size_t i = 0; i < random_count; i++) {
+            sum += h.read(random() % file_size).value_or(0);
+        }
+        sink = sum;
+    });
+
+    size_t multiple_count = 20000;
+    bench.run("read_multiple", params, multiple_count, multiple_count * 64, nullptr, [&] () {
+        Herix h(path, false);
+        std::mt19937_64 random(43);
+        size_t sum = 0;
+        for (size_t i = 0; i < multiple_count; i++) {
+            sum += h.readMultiple(random() % (file_size - 64), 64).size();
+        }
+        sink = sum;
+    });
+
+    // Fixed size chunks against adaptive chunking, with enough memory for the larger extents to matter
+    for (bool adaptive : { false, true }) {
+        std::map<std::string, std::string> chunk_params = params;
+        chunk_params["chunking"] = adaptive ? "adaptive" : "fixed";
+
+        bench.run("read_into_sequential", chunk_params, file_size / 64, file_size, nullptr, [&] () {
+            Herix h(path, false, std::make_pair(0, std::nullopt), 256 * 1024, 1024);
+            if (adaptive) {
+                h.enableAdaptiveChunking();
+            }
+            Buffer row(64);
+            size_t sum = 0;
+            for (FilePosition pos = 0; pos < file_size; pos += row.size()) {
+                h.readInto(pos, row.size(), row.data());
+                sum += row[0];
+            }
+            sink = sum;
+        });
+
+        size_t count = 20000;
+        bench.run("read_into_random", chunk_params, count, count * 8, nullptr, [&] () {
+            Herix h(path, false, std::make_pair(0, std::nullopt), 256 * 1024, 1024);
+            if (adaptive) {
+                h.enableAdaptiveChunking();
+            }
+            std::mt19937_64 random(5678);
+            Buffer value(8);
+            size_t sum = 0;
+            for (size_t i = 0; i < count; i++) {
+                h.readInto(random() % (file_size - value.size()), value.size(), value.data());
+                sum += value[0];
+            }
+            sink = sum;
+        });
+    }
+
+    // Every miss goes over the memory limit, so every load also runs cleanupChunks
+    size_t churn_count = 50000;
+    bench.run("cleanup_churn", params, churn_count, 0, nullptr, [&] () {
+        Herix h(path, false, std::make_pair(0, std::nullopt), 16 * 1024, 1024);
+        std::mt19937_64 random(44);
+        size_t sum = 0;
+        for (size_t i = 0; i < churn_count; i++) {
+            sum += h.read(random() % file_size).value_or(0);
+        }
+        sink = sum;
+    });
+}
+
+// == Compressed tier ==
+
+/// Random reads over a working set eight times the chunk memory, without and with the compressed tier behind it.
+/// The page cache hides most of what the tier saves on a local disk, so this mostly shows its overhead and hit rate.
+static void benchCompressedTier (Bench& bench, size_t file_size) {
+    if (!bench.isSelected("read_compressed_tier")) {
+        return;
+    }
+
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "herix_bench_binary.bin";
+    size_t working_set = std::min(file_size, 8 * mebibyte);
+    writeBinaryFile(path, working_set);
+    std::map<std::string, std::string> params{ { "file_mib", std::to_string(file_size / mebibyte) } };
+
+    for (bool compressed : { false, true }) {
+        std::map<std::string, std::string> tier_params = params;
+        tier_params["tier"] = compressed ? "compressed" : "none";
+
+        size_t count = 20000;
+        CompressedChunkPoolStatistics statistics;
+        bench.run("read_compressed_tier", tier_params, count, count * 8, nullptr, [&] () {
+            Herix h(path, false, std::make_pair(0, std::nullopt), working_set / 8, 16 * 1024);
+            if (compressed) {
+                h.enableCompressedTier(working_set / 2);
+            }
+            std::mt19937_64 random(45);
+            Buffer value(8);
+            size_t sum = 0;
+            for (size_t i = 0; i < count; i++) {
+                h.readInto(random() % (working_set - value.size()), value.size(), value.data());
+                sum += value[0];
+            }
+            sink = sum;
+            statistics = h.getCompressedTierStatistics();
+        });
+
+        if (compressed) {
+            std::cerr << "  compressed tier: ratio " << statistics.getCompressionRatio() << ", " << statistics.hits << " hits, "
+                << statistics.misses << " misses, " << statistics.rejected << " rejected\n";
+        }
+    }
+
+    std::filesystem::remove(path);
+}
+
+// == Slab pool ==
+
+/// Scrolling through a file much larger than the chunk memory, so nearly every screen evicts and loads chunks
+static void benchSlabPool (Bench& bench, const std::filesystem::path& path, size_t file_size) {
+    if (!bench.isSelected("scroll_slab_pool")) {
+        return;
+    }
+
+    std::map<std::string, std::string> params{ { "file_mib", std::to_string(file_size / mebibyte) } };
+    size_t screen_size = 4096;
+    size_t count = std::min(file_size / screen_size, static_cast<size_t>(20000));
+    size_t chunk_memory = 256 * 1024;
+    size_t chunk_size = 16 * 1024;
+
+    for (bool pooled : { false, true }) {
+        std::map<std::string, std::string> pool_params = params;
+        pool_params["pool"] = pooled ? "slab" : "none";
+
+        SlabPoolStatistics statistics;
+        size_t allocations = 0;
+        size_t loads = 0;
+        bench.run("scroll_slab_pool", pool_params, count, count * screen_size, nullptr, [&] () {
+            Herix h(path, false, std::make_pair(0, std::nullopt), chunk_memory, chunk_size);
+            if (pooled) {
+                h.enableSlabPool();
+            }
+            Buffer screen(screen_size);
+            size_t sum = 0;
+            size_t allocations_before = heap_allocations.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < count; i++) {
+                h.readInto(i * screen_size, screen_size, screen.data());
+                sum += screen[0];
+            }
+            allocations = heap_allocations.load(std::memory_order_relaxed) - allocations_before;
+            loads = 0;
+            for (const std::pair<const ChunkSize, size_t>& entry : h.getChunkTelemetry().loads_by_size) {
+                loads += entry.second;
+            }
+            sink = sum;
+            statistics = h.getSlabPoolStatistics();
+        });
+
+        std::cerr << "  heap allocations: " << allocations << " for " << loads << " chunk loads\n";
+        if (pooled) {
+            std::cerr << "  slab pool: " << statistics.acquired << " acquired, " << statistics.reused << " reused, "
+                << statistics.slabs_mapped << " slabs mapped, " << statistics.huge_slabs << " huge, "
+                << statistics.control_block_allocations << " control block allocations\n";
+
+            // Filling the chunk memory the first time allocates the bookkeeping, after which each load reuses what the
+            // chunk it evicted had. Any allocations that grow with the loads mean that something stopped being reused.
+            size_t allowed = (chunk_memory / chunk_size) * 8;
+            if (allocations > allowed) {
+                throw std::runtime_error("scroll_slab_pool: " + std::to_string(allocations) + " heap allocations for " +
+                    std::to_string(loads) + " chunk loads, expected at most " + std::to_string(allowed));
+            }
+        }
+    }
+}
+
+// == Pooled files ==
+
+/// Random reads spread over many instances of the file, each opened normally or through a pool with far fewer
+/// descriptors than there are instances
+static void benchPooledFiles (Bench& bench, const std::filesystem::path& path, size_t file_size) {
+    if (!bench.isSelected("read_many_instances")) {
+        return;
+    }
+
+    std::map<std::string, std::string> params{ { "file_mib", std::to_string(file_size / mebibyte) } };
+    size_t instance_count = 200;
+    size_t count = 20000;
+
+    for (bool pooled : { false, true }) {
+        std::map<std::string, std::string> pool_params = params;
+        pool_params["files"] = pooled ? "pooled" : "plain";
+
+        FilePool pool(16);
+        std::vector<std::unique_ptr<Herix>> instances;
+        bench.run("read_many_instances", pool_params, count, 0, [&] () {
+            instances.clear();
+            for (size_t i = 0; i < instance_count; i++) {
+                if (pooled) {
+                    instances.push_back(std::make_unique<Herix>(false, std::make_pair(0, std::nullopt), 64 * 1024, 4096));
+                    instances.back()->loadPooledFile(path, pool);
+                } else {
+                    instances.push_back(std::make_unique<Herix>(path, false, std::make_pair(0, std::nullopt), 64 * 1024, 4096));
+                }
+            }
+        }, [&] () {
+            std::mt19937_64 random(47);
+            size_t sum = 0;
+            for (size_t i = 0; i < count; i++) {
+                sum += instances[i % instance_count]->read(random() % file_size).value_or(0);
+            }
+            sink = sum;
+        });
+
+        if (pooled) {
+            FilePoolStatistics statistics = pool.getStatistics();
+            std::cerr << "  file pool: " << statistics.opens << " opens, " << statistics.reopens << " reopens, at most "
+                << pool.getMaxOpen() << " open for " << instance_count << " instances\n";
+        }
+        instances.clear();
+    }
+}
+
+// == Chunk alignment ==
+
+/// Byte at a time reads are nearly all cache hits, so they're dominated by finding the chunk
+template<typename HerixType>
+static void benchAlignment (Bench& bench, const char* alignment, const std::filesystem::path& path, size_t file_size) {
+    std::map<std::string, std::string> params{ { "file_mib", std::to_string(file_size / mebibyte) }, { "alignment", alignment } };
+    size_t byte_count = std::min(file_size, 16 * mebibyte);
+
+    bench.run("read_aligned", params, byte_count, byte_count, nullptr, [&] () {
+        HerixType h(path, false, std::make_pair(0, std::nullopt), 256 * 1024, 4096);
+        h.enableAdaptiveChunking(64 * 1024);
+        size_t sum = 0;
+        for (FilePosition pos = 0; pos < byte_count; pos++) {
+            sum += h.read(pos).value_or(0);
+        }
+        sink = sum;
+    });
+
+    // Starting part way through a chunk, so every lookup has to align
+    bench.run("read_aligned_offset", params, byte_count, byte_count, nullptr, [&] () {
+        HerixType h(path, false, std::make_pair(100, std::nullopt), 256 * 1024, 4096);
+        size_t sum = 0;
+        for (FilePosition pos = 0; pos + 100 < byte_count; pos++) {
+            sum += h.read(pos).value_or(0);
+        }
+        sink = sum;
+    });
+}
+
+// == Edits ==
+
+static void benchEdits (Bench& bench, const std::filesystem::path& path, size_t file_size, size_t depth) {
+    std::map<std::string, std::string> params{ { "file_mib", std::to_string(file_size / mebibyte) }, { "depth", std::to_string(depth) } };
+    std::unique_ptr<Herix> h;
+
+    auto fresh = [&] () {
+        h = std::make_unique<Herix>(path, false);
+    };
+    auto makeEdits = [&] () {
+        std::mt19937_64 random(45);
+        for (size_t i = 0; i < depth; i++) {
+            h->edit(random() % file_size, static_cast<Byte>(i));
+        }
+    };
+
+    bench.run("edit", params, depth, 0, fresh, makeEdits);
+
+    // Reads have to look through the history, so keep the total work roughly constant
+    size_t read_count = std::max<size_t>(100, std::min<size_t>(100000, 100000000 / depth));
+    bench.run("read_edited", params, read_count, 0, [&] () { fresh(); makeEdits(); }, [&] () {
+        std::mt19937_64 random(46);
+        size_t sum = 0;
+        for (size_t i = 0; i < read_count; i++) {
+            sum += h->read(random() % file_size).value_or(0);
+        }
+        sink = sum;
+    });
+
+    bench.run("undo_redo", params, depth * 2, 0, [&] () { fresh(); makeEdits(); }, [&] () {
+        while (h->canUndo()) {
+            h->undo();
+        }
+        while (h->canRedo()) {
+            h->redo();
+        }
+    });
+
+    h.reset();
+}
+
+// == Bulk edits ==
+
+static void benchBulk (Bench& bench, const std::filesystem::path& path, size_t file_size) {
+    std::map<std::string, std::string> params{ { "file_mib", std::to_string(file_size / mebibyte) } };
+    std::unique_ptr<Herix> h;
+    auto fresh = [&] () {
+        h = std::make_unique<Herix>(path, false);
+    };
+
+    bench.run("fill", params, 1, 0, fresh, [&] () {
+        h->fill(0, file_size, Buffer{ 0x00 });
+    });
+
+    Buffer output(64 * 1024);
+    bench.run("read_filled", params, file_size / output.size(), file_size, [&] () { fresh(); h->fill(0, file_size, Buffer{ 1, 2, 3 }); }, [&] () {
+        size_t sum = 0;
+        for (FilePosition pos = 0; pos < file_size; pos += output.size()) {
+            sum += h->readInto(pos, output.size(), output.data());
+        }
+        sink = sum;
+    });
+
+    bench.run("read_transformed", params, file_size / output.size(), file_size, [&] () {
+        fresh();
+        h->transform(0, file_size, TransformOp::Xor, Buffer{ 0x5A, 0xA5, 0x3C });
+    }, [&] () {
+        size_t sum = 0;
+        for (FilePosition pos = 0; pos < file_size; pos += output.size()) {
+            sum += h->readInto(pos, output.size(), output.data());
+        }
+        sink = sum;
+    });
+
+    // Never in the file (the bytes are random), so this is the search's throughput
+    Buffer absent{ 0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC, 0xDE, 0xF0 };
+    bench.run("find_absent", params, 1, file_size, fresh, [&] () {
+        sink = h->find(0, absent).value_or(0);
+    });
+
+    // Two random bytes match about once every 64KiB
+    bench.run("replace_all", params, 1, file_size, fresh, [&] () {
+        sink = h->replaceAll(Buffer{ 0x12, 0x34 }, Buffer{ 0x00, 0x00 });
+    });
+
+    h.reset();
+}
+
+// == Saving ==
+
+static void benchSaves (Bench& bench, const std::filesystem::path& path, size_t file_size, size_t depth) {
+    std::map<std::string, std::string> params{ { "file_mib", std::to_string(file_size / mebibyte) }, { "depth", std::to_string(depth) } };
+    std::filesystem::path copy = path;
+    copy += ".save";
+    std::filesystem::path output = path;
+    output += ".saveas";
+    std::unique_ptr<Herix> h;
+
+    auto prepare = [&] () {
+        h.reset();
+        std::filesystem::copy_file(path, copy, std::filesystem::copy_options::overwrite_existing);
+        std::filesystem::remove(output);
+        h = std::make_unique<Herix>(copy, true);
+        std::mt19937_64 random(47);
+        for (size_t i = 0; i < depth; i++) {
+            h->edit(random() % file_size, static_cast<Byte>(i));
+        }
+    };
+
+    bench.run("save", params, depth, depth, prepare, [&] () {
+        h->saveHistoryDestructive();
+    });
+    bench.run("save_as", params, depth, file_size, prepare, [&] () {
+        h->saveAsHistoryDestructive(output.string());
+    });
+
+    h.reset();
+    std::filesystem::remove(copy);
+    std::filesystem::remove(output);
+}
+
+int main (int argc, char** argv) {
+    std::vector<size_t> sizes{ 1, 64 };
+    std::vector<size_t> depths{ 1, 100, 10000, 1000000 };
+    std::string format = "text";
+    std::string out_path;
+    Bench bench;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string flag = argv[i];
+        std::string value = argv[i + 1];
+        if (flag == "--sizes") {
+            sizes = parseList(value);
+        } else if (flag == "--depths") {
+            depths = parseList(value);
+        } else if (flag == "--filter") {
+            bench.filter = value;
+        } else if (flag == "--repetitions") {
+            bench.repetitions = std::max<size_t>(1, std::strtoull(value.c_str(), nullptr, 10));
+        } else if (flag == "--format") {
+            format = value;
+        } else if (flag == "--out") {
+            out_path = value;
+        } else if (flag == "--baseline") {
+            bench.loadBaseline(value);
+        } else {
+            std::cerr << "Unknown option: " << flag << "\n";
+            return 1;
+        }
+    }
+
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "herix_bench.bin";
+    for (size_t size_mib : sizes) {
+        size_t file_size = size_mib * mebibyte;
+        if (file_size < mebibyte) {
+            continue;
+        }
+        writeFile(path, file_size);
+
+        benchReads(bench, path, file_size);
+        benchCompressedTier(bench, file_size);
+        benchSlabPool(bench, path, file_size);
+        benchPooledFiles(bench, path, file_size);
+        benchAlignment<Herix>(bench, "runtime", path, file_size);
+        benchAlignment<PowerOfTwoHerix>(bench, "pow2", path, file_size);
+        benchAlignment<PowerOfTwoFileHerix>(bench, "pow2_file", path, file_size);
+        benchBulk(bench, path, file_size);
+        // The edit cases barely depend on the file, so they're only run for the first size
+        if (size_mib == sizes.front()) {
+            for (size_t depth : depths) {
+                benchEdits(bench, path, file_size, depth);
+            }
+        }
+        benchSaves(bench, path, file_size, std::min<size_t>(10000, depths.empty() ? 1 : depths.back()));
+    }
+    std::filesystem::remove(path);
+
+    std::ofstream out_file;
+    if (!out_path.empty()) {
+        out_file.open(out_path, std::ios_base::out | std::ios_base::trunc);
+    }
+    std::ostream& out = out_path.empty() ? std::cout : out_file;
+
+    if (format == "json") {
+        std::time_t now = std::time(nullptr);
+        char date[32];
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+        bench.writeJSON(out, {
+            { "date", date },
+            { "build", HERIX_BENCH_BUILD },
+            { "compiler", __VERSION__ },
+            { "metrics", Metrics::enabled ? "enabled" : "disabled" },
+        });
+    } else {
+        bench.writeText(out);
+    }
+
+    return 0;
+}
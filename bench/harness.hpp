@@ -0,0 +1,225 @@
+// A small self contained benchmark harness: runs each case a few times, keeps the fastest and median timings along
+// with the library's metrics, and writes everything out as text or JSON.
+#ifndef FILE_SEEN_BENCH_HARNESS
+#define FILE_SEEN_BENCH_HARNESS
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../src/metrics.hpp"
+
+namespace HerixBench {
+
+class BenchResult {
+    public:
+    std::string name;
+    std::map<std::string, std::string> params;
+    size_t repetitions = 0;
+    double seconds_min = 0.0;
+    double seconds_median = 0.0;
+    /// Operations done by one repetition, 0 if it doesn't make sense for the case
+    size_t ops = 0;
+    /// Bytes handled by one repetition, 0 if it doesn't make sense for the case
+    size_t bytes = 0;
+    /// The library's metrics, for the last repetition
+    HerixLib::MetricsSnapshot metrics;
+
+    double getNanosecondsPerOp () const {
+        return ops == 0 ? 0.0 : (seconds_min * 1e9) / static_cast<double>(ops);
+    }
+    double getMiBPerSecond () const {
+        return (bytes == 0 || seconds_min <= 0.0) ? 0.0 : (static_cast<double>(bytes) / (1024.0 * 1024.0)) / seconds_min;
+    }
+};
+
+class Bench {
+    protected:
+    std::vector<BenchResult> results;
+    /// Case key (see getKey) to the fastest time of a previous run, see loadBaseline
+    std::map<std::string, double> baseline;
+
+    static std::string getKey (const std::string& name, const std::map<std::string, std::string>& params) {
+        std::string key = name;
+        for (const std::pair<const std::string, std::string>& param : params) {
+            key += " " + param.first + "=" + param.second;
+        }
+        return key;
+    }
+
+    static std::string escape (const std::string& text) {
+        std::string escaped;
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+
+    public:
+    size_t repetitions = 3;
+    /// Only cases whose name contains this are run
+    std::string filter;
+    /// Prints each result as it finishes
+    bool verbose = true;
+
+    /// Reads the results written by writeJSON from an earlier run (such as of a debug build), so that the text
+    /// output shows the speedup of each case against it. Only understands the layout writeJSON uses.
+    void loadBaseline (const std::string& path) {
+        std::ifstream in(path);
+        if (!in.is_open()) {
+            throw std::runtime_error("Failed in opening baseline file.");
+        }
+
+        std::string line;
+        while (std::getline(in, line)) {
+            size_t name_start = line.find("{\"name\": \"");
+            size_t params_start = line.find("\"params\": {");
+            size_t seconds_start = line.find("\"seconds_min\": ");
+            if (name_start == std::string::npos || params_start == std::string::npos || seconds_start == std::string::npos) {
+                continue;
+            }
+
+            name_start += 10;
+            std::string key = line.substr(name_start, line.find('"', name_start) - name_start);
+            // Parameters are written as "key": "value" pairs in order
+            size_t current = params_start + 11;
+            size_t params_end = line.find('}', current);
+            while (true) {
+                size_t key_start = line.find('"', current);
+                if (key_start == std::string::npos || key_start > params_end) {
+                    break;
+                }
+                size_t key_end = line.find('"', key_start + 1);
+                size_t value_start = line.find('"', key_end + 1);
+                size_t value_end = line.find('"', value_start + 1);
+                key += " " + line.substr(key_start + 1, key_end - key_start - 1) + "=" + line.substr(value_start + 1, value_end - value_start - 1);
+                current = value_end + 1;
+            }
+
+            baseline[key] = std::strtod(line.c_str() + seconds_start + 16, nullptr);
+        }
+    }
+
+    /// How many times faster the result is than the baseline, 0 if it isn't in the baseline
+    double getSpeedup (const BenchResult& result) const {
+        auto iter = baseline.find(getKey(result.name, result.params));
+        if (iter == baseline.end() || result.seconds_min <= 0.0) {
+            return 0.0;
+        }
+        return iter->second / result.seconds_min;
+    }
+
+    bool isSelected (const std::string& name) const {
+        return filter.empty() || name.find(filter) != std::string::npos;
+    }
+
+    /// Runs body repetitions times, calling setup (untimed) before each. ops and bytes describe one run of body.
+    void run (const std::string& name, std::map<std::string, std::string> params, size_t ops, size_t bytes,
+        const std::function<void()>& setup, const std::function<void()>& body) {
+        if (!isSelected(name)) {
+            return;
+        }
+
+        BenchResult result;
+        result.name = name;
+        result.params = std::move(params);
+        result.ops = ops;
+        result.bytes = bytes;
+        result.repetitions = repetitions;
+
+        std::vector<double> timings;
+        for (size_t i = 0; i < repetitions; i++) {
+            if (setup) {
+                setup();
+            }
+            HerixLib::Metrics::reset();
+            auto start = std::chrono::steady_clock::now();
+            body();
+            timings.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            result.metrics = HerixLib::Metrics::snapshot();
+        }
+
+        std::sort(timings.begin(), timings.end());
+        result.seconds_min = timings.front();
+        result.seconds_median = timings[timings.size() / 2];
+
+        if (verbose) {
+            writeText(std::cerr, result, getSpeedup(result));
+        }
+        results.push_back(std::move(result));
+    }
+
+    const std::vector<BenchResult>& getResults () const {
+        return results;
+    }
+
+    static void writeText (std::ostream& out, const BenchResult& result, double speedup) {
+        out << std::left << std::setw(24) << result.name;
+        for (const std::pair<const std::string, std::string>& param : result.params) {
+            out << " " << param.first << "=" << param.second;
+        }
+        out << std::fixed << std::setprecision(3) << "\t" << result.seconds_min * 1000.0 << " ms";
+        if (result.ops > 0) {
+            out << "\t" << std::setprecision(1) << result.getNanosecondsPerOp() << " ns/op";
+        }
+        if (result.bytes > 0) {
+            out << "\t" << std::setprecision(1) << result.getMiBPerSecond() << " MiB/s";
+        }
+        if (speedup > 0.0) {
+            out << "\t" << std::setprecision(2) << speedup << "x baseline";
+        }
+        out << "\n";
+    }
+
+    void writeText (std::ostream& out) const {
+        for (const BenchResult& result : results) {
+            writeText(out, result, getSpeedup(result));
+        }
+    }
+
+    void writeJSON (std::ostream& out, const std::map<std::string, std::string>& context) const {
+        out << "{\n  \"context\": {";
+        bool first = true;
+        for (const std::pair<const std::string, std::string>& entry : context) {
+            out << (first ? "" : ", ") << '"' << escape(entry.first) << "\": \"" << escape(entry.second) << '"';
+            first = false;
+        }
+        out << "},\n  \"benchmarks\": [";
+
+        for (size_t i = 0; i < results.size(); i++) {
+            const BenchResult& result = results[i];
+            out << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << escape(result.name) << "\", \"params\": {";
+            first = true;
+            for (const std::pair<const std::string, std::string>& param : result.params) {
+                out << (first ? "" : ", ") << '"' << escape(param.first) << "\": \"" << escape(param.second) << '"';
+                first = false;
+            }
+            out << std::setprecision(9) << std::defaultfloat
+                << "}, \"repetitions\": " << result.repetitions
+                << ", \"seconds_min\": " << result.seconds_min
+                << ", \"seconds_median\": " << result.seconds_median
+                << ", \"ops\": " << result.ops
+                << ", \"ns_per_op\": " << result.getNanosecondsPerOp()
+                << ", \"bytes\": " << result.bytes
+                << ", \"mib_per_second\": " << result.getMiBPerSecond()
+                << ", \"speedup\": " << getSpeedup(result)
+                << ", \"metrics\": " << result.metrics.toJSON() << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,79 @@
+// The profile training workload for `make pgo`: what a session in an editor does, scrolling, searching, patching and
+// saving. It isn't timed, it only has to exercise the same paths in the same proportions.
+// Run as `workload [file size in MiB]`
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+#include "../src/herix.hpp"
+#include "../src/render.hpp"
+
+using namespace HerixLib;
+
+static void writeFile (const std::filesystem::path& path, size_t size) {
+    std::mt19937_64 random(1234);
+    Buffer block(1024 * 1024);
+    std::ofstream out(path, std::ios_base::binary | std::ios_base::trunc);
+    for (size_t written = 0; written < size; written += block.size()) {
+        for (Byte& byte : block) {
+            // Mostly text-like, so searches find things
+            byte = static_cast<Byte>('a' + (random() % 26));
+        }
+        out.write(reinterpret_cast<const char*>(block.data()), static_cast<std::streamsize>(std::min(block.size(), size - written)));
+    }
+}
+
+int main (int argc, char** argv) {
+    size_t file_size = (argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 32) * 1024 * 1024;
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "herix_workload.bin";
+    writeFile(path, file_size);
+
+    size_t checksum = 0;
+    {
+        Herix h(path, true, std::make_pair(0, std::nullopt), 1024 * 1024, 4096);
+        h.enableAdaptiveChunking();
+        RowRenderer renderer(h);
+        size_t rows_per_page = 64;
+        std::vector<char> page(rows_per_page * renderer.getRowStride());
+        size_t row_count = h.getFileEnd() / renderer.getBytesPerRow();
+        std::mt19937_64 random(99);
+
+        for (size_t round = 0; round < 4; round++) {
+            // Scroll down a stretch of the file a page at a time, then jump somewhere else
+            size_t first = random() % row_count;
+            for (size_t step = 0; step < 2000 && first + rows_per_page < row_count; step++) {
+                renderer.render(first, rows_per_page, page.data());
+                checksum += static_cast<size_t>(page[0]);
+                first += step % 8 == 0 ? rows_per_page : 1;
+            }
+
+            // Search for something, like a user looking for a string
+            Buffer needle{ 'h', 'e', 'r', 'i', 'x' };
+            needle[0] = static_cast<Byte>('a' + round);
+            std::optional<FilePosition> found = h.find(random() % h.getFileEnd(), needle);
+            checksum += found.value_or(0);
+
+            // Patch values around, and change our mind about some of them
+            for (size_t i = 0; i < 20000; i++) {
+                FilePosition pos = random() % h.getFileEnd();
+                if (i % 16 == 0) {
+                    h.editMultiple(pos, Buffer(32, static_cast<Byte>(i)));
+                } else {
+                    h.edit(pos, static_cast<Byte>(i));
+                }
+                checksum += h.read(pos).value_or(0);
+                if (i % 100 == 0) {
+                    h.undo();
+                    h.redo();
+                }
+            }
+
+            h.saveHistoryDestructive();
+        }
+    }
+
+    std::filesystem::remove(path);
+    std::cout << checksum << "\n";
+    return 0;
+}
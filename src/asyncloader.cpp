@@ -0,0 +1,316 @@
+#include "asyncloader.hpp"
+#include "metrics.hpp"
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <system_error>
+
+using namespace HerixLib;
+
+std::unique_ptr<AsyncLoader> AsyncLoader::create (std::shared_ptr<Backend> backend, AbsoluteFilePosition start, size_t thread_count) {
+#ifdef HERIX_HAS_IO_URING
+    if (std::shared_ptr<FileBackend> file = std::dynamic_pointer_cast<FileBackend>(backend)) {
+        try {
+            return std::make_unique<IoUringLoader>(std::move(file), start);
+        } catch (std::system_error&) {
+            // Kernel doesn't support it (or it's disabled), use the threads
+        }
+    }
+#endif
+    return std::make_unique<ThreadPoolLoader>(std::move(backend), start, thread_count);
+}
+
+
+// == Thread pool ==
+
+ThreadPoolLoader::ThreadPoolLoader (std::shared_ptr<Backend> t_backend, AbsoluteFilePosition start, size_t thread_count) :
+    backend(std::move(t_backend)), start_position(start) {
+    if (thread_count == 0) {
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    for (size_t i = 0; i < thread_count; i++) {
+        workers.emplace_back(&ThreadPoolLoader::work, this);
+    }
+}
+
+ThreadPoolLoader::~ThreadPoolLoader () {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPoolLoader::work () {
+    while (true) {
+        AsyncReadRequest request;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_ready.wait(lock, [this] () { return stopping || !queue.empty(); });
+            if (stopping) {
+                return;
+            }
+            request = queue.front();
+            queue.pop_front();
+        }
+
+        AsyncReadResult result;
+        result.pos = request.pos;
+        result.epoch = request.epoch;
+        try {
+            result.data.resize(request.size);
+            result.data.resize(backend->read(start_position + request.pos, request.size, result.data.data()));
+            HERIX_METRIC_ADD(ReadCalls, 1);
+            HERIX_METRIC_ADD(BytesRead, result.data.size());
+        } catch (...) {
+            result.data.clear();
+            result.error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            completed.push_back(std::move(result));
+        }
+        result_ready.notify_all();
+    }
+}
+
+void ThreadPoolLoader::submit (const std::vector<AsyncReadRequest>& requests) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.insert(queue.end(), requests.begin(), requests.end());
+        pending += requests.size();
+    }
+    work_ready.notify_all();
+}
+
+size_t ThreadPoolLoader::collect (std::vector<AsyncReadResult>& results, bool wait) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (wait) {
+        result_ready.wait(lock, [this] () { return pending == 0 || !completed.empty(); });
+    }
+
+    size_t count = completed.size();
+    for (AsyncReadResult& result : completed) {
+        results.push_back(std::move(result));
+    }
+    completed.clear();
+    pending -= count;
+    return count;
+}
+
+size_t ThreadPoolLoader::getPendingCount () const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending;
+}
+
+void ThreadPoolLoader::waitFinished () {
+    std::unique_lock<std::mutex> lock(mutex);
+    result_ready.wait(lock, [this] () { return completed.size() == pending; });
+}
+
+const char* ThreadPoolLoader::getName () const {
+    return "threadpool";
+}
+
+
+// == io_uring ==
+
+#ifdef HERIX_HAS_IO_URING
+
+IoUringLoader::IoUringLoader (std::shared_ptr<FileBackend> t_file, AbsoluteFilePosition start) :
+    file(std::move(t_file)), start_position(start) {
+    int error = io_uring_queue_init(queue_depth, &ring, 0);
+    if (error < 0) {
+        throw std::system_error(-error, std::generic_category(), "io_uring_queue_init");
+    }
+}
+
+IoUringLoader::~IoUringLoader () {
+    // The kernel may still be writing into the buffers, so everything has to be reaped first
+    std::vector<AsyncReadResult> discard;
+    while (pending > 0) {
+        collect(discard, true);
+        discard.clear();
+    }
+
+    io_uring_queue_exit(&ring);
+}
+
+void IoUringLoader::submit (const std::vector<AsyncReadRequest>& requests) {
+    for (const AsyncReadRequest& request : requests) {
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        if (sqe == nullptr) {
+            // The submission queue is full, so push what we have so far and try again
+            io_uring_submit(&ring);
+            sqe = io_uring_get_sqe(&ring);
+            if (sqe == nullptr) {
+                throw std::runtime_error("io_uring submission queue is full.");
+            }
+        }
+
+        InFlight* in_flight = new InFlight{ request.pos, request.epoch, Buffer(request.size) };
+        io_uring_prep_read(sqe, file->getHandle(), in_flight->data.data(), static_cast<unsigned int>(request.size), start_position + request.pos);
+        io_uring_sqe_set_data(sqe, in_flight);
+        pending++;
+    }
+
+    io_uring_submit(&ring);
+}
+
+void IoUringLoader::reap (struct io_uring_cqe* cqe, std::vector<AsyncReadResult>& results) {
+    std::unique_ptr<InFlight> in_flight(static_cast<InFlight*>(io_uring_cqe_get_data(cqe)));
+
+    AsyncReadResult result;
+    result.pos = in_flight->pos;
+    result.epoch = in_flight->epoch;
+    if (cqe->res < 0) {
+        result.error = std::make_exception_ptr(std::system_error(-cqe->res, std::generic_category(), "Failed to read data from file!"));
+    } else {
+        // Reads of regular files are only short at the end of the file
+        in_flight->data.resize(static_cast<size_t>(cqe->res));
+        HERIX_METRIC_ADD(ReadCalls, 1);
+        HERIX_METRIC_ADD(BytesRead, in_flight->data.size());
+        result.data = std::move(in_flight->data);
+    }
+
+    io_uring_cqe_seen(&ring, cqe);
+    pending--;
+    results.push_back(std::move(result));
+}
+
+size_t IoUringLoader::collect (std::vector<AsyncReadResult>& results, bool wait) {
+    size_t count = 0;
+    struct io_uring_cqe* cqe = nullptr;
+
+    if (wait && pending > 0) {
+        int error = io_uring_wait_cqe(&ring, &cqe);
+        if (error < 0 && error != -EINTR) {
+            throw std::system_error(-error, std::generic_category(), "io_uring_wait_cqe");
+        }
+    }
+
+    while (pending > 0 && io_uring_peek_cqe(&ring, &cqe) == 0 && cqe != nullptr) {
+        reap(cqe, results);
+        count++;
+    }
+
+    return count;
+}
+
+size_t IoUringLoader::getPendingCount () const {
+    return pending;
+}
+
+void IoUringLoader::waitFinished () {
+    if (pending == 0) {
+        return;
+    }
+    struct io_uring_cqe* cqe = nullptr;
+    int error;
+    do {
+        // Doesn't consume them, so collect still reaps them all
+        error = io_uring_wait_cqe_nr(&ring, &cqe, static_cast<unsigned int>(pending));
+    } while (error == -EINTR);
+    if (error < 0) {
+        throw std::system_error(-error, std::generic_category(), "io_uring_wait_cqe_nr");
+    }
+}
+
+const char* IoUringLoader::getName () const {
+    return "io_uring";
+}
+
+#endif
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+#include "herix.hpp"
+
+void HerixLib::test_asyncloader () {
+    Buffer contents;
+    for (size_t i = 0; i < 1000; i++) {
+        contents.push_back(static_cast<Byte>(i * 13));
+    }
+    std::filesystem::path path = writeTestFile("herix_test_asyncloader.bin", contents);
+
+    std::vector<std::unique_ptr<AsyncLoader>> loaders;
+    std::shared_ptr<FileBackend> file = std::make_shared<FileBackend>(path);
+    loaders.push_back(std::make_unique<ThreadPoolLoader>(file, 10, 3));
+    loaders.push_back(AsyncLoader::create(file, 10));
+
+    for (std::unique_ptr<AsyncLoader>& loader : loaders) {
+        std::vector<AsyncReadRequest> requests;
+        for (FilePosition pos = 0; pos < 1000; pos += 100) {
+            requests.push_back(AsyncReadRequest{ pos, 100 });
+        }
+        loader->submit(requests);
+
+        std::vector<AsyncReadResult> results;
+        while (loader->getPendingCount() > 0) {
+            loader->collect(results, true);
+        }
+        assert(results.size() == 10);
+
+        std::sort(results.begin(), results.end(), [] (const AsyncReadResult& a, const AsyncReadResult& b) {
+            return a.pos < b.pos;
+        });
+        for (size_t i = 0; i < 9; i++) {
+            assert(!results[i].error);
+            assert(results[i].pos == i * 100);
+            assert(results[i].data.size() == 100);
+            assert(std::equal(results[i].data.begin(), results[i].data.end(), contents.begin() + static_cast<std::ptrdiff_t>(10 + (i * 100))));
+        }
+        // The last one is cut off by the 10 byte start
+        assert(results[9].data.size() == 90);
+    }
+
+    // = Reads that finish before a save, but are collected after it, are dropped rather than installed
+    {
+        Herix h(path, true, std::make_pair(0, std::nullopt), 4096, 256);
+        h.enableAsyncLoading(1);
+        AsyncRequestID id = h.requestRange(0, 1000);
+        h.waitAsyncFinished();
+        h.edit(10, 'Z');
+        h.saveHistoryDestructive();
+        h.pollAsync(true);
+        assert(h.read(10).value() == 'Z');
+        // What was waiting on them is read again
+        h.waitAsync(id);
+        assert(h.isRequestDone(id));
+        assert(h.read(10).value() == 'Z');
+        assert(h.read(600).value() == contents[600]);
+    }
+
+    // = Nor does a stale read reach the other views through a shared cache
+    {
+        SharedChunkCache cache;
+        Herix a(path, false, std::make_pair(0, std::nullopt), 4096, 256);
+        Herix b(path, true, std::make_pair(0, std::nullopt), 4096, 256);
+        a.setSharedCache(&cache);
+        b.setSharedCache(&cache);
+        a.enableAsyncLoading(1);
+        AsyncRequestID id = a.requestRange(0, 1000);
+        a.waitAsyncFinished();
+        b.edit(20, 'Y');
+        b.saveHistoryDestructive();
+        a.waitAsync(id);
+        assert(a.read(20).value() == 'Y');
+        Herix c(path, false, std::make_pair(0, std::nullopt), 4096, 256);
+        c.setSharedCache(&cache);
+        assert(c.read(20).value() == 'Y');
+    }
+
+    std::filesystem::remove(path);
+}
+
+#endif
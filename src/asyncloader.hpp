@@ -0,0 +1,133 @@
+#ifndef FILE_SEEN_ASYNCLOADER
+#define FILE_SEEN_ASYNCLOADER
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "types.hpp"
+#include "backend.hpp"
+
+// io_uring support needs liburing, and is opted into with HERIX_IO_URING (link with -luring)
+#if defined(HERIX_IO_URING) && defined(__has_include)
+#if __has_include(<liburing.h>)
+#define HERIX_HAS_IO_URING 1
+#include <liburing.h>
+#endif
+#endif
+
+namespace HerixLib {
+
+class AsyncReadRequest {
+    public:
+    /// Position relative to the start the loader was given
+    FilePosition pos;
+    size_t size;
+    /// Passed through to the result untouched, so the owner can tell reads it no longer wants apart
+    uint64_t epoch = 0;
+};
+
+class AsyncReadResult {
+    public:
+    FilePosition pos;
+    /// The epoch of the request
+    uint64_t epoch = 0;
+    /// Shorter than the requested size if the read hit the end of the file
+    Buffer data;
+    /// Set if the read failed, in which case data is empty
+    std::exception_ptr error;
+};
+
+/// A backend that reads pieces of a file in the background. Requests are submitted in batches and can complete
+/// in any order. Results are collected by the owner, so nothing outside of the loader runs on its threads.
+class AsyncLoader {
+    public:
+    virtual ~AsyncLoader () = default;
+
+    virtual void submit (const std::vector<AsyncReadRequest>& requests) = 0;
+    /// Moves any completed reads into results. If wait is true and nothing has completed yet, then this blocks
+    /// until at least one read completes (unless there are none pending). Returns how many were added.
+    virtual size_t collect (std::vector<AsyncReadResult>& results, bool wait) = 0;
+    virtual size_t getPendingCount () const = 0;
+    /// Blocks until every pending read has finished, leaving them to be collected
+    virtual void waitFinished () = 0;
+    virtual const char* getName () const = 0;
+
+    /// Creates the best loader available for backend: io_uring on its descriptor if it's a FileBackend, io_uring was
+    /// compiled in and the kernel supports it, otherwise a thread pool. thread_count is for the thread pool, 0 means
+    /// one per core.
+    static std::unique_ptr<AsyncLoader> create (std::shared_ptr<Backend> backend, AbsoluteFilePosition start, size_t thread_count=0);
+};
+
+/// Fallback loader, each worker thread does blocking reads from the backend.
+class ThreadPoolLoader : public AsyncLoader {
+    protected:
+    std::shared_ptr<Backend> backend;
+    AbsoluteFilePosition start_position;
+
+    mutable std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable result_ready;
+    std::deque<AsyncReadRequest> queue;
+    std::vector<AsyncReadResult> completed;
+    size_t pending = 0;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    void work ();
+
+    public:
+    ThreadPoolLoader (std::shared_ptr<Backend> t_backend, AbsoluteFilePosition start, size_t thread_count=0);
+    ~ThreadPoolLoader () override;
+
+    void submit (const std::vector<AsyncReadRequest>& requests) override;
+    size_t collect (std::vector<AsyncReadResult>& results, bool wait) override;
+    size_t getPendingCount () const override;
+    void waitFinished () override;
+    const char* getName () const override;
+};
+
+#ifdef HERIX_HAS_IO_URING
+/// Submits every read of a batch with a single io_uring_submit, and reaps them as they complete.
+class IoUringLoader : public AsyncLoader {
+    protected:
+    class InFlight {
+        public:
+        FilePosition pos;
+        uint64_t epoch;
+        Buffer data;
+    };
+
+    /// Kept alive for its descriptor
+    std::shared_ptr<FileBackend> file;
+    AbsoluteFilePosition start_position;
+    struct io_uring ring;
+    size_t pending = 0;
+
+    void reap (struct io_uring_cqe* cqe, std::vector<AsyncReadResult>& results);
+
+    public:
+    static constexpr unsigned int queue_depth = 256;
+
+    /// Throws if io_uring isn't supported by the kernel
+    IoUringLoader (std::shared_ptr<FileBackend> t_file, AbsoluteFilePosition start);
+    ~IoUringLoader () override;
+
+    void submit (const std::vector<AsyncReadRequest>& requests) override;
+    size_t collect (std::vector<AsyncReadResult>& results, bool wait) override;
+    size_t getPendingCount () const override;
+    void waitFinished () override;
+    const char* getName () const override;
+};
+#endif
+
+void test_asyncloader ();
+
+}
+
+#endif
@@ -0,0 +1,222 @@
+#include "backend.hpp"
+#include <cerrno>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace HerixLib;
+
+std::vector<size_t> Backend::readBatch (const std::vector<BackendRead>& reads) {
+    std::vector<size_t> counts;
+    counts.reserve(reads.size());
+    for (const BackendRead& request : reads) {
+        counts.push_back(read(request.pos, request.size, request.output));
+    }
+    return counts;
+}
+
+bool Backend::hasHoles () const {
+    return false;
+}
+
+bool Backend::isPresent (AbsoluteFilePosition pos) const {
+    return pos < getSize();
+}
+
+size_t Backend::getPresentRun (AbsoluteFilePosition pos, size_t size) const {
+    size_t end = getSize();
+    return pos < end ? std::min(size, end - pos) : 0;
+}
+
+bool Backend::isWritable () const {
+    return false;
+}
+
+void Backend::write (AbsoluteFilePosition, const Byte*, size_t) {
+    throw std::logic_error(std::string("Can't write to a ") + getName() + " backend.");
+}
+
+void Backend::flush () {}
+
+void Backend::dropCached (AbsoluteFilePosition, size_t) {}
+
+bool Backend::isFileContents () const {
+    return false;
+}
+
+// == Files ==
+
+FileHandle HerixLib::openFileHandle (const std::filesystem::path& path, bool writable) {
+#if defined(__unix__) || defined(__APPLE__)
+    return ::open(path.c_str(), (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+#else
+    return std::fopen(path.string().c_str(), writable ? "r+b" : "rb");
+#endif
+}
+
+void HerixLib::closeFileHandle (FileHandle handle) {
+#if defined(__unix__) || defined(__APPLE__)
+    ::close(handle);
+#else
+    std::fclose(handle);
+#endif
+}
+
+size_t HerixLib::readFileHandle (FileHandle handle, AbsoluteFilePosition pos, size_t size, Byte* output) {
+#if defined(__unix__) || defined(__APPLE__)
+    size_t done = 0;
+    while (done < size) {
+        ssize_t got = ::pread(handle, output + done, size - done, static_cast<off_t>(pos + done));
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Failed to read data from file!");
+        } else if (got == 0) {
+            // The end of the file
+            break;
+        }
+        done += static_cast<size_t>(got);
+    }
+    return done;
+#else
+    if (std::fseek(handle, static_cast<long>(pos), SEEK_SET) != 0) {
+        throw std::runtime_error("Failed to seek to position in file!");
+    }
+    size_t done = std::fread(output, 1, size, handle);
+    if (done < size && std::ferror(handle)) {
+        throw std::runtime_error("Failed to read data from file!");
+    }
+    return done;
+#endif
+}
+
+void HerixLib::writeFileHandle (FileHandle handle, AbsoluteFilePosition pos, const Byte* data, size_t size) {
+#if defined(__unix__) || defined(__APPLE__)
+    size_t done = 0;
+    while (done < size) {
+        ssize_t wrote = ::pwrite(handle, data + done, size - done, static_cast<off_t>(pos + done));
+        if (wrote < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Failed to write data to file!");
+        }
+        done += static_cast<size_t>(wrote);
+    }
+#else
+    if (std::fseek(handle, static_cast<long>(pos), SEEK_SET) != 0 || std::fwrite(data, 1, size, handle) != size ||
+        std::fflush(handle) != 0) {
+        throw std::runtime_error("Failed to write data to file!");
+    }
+#endif
+}
+
+FileBackend::FileBackend (const std::filesystem::path& t_path, bool t_writable) :
+    path(t_path), writable(t_writable), handle(openFileHandle(t_path, t_writable)) {
+    if (handle == no_file_handle) {
+        // TODO: make an errortype for this
+        throw std::runtime_error("Failed in opening file.");
+    }
+}
+
+FileBackend::FileBackend (const std::filesystem::path& t_path, bool t_writable, bool t_direct) :
+    path(t_path), writable(t_writable), direct(t_direct) {}
+
+FileBackend::~FileBackend () {
+    if (handle != no_file_handle) {
+        closeFileHandle(handle);
+    }
+}
+
+std::shared_ptr<FileBackend> FileBackend::openSequential (const std::filesystem::path& t_path, bool t_direct, bool no_reuse) {
+    std::shared_ptr<FileBackend> file(new FileBackend(t_path, false, false));
+#if defined(O_DIRECT)
+    if (t_direct) {
+        file->handle = ::open(t_path.c_str(), O_RDONLY | O_DIRECT | O_CLOEXEC);
+        file->direct = file->handle != no_file_handle;
+    }
+#else
+    (void)t_direct;
+#endif
+    if (file->handle == no_file_handle) {
+        // Either not direct, or the filesystem doesn't support it
+        file->handle = openFileHandle(t_path, false);
+    }
+    if (file->handle == no_file_handle) {
+        throw std::runtime_error("Failed in opening file for sequential reading.");
+    }
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+    ::posix_fadvise(file->handle, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (no_reuse) {
+        ::posix_fadvise(file->handle, 0, 0, POSIX_FADV_NOREUSE);
+    }
+#else
+    (void)no_reuse;
+#endif
+    return file;
+}
+
+bool FileBackend::isDirect () const {
+    return direct;
+}
+
+FileHandle FileBackend::getHandle () const {
+    return handle;
+}
+
+size_t FileBackend::getSize () const {
+    return std::filesystem::file_size(path);
+}
+
+size_t FileBackend::read (AbsoluteFilePosition pos, size_t size, Byte* output) {
+#if !defined(__unix__) && !defined(__APPLE__)
+    std::lock_guard<std::mutex> io_lock(io_mutex);
+#endif
+    return readFileHandle(handle, pos, size, output);
+}
+
+bool FileBackend::isWritable () const {
+    return writable;
+}
+
+void FileBackend::write (AbsoluteFilePosition pos, const Byte* data, size_t size) {
+    if (!writable) {
+        Backend::write(pos, data, size);
+    }
+#if !defined(__unix__) && !defined(__APPLE__)
+    std::lock_guard<std::mutex> io_lock(io_mutex);
+#endif
+    writeFileHandle(handle, pos, data, size);
+}
+
+void FileBackend::flush () {
+    // Positional writes go straight to the OS, and the fallback flushes after each
+}
+
+void FileBackend::dropCached (AbsoluteFilePosition pos, size_t size) {
+#if defined(POSIX_FADV_DONTNEED)
+    ::posix_fadvise(handle, static_cast<off_t>(pos), static_cast<off_t>(size), POSIX_FADV_DONTNEED);
+#else
+    (void)pos;
+    (void)size;
+#endif
+}
+
+bool FileBackend::isFileContents () const {
+    return true;
+}
+
+std::filesystem::path FileBackend::getPath () const {
+    return path;
+}
+
+const char* FileBackend::getName () const {
+    return "file";
+}
@@ -0,0 +1,126 @@
+#ifndef FILE_SEEN_BACKEND
+#define FILE_SEEN_BACKEND
+
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "types.hpp"
+
+namespace HerixLib {
+
+class BackendRead {
+    public:
+    AbsoluteFilePosition pos;
+    size_t size;
+    Byte* output;
+};
+
+/// Where the data of a Herix instance is read from and saved to: a file (FileBackend), the decompressed contents of a
+/// compressed file, the memory of a running process.
+/// Reads must be thread safe, since the background readers (SequentialReader, AsyncLoader) share the backend.
+class Backend {
+    public:
+    virtual ~Backend () = default;
+
+    /// One past the last position that can be read
+    virtual size_t getSize () const = 0;
+    /// Reads up to size bytes at pos into output. Returns how many were read, which is less than size only at the end.
+    /// Positions in a hole (see isPresent) read as zero.
+    virtual size_t read (AbsoluteFilePosition pos, size_t size, Byte* output) = 0;
+    /// Reads each of the ranges as read does, returning the counts in the same order. Backends that can, do it with
+    /// fewer calls than reading them one at a time.
+    virtual std::vector<size_t> readBatch (const std::vector<BackendRead>& reads);
+
+    /// Whether some positions before the end don't exist, such as unmapped memory
+    virtual bool hasHoles () const;
+    /// Whether pos exists. Everything before the end does, unless there are holes.
+    virtual bool isPresent (AbsoluteFilePosition pos) const;
+    /// How many bytes starting at pos exist one after the other, at most size
+    virtual size_t getPresentRun (AbsoluteFilePosition pos, size_t size) const;
+
+    virtual bool isWritable () const;
+    /// Writes size bytes at pos. Throws std::logic_error if the backend isn't writable, and std::runtime_error if it
+    /// couldn't all be written.
+    virtual void write (AbsoluteFilePosition pos, const Byte* data, size_t size);
+    /// Makes what was written visible to other readers
+    virtual void flush ();
+    /// Tells the OS that [pos, pos+size) won't be read again soon, so it can drop it from its cache
+    virtual void dropCached (AbsoluteFilePosition pos, size_t size);
+    /// Whether it reads the file at getPath as it is, so its chunks can be shared with instances that open the file
+    /// normally (see SharedChunkCache)
+    virtual bool isFileContents () const;
+
+    /// The path that identifies the data, used as the filename of a Herix instance viewing it
+    virtual std::filesystem::path getPath () const = 0;
+    virtual const char* getName () const = 0;
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+using FileHandle = int;
+constexpr FileHandle no_file_handle = -1;
+#else
+using FileHandle = std::FILE*;
+constexpr FileHandle no_file_handle = nullptr;
+#endif
+
+/// Returns no_file_handle if it can't be opened, with errno set
+FileHandle openFileHandle (const std::filesystem::path& path, bool writable);
+void closeFileHandle (FileHandle handle);
+/// Reads up to size bytes at pos into output. Returns how many were read, which is less than size only at the end.
+/// Positional (pread) where the platform has it, otherwise the caller has to keep other threads from seeking in
+/// between.
+size_t readFileHandle (FileHandle handle, AbsoluteFilePosition pos, size_t size, Byte* output);
+/// Throws std::runtime_error if it couldn't all be written. Positional the same as readFileHandle.
+void writeFileHandle (FileHandle handle, AbsoluteFilePosition pos, const Byte* data, size_t size);
+
+/// A file as it is on disk, which is what a Herix instance reads and saves into when it's opened with a path. Reads
+/// and writes are positional, so the background readers use the same descriptor without getting in each other's way.
+/// It's final so that PowerOfTwoFileHerix calls it directly.
+class FileBackend final : public Backend {
+    protected:
+    std::filesystem::path path;
+    bool writable;
+    bool direct = false;
+    FileHandle handle = no_file_handle;
+#if !defined(__unix__) && !defined(__APPLE__)
+    /// Without positional reads, a seek and a read have to happen together
+    std::mutex io_mutex;
+#endif
+
+    FileBackend (const std::filesystem::path& t_path, bool t_writable, bool t_direct);
+
+    public:
+    /// Throws std::runtime_error if the file can't be opened
+    explicit FileBackend (const std::filesystem::path& t_path, bool t_writable=false);
+    ~FileBackend ();
+
+    FileBackend (const FileBackend&) = delete;
+    FileBackend& operator= (const FileBackend&) = delete;
+
+    /// Opens path read only for a front to back pass, with its own descriptor so that the hints to the OS (sequential
+    /// readahead, not reusing the pages when no_reuse) don't affect other readers. With direct it skips the page
+    /// cache through O_DIRECT, falling back to normal reads where that isn't supported (see isDirect). Direct reads
+    /// have to be at aligned positions, with aligned sizes and buffers.
+    static std::shared_ptr<FileBackend> openSequential (const std::filesystem::path& t_path, bool t_direct, bool no_reuse);
+
+    bool isDirect () const;
+    FileHandle getHandle () const;
+
+    size_t getSize () const override;
+    size_t read (AbsoluteFilePosition pos, size_t size, Byte* output) override;
+    bool isWritable () const override;
+    void write (AbsoluteFilePosition pos, const Byte* data, size_t size) override;
+    void flush () override;
+    void dropCached (AbsoluteFilePosition pos, size_t size) override;
+    bool isFileContents () const override;
+
+    std::filesystem::path getPath () const override;
+    const char* getName () const override;
+};
+
+}
+
+#endif
@@ -0,0 +1,259 @@
+#include "chunkpool.hpp"
+#include "compression.hpp"
+#include "herix.hpp"
+#include <cassert>
+#include <fstream>
+#include <tuple>
+
+using namespace HerixLib;
+
+double CompressedChunkPoolStatistics::getCompressionRatio () const {
+    if (compressed_bytes == 0) {
+        return 1.0;
+    }
+    return static_cast<double>(original_bytes) / static_cast<double>(compressed_bytes);
+}
+
+
+bool CompressedChunkPool::Key::operator< (const Key& other) const {
+    return std::tie(block_size, block_start) < std::tie(other.block_size, other.block_start);
+}
+
+CompressedChunkPool::CompressedChunkPool (size_t t_max_memory) : max_memory(t_max_memory) {}
+
+std::map<CompressedChunkPool::Key, CompressedChunkPool::Entry>::iterator CompressedChunkPool::erase (std::map<Key, Entry>::iterator iter) {
+    memory -= iter->second.data.size();
+    original_bytes -= iter->second.original_size;
+    order.erase(iter->second.order);
+    return entries.erase(iter);
+}
+
+size_t CompressedChunkPool::trim (size_t limit) {
+    size_t freed = 0;
+    while (memory > limit && !order.empty()) {
+        auto iter = entries.find(order.front());
+        freed += iter->second.data.size();
+        erase(iter);
+        statistics.evicted++;
+    }
+    return freed;
+}
+
+bool CompressedChunkPool::put (size_t block_size, AbsoluteFilePosition block_start, AbsoluteFilePosition data_start, const Byte* data, size_t size) {
+    Key key{ block_size, block_start };
+    auto existing = entries.find(key);
+    if (existing != entries.end()) {
+        if (existing->second.data_start == data_start && existing->second.original_size >= size) {
+            // Chunks are only ever file data, so it's the same as what was decompressed before. No need to compress it again.
+            touch(existing);
+            return true;
+        }
+        erase(existing);
+    }
+
+    Buffer compressed = compressLZ4Block(data, size);
+    if (compressed.size() > size - (size / 8) || compressed.size() > max_memory) {
+        statistics.rejected++;
+        return false;
+    }
+    // It was allocated for the worst case
+    compressed.shrink_to_fit();
+
+    memory += compressed.size();
+    original_bytes += size;
+    Entry& entry = entries[key];
+    entry.data_start = data_start;
+    entry.original_size = size;
+    entry.data = std::move(compressed);
+    entry.order = order.insert(order.end(), key);
+    statistics.stored++;
+
+    trim(max_memory);
+    return true;
+}
+
+std::optional<Buffer> CompressedChunkPool::get (size_t block_size, AbsoluteFilePosition block_start, AbsoluteFilePosition data_start, size_t size) {
+    auto iter = entries.find(Key{ block_size, block_start });
+    if (iter == entries.end()) {
+        statistics.misses++;
+        return std::nullopt;
+    }
+
+    if (iter->second.data_start != data_start || iter->second.original_size < size) {
+        // It's about to be loaded from the file, and will replace this when it's evicted
+        erase(iter);
+        statistics.misses++;
+        return std::nullopt;
+    }
+
+    Buffer result(iter->second.original_size);
+    decompressLZ4Block(iter->second.data.data(), iter->second.data.size(), result.data(), result.size());
+    result.resize(size);
+    touch(iter);
+    statistics.hits++;
+    return result;
+}
+
+void CompressedChunkPool::touch (std::map<Key, Entry>::iterator iter) {
+    order.splice(order.end(), order, iter->second.order);
+}
+
+void CompressedChunkPool::clear () {
+    entries.clear();
+    order.clear();
+    memory = 0;
+    original_bytes = 0;
+}
+
+size_t CompressedChunkPool::freeMemory (size_t bytes) {
+    return trim(memory > bytes ? memory - bytes : 0);
+}
+
+size_t CompressedChunkPool::getMemoryUsage () const {
+    return memory;
+}
+
+void CompressedChunkPool::setMaxMemory (size_t t_max_memory) {
+    max_memory = t_max_memory;
+    trim(max_memory);
+}
+size_t CompressedChunkPool::getMaxMemory () const {
+    return max_memory;
+}
+
+CompressedChunkPoolStatistics CompressedChunkPool::getStatistics () const {
+    CompressedChunkPoolStatistics result = statistics;
+    result.chunk_count = entries.size();
+    result.original_bytes = original_bytes;
+    result.compressed_bytes = memory;
+    return result;
+}
+void CompressedChunkPool::resetStatistics () {
+    statistics = CompressedChunkPoolStatistics();
+}
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+void HerixLib::test_chunkpool () {
+    // Something like a binary: runs of zeroes, repeated instruction-ish patterns and some noise
+    Buffer contents;
+    uint32_t state = 1;
+    for (size_t i = 0; i < 64 * 1024; i++) {
+        state = state * 1103515245 + 12345;
+        if ((i / 512) % 3 == 0) {
+            contents.push_back(0);
+        } else if ((i / 512) % 3 == 1) {
+            contents.push_back(static_cast<Byte>("\x48\x89\xE5\x48\x83\xEC\x10\xC3"[i % 8]));
+        } else {
+            contents.push_back(static_cast<Byte>((state >> 16) & 0x0F));
+        }
+    }
+
+    // = The pool on its own
+    {
+        CompressedChunkPool pool(8 * 1024);
+        assert(pool.put(1024, 0, 0, contents.data(), 1024));
+        assert(pool.getMemoryUsage() > 0 && pool.getMemoryUsage() < 1024);
+
+        // Wrong block, or a different start, misses
+        assert(!pool.get(1024, 1024, 1024, 1024).has_value());
+        assert(!pool.get(2048, 0, 0, 1024).has_value());
+        std::optional<Buffer> data = pool.get(1024, 0, 0, 1000);
+        assert(data.has_value() && data->size() == 1000);
+        assert(std::equal(data->begin(), data->end(), contents.begin()));
+
+        // Putting the same chunk back (as when it's evicted again) keeps what's there
+        size_t memory = pool.getMemoryUsage();
+        assert(pool.put(1024, 0, 0, contents.data(), 1024));
+        assert(pool.getMemoryUsage() == memory && pool.getStatistics().stored == 1);
+        // A different start replaces it, and getting it at the old start drops it
+        assert(pool.put(1024, 0, 10, contents.data() + 10, 1014));
+        assert(pool.getStatistics().stored == 2);
+        assert(!pool.get(1024, 0, 0, 1024).has_value());
+        assert(pool.getMemoryUsage() == 0);
+
+        // Not compressible enough
+        Buffer noise(1024);
+        for (Byte& value : noise) {
+            state = state * 1103515245 + 12345;
+            value = static_cast<Byte>(state >> 16);
+        }
+        assert(!pool.put(1024, 0, 0, noise.data(), noise.size()));
+
+        // Stays under the max memory by dropping the oldest
+        for (AbsoluteFilePosition pos = 0; pos < contents.size(); pos += 1024) {
+            pool.put(1024, pos, pos, contents.data() + pos, 1024);
+        }
+        assert(pool.getMemoryUsage() <= 8 * 1024);
+        CompressedChunkPoolStatistics statistics = pool.getStatistics();
+        assert(statistics.evicted > 0);
+        assert(statistics.rejected == 1);
+        assert(statistics.getCompressionRatio() > 1.5);
+        assert(!pool.get(1024, 0, 0, 1024).has_value());
+        data = pool.get(1024, 63 * 1024, 63 * 1024, 1024);
+        assert(data.has_value() && std::equal(data->begin(), data->end(), contents.begin() + (63 * 1024)));
+
+        size_t before = pool.getMemoryUsage();
+        assert(pool.freeMemory(1) > 0);
+        assert(pool.getMemoryUsage() < before);
+        pool.clear();
+        assert(pool.getMemoryUsage() == 0 && pool.getStatistics().chunk_count == 0);
+    }
+
+    std::filesystem::path path = writeTestFile("herix_test_chunkpool.bin", contents);
+
+    // = Evicted chunks come back from the pool rather than the file
+    {
+        Herix h(path, true, std::make_pair(100, std::nullopt), 4 * 1024, 1024);
+        h.enableCompressedTier(64 * 1024);
+        assert(h.isCompressedTierEnabled());
+
+        for (int pass = 0; pass < 2; pass++) {
+            for (FilePosition pos = 0; pos < contents.size() - 100; pos += 7) {
+                assert(h.read(pos).value() == contents[100 + pos]);
+            }
+        }
+        CompressedChunkPoolStatistics statistics = h.getCompressedTierStatistics();
+        assert(statistics.stored > 0);
+        assert(statistics.hits > 0);
+        assert(statistics.getCompressionRatio() > 1.5);
+        assert(h.getMemoryUsage() >= h.getChunkMemory() - 100 + statistics.compressed_bytes);
+
+        // Edits are never in the chunks, so they still apply on top of a decompressed one
+        h.edit(5, 0xEE);
+        for (FilePosition pos = 0; pos < contents.size() - 100; pos += 1024) {
+            h.read(pos);
+        }
+        assert(h.read(5).value() == 0xEE);
+        assert(h.read(6).value() == contents[106]);
+
+        // Saving changes the file, so the pool has to be dropped
+        h.saveHistoryDestructive();
+        assert(h.getCompressedTierStatistics().chunk_count == 0);
+        assert(h.read(5).value() == 0xEE);
+
+        h.disableCompressedTier();
+        assert(!h.isCompressedTierEnabled());
+        assert(h.getCompressedTierStatistics().stored == 0);
+    }
+
+    // = Under a governor the pool is given up before the loaded chunks
+    {
+        MemoryGovernor governor(8 * 1024);
+        Herix h(path, false, std::make_pair(0, std::nullopt), 4 * 1024, 1024);
+        h.enableCompressedTier(64 * 1024);
+        h.setMemoryGovernor(&governor);
+        for (FilePosition pos = 0; pos < contents.size(); pos += 512) {
+            assert(h.read(pos).value() == contents[pos]);
+        }
+        assert(h.getMemoryUsage() <= 8 * 1024 + 1024);
+        h.setMemoryGovernor(nullptr);
+    }
+
+    std::filesystem::remove(path);
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef FILE_SEEN_CHUNKPOOL
+#define FILE_SEEN_CHUNKPOOL
+
+#include <list>
+#include <map>
+#include <optional>
+
+#include "types.hpp"
+
+namespace HerixLib {
+
+class CompressedChunkPoolStatistics {
+    public:
+    size_t hits = 0;
+    size_t misses = 0;
+    /// Chunks that were compressed into the pool
+    size_t stored = 0;
+    /// Chunks that didn't compress enough to be worth keeping
+    size_t rejected = 0;
+    /// Chunks dropped from the pool to keep it under its max memory
+    size_t evicted = 0;
+    size_t chunk_count = 0;
+    /// The size the chunks in the pool would be uncompressed
+    size_t original_bytes = 0;
+    /// The memory the chunks in the pool take up
+    size_t compressed_bytes = 0;
+
+    /// original_bytes / compressed_bytes, which is how many times more data the pool holds than plain chunks in the
+    /// same memory would. 1 when it's empty.
+    double getCompressionRatio () const;
+};
+
+/// A second tier for chunks that have been evicted: they're kept LZ4 compressed (see compressLZ4Block), and
+/// decompressing one on a later miss is far cheaper than reading it again from a slow disk or network mount.
+/// Chunks are keyed by the block they're from, like the chunk index, and the least recently used are dropped to stay
+/// under the max memory. Not thread safe, each instance has its own (see Herix::enableCompressedTier).
+class CompressedChunkPool {
+    protected:
+    class Key {
+        public:
+        size_t block_size;
+        AbsoluteFilePosition block_start;
+
+        bool operator< (const Key& other) const;
+    };
+
+    class Entry {
+        public:
+        /// Where the data starts in the file, which is after block_start for a chunk cut off by the start position
+        AbsoluteFilePosition data_start;
+        size_t original_size;
+        Buffer data;
+        std::list<Key>::iterator order;
+    };
+
+    size_t max_memory;
+    size_t memory = 0;
+    size_t original_bytes = 0;
+    std::map<Key, Entry> entries;
+    /// Least recently used first
+    std::list<Key> order;
+    CompressedChunkPoolStatistics statistics;
+
+    std::map<Key, Entry>::iterator erase (std::map<Key, Entry>::iterator iter);
+    /// Moves the entry to the back, as the most recently used
+    void touch (std::map<Key, Entry>::iterator iter);
+    /// Drops the oldest chunks until the memory is at most limit
+    size_t trim (size_t limit);
+
+    public:
+    static constexpr size_t default_max_memory = 16 * 1024 * 1024;
+
+    explicit CompressedChunkPool (size_t t_max_memory=default_max_memory);
+
+    /// Compresses the chunk's data into the pool, replacing any other chunk of the same block. If the pool already has
+    /// it (it was decompressed by get, then evicted again) it's only moved to the back rather than compressed again.
+    /// Returns false if it didn't compress to at most 7/8 of its size, since then it's cheaper to read it again than
+    /// to hold it.
+    bool put (size_t block_size, AbsoluteFilePosition block_start, AbsoluteFilePosition data_start, const Byte* data, size_t size);
+    /// Decompresses the first size bytes of the chunk of the block, if it's there, starts at data_start and has at
+    /// least size bytes. The compressed chunk is kept, so evicting it again is free.
+    std::optional<Buffer> get (size_t block_size, AbsoluteFilePosition block_start, AbsoluteFilePosition data_start, size_t size);
+
+    void clear ();
+    /// Drops the oldest chunks until at least bytes have been freed (or it's empty). Returns how much was freed.
+    size_t freeMemory (size_t bytes);
+    size_t getMemoryUsage () const;
+
+    void setMaxMemory (size_t t_max_memory);
+    size_t getMaxMemory () const;
+    CompressedChunkPoolStatistics getStatistics () const;
+    void resetStatistics ();
+};
+
+void test_chunkpool ();
+
+}
+
+#endif
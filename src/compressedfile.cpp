@@ -0,0 +1,765 @@
+#include "compressedfile.hpp"
+#include "herix.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+#ifdef HERIX_HAS_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HERIX_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace HerixLib;
+
+CompressedFile::CompressedFile (const std::filesystem::path& t_path, size_t t_cached_frames) :
+    path(t_path), cached_frames(std::max<size_t>(t_cached_frames, 1)) {
+    file.open(path, std::ios_base::in | std::ios_base::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Failed in opening compressed file.");
+    }
+}
+
+std::unique_ptr<CompressedFile> CompressedFile::open (const std::filesystem::path& path, const CompressedFileOptions& options) {
+    Byte magic[4] = { 0, 0, 0, 0 };
+    {
+        std::ifstream in(path, std::ios_base::in | std::ios_base::binary);
+        if (!in.is_open()) {
+            throw std::runtime_error("Failed in opening compressed file.");
+        }
+        in.read(reinterpret_cast<char*>(magic), sizeof(magic));
+    }
+
+    if (magic[0] == 0x1F && magic[1] == 0x8B) {
+#ifdef HERIX_HAS_ZLIB
+        return std::make_unique<GzipFile>(path, options);
+#else
+        throw std::runtime_error("gzip support was not compiled in (see HERIX_ZLIB).");
+#endif
+    }
+
+    // A zstd frame, or a skippable frame (which a seekable file with no frames is only made of)
+    uint32_t value = uint32_t(magic[0]) | (uint32_t(magic[1]) << 8) | (uint32_t(magic[2]) << 16) | (uint32_t(magic[3]) << 24);
+    if (value == 0xFD2FB528 || (value & 0xFFFFFFF0) == 0x184D2A50) {
+#ifdef HERIX_HAS_ZSTD
+        return std::make_unique<ZstdSeekableFile>(path, options);
+#else
+        throw std::runtime_error("zstd support was not compiled in (see HERIX_ZSTD).");
+#endif
+    }
+
+    (void)options;
+    throw std::runtime_error("Not a supported compressed file.");
+}
+
+void CompressedFile::readCompressed (AbsoluteFilePosition pos, size_t size, Byte* output) {
+    file.clear();
+    file.seekg(static_cast<std::streamoff>(pos));
+    file.read(reinterpret_cast<char*>(output), static_cast<std::streamsize>(size));
+    if (static_cast<size_t>(file.gcount()) != size) {
+        file.clear();
+        throw std::runtime_error("Compressed file is shorter than its index says.");
+    }
+}
+
+std::shared_ptr<const Buffer> CompressedFile::getFrame (size_t index) {
+    for (auto iter = cache.begin(); iter != cache.end(); iter++) {
+        if (iter->first == index) {
+            cache.splice(cache.begin(), cache, iter);
+            statistics.frame_hits++;
+            return cache.front().second;
+        }
+    }
+
+    statistics.frame_misses++;
+    std::shared_ptr<const Buffer> frame = std::make_shared<const Buffer>(decompressFrame(index));
+    assert(frame->size() == frame_starts[index + 1] - frame_starts[index]);
+    statistics.bytes_decompressed += frame->size();
+
+    cache.emplace_front(index, frame);
+    if (cache.size() > cached_frames) {
+        cache.pop_back();
+    }
+    return frame;
+}
+
+std::filesystem::path CompressedFile::getPath () const {
+    return path;
+}
+
+size_t CompressedFile::getSize () const {
+    return frame_starts.back();
+}
+
+size_t CompressedFile::getFrameCount () const {
+    return frame_starts.size() - 1;
+}
+
+size_t CompressedFile::read (AbsoluteFilePosition pos, size_t size, Byte* output) {
+    if (pos >= getSize()) {
+        return 0;
+    }
+    size = std::min(size, getSize() - pos);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // The last frame starting at or before pos
+    size_t index = static_cast<size_t>(std::upper_bound(frame_starts.begin(), frame_starts.end(), pos) - frame_starts.begin()) - 1;
+    size_t done = 0;
+    while (done < size) {
+        // Empty frames (such as an empty gzip member) have nothing to read
+        if (frame_starts[index + 1] == frame_starts[index]) {
+            index++;
+            continue;
+        }
+
+        std::shared_ptr<const Buffer> frame = getFrame(index);
+        size_t offset = (pos + done) - frame_starts[index];
+        size_t amount = std::min(frame->size() - offset, size - done);
+        std::memcpy(output + done, frame->data() + offset, amount);
+        done += amount;
+        index++;
+    }
+    return done;
+}
+
+void CompressedFile::clearCache () {
+    std::lock_guard<std::mutex> lock(mutex);
+    cache.clear();
+}
+
+CompressedFileStatistics CompressedFile::getStatistics () const {
+    std::lock_guard<std::mutex> lock(mutex);
+    CompressedFileStatistics result = statistics;
+    result.frame_count = getFrameCount();
+    result.memory = getIndexMemory() + (frame_starts.size() * sizeof(AbsoluteFilePosition));
+    for (const std::pair<size_t, std::shared_ptr<const Buffer>>& frame : cache) {
+        result.memory += frame.second->size();
+    }
+    return result;
+}
+
+
+// == gzip ==
+
+#ifdef HERIX_HAS_ZLIB
+
+namespace {
+
+constexpr size_t window_size = 32768;
+constexpr size_t input_size = 64 * 1024;
+
+/// Ends the stream however the function using it returns
+class InflateStream {
+    public:
+    z_stream stream;
+
+    explicit InflateStream (int window_bits) {
+        std::memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, window_bits) != Z_OK) {
+            throw std::runtime_error("Failed to start inflating.");
+        }
+    }
+    ~InflateStream () {
+        inflateEnd(&stream);
+    }
+
+    InflateStream (const InflateStream&) = delete;
+    InflateStream& operator= (const InflateStream&) = delete;
+};
+
+Buffer deflateWindow (const Byte* window, size_t size) {
+    uLongf length = compressBound(static_cast<uLong>(size));
+    Buffer result(length);
+    if (compress2(result.data(), &length, window, static_cast<uLong>(size), 1) != Z_OK) {
+        throw std::runtime_error("Failed to compress access point window.");
+    }
+    result.resize(length);
+    result.shrink_to_fit();
+    return result;
+}
+
+}
+
+GzipFile::GzipFile (const std::filesystem::path& t_path, const CompressedFileOptions& options) :
+    CompressedFile(t_path, options.cached_frames), span(std::max<size_t>(options.span, 1)) {
+    std::optional<std::filesystem::path> index_path;
+    if (!options.index.has_value()) {
+        index_path = path;
+        index_path.value() += ".hxgz";
+    } else if (!options.index.value().empty()) {
+        index_path = options.index;
+    }
+
+    if (index_path.has_value() && loadIndex(index_path.value())) {
+        loaded_index = true;
+        return;
+    }
+
+    buildIndex();
+    if (index_path.has_value()) {
+        saveIndex(index_path.value());
+    }
+}
+
+void GzipFile::buildIndex () {
+    points.clear();
+    frame_starts.clear();
+
+    // 47 takes either a gzip or zlib header
+    InflateStream inflater(47);
+    z_stream& stream = inflater.stream;
+
+    Buffer input(input_size);
+    Buffer window(window_size);
+    AbsoluteFilePosition total_in = 0;
+    AbsoluteFilePosition total_out = 0;
+    AbsoluteFilePosition last = 0;
+    AbsoluteFilePosition member_start = 0;
+    bool new_member = true;
+
+    file.clear();
+    file.seekg(0);
+    stream.avail_out = 0;
+
+    while (true) {
+        if (stream.avail_in == 0) {
+            file.read(reinterpret_cast<char*>(input.data()), static_cast<std::streamsize>(input.size()));
+            stream.avail_in = static_cast<uInt>(file.gcount());
+            stream.next_in = input.data();
+            if (stream.avail_in == 0) {
+                throw std::runtime_error("gzip file ends in the middle of its data.");
+            }
+        }
+
+        if (stream.avail_out == 0) {
+            stream.avail_out = static_cast<uInt>(window.size());
+            stream.next_out = window.data();
+        }
+
+        // Inflate until the end of a deflate block (or the end of the input or the window)
+        total_in += stream.avail_in;
+        total_out += stream.avail_out;
+        int result = inflate(&stream, Z_BLOCK);
+        total_in -= stream.avail_in;
+        total_out -= stream.avail_out;
+        if (result == Z_NEED_DICT || result == Z_DATA_ERROR || result == Z_MEM_ERROR) {
+            throw std::runtime_error("gzip file is corrupt.");
+        }
+
+        if (result == Z_STREAM_END) {
+            // Another member may follow, with a header of its own
+            if (stream.avail_in == 0) {
+                file.read(reinterpret_cast<char*>(input.data()), static_cast<std::streamsize>(input.size()));
+                stream.avail_in = static_cast<uInt>(file.gcount());
+                stream.next_in = input.data();
+            }
+            if (stream.avail_in == 0 || stream.next_in[0] != 0x1F) {
+                // The end, or padding after the last member
+                break;
+            }
+            inflateReset(&stream);
+            new_member = true;
+            member_start = total_out;
+            continue;
+        }
+
+        // Past the header or a block, and not the last block of the member
+        bool at_boundary = (stream.data_type & 128) != 0 && (stream.data_type & 64) == 0;
+        if (at_boundary && (new_member || total_out - last >= span)) {
+            AccessPoint point;
+            point.in = total_in;
+            point.bits = stream.data_type & 7;
+            if (total_out > member_start) {
+                // The window is circular, so the oldest output is after where it's up to
+                Buffer linear(window_size);
+                size_t left = stream.avail_out;
+                std::memcpy(linear.data(), window.data() + window_size - left, left);
+                std::memcpy(linear.data() + left, window.data(), window_size - left);
+                size_t available = static_cast<size_t>(std::min<AbsoluteFilePosition>(total_out - member_start, window_size));
+                point.window = deflateWindow(linear.data() + window_size - available, available);
+            }
+            points.push_back(std::move(point));
+            frame_starts.push_back(total_out);
+            last = total_out;
+            new_member = false;
+        }
+    }
+
+    frame_starts.push_back(total_out);
+    file.clear();
+}
+
+Buffer GzipFile::decompressFrame (size_t index) {
+    const AccessPoint& point = points[index];
+    size_t size = static_cast<size_t>(frame_starts[index + 1] - frame_starts[index]);
+
+    // Raw deflate, since the point is past the header
+    InflateStream inflater(-15);
+    z_stream& stream = inflater.stream;
+
+    file.clear();
+    file.seekg(static_cast<std::streamoff>(point.in - (point.bits != 0 ? 1 : 0)));
+    if (point.bits != 0) {
+        int value = file.get();
+        if (value == EOF) {
+            throw std::runtime_error("Compressed file is shorter than its index says.");
+        }
+        inflatePrime(&stream, point.bits, value >> (8 - point.bits));
+    }
+
+    if (!point.window.empty()) {
+        Buffer window(window_size);
+        uLongf length = static_cast<uLongf>(window.size());
+        if (uncompress(window.data(), &length, point.window.data(), static_cast<uLong>(point.window.size())) != Z_OK) {
+            throw std::runtime_error("gzip index is corrupt.");
+        }
+        inflateSetDictionary(&stream, window.data(), static_cast<uInt>(length));
+    }
+
+    Buffer output(size);
+    Buffer input(input_size);
+    stream.next_out = output.data();
+    stream.avail_out = static_cast<uInt>(size);
+    while (stream.avail_out > 0) {
+        if (stream.avail_in == 0) {
+            file.read(reinterpret_cast<char*>(input.data()), static_cast<std::streamsize>(input.size()));
+            stream.avail_in = static_cast<uInt>(file.gcount());
+            stream.next_in = input.data();
+            if (stream.avail_in == 0) {
+                throw std::runtime_error("gzip file ends in the middle of its data.");
+            }
+        }
+
+        int result = inflate(&stream, Z_NO_FLUSH);
+        if (result == Z_STREAM_END) {
+            break;
+        } else if (result != Z_OK) {
+            throw std::runtime_error("gzip file is corrupt.");
+        }
+    }
+    file.clear();
+
+    if (stream.avail_out != 0) {
+        throw std::runtime_error("gzip frame is shorter than its index says.");
+    }
+    return output;
+}
+
+size_t GzipFile::getIndexMemory () const {
+    size_t memory = points.capacity() * sizeof(AccessPoint);
+    for (const AccessPoint& point : points) {
+        memory += point.window.capacity();
+    }
+    return memory;
+}
+
+bool GzipFile::wasIndexLoaded () const {
+    return loaded_index;
+}
+
+const char* GzipFile::getName () const {
+    return "gzip";
+}
+
+// == Index ==
+// Layout: magic, version, then the u64 header fields, then for each point its u64 fields and its window.
+// Like the overview sidecar it's a cache of this machine's file, so it isn't meant to be portable.
+
+static const char index_magic[4] = { 'H', 'X', 'G', 'Z' };
+static const uint64_t index_version = 1;
+
+bool GzipFile::loadIndex (const std::filesystem::path& index_path) {
+    if (!std::filesystem::exists(index_path)) {
+        return false;
+    }
+
+    std::ifstream in(index_path, std::ios_base::in | std::ios_base::binary);
+    char magic[4];
+    uint64_t header[5];
+    in.read(magic, 4);
+    in.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!in || std::memcmp(magic, index_magic, 4) != 0) {
+        return false;
+    }
+
+    uint64_t modified = static_cast<uint64_t>(std::filesystem::last_write_time(path).time_since_epoch().count());
+    if (header[0] != index_version || header[1] != span || header[2] != std::filesystem::file_size(path) || header[3] != modified) {
+        return false;
+    }
+
+    uint64_t count = header[4];
+    std::vector<AccessPoint> loaded_points;
+    std::vector<AbsoluteFilePosition> loaded_starts;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t fields[4];
+        in.read(reinterpret_cast<char*>(fields), sizeof(fields));
+        if (!in || fields[2] > 7 || fields[3] > window_size * 2) {
+            return false;
+        }
+
+        AccessPoint point;
+        point.in = fields[1];
+        point.bits = static_cast<int>(fields[2]);
+        point.window.resize(static_cast<size_t>(fields[3]));
+        in.read(reinterpret_cast<char*>(point.window.data()), static_cast<std::streamsize>(point.window.size()));
+        if (!in || (!loaded_starts.empty() && fields[0] < loaded_starts.back())) {
+            return false;
+        }
+        loaded_starts.push_back(fields[0]);
+        loaded_points.push_back(std::move(point));
+    }
+
+    uint64_t total;
+    in.read(reinterpret_cast<char*>(&total), sizeof(total));
+    if (!in || (!loaded_starts.empty() && total < loaded_starts.back())) {
+        return false;
+    }
+    loaded_starts.push_back(total);
+
+    points = std::move(loaded_points);
+    frame_starts = std::move(loaded_starts);
+    return true;
+}
+
+void GzipFile::saveIndex (const std::filesystem::path& index_path) const {
+    std::ofstream out(index_path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!out.is_open()) {
+        return;
+    }
+
+    uint64_t modified = static_cast<uint64_t>(std::filesystem::last_write_time(path).time_since_epoch().count());
+    uint64_t header[5] = { index_version, span, std::filesystem::file_size(path), modified, points.size() };
+    out.write(index_magic, 4);
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    for (size_t i = 0; i < points.size(); i++) {
+        uint64_t fields[4] = { frame_starts[i], points[i].in, static_cast<uint64_t>(points[i].bits), points[i].window.size() };
+        out.write(reinterpret_cast<const char*>(fields), sizeof(fields));
+        out.write(reinterpret_cast<const char*>(points[i].window.data()), static_cast<std::streamsize>(points[i].window.size()));
+    }
+    uint64_t total = frame_starts.back();
+    out.write(reinterpret_cast<const char*>(&total), sizeof(total));
+}
+
+#endif
+
+
+// == zstd seekable ==
+
+#ifdef HERIX_HAS_ZSTD
+
+namespace {
+
+constexpr uint32_t skippable_magic = 0x184D2A5E;
+constexpr uint32_t seekable_magic = 0x8F92EAB1;
+constexpr size_t seek_footer_size = 9;
+
+uint32_t readLE32 (const Byte* data) {
+    return uint32_t(data[0]) | (uint32_t(data[1]) << 8) | (uint32_t(data[2]) << 16) | (uint32_t(data[3]) << 24);
+}
+
+}
+
+ZstdSeekableFile::ZstdSeekableFile (const std::filesystem::path& t_path, const CompressedFileOptions& options) :
+    CompressedFile(t_path, options.cached_frames) {
+    AbsoluteFilePosition file_size = std::filesystem::file_size(path);
+    if (file_size < seek_footer_size + 8) {
+        throw std::runtime_error("zstd file isn't in the seekable format.");
+    }
+
+    Byte footer[seek_footer_size];
+    readCompressed(file_size - seek_footer_size, seek_footer_size, footer);
+    if (readLE32(footer + 5) != seekable_magic) {
+        throw std::runtime_error("zstd file isn't in the seekable format.");
+    }
+
+    uint64_t frame_count = readLE32(footer);
+    Byte descriptor = footer[4];
+    if ((descriptor & 0x7C) != 0) {
+        throw std::runtime_error("zstd seek table uses reserved bits.");
+    }
+    size_t entry_size = (descriptor & 0x80) != 0 ? 12 : 8;
+    uint64_t table_size = (frame_count * entry_size) + seek_footer_size;
+    if (table_size + 8 > file_size) {
+        throw std::runtime_error("zstd seek table is larger than the file.");
+    }
+
+    Byte frame_header[8];
+    AbsoluteFilePosition table_start = file_size - table_size - 8;
+    readCompressed(table_start, 8, frame_header);
+    if (readLE32(frame_header) != skippable_magic || readLE32(frame_header + 4) != table_size) {
+        throw std::runtime_error("zstd seek table is corrupt.");
+    }
+
+    Buffer entries(static_cast<size_t>(frame_count * entry_size));
+    readCompressed(table_start + 8, entries.size(), entries.data());
+
+    AbsoluteFilePosition compressed = 0;
+    AbsoluteFilePosition decompressed = 0;
+    for (size_t i = 0; i < frame_count; i++) {
+        compressed_starts.push_back(compressed);
+        frame_starts.push_back(decompressed);
+        compressed += readLE32(entries.data() + (i * entry_size));
+        decompressed += readLE32(entries.data() + (i * entry_size) + 4);
+    }
+    compressed_starts.push_back(compressed);
+    frame_starts.push_back(decompressed);
+
+    if (compressed > table_start) {
+        throw std::runtime_error("zstd seek table has frames past the end of the file.");
+    }
+}
+
+Buffer ZstdSeekableFile::decompressFrame (size_t index) {
+    Buffer input(static_cast<size_t>(compressed_starts[index + 1] - compressed_starts[index]));
+    readCompressed(compressed_starts[index], input.size(), input.data());
+
+    Buffer output(static_cast<size_t>(frame_starts[index + 1] - frame_starts[index]));
+    std::unique_ptr<ZSTD_DCtx, size_t(*)(ZSTD_DCtx*)> context(ZSTD_createDCtx(), ZSTD_freeDCtx);
+    if (!context) {
+        throw std::bad_alloc();
+    }
+
+    size_t result = ZSTD_decompressDCtx(context.get(), output.data(), output.size(), input.data(), input.size());
+    if (ZSTD_isError(result)) {
+        throw std::runtime_error(std::string("zstd frame is corrupt: ") + ZSTD_getErrorName(result));
+    }
+    if (result != output.size()) {
+        throw std::runtime_error("zstd frame is a different size than its seek table says.");
+    }
+    return output;
+}
+
+size_t ZstdSeekableFile::getIndexMemory () const {
+    return compressed_starts.capacity() * sizeof(AbsoluteFilePosition);
+}
+
+const char* ZstdSeekableFile::getName () const {
+    return "zstd-seekable";
+}
+
+#endif
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+void HerixLib::test_compressedfile () {
+    const std::string plain = "not compressed at all";
+    std::filesystem::path plain_path = writeTestFile("herix_test_compressedfile.bin", Buffer(plain.begin(), plain.end()));
+    bool threw = false;
+    try {
+        CompressedFile::open(plain_path);
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+    std::filesystem::remove(plain_path);
+
+    // Compressible but varied, so deflate makes many blocks and matches reach back across access points
+    Buffer contents;
+    uint32_t state = 7;
+    for (size_t i = 0; i < 3 * 1024 * 1024; i++) {
+        state = state * 1103515245 + 12345;
+        contents.push_back(static_cast<Byte>(((i / 3000) % 2 == 0) ? ((i * 31) >> 4) : (state >> 28)));
+    }
+
+    auto checkReads = [&contents] (CompressedFile& compressed) {
+        assert(compressed.getSize() == contents.size());
+        Buffer output(100000);
+        uint32_t random = 99;
+        for (size_t i = 0; i < 200; i++) {
+            random = random * 1103515245 + 12345;
+            AbsoluteFilePosition pos = random % contents.size();
+            size_t size = std::min<size_t>((random >> 8) % output.size(), contents.size() - pos);
+            assert(compressed.read(pos, size, output.data()) == size);
+            assert(std::equal(output.begin(), output.begin() + static_cast<std::ptrdiff_t>(size), contents.begin() + static_cast<std::ptrdiff_t>(pos)));
+        }
+        // Cut off at the end
+        assert(compressed.read(contents.size() - 10, 100, output.data()) == 10);
+        assert(compressed.read(contents.size(), 100, output.data()) == 0);
+    };
+
+#ifdef HERIX_HAS_ZLIB
+    // = gzip, as two members with an empty one between them
+    std::filesystem::path gzip_path = getTestPath("herix_test_compressedfile.gz");
+    std::filesystem::path index_path = gzip_path.string() + ".index";
+    {
+        std::ofstream out(gzip_path, std::ios_base::binary | std::ios_base::trunc);
+        size_t split = 1234567;
+        std::pair<size_t, size_t> members[] = { { 0, split }, { split, 0 }, { split, contents.size() - split } };
+        for (const std::pair<size_t, size_t>& member : members) {
+            z_stream stream;
+            std::memset(&stream, 0, sizeof(stream));
+            deflateInit2(&stream, 6, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY);
+            Buffer compressed(deflateBound(&stream, static_cast<uLong>(member.second)));
+            stream.next_in = contents.data() + member.first;
+            stream.avail_in = static_cast<uInt>(member.second);
+            stream.next_out = compressed.data();
+            stream.avail_out = static_cast<uInt>(compressed.size());
+            int result = deflate(&stream, Z_FINISH);
+            assert(result == Z_STREAM_END);
+            (void)result;
+            out.write(reinterpret_cast<const char*>(compressed.data()), static_cast<std::streamsize>(stream.total_out));
+            deflateEnd(&stream);
+        }
+    }
+    std::filesystem::remove(index_path);
+
+    CompressedFileOptions options;
+    options.span = 256 * 1024;
+    options.index = index_path;
+    {
+        std::unique_ptr<CompressedFile> compressed = CompressedFile::open(gzip_path, options);
+        assert(std::string(compressed->getName()) == "gzip");
+        assert(!dynamic_cast<GzipFile&>(*compressed).wasIndexLoaded());
+        assert(compressed->getFrameCount() >= 3 * 1024 / 256);
+        checkReads(*compressed);
+
+        CompressedFileStatistics statistics = compressed->getStatistics();
+        assert(statistics.frame_misses > 0 && statistics.frame_hits > 0);
+        assert(statistics.memory > 0);
+    }
+    assert(std::filesystem::exists(index_path));
+
+    // The second time the index is loaded
+    {
+        std::unique_ptr<CompressedFile> compressed = CompressedFile::open(gzip_path, options);
+        assert(dynamic_cast<GzipFile&>(*compressed).wasIndexLoaded());
+        checkReads(*compressed);
+    }
+
+    // A different span doesn't match the saved index, and a corrupt index is rebuilt
+    options.span = 512 * 1024;
+    assert(!dynamic_cast<GzipFile&>(*CompressedFile::open(gzip_path, options)).wasIndexLoaded());
+    {
+        std::fstream index(index_path, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+        // The first point's bits
+        index.seekp(4 + (5 * 8) + 16);
+        uint64_t bad = 9;
+        index.write(reinterpret_cast<const char*>(&bad), sizeof(bad));
+    }
+    {
+        std::unique_ptr<CompressedFile> compressed = CompressedFile::open(gzip_path, options);
+        assert(!dynamic_cast<GzipFile&>(*compressed).wasIndexLoaded());
+        checkReads(*compressed);
+    }
+
+    // = Through Herix, which reads its chunks from the decompressed contents
+    {
+        Herix h(true, std::make_pair(1000, std::nullopt), 64 * 1024, 4096);
+        h.loadCompressedFile(gzip_path, options);
+        assert(h.isCompressedFile());
+        assert(h.getFileSize() == contents.size());
+        assert(h.getFileEnd() == contents.size() - 1000);
+        for (FilePosition pos = 0; pos < h.getFileEnd(); pos += 4999) {
+            assert(h.read(pos).value() == contents[1000 + pos]);
+        }
+
+        Buffer needle(contents.begin() + 2000000, contents.begin() + 2000016);
+        assert(h.find(0, needle).value() <= 2000000 - 1000);
+
+        h.edit(5, 0xEE);
+        bool save_threw = false;
+        try {
+            h.saveHistoryDestructive();
+        } catch (std::logic_error&) {
+            save_threw = true;
+        }
+        assert(save_threw);
+
+        h.enableAsyncLoading(2);
+        bool arrived = false;
+        AsyncRequestID request = h.requestRange(1500000, 100000, [&arrived] (FilePosition, size_t) {
+            arrived = true;
+        });
+        h.waitAsync(request);
+        assert(arrived && h.isRangeCached(1500000, 100000));
+        assert(h.read(1500000 + 500).value() == contents[1000 + 1500000 + 500]);
+        h.disableAsyncLoading();
+
+        // Saving as writes it out decompressed, and then it's a normal file
+        std::filesystem::path saved_path = getTestPath("herix_test_compressedfile_saved.bin");
+        h.saveAsHistoryDestructive(saved_path.string());
+        assert(!h.isCompressedFile());
+        assert(h.getFileSize() == contents.size() - 1000);
+        std::ifstream saved(saved_path, std::ios_base::binary);
+        Buffer saved_contents((std::istreambuf_iterator<char>(saved)), std::istreambuf_iterator<char>());
+        assert(saved_contents[5] == 0xEE);
+        assert(std::equal(saved_contents.begin() + 6, saved_contents.end(), contents.begin() + 1006));
+        h.closeFile();
+        std::filesystem::remove(saved_path);
+    }
+
+    std::filesystem::remove(gzip_path);
+    std::filesystem::remove(index_path);
+#endif
+
+#ifdef HERIX_HAS_ZSTD
+    // = zstd seekable, with frames of different sizes and checksums in the seek table
+    std::filesystem::path zstd_path = getTestPath("herix_test_compressedfile.zst");
+    {
+        std::ofstream out(zstd_path, std::ios_base::binary | std::ios_base::trunc);
+        Buffer table;
+        auto writeLE32 = [] (Buffer& buffer, uint32_t value) {
+            for (size_t i = 0; i < 4; i++) {
+                buffer.push_back(static_cast<Byte>(value >> (i * 8)));
+            }
+        };
+
+        uint32_t frame_count = 0;
+        for (size_t pos = 0; pos < contents.size(); frame_count++) {
+            size_t size = std::min<size_t>(100000 + (frame_count * 7919), contents.size() - pos);
+            Buffer compressed(ZSTD_compressBound(size));
+            size_t compressed_size = ZSTD_compress(compressed.data(), compressed.size(), contents.data() + pos, size, 3);
+            assert(!ZSTD_isError(compressed_size));
+            out.write(reinterpret_cast<const char*>(compressed.data()), static_cast<std::streamsize>(compressed_size));
+            writeLE32(table, static_cast<uint32_t>(compressed_size));
+            writeLE32(table, static_cast<uint32_t>(size));
+            writeLE32(table, 0);
+            pos += size;
+        }
+        writeLE32(table, frame_count);
+        table.push_back(0x80);
+        writeLE32(table, seekable_magic);
+
+        Buffer header;
+        writeLE32(header, skippable_magic);
+        writeLE32(header, static_cast<uint32_t>(table.size()));
+        out.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+        out.write(reinterpret_cast<const char*>(table.data()), static_cast<std::streamsize>(table.size()));
+    }
+    {
+        std::unique_ptr<CompressedFile> compressed = CompressedFile::open(zstd_path);
+        assert(std::string(compressed->getName()) == "zstd-seekable");
+        assert(compressed->getFrameCount() > 10);
+        checkReads(*compressed);
+    }
+
+    // A plain zstd file has no seek table
+    {
+        Buffer compressed(ZSTD_compressBound(1000));
+        size_t compressed_size = ZSTD_compress(compressed.data(), compressed.size(), contents.data(), 1000, 3);
+        compressed.resize(compressed_size);
+        std::filesystem::remove(zstd_path);
+        zstd_path = writeTestFile("herix_test_compressedfile.zst", compressed);
+    }
+    threw = false;
+    try {
+        CompressedFile::open(zstd_path);
+    } catch (std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+    std::filesystem::remove(zstd_path);
+#endif
+
+    (void)checkReads;
+}
+
+#endif
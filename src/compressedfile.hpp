@@ -0,0 +1,165 @@
+#ifndef FILE_SEEN_COMPRESSEDFILE
+#define FILE_SEEN_COMPRESSEDFILE
+
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "types.hpp"
+#include "backend.hpp"
+
+// gzip support needs zlib, and is opted into with HERIX_ZLIB (link with -lz)
+#if defined(HERIX_ZLIB) && defined(__has_include)
+#if __has_include(<zlib.h>)
+#define HERIX_HAS_ZLIB 1
+#endif
+#endif
+
+// zstd support needs libzstd, and is opted into with HERIX_ZSTD (link with -lzstd)
+#if defined(HERIX_ZSTD) && defined(__has_include)
+#if __has_include(<zstd.h>)
+#define HERIX_HAS_ZSTD 1
+#endif
+#endif
+
+namespace HerixLib {
+
+class CompressedFileOptions {
+    public:
+    /// gzip: roughly how much decompressed data lies between access points. Each one keeps a (compressed) 32KiB
+    /// window, so smaller spans make random access faster but the index bigger.
+    size_t span = 1024 * 1024;
+    /// gzip: where the index is saved and loaded from. Defaults to the filename with ".hxgz" appended, an empty path
+    /// means it's rebuilt every time the file is opened.
+    std::optional<std::filesystem::path> index;
+    /// How many decompressed frames are kept, so reads near each other only decompress a frame once
+    size_t cached_frames = 4;
+};
+
+class CompressedFileStatistics {
+    public:
+    size_t frame_count = 0;
+    size_t frame_hits = 0;
+    size_t frame_misses = 0;
+    size_t bytes_decompressed = 0;
+    /// Memory taken by the index and the cached frames
+    size_t memory = 0;
+    /// gzip: whether the index was loaded rather than built
+    bool loaded_index = false;
+};
+
+/// Random access into the decompressed contents of a compressed file. The contents are split into frames which can
+/// each be decompressed on their own: the frames of a zstd seekable file, or the spans between the access points of
+/// a gzip file. A read only decompresses the frames that cover it, and the most recent frames are kept around.
+/// Reads are thread safe, so the background readers (SequentialReader, AsyncLoader) can share it.
+class CompressedFile : public Backend {
+    protected:
+    std::filesystem::path path;
+    std::ifstream file;
+    size_t cached_frames;
+
+    /// The decompressed start of each frame, followed by the decompressed size
+    std::vector<AbsoluteFilePosition> frame_starts;
+
+    mutable std::mutex mutex;
+    /// Most recently used first
+    std::list<std::pair<size_t, std::shared_ptr<const Buffer>>> cache;
+    CompressedFileStatistics statistics;
+
+    CompressedFile (const std::filesystem::path& t_path, size_t t_cached_frames);
+
+    /// Reads exactly size bytes at pos of the compressed file. Must hold the mutex.
+    void readCompressed (AbsoluteFilePosition pos, size_t size, Byte* output);
+    /// Must hold the mutex
+    std::shared_ptr<const Buffer> getFrame (size_t index);
+    /// Decompresses the frame, which must come out as its full size. Called with the mutex held.
+    virtual Buffer decompressFrame (size_t index) = 0;
+    /// Memory taken by the index. Called with the mutex held.
+    virtual size_t getIndexMemory () const = 0;
+
+    public:
+    virtual ~CompressedFile () = default;
+
+    CompressedFile (const CompressedFile&) = delete;
+    CompressedFile& operator= (const CompressedFile&) = delete;
+
+    /// Opens path by what its first bytes say it is. Throws std::runtime_error if it isn't a format that's supported
+    /// (or that was compiled in), and on corrupt data.
+    static std::unique_ptr<CompressedFile> open (const std::filesystem::path& path, const CompressedFileOptions& options=CompressedFileOptions());
+
+    /// The size of the decompressed contents
+    size_t getSize () const override;
+    size_t getFrameCount () const;
+    /// Reads up to size bytes of the decompressed contents at pos into output. Returns how many were read, which is
+    /// less than size at the end.
+    size_t read (AbsoluteFilePosition pos, size_t size, Byte* output) override;
+    /// Drops the cached frames
+    void clearCache ();
+    CompressedFileStatistics getStatistics () const;
+    std::filesystem::path getPath () const override;
+};
+
+#ifdef HERIX_HAS_ZLIB
+/// gzip (or zlib) files, including several gzip members one after the other. The first open makes a pass over the
+/// whole file to find access points, in the same way as zlib's zran example: at a deflate block boundary about every
+/// span bytes of output, it notes the position in the compressed data and the 32KiB of output before it, which is
+/// all inflate needs to start from there. Each member also starts with one.
+class GzipFile : public CompressedFile {
+    protected:
+    class AccessPoint {
+        public:
+        AbsoluteFilePosition in;
+        /// Bits of the byte before in that belong to the block, if it doesn't start on a byte boundary
+        int bits;
+        /// The output before the point, deflated. Empty at the start of a member, where there's nothing to refer back to.
+        Buffer window;
+    };
+
+    std::vector<AccessPoint> points;
+    size_t span;
+    bool loaded_index = false;
+
+    void buildIndex ();
+    bool loadIndex (const std::filesystem::path& index_path);
+    /// Best effort, failing to write it only means it'll be built again next time
+    void saveIndex (const std::filesystem::path& index_path) const;
+
+    Buffer decompressFrame (size_t index) override;
+    size_t getIndexMemory () const override;
+
+    public:
+    GzipFile (const std::filesystem::path& t_path, const CompressedFileOptions& options=CompressedFileOptions());
+
+    bool wasIndexLoaded () const;
+    const char* getName () const override;
+};
+#endif
+
+#ifdef HERIX_HAS_ZSTD
+/// zstd files in the seekable format: independent frames, with a table of their sizes in a skippable frame at the end.
+/// There's nothing to build, the table is the index.
+class ZstdSeekableFile : public CompressedFile {
+    protected:
+    /// Where each frame starts in the compressed file
+    std::vector<AbsoluteFilePosition> compressed_starts;
+
+    Buffer decompressFrame (size_t index) override;
+    size_t getIndexMemory () const override;
+
+    public:
+    ZstdSeekableFile (const std::filesystem::path& t_path, const CompressedFileOptions& options=CompressedFileOptions());
+
+    const char* getName () const override;
+};
+#endif
+
+void test_compressedfile ();
+
+}
+
+#endif
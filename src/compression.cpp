@@ -0,0 +1,283 @@
+#include "compression.hpp"
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+using namespace HerixLib;
+
+namespace {
+
+constexpr size_t min_match = 4;
+/// The last match has to start at least this far from the end
+constexpr size_t match_limit = 12;
+/// The last bytes are always literals
+constexpr size_t last_literals = 5;
+constexpr size_t max_offset = 65535;
+constexpr size_t hash_log = 12;
+
+inline uint32_t read32 (const Byte* data) {
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+inline uint64_t read64 (const Byte* data) {
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+inline size_t hash32 (uint32_t value) {
+    return (value * 2654435761u) >> (32 - hash_log);
+}
+
+/// Writes the part of a length past the 15 that fits in the token
+inline Byte* writeLength (Byte* out, size_t length) {
+    length -= 15;
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = static_cast<Byte>(length);
+    return out;
+}
+
+inline Byte* writeSequence (Byte* out, const Byte* literals, size_t literal_length, size_t offset, size_t match_length) {
+    Byte* token = out++;
+    *token = static_cast<Byte>(std::min<size_t>(literal_length, 15) << 4);
+    if (literal_length >= 15) {
+        out = writeLength(out, literal_length);
+    }
+    if (literal_length > 0) {
+        std::memcpy(out, literals, literal_length);
+    }
+    out += literal_length;
+
+    if (match_length == 0) {
+        // The last sequence, which has no match
+        return out;
+    }
+
+    *out++ = static_cast<Byte>(offset & 0xFF);
+    *out++ = static_cast<Byte>(offset >> 8);
+    size_t stored = match_length - min_match;
+    *token |= static_cast<Byte>(std::min<size_t>(stored, 15));
+    if (stored >= 15) {
+        out = writeLength(out, stored);
+    }
+    return out;
+}
+
+/// Reads the extra bytes of a length that was 15 in the token
+size_t readLength (const Byte* data, size_t size, size_t& pos) {
+    size_t length = 0;
+    Byte value;
+    do {
+        if (pos >= size) {
+            throw std::runtime_error("Compressed block ends in the middle of a length.");
+        }
+        value = data[pos++];
+        length += value;
+    } while (value == 255);
+    return length;
+}
+
+}
+
+size_t HerixLib::getLZ4BlockBound (size_t size) {
+    return size + (size / 255) + 16;
+}
+
+Buffer HerixLib::compressLZ4Block (const Byte* data, size_t size) {
+    Buffer output(getLZ4BlockBound(size));
+    Byte* out = output.data();
+
+    size_t anchor = 0;
+    if (size > match_limit) {
+        // Positions are only trusted after comparing the bytes, so a zeroed table is fine
+        uint32_t table[size_t(1) << hash_log] = {};
+        size_t match_end_limit = size - last_literals;
+        size_t pos = 1;
+
+        while (pos + match_limit < size) {
+            uint32_t sequence = read32(data + pos);
+            size_t hash = hash32(sequence);
+            size_t candidate = table[hash];
+            table[hash] = static_cast<uint32_t>(pos);
+
+            if (pos - candidate > max_offset || read32(data + candidate) != sequence) {
+                // Step further the longer it's been since a match, so incompressible data is skipped over quickly
+                pos += 1 + ((pos - anchor) >> 6);
+                continue;
+            }
+
+            // Extend backwards into the literals, then forwards as far as it goes
+            while (pos > anchor && candidate > 0 && data[pos - 1] == data[candidate - 1]) {
+                pos--;
+                candidate--;
+            }
+            size_t end = pos + min_match;
+            size_t from = candidate + min_match;
+            while (end + 8 <= match_end_limit && read64(data + end) == read64(data + from)) {
+                end += 8;
+                from += 8;
+            }
+            while (end < match_end_limit && data[end] == data[from]) {
+                end++;
+                from++;
+            }
+
+            out = writeSequence(out, data + anchor, pos - anchor, pos - candidate, end - pos);
+            pos = end;
+            anchor = end;
+            // Also index the end of the match, which is what's most likely to repeat next
+            table[hash32(read32(data + pos - 2))] = static_cast<uint32_t>(pos - 2);
+        }
+    }
+
+    out = writeSequence(out, data + anchor, size - anchor, 0, 0);
+    output.resize(static_cast<size_t>(out - output.data()));
+    return output;
+}
+
+void HerixLib::decompressLZ4Block (const Byte* data, size_t size, Byte* output, size_t output_size) {
+    size_t pos = 0;
+    size_t out = 0;
+
+    while (true) {
+        if (pos >= size) {
+            throw std::runtime_error("Compressed block ends before its last sequence.");
+        }
+        Byte token = data[pos++];
+
+        size_t literal_length = token >> 4;
+        if (literal_length == 15) {
+            literal_length += readLength(data, size, pos);
+        }
+        if (literal_length > size - pos || literal_length > output_size - out) {
+            throw std::runtime_error("Compressed block has literals past its end.");
+        }
+        if (literal_length <= 16 && size - pos >= 16 && output_size - out >= 16) {
+            // A fixed size copy is much cheaper than one of any size. What it writes past the literals is written
+            // over by whatever comes next.
+            std::memcpy(output + out, data + pos, 16);
+        } else if (literal_length > 0) {
+            std::memcpy(output + out, data + pos, literal_length);
+        }
+        pos += literal_length;
+        out += literal_length;
+
+        if (pos == size) {
+            break;
+        }
+
+        if (size - pos < 2) {
+            throw std::runtime_error("Compressed block ends in the middle of an offset.");
+        }
+        size_t offset = size_t(data[pos]) | (size_t(data[pos + 1]) << 8);
+        pos += 2;
+        if (offset == 0 || offset > out) {
+            throw std::runtime_error("Compressed block has a match before its start.");
+        }
+
+        size_t match_length = (token & 0xF);
+        if (match_length == 15) {
+            match_length += readLength(data, size, pos);
+        }
+        match_length += min_match;
+        if (match_length > output_size - out) {
+            throw std::runtime_error("Compressed block decompresses past the expected size.");
+        }
+
+        // The match can overlap what it's writing, such as a run of one byte. Everything from the match to what's
+        // been written so far repeats every offset bytes, so each copy can reach back a whole number of repeats and
+        // twice as much is available for the next one.
+        size_t copied = 0;
+        if (match_length <= 16 && offset >= 16 && output_size - out >= 16) {
+            std::memcpy(output + out, output + out - offset, 16);
+            copied = match_length;
+        }
+        while (copied < match_length) {
+            size_t distance = ((offset + copied) / offset) * offset;
+            size_t amount = std::min(distance, match_length - copied);
+            std::memcpy(output + out + copied, output + out + copied - distance, amount);
+            copied += amount;
+        }
+        out += match_length;
+    }
+
+    if (out != output_size) {
+        throw std::runtime_error("Compressed block is smaller than the expected size.");
+    }
+}
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+void HerixLib::test_compression () {
+    auto roundTrip = [] (const Buffer& original) {
+        Buffer compressed = compressLZ4Block(original.data(), original.size());
+        assert(compressed.size() <= getLZ4BlockBound(original.size()));
+        Buffer decompressed(original.size());
+        decompressLZ4Block(compressed.data(), compressed.size(), decompressed.data(), decompressed.size());
+        assert(decompressed == original);
+        return compressed.size();
+    };
+
+    // Too small to have any matches
+    assert(roundTrip(Buffer{}) == 1);
+    roundTrip(Buffer{ 1, 2, 3, 4, 5 });
+
+    // A run of one byte is a single long overlapping match
+    assert(roundTrip(Buffer(100000, 0xAA)) < 1000);
+
+    // Text-like data with repeats at varying distances, including past the 64K window
+    Buffer text;
+    const char* words[] = { "alpha ", "beta ", "gamma ", "delta ", "epsilon " };
+    for (size_t i = 0; text.size() < 200000; i++) {
+        const char* word = words[(i * 7 + (i / 5)) % 5];
+        text.insert(text.end(), word, word + std::strlen(word));
+    }
+    assert(roundTrip(text) < text.size() / 4);
+
+    // Pseudo random data doesn't compress, but still round trips within the bound
+    Buffer noise(70000);
+    uint32_t state = 12345;
+    for (Byte& value : noise) {
+        state = state * 1103515245 + 12345;
+        value = static_cast<Byte>(state >> 16);
+    }
+    assert(roundTrip(noise) > noise.size());
+
+    // Every size around the limits on where matches can be
+    for (size_t size = 0; size < 40; size++) {
+        roundTrip(Buffer(size, 7));
+    }
+
+    // A known block: "aaaaaaaaaaaaaaaaaaaa" is one literal then a match of 14 at offset 1, then 5 literals
+    Buffer known = { 0x1A, 'a', 0x01, 0x00, 0x50, 'a', 'a', 'a', 'a', 'a' };
+    Buffer known_output(20);
+    decompressLZ4Block(known.data(), known.size(), known_output.data(), known_output.size());
+    assert(known_output == Buffer(20, 'a'));
+
+    // Malformed blocks throw rather than writing past the output
+    auto throws = [] (const Buffer& block, size_t output_size) {
+        Buffer output(output_size);
+        try {
+            decompressLZ4Block(block.data(), block.size(), output.data(), output.size());
+        } catch (std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    assert(throws(known, 19));
+    assert(throws(known, 21));
+    assert(throws(Buffer{ 0x1A, 'a', 0x02, 0x00, 0x50, 'a', 'a', 'a', 'a', 'a' }, 20));
+    assert(throws(Buffer{ 0x1A, 'a', 0x01 }, 20));
+    assert(throws(Buffer{ 0xF0 }, 20));
+    assert(throws(Buffer{}, 0));
+}
+
+#endif
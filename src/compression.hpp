@@ -0,0 +1,25 @@
+#ifndef FILE_SEEN_COMPRESSION
+#define FILE_SEEN_COMPRESSION
+
+#include "types.hpp"
+
+namespace HerixLib {
+
+/// The most that compressLZ4Block can produce for size bytes
+size_t getLZ4BlockBound (size_t size);
+
+/// Compresses data into the LZ4 block format (a single block, without the frame around it), so it can be read back by
+/// anything that speaks LZ4. This is the plain greedy compressor with a 4096 entry hash table: it's meant to be cheap
+/// enough to run on every evicted chunk, not to get the best ratio.
+Buffer compressLZ4Block (const Byte* data, size_t size);
+
+/// Decompresses an LZ4 block into output, which must be exactly the size that was compressed.
+/// Throws std::runtime_error if the block is malformed or doesn't fill output exactly, rather than reading or
+/// writing out of bounds.
+void decompressLZ4Block (const Byte* data, size_t size, Byte* output, size_t output_size);
+
+void test_compression ();
+
+}
+
+#endif
@@ -0,0 +1,194 @@
+#include "decode.hpp"
+#include <cassert>
+#include <limits>
+
+using namespace HerixLib;
+
+std::optional<VarIntResult<uint64_t>> HerixLib::decodeULEB128 (const Byte* data, size_t size) {
+    uint64_t value = 0;
+    unsigned int shift = 0;
+
+    for (size_t i = 0; i < size && i < max_leb128_size; i++) {
+        Byte byte = data[i];
+        uint64_t low = byte & 0x7f;
+
+        // The tenth byte may only hold the single top bit
+        if (shift == 63 && low > 1) {
+            return std::nullopt;
+        }
+
+        value |= low << shift;
+        shift += 7;
+
+        if ((byte & 0x80) == 0) {
+            return std::make_pair(value, i + 1);
+        }
+    }
+
+    return std::nullopt;
+}
+
+std::optional<VarIntResult<int64_t>> HerixLib::decodeSLEB128 (const Byte* data, size_t size) {
+    uint64_t value = 0;
+    unsigned int shift = 0;
+
+    for (size_t i = 0; i < size && i < max_leb128_size; i++) {
+        Byte byte = data[i];
+        uint64_t low = byte & 0x7f;
+
+        // The tenth byte holds the single top bit, and the rest of it has to be that bit sign extended
+        if (shift == 63 && low != 0 && low != 0x7f) {
+            return std::nullopt;
+        }
+
+        value |= low << shift;
+        shift += 7;
+
+        if ((byte & 0x80) == 0) {
+            // Sign extend if the sign bit of the last byte is set
+            if (shift < 64 && (byte & 0x40) != 0) {
+                value |= ~uint64_t(0) << shift;
+            }
+            return std::make_pair(static_cast<int64_t>(value), i + 1);
+        }
+    }
+
+    return std::nullopt;
+}
+
+/// The whole seconds a Timestamp can hold either side of the epoch, which for nanoseconds is about 292 years
+static constexpr int64_t max_timestamp_seconds = std::chrono::duration_cast<std::chrono::seconds>(Timestamp::duration::max()).count();
+static constexpr int64_t min_timestamp_seconds = std::chrono::duration_cast<std::chrono::seconds>(Timestamp::duration::min()).count();
+
+std::optional<Timestamp> HerixLib::decodeUnixTime (int64_t seconds) {
+    if (seconds > max_timestamp_seconds || seconds < min_timestamp_seconds) {
+        return std::nullopt;
+    }
+    return Timestamp(std::chrono::duration_cast<Timestamp::duration>(std::chrono::seconds(seconds)));
+}
+
+std::optional<Timestamp> HerixLib::decodeFileTime (uint64_t intervals) {
+    // Seconds between 1601-01-01 and 1970-01-01
+    constexpr int64_t epoch_difference = 11644473600;
+    // At most about 1.8e12, so it can't overflow
+    int64_t seconds = static_cast<int64_t>(intervals / 10000000) - epoch_difference;
+    // The last second is left out, since the remainder could take it past the end
+    if (seconds >= max_timestamp_seconds) {
+        return std::nullopt;
+    }
+    std::optional<Timestamp> whole = decodeUnixTime(seconds);
+    if (!whole.has_value()) {
+        return std::nullopt;
+    }
+    auto remainder = std::chrono::nanoseconds(static_cast<int64_t>(intervals % 10000000) * 100);
+    return whole.value() + std::chrono::duration_cast<Timestamp::duration>(remainder);
+}
+
+/// Days since the unix epoch of a civil date. From Howard Hinnant's date algorithms.
+static int64_t daysFromCivil (int64_t year, unsigned int month, unsigned int day) {
+    year -= month <= 2;
+    const int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const unsigned int yoe = static_cast<unsigned int>(year - era * 400);
+    const unsigned int doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const unsigned int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+std::optional<Timestamp> HerixLib::decodeDosDateTime (uint16_t date, uint16_t time) {
+    unsigned int day = date & 0x1f;
+    unsigned int month = (date >> 5) & 0x0f;
+    int64_t year = 1980 + (date >> 9);
+
+    unsigned int second = (time & 0x1f) * 2;
+    unsigned int minute = (time >> 5) & 0x3f;
+    unsigned int hour = time >> 11;
+
+    if (day == 0 || month == 0 || month > 12 || hour > 23 || minute > 59 || second > 59) {
+        return std::nullopt;
+    }
+
+    int64_t seconds = daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+    return decodeUnixTime(seconds);
+}
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+void HerixLib::test_decode () {
+    const Byte data[] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12 };
+
+    // Single values
+    assert((decodeValue<uint8_t, Endian::Little>(data) == 0x01));
+    assert((decodeValue<uint16_t, Endian::Little>(data) == 0x0201));
+    assert((decodeValue<uint16_t, Endian::Big>(data) == 0x0102));
+    assert((decodeValue<uint32_t, Endian::Little>(data) == 0x04030201));
+    assert((decodeValue<uint32_t, Endian::Big>(data) == 0x01020304));
+    assert((decodeValue<uint64_t, Endian::Big>(data) == 0x0102030405060708));
+    assert((decodeValue<int16_t, Endian::Big>(data + 16) == 0x1112));
+
+    const Byte negative[] = { 0xff, 0xfe };
+    assert((decodeValue<int16_t, Endian::Little>(negative) == -257));
+    assert((decodeValue<int8_t, Endian::Little>(negative) == -1));
+
+    const Byte one_f32[] = { 0x3f, 0x80, 0x00, 0x00 };
+    assert((decodeValue<float, Endian::Big>(one_f32) == 1.0f));
+    const Byte one_f64[] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf0, 0x3f };
+    assert((decodeValue<double, Endian::Little>(one_f64) == 1.0));
+
+    // Arrays, with a count that isn't a multiple of the vector width so the tail is also checked
+    uint16_t words[9];
+    decodeArray<uint16_t, Endian::Big>(data, 9, words);
+    for (size_t i = 0; i < 9; i++) {
+        assert((words[i] == decodeValue<uint16_t, Endian::Big>(data + (i * 2))));
+    }
+    uint32_t dwords[4];
+    decodeArray<uint32_t, Endian::Big>(data, 4, dwords);
+    assert(dwords[0] == 0x01020304);
+    assert(dwords[3] == 0x0d0e0f10);
+    uint64_t qwords[2];
+    decodeArray<uint64_t, Endian::Little>(data, 2, qwords);
+    assert(qwords[1] == 0x100f0e0d0c0b0a09);
+
+    // LEB128
+    const Byte leb[] = { 0xe5, 0x8e, 0x26 };
+    auto uleb = decodeULEB128(leb, 3);
+    assert(uleb.has_value());
+    assert(uleb.value().first == 624485);
+    assert(uleb.value().second == 3);
+    assert(!decodeULEB128(leb, 2).has_value());
+
+    const Byte sleb[] = { 0xc0, 0xbb, 0x78 };
+    auto sleb_result = decodeSLEB128(sleb, 3);
+    assert(sleb_result.has_value());
+    assert(sleb_result.value().first == -123456);
+    const Byte sleb_small[] = { 0x7f };
+    assert(decodeSLEB128(sleb_small, 1).value().first == -1);
+    // Ten bytes only fit if the unused bits of the last one match the sign
+    const Byte sleb_min[] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x7f };
+    assert(decodeSLEB128(sleb_min, 10).value().first == std::numeric_limits<int64_t>::min());
+    const Byte sleb_max[] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00 };
+    assert(decodeSLEB128(sleb_max, 10).value().first == std::numeric_limits<int64_t>::max());
+    const Byte sleb_overflow[] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x01 };
+    assert(!decodeSLEB128(sleb_overflow, 10).has_value());
+    const Byte sleb_garbage[] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3f };
+    assert(!decodeSLEB128(sleb_garbage, 10).has_value());
+
+    // Timestamps
+    assert(decodeUnixTime(0).value().time_since_epoch().count() == 0);
+    assert(decodeFileTime(116444736000000000ull) == decodeUnixTime(0));
+    assert(decodeFileTime(116444736000000001ull).value() - decodeUnixTime(0).value() == std::chrono::nanoseconds(100));
+    // Out of range values, which would overflow the nanoseconds
+    assert(!decodeUnixTime(std::numeric_limits<int64_t>::max()).has_value());
+    assert(!decodeUnixTime(std::numeric_limits<int64_t>::min()).has_value());
+    assert(decodeUnixTime(4102444800).has_value());
+    assert(!decodeFileTime(std::numeric_limits<uint64_t>::max()).has_value());
+    // 2019-06-15 12:30:10
+    uint16_t dos_date = static_cast<uint16_t>(((2019 - 1980) << 9) | (6 << 5) | 15);
+    uint16_t dos_time = static_cast<uint16_t>((12 << 11) | (30 << 5) | 5);
+    assert(decodeDosDateTime(dos_date, dos_time) == decodeUnixTime(1560601810));
+    assert(!decodeDosDateTime(0, 0).has_value());
+}
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef FILE_SEEN_DECODE
+#define FILE_SEEN_DECODE
+
+#include <cstring>
+#include <chrono>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+#include "types.hpp"
+
+namespace HerixLib {
+
+enum class Endian {
+    Little,
+    Big,
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    Native = Big,
+#else
+    Native = Little,
+#endif
+};
+
+namespace detail {
+    template<size_t N>
+    struct UnsignedOfSize {};
+    template<> struct UnsignedOfSize<1> { using type = uint8_t; };
+    template<> struct UnsignedOfSize<2> { using type = uint16_t; };
+    template<> struct UnsignedOfSize<4> { using type = uint32_t; };
+    template<> struct UnsignedOfSize<8> { using type = uint64_t; };
+
+    inline uint8_t byteSwap (uint8_t value) { return value; }
+    inline uint16_t byteSwap (uint16_t value) { return __builtin_bswap16(value); }
+    inline uint32_t byteSwap (uint32_t value) { return __builtin_bswap32(value); }
+    inline uint64_t byteSwap (uint64_t value) { return __builtin_bswap64(value); }
+}
+
+/// Any arithmetic type which can be decoded from bytes. (u8-u64, i8-i64, f32, f64)
+template<typename T>
+constexpr bool is_decodable_v = std::is_arithmetic_v<T> && !std::is_same_v<T, bool> &&
+    (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8);
+
+/// Decodes a single value from data, which must have at least sizeof(T) bytes.
+template<typename T, Endian E=Endian::Little>
+T decodeValue (const Byte* data) {
+    static_assert(is_decodable_v<T>, "Can only decode integers and floating point values.");
+    using Raw = typename detail::UnsignedOfSize<sizeof(T)>::type;
+
+    Raw raw;
+    std::memcpy(&raw, data, sizeof(T));
+    if constexpr (E != Endian::Native) {
+        raw = detail::byteSwap(raw);
+    }
+
+    T value;
+    std::memcpy(&value, &raw, sizeof(T));
+    return value;
+}
+
+/// Decodes count values from data (which must have count * sizeof(T) bytes) into output.
+/// Uses a shuffle to swap 16 bytes at a time if SSSE3 is available, otherwise the compiler is left to vectorize the loop.
+template<typename T, Endian E=Endian::Little>
+void decodeArray (const Byte* data, size_t count, T* output) {
+    static_assert(is_decodable_v<T>, "Can only decode integers and floating point values.");
+
+    if constexpr (E == Endian::Native || sizeof(T) == 1) {
+        std::memcpy(output, data, count * sizeof(T));
+    } else {
+        size_t i = 0;
+#if defined(__SSSE3__)
+        constexpr size_t per_vector = 16 / sizeof(T);
+        // Reverse the bytes of each sizeof(T) lane
+        alignas(16) Byte shuffle[16];
+        for (size_t j = 0; j < 16; j++) {
+            shuffle[j] = static_cast<Byte>((j - (j % sizeof(T))) + (sizeof(T) - 1 - (j % sizeof(T))));
+        }
+        const __m128i mask = _mm_load_si128(reinterpret_cast<const __m128i*>(shuffle));
+
+        Byte* out_bytes = reinterpret_cast<Byte*>(output);
+        for (; i + per_vector <= count; i += per_vector) {
+            __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + (i * sizeof(T))));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out_bytes + (i * sizeof(T))), _mm_shuffle_epi8(values, mask));
+        }
+#endif
+        for (; i < count; i++) {
+            output[i] = decodeValue<T, E>(data + (i * sizeof(T)));
+        }
+    }
+}
+
+/// The decoded value of a variable length integer, and how many bytes it took up.
+template<typename T>
+using VarIntResult = std::pair<T, size_t>;
+
+/// Decodes an unsigned LEB128 value from (at most) size bytes.
+/// Returns nullopt if the value was not terminated within size bytes, or if it does not fit in 64 bits.
+std::optional<VarIntResult<uint64_t>> decodeULEB128 (const Byte* data, size_t size);
+/// Decodes a signed LEB128 value from (at most) size bytes.
+/// Returns nullopt if the value was not terminated within size bytes, or if it does not fit in 64 bits.
+std::optional<VarIntResult<int64_t>> decodeSLEB128 (const Byte* data, size_t size);
+/// The maximum amount of bytes a 64 bit LEB128 value can take up.
+constexpr size_t max_leb128_size = 10;
+
+using Timestamp = std::chrono::system_clock::time_point;
+
+/// Seconds since the unix epoch. Returns nullopt if it's past what a Timestamp can hold.
+std::optional<Timestamp> decodeUnixTime (int64_t seconds);
+/// Windows FILETIME, 100 nanosecond intervals since 1601-01-01. Returns nullopt if it's past what a Timestamp can hold.
+std::optional<Timestamp> decodeFileTime (uint64_t intervals);
+/// MS-DOS date and time, as used in FAT and zip. Returns nullopt if the fields are out of range.
+/// Treated as UTC, since DOS timestamps don't store a timezone.
+std::optional<Timestamp> decodeDosDateTime (uint16_t date, uint16_t time);
+
+void test_decode ();
+
+}
+
+#endif
@@ -1,10 +1,54 @@
 #include "editstorage.hpp"
+#include "metrics.hpp"
 #include <map>
 #include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
 
 using namespace HerixLib;
 
-EditStorageItem::EditStorageItem (FilePosition t_pos, Buffer t_data) : pos(t_pos), data(t_data) {}
+EditStorageItem::EditStorageItem (FilePosition t_pos, Buffer t_data) : pos(t_pos), data(std::move(t_data)) {}
+
+size_t EditStorageItem::getSize () const {
+    if (repeating || isGroup() || transform.has_value()) {
+        return written_size;
+    }
+    return spilled.has_value() ? spilled.value().size : data.size();
+}
+
+bool EditStorageItem::isGroup () const {
+    return !runs.empty();
+}
+
+EditRange EditStorageItem::getSpan () const {
+    if (!isGroup()) {
+        return std::make_pair(pos, getSize());
+    }
+    const EditRun& last = runs.back();
+    return std::make_pair(runs.front().pos, (last.pos + last.size) - runs.front().pos);
+}
+
+std::optional<size_t> EditStorageItem::findOffset (FilePosition at) const {
+    EditRange span = getSpan();
+    if (at < span.first || at >= span.first + span.second) {
+        return std::nullopt;
+    }
+    if (!isGroup()) {
+        return at - pos;
+    }
+
+    // The run which could hold it is the one before the first that starts after it
+    auto iter = std::upper_bound(runs.begin(), runs.end(), at, [] (FilePosition value, const EditRun& run) {
+        return value < run.pos;
+    });
+    iter--;
+    if (at >= iter->pos + iter->size) {
+        return std::nullopt;
+    }
+    return iter->offset + (at - iter->pos);
+}
 
 
 
@@ -49,7 +93,7 @@ size_t EditStorage::getFutureEntryCount() const {
 size_t EditStorage::getBytesStored() const {
     size_t count = 0;
     for (const EditStorageItem& item : edits) {
-        count += item.data.size();
+        count += item.getSize();
     }
     return count;
 }
@@ -58,7 +102,7 @@ size_t EditStorage::getBytesStoredPast() const {
     size_t end = getCurrentEnd();
 
     for (size_t i = 0; i < end; i++) {
-        count += edits.at(i).data.size();
+        count += edits.at(i).getSize();
     }
 
     return count;
@@ -66,7 +110,7 @@ size_t EditStorage::getBytesStoredPast() const {
 size_t EditStorage::getBytesStoredFuture() const {
     size_t count = 0;
     for (size_t i = getCurrentEnd(); i < edits.size(); i++) {
-        count += edits.at(i).data.size();
+        count += edits.at(i).getSize();
     }
     return count;
 }
@@ -82,35 +126,158 @@ unsigned long EditStorage::getBytesWrittenAllTime() const {
 /// Returns the number of bytes that have been edited at the current time. If two edits were done at the same position,
 /// it considers them the same. I couldn't think of a better name.
 size_t EditStorage::getBytesFilledIn() const {
-    // TODO: make this better.
-    // A simple modification would be to remove count and just use found.size()
-    // But a better modification would be nice.
-    size_t count = 0;
-    std::vector<size_t> found;
-    size_t end = getCurrentEnd();
+    return filled.get().getCoveredBytes();
+}
 
-    for (size_t i = 0; i < end; i++) {
-        EditStorageItem item = edits.at(end - i - 1);
+bool EditStorage::isFilledIn (FilePosition pos) const {
+    return filled.get().contains(pos);
+}
 
-        bool should_continue = false;
-        for (const size_t index : found) {
-            if (index == item.pos) {
-                should_continue = true;
-                break;
-            }
+std::vector<EditRange> EditStorage::getFilledRanges (FilePosition pos, size_t size) const {
+    return filled.get().getRanges(pos, size);
+}
+
+const RangeSet& EditStorage::getFilled () const {
+    return filled.get();
+}
+
+const RangeSet& EditStorage::getTransformed () const {
+    return transformed.get();
+}
+
+bool EditStorage::hasTransforms () const {
+    return transformed.get().getCoveredBytes() != 0;
+}
+
+void EditStorage::addFilled (const EditStorageItem& item) {
+    RangeSet& target = item.transform.has_value() ? transformed.edit() : filled.edit();
+    EditRange span = item.getSpan();
+    item.forEachRunWithin(span.first, span.second, [&target] (FilePosition pos, size_t, size_t size) {
+        target.add(pos, size);
+    });
+}
+
+void EditStorage::removeFilled (const EditStorageItem& item) {
+    RangeSet& target = item.transform.has_value() ? transformed.edit() : filled.edit();
+    EditRange span = item.getSpan();
+    item.forEachRunWithin(span.first, span.second, [&target] (FilePosition pos, size_t, size_t size) {
+        target.remove(pos, size);
+    });
+}
+
+size_t EditStorage::getItemMemory (const EditStorageItem& item) {
+    return item.data.capacity() + (item.runs.capacity() * sizeof(EditRun));
+}
+
+size_t EditStorage::getMemoryUsage () const {
+    return edits.getMemoryUsage() + payload_memory + filled.get().getMemoryUsage();
+}
+
+size_t EditStorage::getSpilledBytes () const {
+    size_t count = 0;
+    for (const EditStorageItem& item : edits) {
+        if (item.spilled.has_value()) {
+            count += item.spilled.value().size;
         }
+    }
+    return count;
+}
+
+size_t EditStorage::getUnspilledBytes () const {
+    return unspilled_bytes;
+}
+
+// == Spilling ==
+
+void EditStorage::setSpillThreshold (size_t threshold) {
+    spill_threshold = threshold;
+}
+size_t EditStorage::getSpillThreshold () const {
+    return spill_threshold;
+}
 
-        if (should_continue) {
-            continue;
+/// Fills and transforms only store their pattern or key, so they're never spilled
+static bool isSpillable (const EditStorageItem& item) {
+    return !item.spilled.has_value() && !item.repeating && !item.transform.has_value() && !item.data.empty();
+}
+
+void EditStorage::addSpillable (size_t index) {
+    const EditStorageItem& item = edits[index];
+    if (isSpillable(item)) {
+        spillable.edit().insert(std::make_pair(item.data.size(), index));
+        unspilled_bytes += item.data.size();
+    }
+}
+
+void EditStorage::removeSpillable (size_t index) {
+    const EditStorageItem& item = edits[index];
+    if (isSpillable(item)) {
+        spillable.edit().erase(std::make_pair(item.data.size(), index));
+        unspilled_bytes -= item.data.size();
+    }
+}
+
+size_t EditStorage::spillItems (size_t min_size) {
+    size_t freed = 0;
+    const std::set<std::pair<size_t, size_t>>& candidates = spillable.get();
+    auto first = candidates.lower_bound(std::make_pair(std::max<size_t>(min_size, 1), size_t{0}));
+    if (first == candidates.end()) {
+        return 0;
+    }
+
+    if (!spill_store) {
+        spill_store = std::make_shared<SpillStore>();
+    }
+    std::vector<size_t> indices;
+    for (auto iter = first; iter != candidates.end(); iter++) {
+        indices.push_back(iter->second);
+    }
+    for (size_t i : indices) {
+        removeSpillable(i);
+        const EditStorageItem& item = edits[i];
+        // Items can be shared with snapshots, so it's replaced rather than changed. A snapshot that has the item
+        // keeps its data in memory.
+        EditStorageItem spilled(item.pos, Buffer());
+        spilled.spilled = spill_store->write(item.data.data(), item.data.size());
+        spilled.runs = item.runs;
+        spilled.written_size = item.written_size;
+        spilled.transaction_index = item.transaction_index;
+
+        freed += item.data.capacity();
+        payload_memory -= item.data.capacity();
+        edits.set(i, std::move(spilled));
+    }
+    return freed;
+}
+
+void EditStorage::readItemData (const EditStorageItem& item, size_t offset, size_t size, Byte* output) const {
+    readItemData(item, spill_store.get(), offset, size, output);
+}
+
+void EditStorage::readItemData (const EditStorageItem& item, const SpillStore* store, size_t offset, size_t size, Byte* output) {
+    if (item.repeating) {
+        // One repeat of the pattern, lined up with offset
+        size_t pattern_size = item.data.size();
+        size_t start = offset % pattern_size;
+        size_t done = std::min(pattern_size - start, size);
+        std::memcpy(output, item.data.data() + start, done);
+        if (done < size) {
+            size_t amount = std::min(start, size - done);
+            std::memcpy(output + done, item.data.data(), amount);
+            done += amount;
         }
 
-        for (size_t j = 0; j < item.data.size(); j++) {
-            found.push_back(item.pos + j);
+        // done is now a whole number of repeats, so what's been written can be copied after itself
+        while (done < size) {
+            size_t amount = std::min(done, size - done);
+            std::memcpy(output + done, output, amount);
+            done += amount;
         }
-        count += item.data.size();
+    } else if (item.spilled.has_value()) {
+        store->read(item.spilled.value(), offset, size, output);
+    } else {
+        std::memcpy(output, item.data.data() + offset, size);
     }
-
-    return count;
 }
 
 // == Editing ==
@@ -124,19 +291,162 @@ void EditStorage::edit (FilePosition pos, Byte value) {
 /// Sets multiple bytes, starting at the position. (data[0] is at pos, data[1] is at pos+1, data[n] is at pos+n)
 /// If there is future edits (aka you've undone, and moved back), then this will erase those and replace it with this edit
 void EditStorage::editMultiple (FilePosition pos, Buffer data) {
+    pushItem(EditStorageItem(pos, std::move(data)));
+}
+
+void EditStorage::fill (FilePosition pos, size_t size, Buffer pattern) {
+    if (pattern.empty()) {
+        throw std::invalid_argument("Can't fill with an empty pattern.");
+    }
+    if (size == 0) {
+        return;
+    }
+
+    // Past the range there's no need for more than it covers
+    if (pattern.size() > size) {
+        pattern.resize(size);
+    }
+    EditStorageItem item(pos, std::move(pattern));
+    item.repeating = true;
+    item.written_size = size;
+    pushItem(std::move(item));
+}
+
+void EditStorage::editEach (const std::vector<FilePosition>& positions, Buffer data) {
+    if (positions.empty() || data.empty()) {
+        return;
+    }
+
+    std::vector<EditRun> runs;
+    runs.reserve(positions.size());
+    for (FilePosition pos : positions) {
+        if (!runs.empty() && pos < runs.back().pos + data.size()) {
+            throw std::invalid_argument("Positions must be sorted and not overlap.");
+        }
+        runs.push_back(EditRun{ pos, 0, data.size() });
+    }
+
+    EditStorageItem item(positions.front(), std::move(data));
+    item.written_size = runs.size() * item.data.size();
+    item.runs = std::move(runs);
+    pushItem(std::move(item));
+}
+
+void EditStorage::transform (FilePosition pos, size_t size, TransformOp op, Buffer key) {
+    if (key.empty()) {
+        throw std::invalid_argument("Can't transform with an empty key.");
+    }
+    if (size == 0) {
+        return;
+    }
+
+    EditStorageItem item(pos, std::move(key));
+    item.transform = op;
+    item.written_size = size;
+    pushItem(std::move(item));
+}
+
+void EditStorage::pushItem (EditStorageItem item) {
     assert(current_limit == 0 || current_limit <= current_end);
 
     if (current_end.has_value()) {
-        while (edits.size() > current_end) {
-            edits.pop_back();
+        truncate(current_end.value());
+    }
+
+    size_t size = item.getSize();
+    if (transaction_start.has_value()) {
+        item.transaction_index = edits.size() - transaction_start.value();
+    }
+    edits.push_back(std::move(item));
+    payload_memory += getItemMemory(edits.back());
+    addFilled(edits.back());
+    addSpillable(edits.size() - 1);
+    if (edits.back().data.size() >= spill_threshold) {
+        spillItems(spill_threshold);
+    }
+
+    bytes_written += size;
+    bytes_written_alltime += size;
+}
+
+/// Removes every item from index onwards. Spilled data is left where it is, the space is reclaimed once everything
+/// is cleared.
+void EditStorage::truncate (size_t index) {
+    size_t end = getCurrentEnd();
+    while (edits.size() > index) {
+        if (edits.size() <= end) {
+            bytes_written -= edits.back().getSize();
+            removeFilled(edits.back());
         }
-        current_end = std::nullopt;
+        payload_memory -= getItemMemory(edits.back());
+        removeSpillable(edits.size() - 1);
+        edits.pop_back();
+    }
+    current_end = std::nullopt;
+}
+
+// == Transactions ==
+
+void EditStorage::beginTransaction () {
+    if (transaction_depth == 0) {
+        // Anything which was undone can't be redone in the middle of a transaction, so it is dropped now rather
+        // than by the first edit
+        if (current_end.has_value()) {
+            truncate(current_end.value());
+        }
+        transaction_start = getCurrentEnd();
+    }
+    transaction_depth++;
+}
+
+void EditStorage::commitTransaction () {
+    if (transaction_depth == 0) {
+        throw std::logic_error("Committing a transaction that was never started.");
+    }
+    transaction_depth--;
+    if (transaction_depth > 0) {
+        return;
+    }
+
+    // Edits that were undone within the transaction aren't part of it
+    if (current_end.has_value()) {
+        truncate(current_end.value());
+    }
+    // The items already know where they are in it, so they become one step as they are
+    transaction_start = std::nullopt;
+}
+
+void EditStorage::rollbackTransaction () {
+    if (transaction_depth == 0) {
+        throw std::logic_error("Rolling back a transaction that was never started.");
+    }
+
+    truncate(transaction_start.value());
+    transaction_depth = 0;
+    transaction_start = std::nullopt;
+}
+
+bool EditStorage::isInTransaction () const {
+    return transaction_depth > 0;
+}
+
+std::optional<EditRange> EditStorage::getTransactionRange () const {
+    if (!transaction_start.has_value() || transaction_start.value() >= edits.size()) {
+        return std::nullopt;
     }
 
-    edits.push_back(EditStorageItem(pos, data));
+    return getItemsSpan(transaction_start.value(), edits.size());
+}
 
-    bytes_written += data.size();
-    bytes_written_alltime += data.size();
+EditRange EditStorage::getItemsSpan (size_t first, size_t last) const {
+    FilePosition start = std::numeric_limits<FilePosition>::max();
+    FilePosition end = 0;
+    for (size_t i = first; i < last; i++) {
+        EditRange span = edits[i].getSpan();
+        start = std::min(start, span.first);
+        end = std::max(end, span.first + span.second);
+    }
+    return std::make_pair(start, end - start);
 }
 
 // == Reading ==
@@ -150,9 +460,11 @@ std::optional<Byte> EditStorage::readSingleAssignment (FilePosition pos) const {
     size_t end = getCurrentEnd();
 
     for (size_t i = 0; i < end; i++) {
-        EditStorageItem item = edits.at(end - i - 1);
-        if (pos == item.pos && item.data.size() == 1) {
-            return item.data[0];
+        const EditStorageItem& item = edits.at(end - i - 1);
+        if (!item.isGroup() && !item.transform.has_value() && pos == item.pos && item.getSize() == 1) {
+            Byte value;
+            readItemData(item, 0, 1, &value);
+            return value;
         }
     }
 
@@ -161,16 +473,38 @@ std::optional<Byte> EditStorage::readSingleAssignment (FilePosition pos) const {
 
 std::optional<Byte> EditStorage::read (FilePosition pos) const {
     size_t end = getCurrentEnd();
+    HERIX_METRIC_ADD(EditReads, 1);
 
-    for (size_t i = 0; i < end; i++) {
-        EditStorageItem item = edits.at(end - i - 1);
+    bool transformed_above = false;
+    std::optional<Byte> result;
+    edits.forEachInReverse(0, end, [this, pos, end, &transformed_above, &result] (size_t index, const EditRange& span, const EditStorageItem& item) {
+        if (pos < span.first || pos - span.first >= span.second) {
+            return true;
+        }
         // The buffer is of a variable size so it might be setting at the position we want, but not exactly on it
-        if (pos >= item.pos && pos < (item.pos + item.data.size())) {
-            size_t rpos = pos - item.pos;
-            return item.data.at(rpos);
+        std::optional<size_t> offset = item.findOffset(pos);
+        if (!offset.has_value()) {
+            return true;
+        }
+        if (item.transform.has_value()) {
+            transformed_above = true;
+            return true;
+        }
+
+        HERIX_METRIC_RECORD(EditProbeLength, end - index);
+        Byte value;
+        readItemData(item, offset.value(), 1, &value);
+        if (transformed_above) {
+            // Anything transformed since it was written is applied in order on top of it
+            applyFrom(index + 1, pos, 1, &value, nullptr, false);
         }
+        result = value;
+        return false;
+    });
+    if (!result.has_value()) {
+        HERIX_METRIC_RECORD(EditProbeLength, end);
     }
-    return std::nullopt;
+    return result;
 }
 
 /// Reads multiple bytes
@@ -187,36 +521,75 @@ std::vector<std::optional<Byte>> EditStorage::readMultiple (FilePosition pos, si
     return ret;
 }
 
+/// Writes the edits over output, which holds the bytes in [pos, pos+size). Edits are applied in history order
+/// so later edits overwrite earlier ones, and transforms change what's in output. If edited_mask is given, then every
+/// byte that was changed by an edit has its entry set to 1 (the rest are left as they were). Without
+/// mark_transformed only the bytes that were overwritten are, which are the ones that don't depend on the file.
+/// This walks the history once for the whole range, rather than once per byte like read.
+void EditStorage::applyTo (FilePosition pos, size_t size, Byte* output, Byte* edited_mask, bool mark_transformed) const {
+    applyFrom(0, pos, size, output, edited_mask, mark_transformed);
+}
+
+void EditStorage::applyFrom (size_t first, FilePosition pos, size_t size, Byte* output, Byte* edited_mask, bool mark_transformed) const {
+    size_t end = getCurrentEnd();
+
+    edits.forEachIn(first, end, [this, pos, size, output, edited_mask, mark_transformed] (const EditRange& span, const EditStorageItem& item) {
+        if (span.first >= pos + size || span.first + span.second <= pos) {
+            return;
+        }
+        item.forEachRunWithin(pos, size, [this, &item, pos, output, edited_mask, mark_transformed] (FilePosition overlap_start, size_t offset, size_t overlap_size) {
+            Byte* target = output + (overlap_start - pos);
+            if (item.transform.has_value()) {
+                applyTransform(item.transform.value(), item.data.data(), item.data.size(), offset, target, overlap_size);
+                if (!mark_transformed) {
+                    return;
+                }
+            } else {
+                readItemData(item, offset, overlap_size, target);
+            }
+            if (edited_mask != nullptr) {
+                std::memset(edited_mask + (overlap_start - pos), 1, overlap_size);
+            }
+        });
+    });
+}
+
 
 // == Undoing/Redoing ==
 
-/// Undoes the 'latest' edit at our point in history. If it was a single byte written then it undoes that, if it was a group, then it undoes the entire group.
-/// Returns the pair of FilePosition and Buffer that was stored
+/// Undoes the 'latest' edit at our point in history. If it was a single byte written then it undoes that, if it was a
+/// committed transaction, then it undoes every item of it.
+/// Returns the items that were undone, in history order.
 /// Do note that there is an inbuilt redo, so you don't need to store it for your own redo.
-std::optional<EditStorageItem> EditStorage::undoR () {
-    size_t end = EditStorage::getCurrentEnd();
-
-    if (canUndo()) {
-        current_end = std::make_optional(end - 1);
-        EditStorageItem const& item = edits.at(end-1);
-        bytes_written -= item.data.size();
-        return edits.at(end-1);
-    } else {
-        return std::nullopt;
+std::vector<EditStorageItem> EditStorage::undoR () {
+    std::vector<EditStorageItem> items;
+    if (!canUndo()) {
+        return items;
+    }
+
+    size_t end = getCurrentEnd();
+    size_t first = end - getUndoCount();
+    current_end = std::make_optional(first);
+    for (size_t i = first; i < end; i++) {
+        const EditStorageItem& item = edits.at(i);
+        bytes_written -= item.getSize();
+        removeFilled(item);
+        items.push_back(item);
     }
+    return items;
 }
 
 std::optional<size_t> EditStorage::undoP () {
-    std::optional<EditStorageItem> item = undoR();
+    std::vector<EditStorageItem> items = undoR();
 
-    if (item.has_value()) {
-        return std::make_optional(item.value().pos);
+    if (!items.empty()) {
+        return std::make_optional(items.front().pos);
     } else {
         return std::nullopt;
     }
 }
 
-/// Undoes the latest edit call. If it was a single byte written then it undoes that, if it was a group, then it undoes the entire group.
+/// Undoes the latest edit call. If it was a single byte written then it undoes that, if it was a transaction, then it undoes all of it.
 void EditStorage::undo () {
     // Just call it and discard the return.
     undoR();
@@ -224,38 +597,74 @@ void EditStorage::undo () {
 
 bool EditStorage::canUndo () const {
     size_t end = getCurrentEnd();
-    return end != 0 && end > current_limit;
+    return end != 0 && end > current_limit && end > transaction_start.value_or(0);
+}
+
+size_t EditStorage::getUndoCount () const {
+    size_t end = getCurrentEnd();
+    // In an open transaction its edits are undone one at a time
+    if (transaction_start.has_value() && end > transaction_start.value()) {
+        return 1;
+    }
+    return edits.at(end - 1).transaction_index + 1;
 }
 
-// Redo and return Position and values stored their
-std::optional<EditStorageItem> EditStorage::redoR () {
+size_t EditStorage::getRedoCount () const {
     size_t end = getCurrentEnd();
+    if (transaction_start.has_value()) {
+        return 1;
+    }
+    size_t count = 1;
+    while (end + count < edits.size() && edits.at(end + count).transaction_index != 0) {
+        count++;
+    }
+    return count;
+}
 
-    if (canRedo()) {
-        if ((end+1) == edits.size()) {
-            // Reset it back to nullopt if we go to the end.
-            // If we didn't do this, then why not just track the value constantly?
-            // I mean that's a possiblity, but we don't.
-            current_end = std::nullopt;
-        } else {
-            current_end = std::make_optional(end + 1);
-        }
+/// The range which would be changed by undoing, without undoing it
+std::optional<EditRange> EditStorage::getUndoRange () const {
+    if (!canUndo()) {
+        return std::nullopt;
+    }
+
+    size_t end = getCurrentEnd();
+    return getItemsSpan(end - getUndoCount(), end);
+}
 
-        // Since end is at the *end* of the current data, this will return the one we redo
-        EditStorageItem item = edits.at(end);
-        bytes_written += item.data.size();
-        return std::make_optional(item);
+// Redo and return the items stored there
+std::vector<EditStorageItem> EditStorage::redoR () {
+    std::vector<EditStorageItem> items;
+    if (!canRedo()) {
+        return items;
+    }
+
+    size_t end = getCurrentEnd();
+    size_t last = end + getRedoCount();
+    if (last == edits.size()) {
+        // Reset it back to nullopt if we go to the end.
+        // If we didn't do this, then why not just track the value constantly?
+        // I mean that's a possiblity, but we don't.
+        current_end = std::nullopt;
     } else {
-        return std::nullopt;
+        current_end = std::make_optional(last);
+    }
+
+    // Since end is at the *end* of the current data, these are the ones we redo
+    for (size_t i = end; i < last; i++) {
+        const EditStorageItem& item = edits.at(i);
+        bytes_written += item.getSize();
+        addFilled(item);
+        items.push_back(item);
     }
+    return items;
 }
 
 // Redo and return position
 std::optional<size_t> EditStorage::redoP () {
-    std::optional<EditStorageItem> item = redoR();
+    std::vector<EditStorageItem> items = redoR();
 
-    if (item.has_value()) {
-        return std::make_optional(item.value().pos);
+    if (!items.empty()) {
+        return std::make_optional(items.front().pos);
     } else {
         return std::nullopt;
     }
@@ -271,6 +680,41 @@ bool EditStorage::canRedo () const {
     return end < edits.size();
 }
 
+/// The range which would be changed by redoing, without redoing it
+std::optional<EditRange> EditStorage::getRedoRange () const {
+    if (!canRedo()) {
+        return std::nullopt;
+    }
+
+    size_t end = getCurrentEnd();
+    return getItemsSpan(end, end + getRedoCount());
+}
+
+// == Snapshots ==
+
+std::shared_ptr<const EditStorage> EditStorage::snapshot () const {
+    if (isInTransaction()) {
+        throw std::logic_error("Can't take a snapshot of the edits in a transaction.");
+    }
+    return std::make_shared<const EditStorage>(*this);
+}
+
+void EditStorage::restore (const EditStorage& snapshot) {
+    if (isInTransaction() || snapshot.isInTransaction()) {
+        throw std::logic_error("Can't restore a snapshot of the edits in a transaction.");
+    }
+
+    unsigned long alltime = bytes_written_alltime;
+    size_t threshold = spill_threshold;
+    *this = snapshot;
+    bytes_written_alltime = alltime;
+    spill_threshold = threshold;
+}
+
+size_t EditStorage::getSharedPrefix (const EditStorage& other) const {
+    return std::min({ edits.getSharedPrefix(other.edits), getCurrentEnd(), other.getCurrentEnd() });
+}
+
 void EditStorage::clear () noexcept {
     bytes_written_alltime = 0;
     bytes_written = 0;
@@ -284,6 +728,15 @@ void EditStorage::clearNotStats () noexcept {
     current_limit = 0;
 
     edits.clear();
+    payload_memory = 0;
+    filled = CopyOnWrite<RangeSet>();
+    transformed = CopyOnWrite<RangeSet>();
+    spill_store.reset();
+    spillable = CopyOnWrite<std::set<std::pair<size_t, size_t>>>();
+    unspilled_bytes = 0;
+
+    transaction_start = std::nullopt;
+    transaction_depth = 0;
 }
 
 
@@ -329,8 +782,8 @@ void HerixLib::test_editstorage () {
     assert(e.readMultiple(0, 0).size() == 0);
 
     // Test undo/redo
-    assert(e.undoR() == std::nullopt);
-    assert(e.redoR() == std::nullopt);
+    assert(e.undoR().empty());
+    assert(e.redoR().empty());
     assert(e.undoP() == std::nullopt);
     assert(e.redoP() == std::nullopt);
 
@@ -435,11 +888,11 @@ void HerixLib::test_editstorage () {
 
 
     // = Test undo
-    std::optional<EditStorageItem> u1 = e.undoR();
-    assert(u1.has_value());
-    assert(u1.value().pos == 2);
-    assert(u1.value().data.size() == 1);
-    assert(u1.value().data.at(0) == 6);
+    std::vector<EditStorageItem> u1 = e.undoR();
+    assert(u1.size() == 1);
+    assert(u1.front().pos == 2);
+    assert(u1.front().data.size() == 1);
+    assert(u1.front().data.at(0) == 6);
 
     // test reading
     std::vector<std::optional<Byte>> readm4 = e.readMultiple(0, 3);
@@ -472,11 +925,11 @@ void HerixLib::test_editstorage () {
 
     // Undo again
 
-    std::optional<EditStorageItem> u2 = e.undoR();
-    assert(u2.has_value());
-    assert(u2.value().pos == 0);
-    assert(u2.value().data.size() == 1);
-    assert(u2.value().data.at(0) == 9);
+    std::vector<EditStorageItem> u2 = e.undoR();
+    assert(u2.size() == 1);
+    assert(u2.front().pos == 0);
+    assert(u2.front().data.size() == 1);
+    assert(u2.front().data.at(0) == 9);
 
     // test reading
     std::vector<std::optional<Byte>> readm5 = e.readMultiple(0, 3);
@@ -509,11 +962,11 @@ void HerixLib::test_editstorage () {
 
     // Undo again
 
-    std::optional<EditStorageItem> u3 = e.undoR();
-    assert(u3.has_value());
-    assert(u3.value().pos == 0);
-    assert(u3.value().data.size() == 1);
-    assert(u3.value().data.at(0) == 4);
+    std::vector<EditStorageItem> u3 = e.undoR();
+    assert(u3.size() == 1);
+    assert(u3.front().pos == 0);
+    assert(u3.front().data.size() == 1);
+    assert(u3.front().data.at(0) == 4);
 
     // test reading
     std::vector<std::optional<Byte>> readm6 = e.readMultiple(0, 3);
@@ -544,14 +997,14 @@ void HerixLib::test_editstorage () {
     assert(e.getBytesFilledIn() == 0);
 
     // Check that undo doesn't do anything
-    assert(!e.undoR().has_value());
+    assert(e.undoR().empty());
 
     // = Redo
-    std::optional<EditStorageItem> r1 = e.redoR();
-    assert(r1.has_value());
-    assert(r1.value().pos == 0);
-    assert(r1.value().data.size() == 1);
-    assert(r1.value().data.at(0) == 4);
+    std::vector<EditStorageItem> r1 = e.redoR();
+    assert(r1.size() == 1);
+    assert(r1.front().pos == 0);
+    assert(r1.front().data.size() == 1);
+    assert(r1.front().data.at(0) == 4);
 
     // test reading
     std::vector<std::optional<Byte>> readm7 = e.readMultiple(0, 3);
@@ -583,11 +1036,11 @@ void HerixLib::test_editstorage () {
     assert(e.getBytesFilledIn() == 1);
 
     // = Redo again
-    std::optional<EditStorageItem> r2 = e.redoR();
-    assert(r2.has_value());
-    assert(r2.value().pos == 0);
-    assert(r2.value().data.size() == 1);
-    assert(r2.value().data.at(0) == 9);
+    std::vector<EditStorageItem> r2 = e.redoR();
+    assert(r2.size() == 1);
+    assert(r2.front().pos == 0);
+    assert(r2.front().data.size() == 1);
+    assert(r2.front().data.at(0) == 9);
 
     // test reading
     std::vector<std::optional<Byte>> readm8 = e.readMultiple(0, 3);
@@ -619,11 +1072,11 @@ void HerixLib::test_editstorage () {
     assert(e.getBytesFilledIn() == 1);
 
     // = Redo again
-    std::optional<EditStorageItem> r3 = e.redoR();
-    assert(r3.has_value());
-    assert(r3.value().pos == 2);
-    assert(r3.value().data.size() == 1);
-    assert(r3.value().data.at(0) == 6);
+    std::vector<EditStorageItem> r3 = e.redoR();
+    assert(r3.size() == 1);
+    assert(r3.front().pos == 2);
+    assert(r3.front().data.size() == 1);
+    assert(r3.front().data.at(0) == 6);
 
     // test reading
     std::vector<std::optional<Byte>> readm9 = e.readMultiple(0, 3);
@@ -654,6 +1107,280 @@ void HerixLib::test_editstorage () {
 
     // Test filled in bytes
     assert(e.getBytesFilledIn() == 2);
+
+    // = Applying edits over a range
+    Buffer applied = { 20, 21, 22, 23 };
+    Buffer applied_mask(4, 0);
+    e.applyTo(0, 4, applied.data(), applied_mask.data());
+    assert((applied == Buffer{ 9, 21, 6, 23 }));
+    assert((applied_mask == Buffer{ 1, 0, 1, 0 }));
+
+    // Only part of the range
+    Buffer applied_offset = { 30, 31 };
+    e.applyTo(1, 2, applied_offset.data());
+    assert((applied_offset == Buffer{ 30, 6 }));
+
+    // = Spilling large edits out of memory
+    EditStorage spill;
+    spill.setSpillThreshold(1024);
+    Buffer large(4096);
+    for (size_t i = 0; i < large.size(); i++) {
+        large[i] = static_cast<Byte>(i);
+    }
+    spill.editMultiple(100, large);
+    spill.editMultiple(200, Buffer{ 1, 2 });
+    assert(spill.edits.at(0).spilled.has_value());
+    assert(spill.edits.at(0).data.empty());
+    assert(!spill.edits.at(1).spilled.has_value());
+    assert(spill.getSpilledBytes() == 4096);
+    assert(spill.getBytesStored() == 4098);
+    assert(spill.getMemoryUsage() < 1024);
+
+    assert(spill.read(100).value() == 0);
+    assert(spill.read(100 + 255).value() == 255);
+    assert(spill.read(200).value() == 1);
+    assert(spill.read(100 + 4095).value() == static_cast<Byte>(4095));
+    assert(!spill.read(100 + 4096).has_value());
+
+    Buffer spill_applied(300, 0);
+    spill.applyTo(0, 300, spill_applied.data());
+    assert(spill_applied[99] == 0 && spill_applied[150] == 50 && spill_applied[200] == 1 && spill_applied[201] == 2 && spill_applied[202] == 102);
+
+    // Small items can be spilled later, such as under memory pressure
+    assert(spill.getUnspilledBytes() == 2);
+    assert(spill.spillItems(1) >= 2);
+    assert(spill.read(201).value() == 2);
+    assert(spill.getSpilledBytes() == 4098);
+    assert(spill.getUnspilledBytes() == 0);
+    assert(spill.spillItems(1) == 0);
+
+    // Only the items large enough are spilled, and undone items that are dropped stop being spillable
+    for (size_t i = 0; i < 1000; i++) {
+        spill.edit(i, static_cast<Byte>(i));
+    }
+    spill.editMultiple(5000, Buffer(600, 7));
+    assert(spill.getUnspilledBytes() == 1600);
+    spill.undo();
+    spill.edit(0, 1);
+    assert(spill.getUnspilledBytes() == 1001);
+    spill.editMultiple(6000, Buffer(600, 8));
+    assert(spill.spillItems(500) >= 600);
+    assert(spill.getUnspilledBytes() == 1001);
+    assert(spill.read(6599).value() == 8 && !spill.read(5000).has_value());
+    spill.clear();
+    assert(spill.getUnspilledBytes() == 0);
+
+    // = Transactions
+    EditStorage t;
+    t.edit(0, 1);
+    t.beginTransaction();
+    // Scattered, in no particular order, with some overlapping
+    for (size_t i = 0; i < 2000; i++) {
+        t.edit(((i * 7919) % 2000) * 3 + 10, static_cast<Byte>(i));
+    }
+    t.editMultiple(11, Buffer{ 0xAA, 0xBB });
+    t.edit(10, 0xCC);
+    // Nested transactions are part of the outer one
+    t.beginTransaction();
+    t.edit(7000, 5);
+    t.commitTransaction();
+    assert(t.isInTransaction());
+    assert(t.read(7000).value() == 5);
+    // Undo stops at the start of the transaction
+    size_t in_transaction = t.getEntryCount();
+    while (t.canUndo()) {
+        t.undo();
+    }
+    assert(t.getCurrentEnd() == 1);
+    while (t.canRedo()) {
+        t.redo();
+    }
+    assert(t.getEntryCount() == in_transaction);
+    t.commitTransaction();
+
+    assert(!t.isInTransaction());
+    // The items are kept as they were made, each knowing where it is in the transaction
+    assert(t.getEntryCount() == in_transaction);
+    assert(t.edits.at(1).transaction_index == 0);
+    assert(t.edits.at(in_transaction - 1).transaction_index == in_transaction - 2);
+    assert(t.getBytesStored() == 1 + 2004);
+    assert(t.getBytesWritten() == 1 + 2004);
+    assert(t.getUndoRange() == std::make_optional(std::make_pair<FilePosition, size_t>(10, 7000 - 10 + 1)));
+
+    auto check_transaction = [&t] () {
+        assert(t.read(10).value() == 0xCC);
+        assert(t.read(11).value() == 0xAA);
+        assert(t.read(12).value() == 0xBB);
+        assert(!t.read(14).has_value());
+        assert(t.read(7000).value() == 5);
+        for (size_t i = 1; i < 2000; i++) {
+            assert(t.read(((i * 7919) % 2000) * 3 + 10).value() == static_cast<Byte>(i));
+        }
+
+        Buffer range(10, 0);
+        Buffer range_mask(10, 0);
+        t.applyTo(8, 10, range.data(), range_mask.data());
+        assert((range_mask == Buffer{ 0, 0, 1, 1, 1, 1, 0, 0, 1, 0 }));
+        assert(range[2] == 0xCC && range[3] == 0xAA && range[4] == 0xBB && range[7] == 0);
+    };
+    check_transaction();
+
+    // One undo takes back every edit in it
+    t.undo();
+    assert(t.getCurrentEnd() == 1);
+    assert(t.read(0).value() == 1);
+    assert(!t.read(10).has_value());
+    assert(!t.read(7000).has_value());
+    t.redo();
+    check_transaction();
+
+    // Its items can be spilled like anything else
+    t.spillItems(1);
+    check_transaction();
+    t.undo();
+    assert(t.getCurrentEnd() == 1);
+    t.redo();
+    check_transaction();
+
+    // Rolling back
+    t.beginTransaction();
+    t.edit(0, 2);
+    t.edit(10, 3);
+    assert(t.getTransactionRange() == std::make_optional(std::make_pair<FilePosition, size_t>(0, 11)));
+    t.rollbackTransaction();
+    assert(!t.isInTransaction());
+    assert(t.getEntryCount() == in_transaction);
+    assert(t.read(0).value() == 1);
+    check_transaction();
+
+    // The edited ranges follow undo and redo
+    assert(t.getBytesFilledIn() == 1 + 2003);
+    assert(t.isFilledIn(13) && !t.isFilledIn(14));
+    assert((t.getFilledRanges(0, 20) == std::vector<EditRange>{ { 0, 1 }, { 10, 4 }, { 16, 1 }, { 19, 1 } }));
+    t.undo();
+    assert(t.getBytesFilledIn() == 1);
+    assert(!t.isFilledIn(13));
+    assert((t.getFilledRanges(0, 20) == std::vector<EditRange>{ { 0, 1 } }));
+    t.redo();
+    assert(t.getBytesFilledIn() == 1 + 2003);
+    t.edit(14, 1);
+    t.edit(14, 2);
+    assert(t.getBytesFilledIn() == 1 + 2004);
+    assert((t.getFilledRanges(12, 4) == std::vector<EditRange>{ { 12, 3 } }));
+    t.undo();
+    assert(t.isFilledIn(14));
+    t.undo();
+    assert(!t.isFilledIn(14));
+    // A new edit drops what was undone
+    t.edit(0, 3);
+    assert(t.getBytesFilledIn() == 1 + 2003);
+
+    // = Fills and repeated edits, which only store their pattern
+    EditStorage f;
+    f.fill(1000, 1024 * 1024 * 1024, Buffer{ 1, 2, 3, 4, 5 });
+    assert(f.getMemoryUsage() < 1024);
+    assert(f.getBytesFilledIn() == 1024 * 1024 * 1024);
+    assert(f.read(1000).value() == 1);
+    assert(f.read(1007).value() == 3);
+    assert(f.read(1000 + (1024 * 1024 * 1024) - 1).value() == static_cast<Byte>(((1024 * 1024 * 1024) - 1) % 5 + 1));
+    assert(!f.read(999).has_value());
+    Buffer fill_range(12, 0);
+    f.applyTo(1003, 12, fill_range.data());
+    assert((fill_range == Buffer{ 4, 5, 1, 2, 3, 4, 5, 1, 2, 3, 4, 5 }));
+    // A pattern longer than the range
+    f.fill(0, 2, Buffer{ 9, 8, 7 });
+    assert(f.read(1).value() == 8 && !f.read(2).has_value());
+
+    f.editEach({ 10, 20, 22 }, Buffer{ 6, 6 });
+    assert(f.read(10).value() == 6 && f.read(23).value() == 6 && !f.read(12).has_value());
+    assert(f.getBytesWritten() == (1024 * 1024 * 1024) + 2 + 6);
+    f.undo();
+    assert(!f.read(10).has_value());
+
+    bool threw = false;
+    try {
+        f.editEach({ 10, 11 }, Buffer{ 6, 6 });
+    } catch (std::invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+
+    // Fills in a transaction stay as small as they are outside of one, and are undone with it
+    size_t memory_before = f.getMemoryUsage();
+    f.beginTransaction();
+    f.edit(35, 3);
+    f.fill(0, 1024 * 1024 * 1024, Buffer{ 0 });
+    f.edit(36, 4);
+    f.commitTransaction();
+    assert(f.read(35).value() == 0 && f.read(36).value() == 4 && f.read(1000).value() == 0);
+    assert(f.getMemoryUsage() - memory_before < 1024);
+    assert((f.getUndoRange() == std::make_optional<EditRange>(0, 1024 * 1024 * 1024)));
+    f.undo();
+    assert(!f.read(35).has_value() && f.read(1000).value() == 1);
+    f.redo();
+    assert(f.read(35).value() == 0 && f.read(36).value() == 4);
+    // The edit after it is a step of its own
+    f.edit(37, 5);
+    f.undo();
+    assert(f.read(36).value() == 4);
+    f.undo();
+    assert(f.read(1000).value() == 1);
+
+    threw = false;
+    try {
+        t.commitTransaction();
+    } catch (std::logic_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    // = Snapshots
+    EditStorage s;
+    for (size_t i = 0; i < 1000; i++) {
+        s.edit(i * 2, static_cast<Byte>(i));
+    }
+    s.undo();
+    std::shared_ptr<const EditStorage> before = s.snapshot();
+    assert(s.getSharedPrefix(*before) == 999);
+
+    s.fill(0, 100, Buffer{ 0xFF });
+    s.edit(5000, 1);
+    s.transform(0, 10, TransformOp::Xor, Buffer{ 0x0F });
+    assert(s.read(2).value() == 0xF0 && s.read(50).value() == 0xFF && s.read(5000).value() == 1 && s.hasTransforms());
+    assert(s.getSharedPrefix(*before) == 999);
+    // The snapshot is as it was, undo history included
+    assert(before->read(2).value() == 1 && !before->read(5000).has_value() && !before->hasTransforms());
+    assert(before->getBytesFilledIn() == 999 && before->canRedo());
+    assert(before->getEntryCount() == 1000);
+
+    // Changing an item that's shared, such as by spilling it, leaves the snapshot's alone
+    s.spillItems(1);
+    assert(s.getSpilledBytes() != 0 && before->getSpilledBytes() == 0);
+    assert(s.getSharedPrefix(*before) == 0);
+    assert(s.read(51).value() == 0xFF && s.read(3).value() == 0xF0);
+
+    s.restore(*before);
+    assert(s.read(2).value() == 1 && !s.read(5000).has_value() && !s.hasTransforms());
+    assert(s.getBytesFilledIn() == 999);
+    assert(s.getBytesWritten() == 999);
+    assert(s.getBytesWrittenAllTime() == 1000 + 100 + 1 + 10);
+    s.redo();
+    assert(s.read(1998).value() == static_cast<Byte>(999));
+    // Restoring doesn't tie the two together, the snapshot still doesn't change
+    s.edit(2, 9);
+    assert(before->read(2).value() == 1 && !before->read(1998).has_value());
+    s.restore(*before);
+    assert(s.read(2).value() == 1);
+
+    threw = false;
+    s.beginTransaction();
+    try {
+        s.snapshot();
+    } catch (std::logic_error&) {
+        threw = true;
+    }
+    s.rollbackTransaction();
+    assert(threw);
 }
 
 
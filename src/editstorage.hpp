@@ -2,21 +2,79 @@
 #define FILE_SEEN_EDITSTORAGE
 
 #include "types.hpp"
+#include "spillstore.hpp"
+#include "rangeset.hpp"
+#include "transform.hpp"
+#include "persistent.hpp"
+#include <algorithm>
+#include <memory>
+#include <set>
 #include <vector>
 #include <optional>
+#include <utility>
 namespace HerixLib {
 
+/// One contiguous piece of a group item
+class EditRun {
+    public:
+    FilePosition pos;
+    /// Where its bytes start in the item's data
+    size_t offset;
+    size_t size;
+};
+
 class EditStorageItem {
     public:
     FilePosition pos;
+    /// Empty if the data has been spilled, use EditStorage::readItemData to get at it either way
     Buffer data;
+    /// Where the data is in the EditStorage's spill store, if it was moved out of memory
+    std::optional<SpillLocation> spilled;
+    /// Only set for a group (see EditStorage::editEach): sorted, non-overlapping runs, whose bytes are
+    /// in data at their offset. Runs can share their bytes, such as every match of a replace all. A plain item writes
+    /// all of data at pos.
+    std::vector<EditRun> runs;
+    /// A fill: data is a pattern which is repeated over [pos, pos+written_size). It is never spilled.
+    bool repeating = false;
+    /// A transform: data is the key, which op combines with the bytes already in [pos, pos+written_size) when
+    /// they're read. Unlike the other items it depends on what is underneath it. It is never spilled.
+    std::optional<TransformOp> transform;
+    /// For groups, fills and transforms, how many bytes are covered. This can be far more than data holds.
+    size_t written_size = 0;
+    /// Where this is among the items of the transaction it was made in, 0 for the first one or an item made outside
+    /// of one. Undo and redo step over the items of a committed transaction together.
+    size_t transaction_index = 0;
 
     EditStorageItem (FilePosition t_pos, Buffer t_data);
+
+    /// The amount of bytes this item writes
+    size_t getSize () const;
+    bool isGroup () const;
+    /// From the first byte written to the last. For a group this includes the gaps between the runs.
+    EditRange getSpan () const;
+    /// Where the byte at pos is in the data, if this item writes it. Groups are binary searched.
+    std::optional<size_t> findOffset (FilePosition pos) const;
+    /// Calls callback(run_pos, data_offset, size) for each piece written in [pos, pos+size), in order
+    template<typename Callback>
+    void forEachRunWithin (FilePosition pos, size_t size, Callback callback) const;
 };
 
+/// The span of each item is kept next to it in the PersistentVector, so looking through the history for the items
+/// over a position doesn't have to touch the ones that aren't
+template<>
+class PersistentSummary<EditStorageItem> {
+    public:
+    using Type = EditRange;
+    static EditRange make (const EditStorageItem& item) {
+        return item.getSpan();
+    }
+};
+
+/// Copying is O(1): the items are in a PersistentVector and the filled ranges are copied on write, so a copy (see
+/// snapshot) only takes memory for what changes after it.
 class EditStorage {
     public:
-    std::vector<EditStorageItem> edits;
+    PersistentVector<EditStorageItem> edits;
     // TODO: think about whether you should just store this as a size_t and update it.
     /// The current_end of data, used to keep track of history with undo/redo
     /// If it's nullopt then it's at the end of the vector
@@ -32,6 +90,51 @@ class EditStorage {
     // Updated by edit operations, undone when you undo an action
     // So this only includes in the past
     unsigned long bytes_written = 0;
+    /// Sum of the capacities of the stored items data, kept up to date by the edit operations
+    size_t payload_memory = 0;
+    /// Every byte written by the items in the past, kept up to date by edit, undo and redo
+    CopyOnWrite<RangeSet> filled;
+    /// Every byte covered by a transform in the past, which isn't in filled since it still needs the file's data
+    CopyOnWrite<RangeSet> transformed;
+
+    /// Items of at least this many bytes have their data moved out of memory into the spill store.
+    size_t spill_threshold = default_spill_threshold;
+    /// Holds the data of spilled items. Created once the first item is spilled.
+    /// It's shared since the data written into it never changes, so copies of this EditStorage can use it too.
+    std::shared_ptr<SpillStore> spill_store;
+    /// The items whose data is in memory and could be spilled, as (data size, index), so spilling only looks at the
+    /// items large enough rather than the whole history
+    CopyOnWrite<std::set<std::pair<size_t, size_t>>> spillable;
+    /// Sum of the data of the spillable items
+    size_t unspilled_bytes = 0;
+
+    static constexpr size_t default_spill_threshold = 16 * 1024 * 1024;
+
+    // == Transactions ==
+    /// Where the edits of the open transaction start, nullopt if there isn't one
+    std::optional<size_t> transaction_start = std::nullopt;
+    /// Transactions can be nested, only the outermost one is committed
+    size_t transaction_depth = 0;
+
+    /// The memory used by the item's data (and runs)
+    static size_t getItemMemory (const EditStorageItem& item);
+    /// How many items the next undo (or redo) steps over, which is every item of a committed transaction
+    size_t getUndoCount () const;
+    size_t getRedoCount () const;
+    /// The span covering the items [first, last)
+    EditRange getItemsSpan (size_t first, size_t last) const;
+    /// Removes the items from index onwards, updating the stats. Items before current end are counted as written.
+    void truncate (size_t index);
+    /// applyTo, for just the items from first on
+    void applyFrom (size_t first, FilePosition pos, size_t size, Byte* output, Byte* edited_mask, bool mark_transformed) const;
+    /// Adds a new item at the current end of history, dropping anything that was undone
+    void pushItem (EditStorageItem item);
+    /// Adds or removes the item at index from spillable, if it can be spilled
+    void addSpillable (size_t index);
+    void removeSpillable (size_t index);
+    /// Adds or removes the bytes the item covers from filled (or transformed)
+    void addFilled (const EditStorageItem& item);
+    void removeFilled (const EditStorageItem& item);
 
     EditStorage ();
 
@@ -57,6 +160,34 @@ class EditStorage {
 
     // The bytes filled in uniquely. Writes to the same position yield only 1
     size_t getBytesFilledIn () const;
+    /// If the byte at pos has been edited, without reading the edit
+    bool isFilledIn (FilePosition pos) const;
+    /// The edited ranges within [pos, pos+size), such as for highlighting the edited bytes in a view.
+    /// Bytes that were edited are reported even if the edit happened to write what was there already.
+    std::vector<EditRange> getFilledRanges (FilePosition pos, size_t size) const;
+    const RangeSet& getFilled () const;
+    /// The ranges covered by transforms, which change the bytes underneath them rather than overwriting them
+    const RangeSet& getTransformed () const;
+    bool hasTransforms () const;
+
+    /// Bytes of memory used, for the items and their data
+    size_t getMemoryUsage () const;
+    /// Bytes of item data that are in the spill store rather than memory
+    size_t getSpilledBytes () const;
+    /// Bytes of item data in memory that could be spilled, which is the most spillItems can free
+    size_t getUnspilledBytes () const;
+
+    // Spilling
+    void setSpillThreshold (size_t threshold);
+    size_t getSpillThreshold () const;
+    /// Moves the data of every item with at least min_size bytes into the spill store, such as when memory is
+    /// running low (see MemoryGovernor). Returns how many bytes of memory were freed.
+    size_t spillItems (size_t min_size);
+    /// Reads [offset, offset+size) of the item's data into output, whether it's in memory or spilled.
+    /// For a fill the offset is into the bytes written, and the pattern is generated for it.
+    void readItemData (const EditStorageItem& item, size_t offset, size_t size, Byte* output) const;
+    /// readItemData for an item whose data may be spilled into store, such as one kept after it was undone
+    static void readItemData (const EditStorageItem& item, const SpillStore* store, size_t offset, size_t size, Byte* output);
 
     // TODO: add function to return # possible undos
     // TODO: add function to return # possible redos
@@ -64,21 +195,64 @@ class EditStorage {
     // Editing
     void edit (FilePosition pos, Byte value);
     void editMultiple (FilePosition pos, Buffer data);
+    /// Writes pattern repeated over [pos, pos+size), storing just the pattern however large the range is.
+    /// The last repeat is cut short if size isn't a multiple of the pattern's size.
+    void fill (FilePosition pos, size_t size, Buffer pattern);
+    /// Writes data at each of positions, which must be sorted and at least data.size() apart, as a single item
+    /// which holds data only once.
+    void editEach (const std::vector<FilePosition>& positions, Buffer data);
+    /// Combines [pos, pos+size) with key repeated over it using op, whenever it's read. Only the key is stored, and
+    /// it applies to whatever is there at this point in history, file or earlier edits.
+    void transform (FilePosition pos, size_t size, TransformOp op, Buffer key);
 
     // Reading
     std::optional<Byte> readSingleAssignment (FilePosition pos) const;
+    /// The edited value at pos, or nullopt if it comes from the file. If it's transformed, then the transforms still
+    /// have to be applied to the file's byte, with applyTo.
     std::optional<Byte> read (FilePosition pos) const;
     std::vector<std::optional<Byte>> readMultiple (FilePosition pos, size_t size) const;
+    void applyTo (FilePosition pos, size_t size, Byte* output, Byte* edited_mask=nullptr, bool mark_transformed=true) const;
+
+    // Transactions
+    /// Starts grouping edits, until the matching commitTransaction. Undo can't go back past the start of it, and
+    /// anything that was undone before it can no longer be redone.
+    void beginTransaction ();
+    /// Makes the edits since beginTransaction into one undo step. The items are kept as they were made, so fills
+    /// and transforms stay as small as they are outside of a transaction.
+    void commitTransaction ();
+    /// Throws away every edit made since the outermost beginTransaction
+    void rollbackTransaction ();
+    bool isInTransaction () const;
+    /// The span of the edits in the open transaction, the range which rolling it back would change
+    std::optional<EditRange> getTransactionRange () const;
 
     // Undo / Redo
-    std::optional<EditStorageItem> undoR ();
+    /// Returns the items that were undone, in history order. That's more than one for a transaction, and none if
+    /// there was nothing to undo.
+    std::vector<EditStorageItem> undoR ();
     std::optional<size_t> undoP ();
     void undo ();
     bool canUndo () const;
-    std::optional<EditStorageItem> redoR ();
+    std::optional<EditRange> getUndoRange () const;
+    /// Returns the items that were redone, in history order
+    std::vector<EditStorageItem> redoR ();
     std::optional<size_t> redoP ();
     void redo ();
     bool canRedo () const;
+    std::optional<EditRange> getRedoRange () const;
+
+
+    // Snapshots
+    /// An O(1) copy of the edits as they are now, which shares the items with this until either changes. It never
+    /// changes itself, so it can be read on another thread (such as by a SequentialReader) while editing carries on.
+    /// Throws std::logic_error in a transaction.
+    std::shared_ptr<const EditStorage> snapshot () const;
+    /// Puts the edits (and undo history) back to how they were in snapshot, in O(1). The all time stats and spill
+    /// threshold are kept. Throws std::logic_error in a transaction.
+    void restore (const EditStorage& snapshot);
+    /// How many of the first items in the past are shared with other, which is a copy of this or something it was
+    /// copied from. Everything after them is what differs between the two.
+    size_t getSharedPrefix (const EditStorage& other) const;
 
 
 // == Other ==
@@ -91,6 +265,36 @@ class EditStorage {
 
 void test_editstorage();
 
+template<typename Callback>
+void EditStorageItem::forEachRunWithin (FilePosition range_pos, size_t range_size, Callback callback) const {
+    FilePosition range_end = range_pos + range_size;
+    if (!isGroup()) {
+        FilePosition end = pos + getSize();
+        if (pos < range_end && end > range_pos) {
+            FilePosition start = std::max(pos, range_pos);
+            callback(start, start - pos, std::min(end, range_end) - start);
+        }
+        return;
+    }
+
+    // The first run that could overlap is the one before the first starting past range_pos
+    auto iter = std::upper_bound(runs.begin(), runs.end(), range_pos, [] (FilePosition value, const EditRun& run) {
+        return value < run.pos;
+    });
+    if (iter != runs.begin()) {
+        iter--;
+    }
+
+    for (; iter != runs.end() && iter->pos < range_end; iter++) {
+        FilePosition end = iter->pos + iter->size;
+        if (end <= range_pos) {
+            continue;
+        }
+        FilePosition start = std::max(iter->pos, range_pos);
+        callback(start, iter->offset + (start - iter->pos), std::min(end, range_end) - start);
+    }
+}
+
 }
 
 #endif
@@ -0,0 +1,386 @@
+#include "filepool.hpp"
+#include <cassert>
+#include <cerrno>
+#include <iterator>
+#include <stdexcept>
+
+#ifdef DEBUG
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "herix.hpp"
+#include "sharedcache.hpp"
+#endif
+
+using namespace HerixLib;
+
+FilePool::Lease::Lease (FilePool& t_pool, PooledFileID t_id) : pool(t_pool), id(t_id) {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    handle = pool.acquire(id);
+}
+
+FilePool::Lease::~Lease () {
+    pool.release(id);
+}
+
+FilePool::FilePool (size_t t_max_open) : max_open(t_max_open) {}
+
+FilePool::~FilePool () {
+    for (std::pair<const PooledFileID, Entry>& file : files) {
+        if (file.second.handle != no_handle) {
+            closeFileHandle(file.second.handle);
+        }
+    }
+}
+
+FilePool& FilePool::getGlobal () {
+    static FilePool pool;
+    return pool;
+}
+
+FilePool::Handle FilePool::acquire (PooledFileID id) {
+    auto iter = files.find(id);
+    if (iter == files.end()) {
+        throw std::invalid_argument("Unknown pooled file.");
+    }
+    Entry& entry = iter->second;
+
+    if (entry.handle != no_handle) {
+        statistics.hits++;
+        order.splice(order.end(), order, entry.order);
+    } else {
+        // Room is made first, so that the limit holds while it's open
+        closeDownTo(max_open == 0 ? 0 : max_open - 1);
+        entry.handle = openFileHandle(entry.path, entry.writable);
+        if (entry.handle == no_handle && (errno == EMFILE || errno == ENFILE)) {
+            // Something else is using up the descriptors, so give back every one that can be
+            closeDownTo(0);
+            entry.handle = openFileHandle(entry.path, entry.writable);
+        }
+        if (entry.handle == no_handle) {
+            throw std::runtime_error("Failed in opening file.");
+        }
+
+        statistics.opens++;
+        if (entry.was_opened) {
+            statistics.reopens++;
+        }
+        entry.was_opened = true;
+        entry.order = order.insert(order.end(), id);
+    }
+
+    entry.users++;
+    return entry.handle;
+}
+
+void FilePool::release (PooledFileID id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = files.find(id);
+    assert(iter != files.end() && iter->second.users > 0);
+    iter->second.users--;
+    // Files that were in use while others opened can leave it over the limit
+    if (order.size() > max_open) {
+        closeDownTo(max_open);
+    }
+}
+
+void FilePool::closeEntry (Entry& entry) {
+    closeFileHandle(entry.handle);
+    entry.handle = no_handle;
+    order.erase(entry.order);
+}
+
+void FilePool::closeDownTo (size_t limit) {
+    auto iter = order.begin();
+    while (order.size() > limit && iter != order.end()) {
+        Entry& entry = files.at(*iter);
+        iter++;
+        if (entry.users == 0) {
+            closeEntry(entry);
+            statistics.evictions++;
+        }
+    }
+}
+
+PooledFileID FilePool::add (const std::filesystem::path& path, bool writable) {
+    std::lock_guard<std::mutex> lock(mutex);
+    PooledFileID id = f_count++;
+    Entry entry;
+    entry.path = path;
+    entry.writable = writable;
+    files.emplace(id, std::move(entry));
+
+    // Opened now, so a file that doesn't exist fails here rather than on the first read. It's likely to be read
+    // straight away, so it's left open.
+    try {
+        acquire(id);
+    } catch (...) {
+        files.erase(id);
+        throw;
+    }
+    files.at(id).users--;
+    return id;
+}
+
+void FilePool::remove (PooledFileID id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = files.find(id);
+    if (iter == files.end()) {
+        return;
+    }
+    assert(iter->second.users == 0);
+    if (iter->second.handle != no_handle) {
+        closeEntry(iter->second);
+    }
+    files.erase(iter);
+}
+
+size_t FilePool::read (PooledFileID id, AbsoluteFilePosition pos, size_t size, Byte* output) {
+    Lease lease(*this, id);
+#if !defined(__unix__) && !defined(__APPLE__)
+    std::lock_guard<std::mutex> io_lock(io_mutex);
+#endif
+    return readFileHandle(lease.handle, pos, size, output);
+}
+
+void FilePool::write (PooledFileID id, AbsoluteFilePosition pos, const Byte* data, size_t size) {
+    Lease lease(*this, id);
+#if !defined(__unix__) && !defined(__APPLE__)
+    std::lock_guard<std::mutex> io_lock(io_mutex);
+#endif
+    writeFileHandle(lease.handle, pos, data, size);
+}
+
+std::filesystem::path FilePool::getPath (PooledFileID id) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return files.at(id).path;
+}
+
+void FilePool::setMaxOpen (size_t t_max_open) {
+    std::lock_guard<std::mutex> lock(mutex);
+    max_open = t_max_open;
+    closeDownTo(max_open);
+}
+
+size_t FilePool::getMaxOpen () const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return max_open;
+}
+
+size_t FilePool::getOpenCount () const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return order.size();
+}
+
+void FilePool::closeUnused () {
+    std::lock_guard<std::mutex> lock(mutex);
+    closeDownTo(0);
+}
+
+FilePoolStatistics FilePool::getStatistics () const {
+    std::lock_guard<std::mutex> lock(mutex);
+    FilePoolStatistics result = statistics;
+    result.open_count = order.size();
+    result.file_count = files.size();
+    return result;
+}
+
+// == PooledFile ==
+
+PooledFile::PooledFile (const std::filesystem::path& path, bool t_writable, FilePool& t_pool) :
+    pool(t_pool), id(t_pool.add(path, t_writable)), writable(t_writable) {}
+
+PooledFile::~PooledFile () {
+    pool.remove(id);
+}
+
+FilePool& PooledFile::getPool () const {
+    return pool;
+}
+
+size_t PooledFile::getSize () const {
+    // The same as for a file opened normally, which doesn't need it to be open
+    return std::filesystem::file_size(getPath());
+}
+
+size_t PooledFile::read (AbsoluteFilePosition pos, size_t size, Byte* output) {
+    return pool.read(id, pos, size, output);
+}
+
+bool PooledFile::isWritable () const {
+    return writable;
+}
+
+void PooledFile::write (AbsoluteFilePosition pos, const Byte* data, size_t size) {
+    if (!writable) {
+        Backend::write(pos, data, size);
+    }
+    pool.write(id, pos, data, size);
+}
+
+bool PooledFile::isFileContents () const {
+    return true;
+}
+
+std::filesystem::path PooledFile::getPath () const {
+    return pool.getPath(id);
+}
+
+const char* PooledFile::getName () const {
+    return "pooled";
+}
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+void HerixLib::test_filepool () {
+    std::filesystem::path directory = getTestPath("herix_test_filepool");
+    std::filesystem::create_directories(directory);
+    const size_t file_count = 40;
+    const size_t file_size = 3000;
+    std::vector<std::filesystem::path> paths;
+    auto expected = [] (size_t file, size_t pos) {
+        return static_cast<Byte>((file * 31) + (pos * 7) + (pos >> 8));
+    };
+    for (size_t file = 0; file < file_count; file++) {
+        Buffer contents(file_size);
+        for (size_t pos = 0; pos < file_size; pos++) {
+            contents[pos] = expected(file, pos);
+        }
+        paths.push_back(writeTestFile("herix_test_filepool_" + std::to_string(file) + ".bin", contents));
+    }
+
+    // = Many more instances than open files
+    {
+        FilePool pool(4);
+        std::vector<std::unique_ptr<Herix>> instances;
+        for (size_t file = 0; file < file_count; file++) {
+            instances.push_back(std::make_unique<Herix>(true, std::make_pair(0, std::nullopt), 1024, 256));
+            instances.back()->loadPooledFile(paths[file], pool);
+            assert(pool.getOpenCount() <= 4);
+        }
+        assert(pool.getStatistics().file_count == file_count);
+        assert(instances[3]->getFileEnd() == file_size);
+        assert(instances[3]->getBackend()->isWritable());
+
+        for (size_t pass = 0; pass < 3; pass++) {
+            for (size_t file = 0; file < file_count; file++) {
+                for (size_t pos = pass; pos < file_size; pos += 97) {
+                    assert(instances[file]->read(pos).value() == expected(file, pos));
+                }
+                assert(pool.getOpenCount() <= 4);
+            }
+        }
+        assert(!instances[0]->read(file_size).has_value());
+
+        FilePoolStatistics statistics = pool.getStatistics();
+        assert(statistics.open_count <= 4);
+        assert(statistics.reopens > 0);
+        assert(statistics.evictions == statistics.opens - statistics.open_count);
+        assert(statistics.hits > 0);
+
+        // Saving writes through the pool, and the file stays pooled after a save as
+        instances[5]->edit(10, 0xAB);
+        instances[5]->saveHistoryDestructive();
+        pool.closeUnused();
+        assert(pool.getOpenCount() == 0);
+        assert(instances[5]->read(10).value() == 0xAB);
+        {
+            Herix plain(paths[5], false);
+            assert(plain.read(10).value() == 0xAB);
+            assert(plain.read(11).value() == expected(5, 11));
+        }
+
+        std::filesystem::path saved_path = directory / "saved.bin";
+        std::filesystem::remove(saved_path);
+        instances[6]->edit(0, 0xCD);
+        instances[6]->saveAsHistoryDestructive(saved_path.string());
+        assert(dynamic_cast<PooledFile*>(instances[6]->getBackend()) != nullptr);
+        assert(instances[6]->read(0).value() == 0xCD);
+        assert(instances[6]->read(1).value() == expected(6, 1));
+
+        // Closing the instance takes it out of the pool
+        instances[7]->closeFile();
+        assert(pool.getStatistics().file_count == file_count - 1);
+        instances.clear();
+        assert(pool.getStatistics().file_count == 0);
+        assert(pool.getOpenCount() == 0);
+    }
+
+    // = Reading on many threads through fewer open files than there are threads
+    {
+        FilePool pool(2);
+        std::vector<std::unique_ptr<PooledFile>> files;
+        for (size_t file = 10; file < 18; file++) {
+            files.push_back(std::make_unique<PooledFile>(paths[file], false, pool));
+        }
+        assert(!files.front()->isWritable());
+
+        std::vector<std::thread> threads;
+        for (size_t thread = 0; thread < 4; thread++) {
+            threads.emplace_back([&files, &expected, thread] () {
+                Buffer data(500);
+                for (size_t i = 0; i < 200; i++) {
+                    size_t index = (i + thread) % files.size();
+                    size_t pos = (i * 13) % file_size;
+                    size_t count = files[index]->read(pos, data.size(), data.data());
+                    assert(count == std::min(data.size(), file_size - pos));
+                    for (size_t j = 0; j < count; j++) {
+                        assert(data[j] == expected(10 + index, pos + j));
+                    }
+                }
+            });
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        assert(pool.getOpenCount() <= 2);
+
+        bool threw = false;
+        Byte value = 1;
+        try {
+            files.front()->write(0, &value, 1);
+        } catch (std::logic_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+
+    // = Files that can't be opened, and sharing chunks with instances that open the file normally
+    {
+        FilePool pool(2);
+        bool threw = false;
+        try {
+            PooledFile missing(directory / "missing.bin", false, pool);
+        } catch (std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+        assert(pool.getStatistics().file_count == 0);
+
+        SharedChunkCache cache(64 * 1024);
+        Herix plain(paths[20], false, std::make_pair(0, std::nullopt), 4096, 1024);
+        Herix pooled(false, std::make_pair(0, std::nullopt), 4096, 1024);
+        pooled.loadPooledFile(paths[20], pool);
+        plain.setSharedCache(&cache);
+        pooled.setSharedCache(&cache);
+        for (size_t pos = 0; pos < file_size; pos++) {
+            assert(plain.read(pos).value() == expected(20, pos));
+        }
+        SharedChunkCacheStatistics before = cache.getStatistics();
+        for (size_t pos = 0; pos < file_size; pos++) {
+            assert(pooled.read(pos).value() == expected(20, pos));
+        }
+        assert(cache.getStatistics().misses == before.misses);
+    }
+
+    for (const std::filesystem::path& path : paths) {
+        std::filesystem::remove(path);
+    }
+    std::filesystem::remove_all(directory);
+}
+
+#endif
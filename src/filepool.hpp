@@ -0,0 +1,153 @@
+#ifndef FILE_SEEN_FILEPOOL
+#define FILE_SEEN_FILEPOOL
+
+#include <cstdio>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include "types.hpp"
+#include "backend.hpp"
+
+namespace HerixLib {
+
+using PooledFileID = size_t;
+
+class FilePoolStatistics {
+    public:
+    /// Every time a file was opened, including the first
+    size_t opens = 0;
+    /// Opens of a file that the pool had closed to make room
+    size_t reopens = 0;
+    /// Files closed to stay under the limit
+    size_t evictions = 0;
+    /// Uses of a file that was already open
+    size_t hits = 0;
+    size_t open_count = 0;
+    size_t file_count = 0;
+};
+
+/// Shares a limited number of open files between many more files that are in use, so that a process can have far
+/// more Herix instances than ulimit -n allows (see PooledFile and Herix::loadPooledFile). Files are opened when
+/// they're used and closed again least recently used first once there are more than max_open, which only the files
+/// in the middle of a read or write are exempt from. Reads and writes are positional (pread, pwrite), so any
+/// number of threads can use the same file at once. Thread safe.
+class FilePool {
+    protected:
+    using Handle = FileHandle;
+    static constexpr Handle no_handle = no_file_handle;
+
+    class Entry {
+        public:
+        std::filesystem::path path;
+        bool writable;
+        Handle handle = no_handle;
+        /// Reads and writes in progress, which keep it open
+        size_t users = 0;
+        bool was_opened = false;
+        /// Where it is in order, while it's open
+        std::list<PooledFileID>::iterator order;
+    };
+
+    /// Holds a file open for as long as it's alive
+    class Lease {
+        protected:
+        FilePool& pool;
+        PooledFileID id;
+
+        public:
+        Handle handle;
+
+        Lease (FilePool& t_pool, PooledFileID t_id);
+        ~Lease ();
+        Lease (const Lease&) = delete;
+        Lease& operator= (const Lease&) = delete;
+    };
+
+    mutable std::mutex mutex;
+#if !defined(__unix__) && !defined(__APPLE__)
+    /// Without positional reads, a seek and a read have to happen together
+    std::mutex io_mutex;
+#endif
+    size_t max_open;
+    PooledFileID f_count = 0;
+    std::unordered_map<PooledFileID, Entry> files;
+    /// The open files, least recently used first
+    std::list<PooledFileID> order;
+    FilePoolStatistics statistics;
+
+    /// Opens the file if it isn't already, and marks it as in use. Must hold the mutex.
+    Handle acquire (PooledFileID id);
+    void release (PooledFileID id);
+    /// Must hold the mutex
+    void closeEntry (Entry& entry);
+    /// Closes the least recently used files that aren't in use until there are at most limit open. Must hold the mutex.
+    void closeDownTo (size_t limit);
+
+    public:
+    static constexpr size_t default_max_open = 256;
+
+    explicit FilePool (size_t t_max_open=default_max_open);
+    ~FilePool ();
+
+    FilePool (const FilePool&) = delete;
+    FilePool& operator= (const FilePool&) = delete;
+
+    /// One pool for the whole process, which PooledFile uses unless it's given another
+    static FilePool& getGlobal ();
+
+    /// Adds path to the pool, opening it to check that it can be. Throws std::runtime_error if it can't.
+    PooledFileID add (const std::filesystem::path& path, bool writable);
+    /// Closes the file and forgets it
+    void remove (PooledFileID id);
+
+    /// Reads up to size bytes at pos into output. Returns how many were read, which is less than size only at the end.
+    size_t read (PooledFileID id, AbsoluteFilePosition pos, size_t size, Byte* output);
+    /// Throws std::runtime_error if it couldn't all be written
+    void write (PooledFileID id, AbsoluteFilePosition pos, const Byte* data, size_t size);
+    std::filesystem::path getPath (PooledFileID id) const;
+
+    /// Closes files straight away if there are now more than max_open
+    void setMaxOpen (size_t t_max_open);
+    size_t getMaxOpen () const;
+    size_t getOpenCount () const;
+    /// Closes every file that isn't in the middle of being used, such as before a long idle period
+    void closeUnused ();
+    FilePoolStatistics getStatistics () const;
+};
+
+/// A file read and written through a FilePool, so that it only has a descriptor open while it's being used. The
+/// contents are the file as it is, so chunks are shared (see SharedChunkCache) with instances that open it normally.
+/// The pool must outlive it.
+class PooledFile : public Backend {
+    protected:
+    FilePool& pool;
+    PooledFileID id;
+    bool writable;
+
+    public:
+    /// Throws std::runtime_error if the file can't be opened
+    PooledFile (const std::filesystem::path& path, bool t_writable=false, FilePool& t_pool=FilePool::getGlobal());
+    ~PooledFile ();
+
+    PooledFile (const PooledFile&) = delete;
+    PooledFile& operator= (const PooledFile&) = delete;
+
+    FilePool& getPool () const;
+
+    size_t getSize () const override;
+    size_t read (AbsoluteFilePosition pos, size_t size, Byte* output) override;
+    bool isWritable () const override;
+    void write (AbsoluteFilePosition pos, const Byte* data, size_t size) override;
+    bool isFileContents () const override;
+
+    std::filesystem::path getPath () const override;
+    const char* getName () const override;
+};
+
+void test_filepool ();
+
+}
+
+#endif
@@ -1,11 +1,14 @@
 #include <cassert>
+#include <cstring>
 #include <limits>
 
 #include <iostream>
 #include <algorithm>
-#include <deque>
+#include <type_traits>
 
 #include "herix.hpp"
+#include "sequentialreader.hpp"
+#include "metrics.hpp"
 
 using namespace HerixLib;
 
@@ -20,23 +23,89 @@ std::chrono::milliseconds getMillisecondsSinceEpoch () {
     );
 }
 
+/// backend as a T, or null if it isn't one. Instances whose BackendType can't be a T don't need the cast at all.
+template<typename T, typename BackendType>
+static T* backendAs (BackendType* backend) {
+    if constexpr (std::is_base_of_v<BackendType, T>) {
+        return dynamic_cast<T*>(backend);
+    } else {
+        (void)backend;
+        return nullptr;
+    }
+}
+
 
-UndoInfo::UndoInfo (std::optional<EditStorageItem> t_undone) {
-    undone = t_undone;
-    success = undone.has_value();
+UndoInfo::UndoInfo (std::vector<EditStorageItem> t_undone, std::shared_ptr<SpillStore> t_spill_store) {
+    undone = std::move(t_undone);
+    spill_store = std::move(t_spill_store);
+    success = !undone.empty();
 }
 
 bool UndoInfo::wasSuccess () {
     return success;
 }
 
+std::optional<EditRange> UndoInfo::getSpan () const {
+    if (undone.empty()) {
+        return std::nullopt;
+    }
+
+    FilePosition start = std::numeric_limits<FilePosition>::max();
+    FilePosition end = 0;
+    for (const EditStorageItem& item : undone) {
+        EditRange span = item.getSpan();
+        start = std::min(start, span.first);
+        end = std::max(end, span.first + span.second);
+    }
+    return std::make_pair(start, end - start);
+}
+
+bool UndoInfo::isTransform () const {
+    return std::any_of(undone.begin(), undone.end(), [] (const EditStorageItem& item) {
+        return item.transform.has_value();
+    });
+}
+
+size_t UndoInfo::readValues (FilePosition pos, size_t size, Byte* output, Byte* written_mask) const {
+    if (undone.empty()) {
+        throw std::logic_error("Nothing was undone to read the values of.");
+    }
+    if (isTransform()) {
+        throw std::logic_error("A transform doesn't write values of its own.");
+    }
+
+    // Items of a transaction can overwrite each other, so what's written is counted once at the end
+    Buffer written(size, 0);
+    for (const EditStorageItem& item : undone) {
+        item.forEachRunWithin(pos, size, [&] (FilePosition run_pos, size_t data_offset, size_t amount) {
+            EditStorage::readItemData(item, spill_store.get(), data_offset, amount, output + (run_pos - pos));
+            std::memset(written.data() + (run_pos - pos), 1, amount);
+        });
+    }
+    if (written_mask != nullptr) {
+        std::memcpy(written_mask, written.data(), size);
+    }
+    return static_cast<size_t>(std::count(written.begin(), written.end(), 1));
+}
+
 
-Chunk::Chunk (FilePositionStart t_start, ChunkSize t_size, Buffer t_data) : start(t_start), size(t_size), data(t_data) {}
-/// For construction which fills the vector in the struct
-Chunk::Chunk (FilePositionStart t_start, ChunkSize t_size) : start(t_start), size(t_size){}
+Chunk::Chunk (FilePositionStart t_start, ChunkSize t_size, Buffer t_data) : start(t_start), size(t_size), block_size(t_size) {
+    std::shared_ptr<const Buffer> data = std::make_shared<const Buffer>(std::move(t_data));
+    length = data->size();
+    // Points at the data, while keeping the buffer alive
+    block = std::shared_ptr<const Byte>(data, data->data());
+}
+/// For construction which fills the data in afterwards
+Chunk::Chunk (FilePositionStart t_start, ChunkSize t_size) : start(t_start), size(t_size), block_size(t_size) {}
+Chunk::Chunk (FilePositionStart t_start, ChunkSize t_size, ChunkSize t_block_size, std::shared_ptr<const Buffer> t_block, size_t t_offset, size_t t_length) :
+    Chunk(t_start, t_size, t_block_size, t_block ? std::shared_ptr<const Byte>(t_block, t_block->data()) : nullptr, t_offset, t_length) {
+    assert(t_block == nullptr || offset + length <= t_block->size());
+}
+Chunk::Chunk (FilePositionStart t_start, ChunkSize t_size, ChunkSize t_block_size, std::shared_ptr<const Byte> t_block, size_t t_offset, size_t t_length) :
+    start(t_start), size(t_size), block_size(t_block_size), block(std::move(t_block)), offset(t_offset), length(t_length) {}
 
 bool Chunk::isSizeEqual () const {
-    return size == data.size();
+    return size == length;
 }
 
 void Chunk::touch (size_t times) {
@@ -49,7 +118,11 @@ void Chunk::updateTime () {
 }
 
 size_t Chunk::getRealSize () const {
-    return data.size();
+    return length;
+}
+
+const Byte* Chunk::getData () const {
+    return block ? block.get() + offset : nullptr;
 }
 
 std::optional<std::chrono::milliseconds> Chunk::timeElapsed () {
@@ -61,25 +134,44 @@ std::optional<std::chrono::milliseconds> Chunk::timeElapsed () {
 }
 
 
-Herix::Herix (std::filesystem::path t_filename, bool t_allow_writing, std::pair<AbsoluteFilePosition, std::optional<AbsoluteFilePosition>> read_pos, ChunkSize t_max_chunk_memory, ChunkSize t_chunk_size) :
-    max_chunk_memory(t_max_chunk_memory), chunk_size(t_chunk_size), start_position(read_pos.first), end_position(read_pos.second), allow_writing(t_allow_writing) {
+template<typename Alignment, typename BackendType>
+BasicHerix<Alignment, BackendType>::BasicHerix (std::filesystem::path t_filename, bool t_allow_writing, std::pair<AbsoluteFilePosition, std::optional<AbsoluteFilePosition>> read_pos, ChunkSize t_max_chunk_memory, ChunkSize t_chunk_size) :
+    max_chunk_memory(t_max_chunk_memory), chunk_size(t_chunk_size), max_extent_size(t_chunk_size), start_position(read_pos.first), end_position(read_pos.second), allow_writing(t_allow_writing) {
+    checkChunkSize();
     loadFile(t_filename);
 }
-Herix::Herix (bool t_allow_writing, std::pair<AbsoluteFilePosition, std::optional<AbsoluteFilePosition>> read_pos, ChunkSize t_max_chunk_memory, ChunkSize t_chunk_size) :
-    max_chunk_memory(t_max_chunk_memory), chunk_size(t_chunk_size), start_position(read_pos.first), end_position(read_pos.second), allow_writing(t_allow_writing) {}
+template<typename Alignment, typename BackendType>
+BasicHerix<Alignment, BackendType>::BasicHerix (bool t_allow_writing, std::pair<AbsoluteFilePosition, std::optional<AbsoluteFilePosition>> read_pos, ChunkSize t_max_chunk_memory, ChunkSize t_chunk_size) :
+    max_chunk_memory(t_max_chunk_memory), chunk_size(t_chunk_size), max_extent_size(t_chunk_size), start_position(read_pos.first), end_position(read_pos.second), allow_writing(t_allow_writing) {
+    checkChunkSize();
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::checkChunkSize () const {
+    if (chunk_size == 0) {
+        throw std::invalid_argument("Chunk size can't be zero.");
+    }
+    if (Alignment::requires_power_of_two && (chunk_size & (chunk_size - 1)) != 0) {
+        throw std::invalid_argument("Chunk size must be a power of two.");
+    }
+}
 
-AbsoluteFilePosition Herix::getStartPosition () const noexcept {
+template<typename Alignment, typename BackendType>
+AbsoluteFilePosition BasicHerix<Alignment, BackendType>::getStartPosition () const noexcept {
     return start_position;
 }
-std::optional<AbsoluteFilePosition> Herix::getEndPosition () const noexcept {
+template<typename Alignment, typename BackendType>
+std::optional<AbsoluteFilePosition> BasicHerix<Alignment, BackendType>::getEndPosition () const noexcept {
     return end_position;
 }
 
-bool Herix::hasFile () const {
-    return file.is_open();
+template<typename Alignment, typename BackendType>
+bool BasicHerix<Alignment, BackendType>::hasFile () const {
+    return backend != nullptr;
 }
 
-void Herix::loadFile (std::filesystem::path t_filename) {
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::loadFile (std::filesystem::path t_filename) {
     // We have a file. Close it up.
     if (hasFile()) {
         closeFile();
@@ -88,51 +180,107 @@ void Herix::loadFile (std::filesystem::path t_filename) {
     filename = t_filename;
 
     openFile(false);
-}
-// Does not currently use swapping, but it's there if we do strange things
-void Herix::openFile (bool) {
-    std::ios_base::openmode mode = std::ios_base::in | std::ios_base::binary;
-    if (allow_writing) {
-        mode |= std::ios_base::out;
-    }
 
-    file.open(filename, mode);
+    notifyChange(0, std::numeric_limits<size_t>::max());
+}
 
-    if (file.fail()) {
-        // TODO: make an errortype for this
-        throw std::runtime_error("Failed in opening file.");
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::loadCompressedFile (std::filesystem::path t_filename, const CompressedFileOptions& options) {
+    if constexpr (std::is_base_of_v<BackendType, CompressedFile>) {
+        // Opened first, so a file that can't be read leaves the current one as it is
+        loadBackend(CompressedFile::open(t_filename, options));
+    } else {
+        (void)t_filename;
+        (void)options;
+        throw std::logic_error("This instance can't hold a compressed file.");
     }
-
-    assert(file.is_open());
-
-    file.unsetf(std::ios::skipws);
 }
+template<typename Alignment, typename BackendType>
+bool BasicHerix<Alignment, BackendType>::isCompressedFile () const {
+    return getCompressedFile() != nullptr;
+}
+template<typename Alignment, typename BackendType>
+CompressedFile* BasicHerix<Alignment, BackendType>::getCompressedFile () const {
+    return backendAs<CompressedFile>(backend.get());
+}
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::loadBackend (std::shared_ptr<BackendType> t_backend) {
+    if (t_backend == nullptr) {
+        throw std::invalid_argument("Backend can't be null.");
+    }
 
-/// Closes file and throws away all data. Does NOT save any edits.
-void Herix::closeFile () {
-    if (file.is_open()) {
-        file.clear(); // clear err state
+    if (hasFile()) {
+        closeFile();
+    }
 
-        file.close();
+    filename = t_backend->getPath();
+    backend = std::move(t_backend);
+    openFile(false);
 
-        // Closing can have issues. If so, we don't know what to do, so complain.
-        // Program using this library can catch it, and perhaps back up the edits and later restore them
-        if (file.fail()) {
-            // TODO: make an error type for this
-            throw std::runtime_error("Failed in closing file.");
+    notifyChange(0, std::numeric_limits<size_t>::max());
+}
+template<typename Alignment, typename BackendType>
+BackendType* BasicHerix<Alignment, BackendType>::getBackend () const {
+    return backend.get();
+}
+template<typename Alignment, typename BackendType>
+std::shared_ptr<BackendType> BasicHerix<Alignment, BackendType>::getSharedBackend () const {
+    return backend;
+}
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::loadPooledFile (std::filesystem::path t_filename, FilePool& pool) {
+    if constexpr (std::is_base_of_v<BackendType, PooledFile>) {
+        loadBackend(std::make_shared<PooledFile>(t_filename, allow_writing, pool));
+    } else {
+        (void)t_filename;
+        (void)pool;
+        throw std::logic_error("This instance can't hold a pooled file.");
+    }
+}
+// Does not currently use swapping, but it's there if we do strange things
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::openFile (bool) {
+    // Opened by path, rather than given a backend
+    if (backend == nullptr) {
+        if constexpr (std::is_base_of_v<BackendType, FileBackend>) {
+            backend = std::make_shared<FileBackend>(filename, allow_writing);
+        } else {
+            throw std::logic_error("This instance can't open a file by path, use loadBackend.");
         }
     }
 
+    file_identity = FileIdentity::of(filename);
+    if (!backend->isFileContents()) {
+        // The blocks are of what the backend reads (such as decompressed contents), which mustn't be shared with
+        // instances viewing the file as it is
+        file_identity.path += std::string("#") + backend->getName();
+    }
+
+    // Anything in flight was for the previous file
+    resetAsync();
+}
+
+/// Closes file and throws away all data. Does NOT save any edits.
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::closeFile () {
+    resetAsync();
     edits.clear();
-    chunks.clear();
+    invalidateChunks();
+    reportMemory({});
+    backend.reset();
     filename = "";
 }
 
-size_t Herix::getFileSize () const {
-    return std::filesystem::file_size(filename);
+template<typename Alignment, typename BackendType>
+size_t BasicHerix<Alignment, BackendType>::getFileSize () const {
+    if (backend == nullptr) {
+        throw std::runtime_error("No file.");
+    }
+    return backend->getSize();
 }
 
-size_t Herix::getFileEnd () const {
+template<typename Alignment, typename BackendType>
+size_t BasicHerix<Alignment, BackendType>::getFileEnd () const {
     size_t file_size = getFileSize();
 
     if (end_position.has_value()) {
@@ -148,114 +296,370 @@ size_t Herix::getFileEnd () const {
     }
 }
 
-void Herix::loadIntoChunk (FilePosition pos, ChunkSize read_size, ChunkID cid, Chunk& chunk, bool eof_handling) {
-    // Modified pos
-    size_t mpos = getStartPosition() + pos;
+template<typename Alignment, typename BackendType>
+Buffer BasicHerix<Alignment, BackendType>::readAbsolute (AbsoluteFilePosition pos, size_t size) {
+    Buffer data(size);
+    data.resize(readAbsoluteInto(pos, size, data.data()));
+    return data;
+}
+
+template<typename Alignment, typename BackendType>
+size_t BasicHerix<Alignment, BackendType>::readAbsoluteInto (AbsoluteFilePosition pos, size_t size, Byte* output) {
+    size_t read_count = backend->read(pos, size, output);
+    HERIX_METRIC_ADD(ReadCalls, 1);
+    HERIX_METRIC_ADD(BytesRead, read_count);
+    return read_count;
+}
+
+// We don't modify the pos here with the start_position since we're storing the data
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::loadChunk (FilePositionStart pos, ChunkSize read_size, ChunkSize block_size) {
+    if (!hasFile()) {
+        throw std::runtime_error("Attempting to load chunk whilst file was not open");
+    }
+
+    if (findChunk(pos).has_value()) {
+        throw std::runtime_error("Attempted to load chunk that is already partially loaded!");
+    }
+
+    size_t file_end = getFileEnd();
+    if (pos >= file_end) {
+        throw std::runtime_error("Attempted to load chunk past end of file.");
+    }
+
+    HERIX_METRIC_TIME(load_timer, ChunkLoadMicroseconds);
+
+    // The data past the end position (or the end of the file) isn't part of this instance
+    size_t length = std::min(read_size, file_end - pos);
+    AbsoluteFilePosition block_start = getBlockStart(pos, block_size);
+    size_t offset = (getStartPosition() + pos) - block_start;
+
+    std::shared_ptr<const Byte> block;
+    if (shared_cache != nullptr) {
+        // The whole block, so that instances with other start and end positions can use it too
+        std::shared_ptr<const Buffer> shared = shared_cache->get(file_identity, block_start, block_size, [this, block_start, block_size] () {
+            return readAbsolute(block_start, block_size);
+        });
+        length = shared->size() > offset ? std::min(length, shared->size() - offset) : 0;
+        block = std::shared_ptr<const Byte>(shared, shared->data());
+    } else {
+        std::optional<Buffer> stored;
+        if (compressed_pool != nullptr) {
+            stored = compressed_pool->get(block_size, block_start, getStartPosition() + pos, length);
+        }
+
+        if (stored.has_value()) {
+            length = std::min(length, stored->size());
+            std::shared_ptr<const Buffer> buffer = std::make_shared<const Buffer>(std::move(*stored));
+            block = std::shared_ptr<const Byte>(buffer, buffer->data());
+        } else {
+            std::shared_ptr<Byte> data = allocateBlock(block_size, length);
+            length = readAbsoluteInto(getStartPosition() + pos, length, data.get());
+            block = std::move(data);
+        }
+        offset = 0;
+    }
+
+    ChunkID cid = installChunk(Chunk(pos, read_size, block_size, std::move(block), offset, length));
+
+    telemetry.bytes_loaded += chunks.at(cid).getRealSize();
+    telemetry.loads_by_size[block_size]++;
+}
+
+/// Loads the chunks of [pos, pos+size) that aren't loaded yet, with a single readBatch rather than a read for each of
+/// them as fetchChunk would do. For process memory that's one process_vm_readv for a screenful.
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::loadMissingChunks (FilePosition pos, size_t size) {
+    // Shared blocks are loaded through the shared cache, one at a time
+    if (shared_cache != nullptr) {
+        return;
+    }
+
+    checkSharedGeneration();
+    size_t file_end = getFileEnd();
+    size_t range_end = std::min(pos + size, file_end);
+    // A single chunk isn't worth it, fetchChunk also does adaptive chunking. Counted before collecting the starts, since
+    // that's the usual case and it shouldn't allocate.
+    size_t missing = 0;
+    for (FilePosition chunk_pos = getAlignedChunk(pos); chunk_pos < range_end && missing < 2; chunk_pos = getAlignedChunkEnd(chunk_pos)) {
+        if (!findChunk(chunk_pos).has_value()) {
+            missing++;
+        }
+    }
+    if (missing < 2) {
+        return;
+    }
+
+    std::vector<FilePosition> starts;
+    for (FilePosition chunk_pos = getAlignedChunk(pos); chunk_pos < range_end; chunk_pos = getAlignedChunkEnd(chunk_pos)) {
+        if (!findChunk(chunk_pos).has_value()) {
+            starts.push_back(chunk_pos);
+        }
+    }
+
+    std::vector<std::shared_ptr<const Byte>> blocks(starts.size());
+    std::vector<BackendRead> reads;
+    std::vector<size_t> counts(starts.size(), 0);
+    std::vector<size_t> read_indices;
+    for (size_t i = 0; i < starts.size(); i++) {
+        AbsoluteFilePosition start = getStartPosition() + starts[i];
+        size_t length = std::min(getAlignedChunkEnd(starts[i]), file_end) - starts[i];
+        if (compressed_pool != nullptr) {
+            std::optional<Buffer> stored = compressed_pool->get(chunk_size, getBlockStart(starts[i], chunk_size), start, length);
+            if (stored.has_value()) {
+                counts[i] = std::min(length, stored->size());
+                std::shared_ptr<const Buffer> buffer = std::make_shared<const Buffer>(std::move(stored.value()));
+                blocks[i] = std::shared_ptr<const Byte>(buffer, buffer->data());
+                continue;
+            }
+        }
 
-    // TODO: should we fail if mpos is past getFileEnd()?
+        std::shared_ptr<Byte> data = allocateBlock(chunk_size, length);
+        reads.push_back(BackendRead{ start, length, data.get() });
+        read_indices.push_back(i);
+        blocks[i] = std::move(data);
+    }
 
-    file.clear();
-    file.seekg(static_cast<std::streamoff>(mpos));
-    if (file.fail()) {
-        throw std::runtime_error("Failed to seek to position in file!: " + std::to_string(mpos) + " | " + std::to_string(static_cast<std::streamoff>(mpos)));
+    if (!reads.empty()) {
+        HERIX_METRIC_TIME(load_timer, ChunkLoadMicroseconds);
+        std::vector<size_t> read_counts = backend->readBatch(reads);
+        for (size_t i = 0; i < read_indices.size(); i++) {
+            counts[read_indices[i]] = read_counts[i];
+            HERIX_METRIC_ADD(BytesRead, read_counts[i]);
+        }
+        HERIX_METRIC_ADD(ReadCalls, 1);
     }
 
-    chunk.data.resize(read_size);
+    std::vector<ChunkID> installed;
+    for (size_t i = 0; i < starts.size(); i++) {
+        size_t length = counts[i];
+        ChunkSize chunk_extent = getAlignedChunkEnd(starts[i]) - starts[i];
+        ChunkID cid = installChunk(Chunk(starts[i], chunk_extent, chunk_size, std::move(blocks[i]), 0, length));
+        chunks.at(cid).touch();
+        installed.push_back(cid);
+
+        telemetry.misses++;
+        telemetry.bytes_loaded += length;
+        telemetry.loads_by_size[chunk_size]++;
+        HERIX_METRIC_ADD(ChunkMisses, 1);
+    }
 
-    // Make sure there's enough space, there should be unless I'm misunderstanding
-    assert(chunk.data.capacity() >= read_size);
-    assert(read_size <= static_cast<ChunkSize>(std::numeric_limits<std::streamsize>::max()));
+    cleanupChunks(installed);
+    reportMemory(installed);
+}
 
-    file.clear();
+/// Adds the chunk to the storage and the index
+template<typename Alignment, typename BackendType>
+ChunkID BasicHerix<Alignment, BackendType>::installChunk (Chunk chunk) {
+    AbsoluteFilePosition block_start = getBlockStart(chunk.start, chunk.block_size);
+    assert(getStartPosition() + chunk.start == block_start || chunk.start == 0);
+    assert(chunk.start + chunk.size == block_start + chunk.block_size - getStartPosition());
 
-    ChunkSize real_read_size;
-    if (pos+read_size >= getFileEnd()) {
-        real_read_size = getFileEnd() - pos;
+    ChunkID cid = getNewChunkID();
+    std::unordered_map<FilePosition, ChunkID>& level = chunk_index[chunk.block_size];
+    if (spare_index_nodes.empty()) {
+        level[block_start] = cid;
     } else {
-        real_read_size = read_size;
-    }
-    // Characters are extracted and stored until:
-    // read_size characters were extracted and stored
-    // or, EOF condition occurs on the input sequence. setstate(failbit|eofbit) is called.
-    //    the number of extracted cahracters can be queried using gcount
-    // TODO: find a way around using reinterpret cast :|
-    file.read(reinterpret_cast<char*>(chunk.data.data()), static_cast<std::streamsize>(real_read_size));
-
-    if (file.fail() && !file.eof()) { // fail, but not eof
-        chunks.erase(cid);
-        // I don't see anything about it being able to fail and not be in eof on my reference, but just in case
-        throw std::runtime_error("Failed to read data from file!");
-    } else if (file.fail() && file.eof()) {
-        if (eof_handling) {
-            // We are already handling eof.. so let's not continue.
-            throw std::runtime_error("Eof handling failed! Previous size: " + std::to_string(real_read_size) + ", attempted current: " + std::to_string(file.gcount()));
-        }
-        loadIntoChunk(pos, file.gcount(), cid, chunk, true);
+        auto node = std::move(spare_index_nodes.back());
+        spare_index_nodes.pop_back();
+        node.key() = block_start;
+        node.mapped() = cid;
+        auto result = level.insert(std::move(node));
+        if (!result.inserted) {
+            result.position->second = cid;
+        }
+    }
+
+    chunk_memory += chunk.size;
+    chunk_data_memory += chunk.getRealSize();
+    if (spare_chunk_nodes.empty()) {
+        chunks.emplace(cid, std::move(chunk));
     } else {
-        std::streamsize gcount = file.gcount();
-        chunk.data.resize(gcount);
-        // Might as well shrink
-        chunk.data.shrink_to_fit();
+        auto node = std::move(spare_chunk_nodes.back());
+        spare_chunk_nodes.pop_back();
+        node.key() = cid;
+        node.mapped() = std::move(chunk);
+        chunks.insert(std::move(node));
     }
+    return cid;
 }
 
-// We don't modify the pos here with the start_position since we're storing the data
-void Herix::loadChunk (FilePositionStart pos, ChunkSize read_size) {
-    if (!file.is_open()) {
-        throw std::runtime_error("Attempting to load chunk whilst file was not open");
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::eraseChunk (ChunkID id) {
+    auto iter = chunks.find(id);
+    if (iter == chunks.end()) {
+        return;
     }
 
-    if (findChunk(pos).has_value()) {
-        throw std::runtime_error("Attempted to load chunk that is already partially loaded!");
+    auto level = chunk_index.find(iter->second.block_size);
+    auto index_node = level->second.extract(getBlockStart(iter->second.start, iter->second.block_size));
+    if (!index_node.empty()) {
+        spare_index_nodes.push_back(std::move(index_node));
     }
-
-    if (pos >= getFileEnd()) {
-        throw std::runtime_error("Attempted to load chunk past end of file.");
+    if (level->second.empty()) {
+        chunk_index.erase(level);
     }
 
-    // Half-formed. This has to be filled in.
-    //ChunkID cid = addChunk(Chunk(pos, chunk_size));
-    ChunkID cid = getNewChunkID();
-    chunks.emplace(std::make_pair(cid, Chunk(pos, chunk_size)));
+    chunk_memory -= iter->second.size;
+    chunk_data_memory -= iter->second.getRealSize();
+    auto node = chunks.extract(iter);
+    // The block is released now rather than whenever the node gets reused, so its memory goes back to the pool
+    node.mapped().block.reset();
+    spare_chunk_nodes.push_back(std::move(node));
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::eraseChunksWithin (AbsoluteFilePosition block_start, ChunkSize size) {
+    std::vector<ChunkID> contained;
+    for (const auto& [level_size, level] : chunk_index) {
+        if (level_size >= size) {
+            break;
+        }
 
-    Chunk& chunk = chunks.at(cid);
+        for (AbsoluteFilePosition current = block_start; current < block_start + size; current += level_size) {
+            auto iter = level.find(current);
+            if (iter != level.end()) {
+                contained.push_back(iter->second);
+            }
+        }
+    }
+
+    for (ChunkID id : contained) {
+        eraseChunk(id);
+    }
+}
 
-    loadIntoChunk(pos, read_size, cid, chunk);
+/// The size of chunk to load for a miss, doubling for each miss in the current sequential run
+template<typename Alignment, typename BackendType>
+ChunkSize BasicHerix<Alignment, BackendType>::pickChunkSize () const {
+    size_t run = sequential_run;
+    ChunkSize size = chunk_size;
+    // Keep at least four of the largest chunks within the memory limit
+    while (run > 0 && size * 2 <= max_extent_size && size * 2 * 4 <= max_chunk_memory) {
+        size *= 2;
+        run--;
+    }
+    return size;
 }
 
-ChunkID Herix::getNewChunkID () {
+template<typename Alignment, typename BackendType>
+ChunkID BasicHerix<Alignment, BackendType>::getNewChunkID () {
     return c_count++; // return it's current value, then add 1
 }
 
 
-size_t Herix::getChunkCount () const {
+template<typename Alignment, typename BackendType>
+size_t BasicHerix<Alignment, BackendType>::getChunkCount () const {
     return chunks.size();
 }
-bool Herix::hasChunks () const {
+template<typename Alignment, typename BackendType>
+bool BasicHerix<Alignment, BackendType>::hasChunks () const {
     return chunks.size() > 0;
 }
 
-bool Herix::hasChunk (size_t id) const {
-    return id < chunks.size();
+template<typename Alignment, typename BackendType>
+bool BasicHerix<Alignment, BackendType>::hasChunk (ChunkID id) const {
+    // Ids aren't reused, so after evictions they're sparse
+    return chunks.find(id) != chunks.end();
 }
 
 // Throws away all the chunks.
-void Herix::invalidateChunks () {
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::invalidateChunks () {
     chunks.clear();
+    chunk_index.clear();
+    chunk_memory = 0;
+    chunk_data_memory = 0;
+    if (compressed_pool != nullptr) {
+        compressed_pool->clear();
+    }
+    // Reads that are in flight (or done but not collected) may be from before whatever made the chunks stale
+    async_epoch++;
+    in_flight.clear();
+}
+
+template<typename Alignment, typename BackendType>
+size_t BasicHerix<Alignment, BackendType>::getChunkMemory () const {
+    return chunk_memory;
+}
+
+template<typename Alignment, typename BackendType>
+size_t BasicHerix<Alignment, BackendType>::getMaxChunkMemory () const {
+    return max_chunk_memory;
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::enableAdaptiveChunking (ChunkSize max_extent) {
+    max_extent_size = std::max(max_extent, chunk_size);
+}
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::disableAdaptiveChunking () {
+    max_extent_size = chunk_size;
+    sequential_run = 0;
+}
+template<typename Alignment, typename BackendType>
+bool BasicHerix<Alignment, BackendType>::isAdaptiveChunkingEnabled () const {
+    return max_extent_size > chunk_size;
+}
+
+template<typename Alignment, typename BackendType>
+ChunkTelemetry BasicHerix<Alignment, BackendType>::getChunkTelemetry () const {
+    ChunkTelemetry result = telemetry;
+    for (const auto& [size, level] : chunk_index) {
+        result.loaded_sizes[size] = level.size();
+    }
+    return result;
+}
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::resetChunkTelemetry () {
+    telemetry = ChunkTelemetry();
 }
 
 /// Cleanup the chunks if they've gone over the limit.
 /// Tries disposing of them in least used order and least recently loaded
-void Herix::cleanupChunks (std::vector<ChunkID> ignore) {
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::cleanupChunks (std::span<const ChunkID> ignore) {
     // We want to clean up in order of farthest away last used, and least used
     // Having the time it was last used lets us keep recently loaded chunks, and dump chunks that were loaded
 
-    if (chunks.size() * chunk_size <= max_chunk_memory) {
+    if (chunk_memory <= max_chunk_memory) {
+        return;
+    }
+
+    getEvictionOrder(ignore, eviction_order);
+
+    // We might have to cleanup multiple chunks since they may go over the limit.
+    // The ignored chunks still count towards the limit, they just can't be the ones removed.
+    for (ChunkID id : eviction_order) {
+        if (chunk_memory <= max_chunk_memory) {
+            return;
+        }
+
+        HERIX_METRIC_ADD(ChunkEvictions, 1);
+
+        compressChunk(id);
+        eraseChunk(id);
+    }
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::compressChunk (ChunkID id) {
+    if (compressed_pool == nullptr || shared_cache != nullptr) {
         return;
     }
 
-    std::deque<ChunkID> chunks_list;
+    const Chunk& chunk = chunks.at(id);
+    if (chunk.getRealSize() == 0) {
+        return;
+    }
+    compressed_pool->put(chunk.block_size, getBlockStart(chunk.start, chunk.block_size), getStartPosition() + chunk.start,
+        chunk.getData(), chunk.getRealSize());
+}
 
+/// Chunk ids in the order they should be removed: farthest away last used and least used first. Excludes ignore.
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::getEvictionOrder (std::span<const ChunkID> ignore, std::vector<ChunkID>& chunks_list) const {
+    chunks_list.clear();
     for (const std::pair<const ChunkID, Chunk>& c : chunks) {
         chunks_list.push_back(c.first);
     }
@@ -264,8 +668,8 @@ void Herix::cleanupChunks (std::vector<ChunkID> ignore) {
     // I add the .touched due to it being useful for dealing with events happening at the same milliseconds
     // It would be nice to give it more weight though
     std::sort(chunks_list.begin(), chunks_list.end(), [&](ChunkID a, ChunkID b) {
-        Chunk& ac = chunks.at(a);
-        Chunk& bc = chunks.at(b);
+        const Chunk& ac = chunks.at(a);
+        const Chunk& bc = chunks.at(b);
         return ac.last_touched != std::chrono::milliseconds(0) &&
             (ac.last_touched+std::chrono::milliseconds(ac.touched)) < (bc.last_touched+std::chrono::milliseconds(bc.touched));
     });
@@ -279,102 +683,303 @@ void Herix::cleanupChunks (std::vector<ChunkID> ignore) {
             }
             return false;
         }), chunks_list.end());
+}
 
-    // We might have to cleanup multiple chunks since they may go over the limit.
-    while (chunks_list.size() * chunk_size > max_chunk_memory) {
-        if (chunks_list.size() == 0) {
-            return;
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::evictChunks (size_t bytes, std::span<const ChunkID> ignore) {
+    getEvictionOrder(ignore, eviction_order);
+    size_t freed = 0;
+    for (ChunkID id : eviction_order) {
+        if (freed >= bytes) {
+            break;
         }
 
-        ChunkID id = chunks_list.at(0);
-        chunks_list.pop_front();
+        freed += chunks.at(id).getRealSize();
+        HERIX_METRIC_ADD(ChunkEvictions, 1);
+        eraseChunk(id);
+    }
+}
+
+template<typename Alignment, typename BackendType>
+std::chrono::milliseconds BasicHerix<Alignment, BackendType>::getColdestTouch () const {
+    std::chrono::milliseconds coldest = std::chrono::milliseconds::max();
+    for (const std::pair<const ChunkID, Chunk>& chunk : chunks) {
+        // Chunks that were just loaded haven't been touched yet
+        if (chunk.second.last_touched != std::chrono::milliseconds(0)) {
+            coldest = std::min(coldest, chunk.second.last_touched + std::chrono::milliseconds(chunk.second.touched));
+        }
+    }
+    return coldest;
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::reportMemory (std::span<const ChunkID> ignore) {
+    if (!governor_membership.isActive()) {
+        return;
+    }
+
+    size_t pool_memory = getPoolMemory();
+    size_t requested = governor_membership.report(chunk_data_memory + pool_memory, edits.getMemoryUsage(), getColdestTouch());
+    if (requested > 0) {
+        // Free slots hold nothing, and then the compressed chunks are the cheapest to lose
+        if (slab_pool != nullptr) {
+            size_t freed = slab_pool->freeMemory(requested);
+            requested -= std::min(freed, requested);
+        }
+        if (compressed_pool != nullptr) {
+            size_t freed = compressed_pool->freeMemory(requested);
+            requested -= std::min(freed, requested);
+        }
+        evictChunks(requested, ignore);
+        // The slots of the evicted chunks are free now, and have to be given back too
+        if (slab_pool != nullptr) {
+            slab_pool->freeMemory(requested);
+        }
+        pool_memory = getPoolMemory();
+        governor_membership.report(chunk_data_memory + pool_memory, edits.getMemoryUsage(), getColdestTouch());
+    }
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::setMemoryGovernor (MemoryGovernor* governor) {
+    if (governor == nullptr) {
+        governor_membership = MemoryGovernor::Membership();
+        return;
+    }
+
+    governor_membership = MemoryGovernor::Membership(*governor);
+    reportMemory({});
+}
+template<typename Alignment, typename BackendType>
+MemoryGovernor* BasicHerix<Alignment, BackendType>::getMemoryGovernor () const {
+    return governor_membership.getGovernor();
+}
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::releaseRequestedMemory () {
+    reportMemory({});
+}
+template<typename Alignment, typename BackendType>
+size_t BasicHerix<Alignment, BackendType>::getMemoryUsage () const {
+    return chunk_data_memory + getPoolMemory() + edits.getMemoryUsage();
+}
+
+/// Memory held for chunks other than the loaded ones: the compressed tier, and the free slots of the slab pool
+template<typename Alignment, typename BackendType>
+size_t BasicHerix<Alignment, BackendType>::getPoolMemory () const {
+    size_t pool_memory = compressed_pool != nullptr ? compressed_pool->getMemoryUsage() : 0;
+    return pool_memory + (slab_pool != nullptr ? slab_pool->getFreeMemory() : 0);
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::setSharedCache (SharedChunkCache* cache) {
+    if (cache == shared_cache) {
+        return;
+    }
+
+    // What's loaded is either private or from the other cache
+    invalidateChunks();
+    shared_cache = cache;
+    if (shared_cache != nullptr) {
+        shared_generation = shared_cache->getGeneration();
+    }
+    reportMemory({});
+}
+template<typename Alignment, typename BackendType>
+SharedChunkCache* BasicHerix<Alignment, BackendType>::getSharedCache () const {
+    return shared_cache;
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::enableCompressedTier (size_t max_memory) {
+    if (compressed_pool != nullptr) {
+        compressed_pool->setMaxMemory(max_memory);
+    } else {
+        compressed_pool = std::make_unique<CompressedChunkPool>(max_memory);
+    }
+    reportMemory({});
+}
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::disableCompressedTier () {
+    compressed_pool.reset();
+    reportMemory({});
+}
+template<typename Alignment, typename BackendType>
+bool BasicHerix<Alignment, BackendType>::isCompressedTierEnabled () const {
+    return compressed_pool != nullptr;
+}
+template<typename Alignment, typename BackendType>
+CompressedChunkPoolStatistics BasicHerix<Alignment, BackendType>::getCompressedTierStatistics () const {
+    if (compressed_pool == nullptr) {
+        return CompressedChunkPoolStatistics();
+    }
+    return compressed_pool->getStatistics();
+}
+
+template<typename Alignment, typename BackendType>
+std::shared_ptr<Byte> BasicHerix<Alignment, BackendType>::allocateBlock (ChunkSize block_size, size_t size) {
+    if (slab_pool != nullptr) {
+        // The whole block, so the slot can be reused for any chunk of the same size
+        return slab_pool->acquire(block_size);
+    }
+    // Not zeroed, it's about to be read into
+    return std::shared_ptr<Byte>(new Byte[size], std::default_delete<Byte[]>());
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::enableSlabPool (SlabPoolOptions options) {
+    slab_pool = std::make_unique<SlabPool>(options);
+    reportMemory({});
+}
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::disableSlabPool () {
+    slab_pool.reset();
+    reportMemory({});
+}
+template<typename Alignment, typename BackendType>
+bool BasicHerix<Alignment, BackendType>::isSlabPoolEnabled () const {
+    return slab_pool != nullptr;
+}
+template<typename Alignment, typename BackendType>
+SlabPoolStatistics BasicHerix<Alignment, BackendType>::getSlabPoolStatistics () const {
+    if (slab_pool == nullptr) {
+        return SlabPoolStatistics();
+    }
+    return slab_pool->getStatistics();
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::checkSharedGeneration () {
+    if (shared_cache == nullptr) {
+        return;
+    }
 
-        chunks.erase(id);
+    uint64_t generation = shared_cache->getGeneration();
+    if (generation != shared_generation) {
+        // Some file was written to, it might be this one
+        invalidateChunks();
+        shared_generation = generation;
     }
 }
 
-void Herix::destroyChunk (ChunkID id) {
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::destroyChunk (ChunkID id) {
     if (!hasChunk(id)) {
         throw std::invalid_argument("chunk argument did not point to an existing chunk to destroy.");
     }
 
-    chunks.erase(id);
+    eraseChunk(id);
+}
+
+template<typename Alignment, typename BackendType>
+AbsoluteFilePosition BasicHerix<Alignment, BackendType>::getBlockStart (FilePosition pos, ChunkSize block_size) const {
+    return Alignment::alignDown(getStartPosition() + pos, block_size);
 }
 
 /// Returns the aligned chunk that includes the pos
-FilePosition Herix::getAlignedChunk (FilePosition pos) const {
-    assert((pos % chunk_size) <= pos);
-    assert((pos - (pos % chunk_size)) % chunk_size == 0);
-    return pos - (pos % chunk_size);
+template<typename Alignment, typename BackendType>
+FilePosition BasicHerix<Alignment, BackendType>::getAlignedChunk (FilePosition pos) const {
+    AbsoluteFilePosition block_start = getBlockStart(pos, chunk_size);
+    return block_start > getStartPosition() ? block_start - getStartPosition() : 0;
 }
 
-std::optional<ChunkID> Herix::findChunk(FilePosition pos) const {
-    // TODO: make sure this is doing what you think (aka not copying the Chunk!)
-    for (const std::pair<const ChunkID, Chunk>& chunk : chunks) {
+template<typename Alignment, typename BackendType>
+FilePosition BasicHerix<Alignment, BackendType>::getAlignedChunkEnd (FilePosition pos) const {
+    return getBlockStart(pos, chunk_size) + chunk_size - getStartPosition();
+}
 
-        // TODO: check this logic to make sure it's not off by one
-        // TODO: think if I should instead use the data size, since we aren't intending to support modification of file mid-edit
-        if (pos >= chunk.second.start && pos < (chunk.second.start + chunk.second.size)) {
-            return chunk.first;
+template<typename Alignment, typename BackendType>
+std::optional<ChunkID> BasicHerix<Alignment, BackendType>::findChunk(FilePosition pos) const {
+    // Larger chunks first, since they're the ones sequential access ends up hitting
+    for (auto iter = chunk_index.rbegin(); iter != chunk_index.rend(); iter++) {
+        auto found = iter->second.find(getBlockStart(pos, iter->first));
+        if (found != iter->second.end()) {
+            return found->second;
         }
     }
     return std::nullopt;
 }
 
-/// Reads the value as it is stored in the file, loading the chunk if need be. Does not look at edits.
-std::optional<Byte> Herix::readRaw (FilePosition pos) {
+template<typename Alignment, typename BackendType>
+Chunk& BasicHerix<Alignment, BackendType>::fetchChunk (FilePosition pos) {
+    checkSharedGeneration();
     std::optional<ChunkID> cid = findChunk(pos);
 
     if (!cid.has_value()) {
-        try {
-            loadChunk(getAlignedChunk(pos), chunk_size);
-        } catch (...) {
-            throw;
-            //return std::nullopt;
+        telemetry.misses++;
+        HERIX_METRIC_ADD(ChunkMisses, 1);
+        sequential_run = pos == last_chunk_end ? sequential_run + 1 : 0;
+
+        ChunkSize block_size = pickChunkSize();
+        AbsoluteFilePosition block_start = getBlockStart(pos, block_size);
+        if (block_size > chunk_size) {
+            eraseChunksWithin(block_start, block_size);
         }
+        // The first block can start before the start position
+        FilePosition start = block_start > getStartPosition() ? block_start - getStartPosition() : 0;
+        loadChunk(start, block_start + block_size - getStartPosition() - start, block_size);
 
         cid = findChunk(pos);
 
         // If it still doesn't have a value and there wasn't an error, something weird is happening
         if (!cid.has_value()) {
-            // TODO: remove this debug
-            assert(false);
-            return std::nullopt;
+            throw std::runtime_error("Loaded chunk did not contain the position it was loaded for.");
         }
 
-        cleanupChunks({ cid.value() });
+        ChunkID loaded = cid.value();
+        cleanupChunks(std::span(&loaded, 1));
+        reportMemory(std::span(&loaded, 1));
+    } else {
+        telemetry.hits++;
+        HERIX_METRIC_ADD(ChunkHits, 1);
     }
 
-    assert(cid.has_value());
-
     Chunk& chunk = chunks.at(cid.value());
+    last_chunk_end = chunk.start + chunk.size;
 
     assert(pos >= chunk.start);
 
     chunk.touch();
 
+    return chunk;
+}
+
+/// Reads the value as it is stored in the file, loading the chunk if need be. Does not look at edits.
+template<typename Alignment, typename BackendType>
+std::optional<Byte> BasicHerix<Alignment, BackendType>::readRaw (FilePosition pos) {
+    Chunk& chunk = fetchChunk(pos);
+
     // It's valid for it to be out of range, since this Chunk might be on the edge
     // So it tries accessing something within the chunks realm but isn't actually existant
-    if (chunk.data.size() <= pos - chunk.start) {
+    if (chunk.getRealSize() <= pos - chunk.start) {
+        return std::nullopt;
+    }
+    // Holes in the backend (such as unmapped memory) are treated the same
+    if (backend->hasHoles() && !backend->isPresent(getStartPosition() + pos)) {
         return std::nullopt;
     }
 
-    return chunk.data.at(pos - chunk.start);
+    return chunk.getData()[pos - chunk.start];
 }
 
 /// Reads the value at that position, returning the edited value, falling back to files value, otherwise it is nullopt
 /// Loads chunk if need be.
-std::optional<Byte> Herix::read (FilePosition pos) {
+template<typename Alignment, typename BackendType>
+std::optional<Byte> BasicHerix<Alignment, BackendType>::read (FilePosition pos) {
     // Check editstorage first
     std::optional<Byte> stored_edit = edits.read(pos);
     if (stored_edit.has_value()) {
         return stored_edit;
     }
 
-    return readRaw(pos);
+    std::optional<Byte> value = readRaw(pos);
+    if (value.has_value() && edits.getTransformed().contains(pos)) {
+        edits.applyTo(pos, 1, &value.value());
+    }
+    return value;
 }
 
-std::vector<std::optional<Byte>> Herix::readMultipleRaw (FilePosition pos, size_t size) {
+template<typename Alignment, typename BackendType>
+std::vector<std::optional<Byte>> BasicHerix<Alignment, BackendType>::readMultipleRaw (FilePosition pos, size_t size) {
     std::vector<std::optional<Byte>> result;
     result.reserve(size);
 
@@ -385,7 +990,8 @@ std::vector<std::optional<Byte>> Herix::readMultipleRaw (FilePosition pos, size_
     return result;
 }
 
-std::vector<std::optional<Byte>> Herix::readMultiple (FilePosition pos, size_t size) {
+template<typename Alignment, typename BackendType>
+std::vector<std::optional<Byte>> BasicHerix<Alignment, BackendType>::readMultiple (FilePosition pos, size_t size) {
     std::vector<std::optional<Byte>> result;
     result.reserve(size);
 
@@ -396,7 +1002,8 @@ std::vector<std::optional<Byte>> Herix::readMultiple (FilePosition pos, size_t s
     return result;
 }
 
-std::vector<Byte> Herix::readMultipleCutoff (FilePosition pos, size_t size) {
+template<typename Alignment, typename BackendType>
+std::vector<Byte> BasicHerix<Alignment, BackendType>::readMultipleCutoff (FilePosition pos, size_t size) {
     std::vector<Byte> result;
     // We're often going to be reading a large area from the file that isn't at the end
     // So I think this is appropriate.
@@ -414,43 +1021,277 @@ std::vector<Byte> Herix::readMultipleCutoff (FilePosition pos, size_t size) {
     return result;
 }
 
-void Herix::edit (FilePosition pos, Byte value) {
-    edits.edit(pos, value);
-}
+/// Reads up to size bytes from the file, as they are stored in the file, into output. Copies a chunk at a time.
+/// Returns the amount of bytes read, which is less than size if the read hit the end of the file.
+template<typename Alignment, typename BackendType>
+size_t BasicHerix<Alignment, BackendType>::readRawInto (FilePosition pos, size_t size, Byte* output) {
+    size_t file_end = getFileEnd();
+    size_t read_count = 0;
+
+    if (pos < file_end) {
+        // No more than fits, so the batch doesn't push itself back out
+        loadMissingChunks(pos, std::min({ size, file_end - pos, max_chunk_memory }));
+    }
+
+    while (read_count < size) {
+        FilePosition current = pos + read_count;
+        if (current >= file_end) {
+            break;
+        }
+
+        Chunk& chunk = fetchChunk(current);
+        size_t offset = current - chunk.start;
+        if (offset >= chunk.getRealSize()) {
+            break;
+        }
+
+        size_t amount = std::min(size - read_count, chunk.getRealSize() - offset);
+        // A hole ends the read the same as the end of the file does
+        bool hole = false;
+        if (backend->hasHoles()) {
+            size_t present = backend->getPresentRun(getStartPosition() + current, amount);
+            hole = present < amount;
+            amount = present;
+        }
+
+        std::memcpy(output + read_count, chunk.getData() + offset, amount);
+        read_count += amount;
+        if (hole) {
+            break;
+        }
+    }
 
-void Herix::editMultiple (FilePosition pos, Buffer values) {
-    edits.editMultiple(pos, values);
+    return read_count;
 }
 
-/// Saves the files, just writes the edits and throws them away.
-void Herix::saveHistoryDestructive () {
-    if (!allow_writing) {
-        return;
+/// Reads up to size bytes into output, with edits applied. This is the bulk version of read, it avoids the
+/// per-byte optional and only walks the edit history once.
+/// If edited_mask is given, entries for edited bytes are set to 1 (see EditStorage::applyTo)
+/// Returns the amount of bytes that are valid, bytes in output past that are unspecified.
+template<typename Alignment, typename BackendType>
+size_t BasicHerix<Alignment, BackendType>::readInto (FilePosition pos, size_t size, Byte* output, Byte* edited_mask) {
+    // Nothing is needed from the file if it's all been overwritten, such as by a fill
+    if (edits.getFilled().covers(pos, size) && pos + size <= getFileEnd()) {
+        edits.applyTo(pos, size, output, edited_mask);
+        return size;
     }
 
-    // TODO: make this efficient, so it only writes what it needs to
-    // TODO: it'd also be nice to make so if it fails at writing, then there won't be partial writes
-    for (const EditStorageItem& edit : edits.edits) {
-        file.seekp(static_cast<std::streampos>(getStartPosition() + edit.pos));
-        // TODO: this is icky, we need to replace file's type with one which uses Byte.
-        // TODO: check if size is withing std::streamsize
-        file.write(reinterpret_cast<const char *>(edit.data.data()), static_cast<std::streamsize>(edit.data.size()));
+    size_t read_count = readRawInto(pos, size, output);
+
+    if (read_count == size) {
+        edits.applyTo(pos, size, output, edited_mask);
+        return size;
     }
 
-    invalidateChunks();
-    edits.clearNotStats();
-}
-/// Saves the files, to the filename. Overwrites if it already exists
-/// It's up to the code using this to check if it already exists, if they care about that.
+    edits.applyTo(pos, read_count, output, edited_mask);
+
+    // Edits can be past the end of the file (read gives them back), so continue on as far as they're contiguous
+    Buffer tail_mask(size - read_count, 0);
+    edits.applyTo(pos + read_count, size - read_count, output + read_count, tail_mask.data(), false);
+    size_t tail_count = static_cast<size_t>(std::find(tail_mask.begin(), tail_mask.end(), 0) - tail_mask.begin());
+
+    if (edited_mask != nullptr) {
+        std::memset(edited_mask + read_count, 1, tail_count);
+    }
+
+    return read_count + tail_count;
+}
+
+template<typename Alignment, typename BackendType>
+std::optional<VarIntResult<uint64_t>> BasicHerix<Alignment, BackendType>::readULEB128 (FilePosition pos) {
+    Byte data[max_leb128_size];
+    size_t read_count = readInto(pos, max_leb128_size, data);
+    return decodeULEB128(data, read_count);
+}
+
+template<typename Alignment, typename BackendType>
+std::optional<VarIntResult<int64_t>> BasicHerix<Alignment, BackendType>::readSLEB128 (FilePosition pos) {
+    Byte data[max_leb128_size];
+    size_t read_count = readInto(pos, max_leb128_size, data);
+    return decodeSLEB128(data, read_count);
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::edit (FilePosition pos, Byte value) {
+    notifyBeforeChange(pos, 1);
+    edits.edit(pos, value);
+    notifyChange(pos, 1);
+    reportMemory({});
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::editMultiple (FilePosition pos, Buffer values) {
+    size_t size = values.size();
+    notifyBeforeChange(pos, size);
+    edits.editMultiple(pos, std::move(values));
+    notifyChange(pos, size);
+    reportMemory({});
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::fill (FilePosition pos, size_t size, Buffer pattern) {
+    notifyBeforeChange(pos, size);
+    edits.fill(pos, size, std::move(pattern));
+    notifyChange(pos, size);
+    reportMemory({});
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::transform (FilePosition pos, size_t size, TransformOp op, Buffer key) {
+    notifyBeforeChange(pos, size);
+    edits.transform(pos, size, op, std::move(key));
+    notifyChange(pos, size);
+    reportMemory({});
+}
+
+template<typename Alignment, typename BackendType>
+size_t BasicHerix<Alignment, BackendType>::replaceAll (const Buffer& needle, Buffer replacement, FilePosition pos) {
+    if (needle.empty()) {
+        throw std::invalid_argument("Can't replace an empty needle.");
+    }
+    if (needle.size() != replacement.size()) {
+        throw std::invalid_argument("The replacement must be the same size as the needle.");
+    }
+
+    size_t file_end = getFileEnd();
+    if (pos >= file_end) {
+        return 0;
+    }
+
+    BlockSearcher searcher(needle);
+    SequentialReaderOptions options;
+    options.block_size = std::max(options.block_size, searcher.getMinimumBlockSize());
+    SequentialReader reader(*this, pos, file_end - pos, options);
+
+    std::vector<FilePosition> matches;
+    while (std::optional<SequentialBlock> block = reader.next()) {
+        searcher.feedAll(block.value(), matches);
+    }
+    if (matches.empty()) {
+        return 0;
+    }
+
+    FilePosition first = matches.front();
+    size_t span = (matches.back() + needle.size()) - first;
+    notifyBeforeChange(first, span);
+    edits.editEach(matches, std::move(replacement));
+    notifyChange(first, span);
+    reportMemory({});
+    return matches.size();
+}
+
+template<typename Alignment, typename BackendType>
+size_t BasicHerix<Alignment, BackendType>::readStored (AbsoluteFilePosition pos, size_t size, Byte* output) {
+    return backend->read(pos, size, output);
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::writeStored (AbsoluteFilePosition pos, const Byte* data, size_t size) {
+    backend->write(pos, data, size);
+}
+
+/// Saves the files, just writes the edits and throws them away.
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::saveHistoryDestructive () {
+    if (!allow_writing) {
+        return;
+    }
+    if (!hasFile()) {
+        throw std::runtime_error("No file.");
+    }
+    if (!backend->isWritable()) {
+        throw std::logic_error(std::string("Can't save into a ") + backend->getName() + " backend, use saveAsHistoryDestructive or exportTo.");
+    }
+
+    HERIX_METRIC_TIME(save_timer, SaveMicroseconds);
+    HERIX_METRIC_ADD(Saves, 1);
+
+    // TODO: make this efficient, so it only writes what it needs to
+    // TODO: it'd also be nice to make so if it fails at writing, then there won't be partial writes
+    Buffer piece;
+    // What was written stops being an edit, so listeners hear about it once the edits are cleared
+    RangeSet saved;
+    // Only the edits in the past, anything that was undone isn't part of the file
+    size_t end = edits.getCurrentEnd();
+    for (size_t i = 0; i < end; i++) {
+        const EditStorageItem& edit = edits.edits[i];
+        HERIX_METRIC_ADD(BytesSaved, edit.getSize());
+        EditRange span = edit.getSpan();
+        saved.add(span.first, span.second);
+        // Groups are written one run at a time
+        edit.forEachRunWithin(span.first, span.second, [this, &edit, &piece] (FilePosition run_pos, size_t run_offset, size_t run_size) {
+            if (edit.transform.has_value()) {
+                // Transforms apply to what the earlier edits left in the file, so it's read back a piece at a time
+                piece.resize(std::min(run_size, SequentialReaderOptions().block_size));
+                for (size_t offset = 0; offset < run_size; offset += piece.size()) {
+                    size_t amount = std::min(piece.size(), run_size - offset);
+                    size_t read_count = readStored(getStartPosition() + run_pos + offset, amount, piece.data());
+
+                    applyTransform(edit.transform.value(), edit.data.data(), edit.data.size(), run_offset + offset, piece.data(), read_count);
+                    writeStored(getStartPosition() + run_pos + offset, piece.data(), read_count);
+                    if (read_count < amount) {
+                        // Past the end of the file there is nothing to transform
+                        break;
+                    }
+                }
+                return;
+            }
+
+            if (!edit.spilled.has_value() && !edit.repeating) {
+                writeStored(getStartPosition() + run_pos, edit.data.data() + run_offset, run_size);
+                return;
+            }
+
+            // Spilled data (and fills) are copied over in pieces, so it never all has to be in memory
+            piece.resize(std::min(run_size, SequentialReaderOptions().block_size));
+            for (size_t offset = 0; offset < run_size; offset += piece.size()) {
+                size_t amount = std::min(piece.size(), run_size - offset);
+                edits.readItemData(edit, run_offset + offset, amount, piece.data());
+                writeStored(getStartPosition() + run_pos + offset, piece.data(), amount);
+            }
+        });
+    }
+
+    // Other instances read the file through their own descriptors
+    backend->flush();
+    invalidateChunks();
+    if (shared_cache != nullptr) {
+        shared_cache->invalidateFile(file_identity);
+        shared_generation = shared_cache->getGeneration();
+    }
+    edits.clearNotStats();
+    for (const EditRange& range : saved.getRanges(0, std::numeric_limits<size_t>::max())) {
+        notifyChange(range.first, range.second);
+    }
+}
+/// Saves the files, to the filename. Overwrites if it already exists
+/// It's up to the code using this to check if it already exists, if they care about that.
 /// The current file then becomes output
 // TODO: Make a function that only saves the portion of the file we're editing (getStartPosition() through getEndPosition)
-void Herix::saveAsHistoryDestructive (std::string output) {
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::saveAsHistoryDestructive (std::string output) {
     if (!hasFile()) {
         throw std::runtime_error("No file.");
     }
 
     // We allow saving-as, even if allow_writing is false, since it's to a new file.
 
+    if (backendAs<FileBackend>(backend.get()) == nullptr) {
+        if constexpr (!std::is_base_of_v<BackendType, FileBackend>) {
+            // The new file couldn't be viewed afterwards
+            throw std::logic_error(std::string("Can't save a ") + backend->getName() + " backend as a file with this instance, use exportTo.");
+        }
+        // The new file is what the backend reads (such as the decompressed contents) with the edits, which is then
+        // opened as a normal file, or in the same pool
+        exportTo(output);
+        if (PooledFile* pooled = backendAs<PooledFile>(backend.get())) {
+            loadPooledFile(output, pooled->getPool());
+        } else {
+            loadFile(output);
+        }
+        return;
+    }
+
     try {
         std::filesystem::copy_file(filename, output);
     } catch (std::filesystem::filesystem_error&) {
@@ -461,31 +1302,819 @@ void Herix::saveAsHistoryDestructive (std::string output) {
     // Set the current file to output
     filename = output;
     // We're swapping over to output, so we have to close the original
-    file.close();
+    backend.reset();
 
     openFile(true);
 
     saveHistoryDestructive();
+    // Like loading a file, listeners have to start over with the new one
+    notifyChange(0, std::numeric_limits<size_t>::max());
+}
+
+/// Writes the edited contents of [pos, pos+size) (by default the whole file) to output, leaving the current file as is.
+/// This goes through a SequentialReader, so it doesn't disturb the chunk cache.
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::exportTo (std::filesystem::path output, FilePosition pos, std::optional<size_t> size) const {
+    if (!hasFile()) {
+        throw std::runtime_error("No file.");
+    }
+
+    std::ofstream out(output, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!out.is_open()) {
+        throw std::runtime_error("Failed in opening file to export to.");
+    }
+
+    SequentialReader reader(*this, pos, size.value_or(getFileEnd()));
+    while (std::optional<SequentialBlock> block = reader.next()) {
+        out.write(reinterpret_cast<const char*>(block.value().data), static_cast<std::streamsize>(block.value().size));
+        if (out.fail()) {
+            throw std::runtime_error("Failed to write to exported file.");
+        }
+    }
+}
+
+/// Returns the position of the first occurrence of needle at or after pos, with edits applied.
+/// Edits past the end of the file aren't searched.
+template<typename Alignment, typename BackendType>
+std::optional<FilePosition> BasicHerix<Alignment, BackendType>::find (FilePosition pos, const Buffer& needle) const {
+    if (needle.empty()) {
+        return pos;
+    }
+
+    size_t file_end = getFileEnd();
+    if (pos >= file_end) {
+        return std::nullopt;
+    }
+
+    BlockSearcher searcher(needle);
+    SequentialReaderOptions options;
+    options.block_size = std::max(options.block_size, searcher.getMinimumBlockSize());
+    SequentialReader reader(*this, pos, file_end - pos, options);
+
+    while (std::optional<SequentialBlock> block = reader.next()) {
+        std::optional<FilePosition> found = searcher.feed(block.value());
+        if (found.has_value()) {
+            return found;
+        }
+    }
+
+    return std::nullopt;
 }
 
 // = Undo/Redo
 
-UndoInfo Herix::undo () {
-    return UndoInfo(edits.undoR());
+template<typename Alignment, typename BackendType>
+UndoInfo BasicHerix<Alignment, BackendType>::undo () {
+    std::optional<EditRange> range = edits.getUndoRange();
+    if (range.has_value()) {
+        notifyBeforeChange(range.value().first, range.value().second);
+    }
+
+    UndoInfo info(edits.undoR(), edits.spill_store);
+    if (range.has_value()) {
+        notifyChange(range.value().first, range.value().second);
+    }
+    return info;
+}
+template<typename Alignment, typename BackendType>
+RedoInfo BasicHerix<Alignment, BackendType>::redo () {
+    std::optional<EditRange> range = edits.getRedoRange();
+    if (range.has_value()) {
+        notifyBeforeChange(range.value().first, range.value().second);
+    }
+
+    RedoInfo info(edits.redoR(), edits.spill_store);
+    if (range.has_value()) {
+        notifyChange(range.value().first, range.value().second);
+    }
+    return info;
+}
+
+// = Transactions
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::beginTransaction () {
+    edits.beginTransaction();
 }
-RedoInfo Herix::redo () {
-    return RedoInfo(edits.redoR());
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::commitTransaction () {
+    edits.commitTransaction();
+    reportMemory({});
 }
 
-bool Herix::hasUnsavedEdits () const {
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::rollbackTransaction () {
+    std::optional<EditRange> range = edits.getTransactionRange();
+    if (range.has_value()) {
+        notifyBeforeChange(range.value().first, range.value().second);
+    }
+
+    edits.rollbackTransaction();
+    if (range.has_value()) {
+        notifyChange(range.value().first, range.value().second);
+    }
+    reportMemory({});
+}
+
+template<typename Alignment, typename BackendType>
+bool BasicHerix<Alignment, BackendType>::isInTransaction () const {
+    return edits.isInTransaction();
+}
+
+// = Snapshots
+
+template<typename Alignment, typename BackendType>
+std::shared_ptr<const EditStorage> BasicHerix<Alignment, BackendType>::snapshotEdits () const {
+    return edits.snapshot();
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::restoreEdits (const EditStorage& snapshot) {
+    if (isInTransaction()) {
+        throw std::logic_error("Can't restore a snapshot of the edits in a transaction.");
+    }
+
+    // Only the items after the shared ones change anything, on either side. Their spans are combined first, so
+    // listeners hear about each changed range once rather than once per item.
+    size_t shared = edits.getSharedPrefix(snapshot);
+    RangeSet changed;
+    for (size_t i = shared; i < edits.getCurrentEnd(); i++) {
+        EditRange span = edits.edits[i].getSpan();
+        changed.add(span.first, span.second);
+    }
+    for (size_t i = shared; i < snapshot.getCurrentEnd(); i++) {
+        EditRange span = snapshot.edits[i].getSpan();
+        changed.add(span.first, span.second);
+    }
+    std::vector<EditRange> ranges = changed.getRanges(0, std::numeric_limits<size_t>::max());
+
+    for (const EditRange& range : ranges) {
+        notifyBeforeChange(range.first, range.second);
+    }
+    edits.restore(snapshot);
+    for (const EditRange& range : ranges) {
+        notifyChange(range.first, range.second);
+    }
+    reportMemory({});
+}
+
+template<typename Alignment, typename BackendType>
+bool BasicHerix<Alignment, BackendType>::hasUnsavedEdits () const {
     // FIXME: this needs to be changed once there's ways of saving other than
-    return canUndo();
+    // Not canUndo, since that stops at the start of a transaction
+    size_t end = edits.getCurrentEnd();
+    return end != 0 && end > edits.getCurrentLimit();
 }
 
-bool Herix::canUndo () const {
+template<typename Alignment, typename BackendType>
+bool BasicHerix<Alignment, BackendType>::isEdited (FilePosition pos) const {
+    return edits.isFilledIn(pos) || edits.getTransformed().contains(pos);
+}
+
+template<typename Alignment, typename BackendType>
+std::vector<EditRange> BasicHerix<Alignment, BackendType>::getEditedRanges (FilePosition pos, size_t size) const {
+    std::vector<EditRange> ranges = edits.getFilledRanges(pos, size);
+    if (!edits.hasTransforms()) {
+        return ranges;
+    }
+
+    // Combined with the transformed ranges, joining any that overlap or touch
+    std::vector<EditRange> transformed = edits.getTransformed().getRanges(pos, size);
+    ranges.insert(ranges.end(), transformed.begin(), transformed.end());
+    std::sort(ranges.begin(), ranges.end());
+    std::vector<EditRange> combined;
+    for (const EditRange& range : ranges) {
+        if (!combined.empty() && range.first <= combined.back().first + combined.back().second) {
+            FilePosition end = std::max(combined.back().first + combined.back().second, range.first + range.second);
+            combined.back().second = end - combined.back().first;
+        } else {
+            combined.push_back(range);
+        }
+    }
+    return combined;
+}
+
+template<typename Alignment, typename BackendType>
+bool BasicHerix<Alignment, BackendType>::canUndo () const {
     return edits.canUndo();
 }
 
-bool Herix::canRedo () const {
+template<typename Alignment, typename BackendType>
+bool BasicHerix<Alignment, BackendType>::canRedo () const {
     return edits.canRedo();
 }
+
+
+// = Listeners
+
+template<typename Alignment, typename BackendType>
+ListenerID BasicHerix<Alignment, BackendType>::addChangeListener (ChangeCallback after, ChangeCallback before) {
+    ListenerID id = l_count++;
+    change_listeners.emplace(id, ChangeListener{ std::move(before), std::move(after) });
+    return id;
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::removeChangeListener (ListenerID id) {
+    change_listeners.erase(id);
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::notifyBeforeChange (FilePosition pos, size_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    for (const std::pair<const ListenerID, ChangeListener>& listener : change_listeners) {
+        if (listener.second.before) {
+            listener.second.before(pos, size);
+        }
+    }
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::notifyChange (FilePosition pos, size_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    for (const std::pair<const ListenerID, ChangeListener>& listener : change_listeners) {
+        if (listener.second.after) {
+            listener.second.after(pos, size);
+        }
+    }
+}
+
+// = Async loading
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::enableAsyncLoading (size_t thread_count) {
+    async_enabled = true;
+    async_thread_count = thread_count;
+    resetAsync();
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::disableAsyncLoading () {
+    async_enabled = false;
+    resetAsync();
+}
+
+template<typename Alignment, typename BackendType>
+bool BasicHerix<Alignment, BackendType>::isAsyncLoadingEnabled () const {
+    return async_enabled;
+}
+
+template<typename Alignment, typename BackendType>
+const char* BasicHerix<Alignment, BackendType>::getAsyncLoaderName () const {
+    return async_loader ? async_loader->getName() : nullptr;
+}
+
+/// Throws away everything in flight, and creates a new loader for the current file if async loading is enabled.
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::resetAsync () {
+    async_loader.reset();
+    async_requests.clear();
+    in_flight.clear();
+
+    if (async_enabled && hasFile()) {
+        async_loader = AsyncLoader::create(backend, getStartPosition(), async_thread_count);
+    }
+}
+
+template<typename Alignment, typename BackendType>
+AsyncRequestID BasicHerix<Alignment, BackendType>::requestRange (FilePosition pos, size_t size, ChangeCallback callback) {
+    if (!async_loader) {
+        throw std::runtime_error("Async loading is not enabled.");
+    }
+
+    AsyncRequestID id = a_count++;
+    AsyncRequest request{ pos, size, std::move(callback), {} };
+
+    size_t file_end = getFileEnd();
+    size_t range_end = std::min(pos + size, file_end);
+    std::vector<AsyncReadRequest> batch;
+
+    checkSharedGeneration();
+    for (FilePosition chunk_pos = getAlignedChunk(pos); chunk_pos < range_end; chunk_pos = getAlignedChunkEnd(chunk_pos)) {
+        if (findChunk(chunk_pos).has_value()) {
+            continue;
+        }
+
+        request.waiting.insert(chunk_pos);
+        if (in_flight.insert(chunk_pos).second) {
+            batch.push_back(AsyncReadRequest{ chunk_pos, std::min(getAlignedChunkEnd(chunk_pos), file_end) - chunk_pos, async_epoch });
+        }
+    }
+
+    if (!batch.empty()) {
+        async_loader->submit(batch);
+    }
+
+    if (request.waiting.empty()) {
+        if (request.callback) {
+            request.callback(pos, size);
+        }
+    } else {
+        async_requests.emplace(id, std::move(request));
+    }
+
+    return id;
+}
+
+template<typename Alignment, typename BackendType>
+bool BasicHerix<Alignment, BackendType>::isRequestDone (AsyncRequestID id) const {
+    return async_requests.count(id) == 0;
+}
+
+template<typename Alignment, typename BackendType>
+bool BasicHerix<Alignment, BackendType>::isAwaited (FilePosition pos) const {
+    for (const std::pair<const AsyncRequestID, AsyncRequest>& request : async_requests) {
+        if (request.second.waiting.count(pos) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename Alignment, typename BackendType>
+size_t BasicHerix<Alignment, BackendType>::pollAsync (bool wait) {
+    if (!async_loader) {
+        return 0;
+    }
+
+    // If another view has written to a file, then what's in flight is dropped along with the chunks
+    checkSharedGeneration();
+
+    std::vector<AsyncReadResult> results;
+    async_loader->collect(results, wait);
+    if (results.empty()) {
+        return 0;
+    }
+
+    std::vector<ChunkID> installed;
+    std::vector<AsyncReadRequest> resubmit;
+    std::optional<std::exception_ptr> error;
+    for (AsyncReadResult& result : results) {
+        if (result.epoch != async_epoch) {
+            // Submitted before the chunks were thrown away (such as by a save), so the data may be out of date. A
+            // current read of the chunk finishes the requests waiting on it, so if there isn't one it's submitted.
+            if (in_flight.count(result.pos) != 0) {
+                continue;
+            }
+            if (!findChunk(result.pos).has_value() && isAwaited(result.pos)) {
+                in_flight.insert(result.pos);
+                resubmit.push_back(AsyncReadRequest{ result.pos, std::min(getAlignedChunkEnd(result.pos), getFileEnd()) - result.pos, async_epoch });
+                continue;
+            }
+        } else {
+            in_flight.erase(result.pos);
+            if (result.error) {
+                error = result.error;
+            } else if (!findChunk(result.pos).has_value()) {
+                // It could have been loaded synchronously while it was in flight
+                ChunkSize size = getAlignedChunkEnd(result.pos) - result.pos;
+                AbsoluteFilePosition block_start = getBlockStart(result.pos, chunk_size);
+                size_t length = result.data.size();
+                std::shared_ptr<const Buffer> block;
+                size_t offset = 0;
+                if (shared_cache != nullptr && block_start == getStartPosition() + result.pos && length == chunk_size) {
+                    // Only whole blocks can be shared
+                    block = shared_cache->put(file_identity, block_start, chunk_size, std::move(result.data));
+                } else {
+                    block = std::make_shared<const Buffer>(std::move(result.data));
+                }
+                ChunkID cid = installChunk(Chunk(result.pos, size, chunk_size, std::move(block), offset, length));
+                chunks.at(cid).touch();
+                installed.push_back(cid);
+            }
+        }
+
+        // A failed read still finishes the requests waiting on it, reading the range will then fail synchronously
+        for (std::pair<const AsyncRequestID, AsyncRequest>& request : async_requests) {
+            request.second.waiting.erase(result.pos);
+        }
+    }
+
+    if (!resubmit.empty()) {
+        async_loader->submit(resubmit);
+    }
+    if (!installed.empty()) {
+        cleanupChunks(installed);
+        reportMemory(installed);
+    }
+
+    // Collect the finished requests first, since a callback could submit a new request
+    std::vector<AsyncRequest> finished;
+    for (auto iter = async_requests.begin(); iter != async_requests.end();) {
+        if (iter->second.waiting.empty()) {
+            finished.push_back(std::move(iter->second));
+            iter = async_requests.erase(iter);
+        } else {
+            iter++;
+        }
+    }
+
+    for (AsyncRequest& request : finished) {
+        if (request.callback) {
+            request.callback(request.pos, request.size);
+        }
+    }
+
+    if (error.has_value()) {
+        std::rethrow_exception(error.value());
+    }
+
+    return finished.size();
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::waitAsync (AsyncRequestID id) {
+    while (!isRequestDone(id) && async_loader && async_loader->getPendingCount() > 0) {
+        pollAsync(true);
+    }
+}
+
+template<typename Alignment, typename BackendType>
+void BasicHerix<Alignment, BackendType>::waitAsyncFinished () {
+    if (async_loader) {
+        async_loader->waitFinished();
+    }
+}
+
+template<typename Alignment, typename BackendType>
+bool BasicHerix<Alignment, BackendType>::isRangeCached (FilePosition pos, size_t size) const {
+    size_t range_end = std::min(pos + size, getFileEnd());
+    for (FilePosition current = pos; current < range_end;) {
+        std::optional<ChunkID> cid = findChunk(current);
+        if (!cid.has_value()) {
+            return false;
+        }
+        const Chunk& chunk = chunks.at(cid.value());
+        current = chunk.start + chunk.size;
+    }
+    return true;
+}
+
+template<typename Alignment, typename BackendType>
+size_t BasicHerix<Alignment, BackendType>::readCachedInto (FilePosition pos, size_t size, Byte* output, Byte* available_mask) {
+    size_t range_end = std::min(pos + size, getFileEnd());
+
+    for (FilePosition current = pos; current < range_end;) {
+        std::optional<ChunkID> cid = findChunk(current);
+        if (!cid.has_value()) {
+            // Skip to the next chunk boundary
+            current = getAlignedChunkEnd(current);
+            continue;
+        }
+
+        Chunk& chunk = chunks.at(cid.value());
+        chunk.touch();
+        size_t offset = current - chunk.start;
+        size_t amount = std::min(range_end - current, chunk.getRealSize() > offset ? chunk.getRealSize() - offset : 0);
+        std::memcpy(output + (current - pos), chunk.getData() + offset, amount);
+        std::memset(available_mask + (current - pos), 1, amount);
+        // Holes in the backend aren't available, the same as past the end of the file
+        if (backend->hasHoles()) {
+            for (size_t i = 0; i < amount;) {
+                size_t present = backend->getPresentRun(getStartPosition() + current + i, amount - i);
+                if (present == 0) {
+                    available_mask[current - pos + i] = 0;
+                    i++;
+                }
+                i += present;
+            }
+        }
+        current = chunk.start + chunk.size;
+    }
+
+    // Transformed bytes still need the file's data, so they only count if they were loaded
+    edits.applyTo(pos, size, output, available_mask, false);
+
+    return static_cast<size_t>(std::count(available_mask, available_mask + size, 1));
+}
+
+// The library is built with both alignments, and a file-only instance, so the definitions can stay in here
+template class HerixLib::BasicHerix<RuntimeChunkAlignment>;
+template class HerixLib::BasicHerix<PowerOfTwoChunkAlignment>;
+template class HerixLib::BasicHerix<PowerOfTwoChunkAlignment, FileBackend>;
+
+// === Testing ===
+
+#ifdef DEBUG
+
+#include <thread>
+
+/// Bytes which don't repeat within a chunk, for reading back through the chunks
+static Buffer makeChunkTestContents () {
+    Buffer contents;
+    for (size_t i = 0; i < 64 * 1024; i++) {
+        contents.push_back(static_cast<Byte>((i * 37) ^ (i >> 8)));
+    }
+    return contents;
+}
+
+void HerixLib::test_chunks () {
+    Buffer contents = makeChunkTestContents();
+    std::filesystem::path path = writeTestFile("herix_test_chunks.bin", contents);
+
+    // = Fixed size chunks
+    {
+        Metrics::reset();
+        Herix h(path, false, std::make_pair(0, std::nullopt), 16 * 1024, 1024);
+        for (size_t i = 0; i < contents.size(); i++) {
+            assert(h.read(i).value() == contents[i]);
+        }
+        if constexpr (Metrics::enabled) {
+            MetricsSnapshot metrics = Metrics::snapshot();
+            assert(metrics.get(Counter::ChunkMisses) == 64);
+            assert(metrics.get(Counter::ChunkEvictions) == 64 - 16);
+            assert(metrics.get(Counter::BytesRead) == contents.size());
+            assert(metrics.getCount(Histogram::ChunkLoadMicroseconds) == 64);
+        }
+
+        ChunkTelemetry telemetry = h.getChunkTelemetry();
+        assert(telemetry.misses == 64);
+        assert(telemetry.loads_by_size.size() == 1);
+        assert(telemetry.loads_by_size.at(1024) == 64);
+        assert(telemetry.bytes_loaded == contents.size());
+        assert(h.getChunkMemory() <= 16 * 1024);
+        // The first chunks were evicted, the last ones are still there
+        assert(!h.hasChunk(0) && h.hasChunk(63) && !h.hasChunk(64));
+
+        // A count past the end of the file is cut off before anything is allocated
+        std::vector<uint32_t> tail = h.readArray<uint32_t>(contents.size() - 9, std::numeric_limits<size_t>::max());
+        assert(tail.size() == 2);
+        assert((tail[1] == decodeValue<uint32_t, Endian::Little>(contents.data() + contents.size() - 5)));
+        assert(h.readArray<uint32_t>(contents.size() + 10, 4).empty());
+    }
+
+    std::filesystem::remove(path);
+}
+
+void HerixLib::test_adaptive_chunks () {
+    Buffer contents = makeChunkTestContents();
+    std::filesystem::path path = writeTestFile("herix_test_adaptive_chunks.bin", contents);
+
+    // = Adaptive chunks grow for sequential access, limited by the chunk memory
+    {
+        Herix h(path, false, std::make_pair(0, std::nullopt), 16 * 1024, 1024);
+        h.enableAdaptiveChunking(64 * 1024);
+        for (size_t i = 0; i < contents.size(); i++) {
+            assert(h.read(i).value() == contents[i]);
+        }
+
+        ChunkTelemetry telemetry = h.getChunkTelemetry();
+        assert(telemetry.misses < 64);
+        assert(telemetry.loads_by_size.rbegin()->first == 4096);
+        assert(h.getChunkMemory() <= 16 * 1024);
+
+        // Random access goes back to the smallest chunks, and positions inside of the larger chunks still resolve
+        h.resetChunkTelemetry();
+        for (size_t i = 1; i < 200; i++) {
+            FilePosition pos = (i * 7919) % contents.size();
+            assert(h.read(pos).value() == contents[pos]);
+        }
+        telemetry = h.getChunkTelemetry();
+        assert(telemetry.hits + telemetry.misses == 199);
+        assert(telemetry.loads_by_size.at(1024) > telemetry.misses / 2);
+        assert(h.getChunkMemory() <= 16 * 1024);
+
+        size_t total = 0;
+        for (const std::pair<const ChunkSize, size_t>& entry : telemetry.loaded_sizes) {
+            total += entry.first * entry.second;
+        }
+        assert(total == h.getChunkMemory());
+    }
+
+    std::filesystem::remove(path);
+}
+
+void HerixLib::test_power_of_two_chunks () {
+    Buffer contents = makeChunkTestContents();
+    std::filesystem::path path = writeTestFile("herix_test_power_of_two_chunks.bin", contents);
+
+    // = Power of two chunks, which are aligned with masks
+    {
+        PowerOfTwoHerix h(path, false, std::make_pair(100, std::nullopt), 16 * 1024, 1024);
+        h.enableAdaptiveChunking(8 * 1024);
+        Buffer data(contents.size());
+        assert(h.readInto(0, data.size(), data.data()) == contents.size() - 100);
+        assert(std::equal(data.begin(), data.begin() + static_cast<std::ptrdiff_t>(contents.size() - 100), contents.begin() + 100));
+        for (size_t i = 1; i < 200; i++) {
+            FilePosition pos = (i * 7919) % (contents.size() - 100);
+            assert(h.read(pos).value() == contents[100 + pos]);
+        }
+        assert(h.getAlignedChunk(5000) == 4096 - 100);
+
+        bool threw = false;
+        try {
+            PowerOfTwoHerix bad(path, false, std::make_pair(0, std::nullopt), 16 * 1024, 1000);
+        } catch (std::invalid_argument&) {
+            threw = true;
+        }
+        assert(threw);
+
+        // Reading through the FileBackend directly gives the same bytes, and it can't be given other backends
+        PowerOfTwoFileHerix file_h(path, false, std::make_pair(100, std::nullopt), 16 * 1024, 1024);
+        for (size_t i = 1; i < 200; i++) {
+            FilePosition pos = (i * 7919) % (contents.size() - 100);
+            assert(file_h.read(pos).value() == contents[100 + pos]);
+        }
+        assert(file_h.getBackend()->getName() == std::string("file"));
+        assert(!file_h.isCompressedFile());
+        threw = false;
+        try {
+            file_h.loadPooledFile(path);
+        } catch (std::logic_error&) {
+            threw = true;
+        }
+        assert(threw && file_h.hasFile());
+    }
+
+    std::filesystem::remove(path);
+}
+
+void HerixLib::test_edit_snapshots () {
+    Buffer contents = makeChunkTestContents();
+    std::filesystem::path path = writeTestFile("herix_test_edit_snapshots.bin", contents);
+
+    // = Snapshots of the edits, read on another thread while editing carries on
+    {
+        Herix h(path, false, std::make_pair(0, std::nullopt), 16 * 1024, 1024);
+        h.fill(1000, 3000, Buffer{ 1, 2 });
+        h.edit(50000, 0xEE);
+        std::shared_ptr<const EditStorage> snapshot = h.snapshotEdits();
+
+        Buffer expected = contents;
+        for (size_t i = 0; i < 3000; i++) {
+            expected[1000 + i] = static_cast<Byte>((i % 2) + 1);
+        }
+        expected[50000] = 0xEE;
+
+        Buffer from_snapshot;
+        std::thread reader([&path, &snapshot, &from_snapshot] () {
+            for (size_t pass = 0; pass < 5; pass++) {
+                from_snapshot.clear();
+                SequentialReader snapshot_reader(path, 0, 0, 64 * 1024, snapshot.get());
+                while (std::optional<SequentialBlock> block = snapshot_reader.next()) {
+                    from_snapshot.insert(from_snapshot.end(), block->data, block->data + block->size);
+                }
+            }
+        });
+        for (size_t i = 0; i < 2000; i++) {
+            h.edit((i * 7919) % contents.size(), 0);
+        }
+        h.transform(0, 64 * 1024, TransformOp::Xor, Buffer{ 0xFF });
+        reader.join();
+        assert(from_snapshot == expected);
+
+        // Restoring tells listeners about what differs
+        std::vector<EditRange> changed;
+        h.addChangeListener([&changed] (FilePosition pos, size_t size) {
+            changed.push_back(std::make_pair(pos, size));
+        });
+        h.restoreEdits(*snapshot);
+        // The transform covers every one of the edits, so there's a single range
+        assert((changed == std::vector<EditRange>{ { 0, 64 * 1024 } }));
+        Buffer restored(contents.size());
+        assert(h.readInto(0, restored.size(), restored.data()) == contents.size());
+        assert(restored == expected);
+        assert(h.canUndo());
+        h.undo();
+        assert(h.read(50000).value() == contents[50000]);
+
+        // Restoring to where it already is changes nothing
+        h.redo();
+        changed.clear();
+        h.restoreEdits(*snapshot);
+        assert(changed.empty());
+    }
+
+    std::filesystem::remove(path);
+}
+
+void HerixLib::test_undo_info () {
+    Buffer contents = makeChunkTestContents();
+    std::filesystem::path path = writeTestFile("herix_test_undo_info.bin", contents);
+
+    // = What was undone is read through the spill store, and fills and groups give the values they wrote
+    {
+        Herix h(path, false, std::make_pair(0, std::nullopt), 16 * 1024, 1024);
+        h.edits.setSpillThreshold(64);
+        Buffer large(100);
+        for (size_t i = 0; i < large.size(); i++) {
+            large[i] = static_cast<Byte>(i + 1);
+        }
+        h.editMultiple(500, large);
+        assert(h.edits.getSpilledBytes() == 100);
+        UndoInfo info = h.undo();
+        assert(info.wasSuccess());
+        assert((info.getSpan() == std::make_optional<EditRange>(500, 100)));
+        Buffer values(120);
+        Buffer written(120);
+        assert(info.readValues(490, 120, values.data(), written.data()) == 100);
+        assert(std::equal(large.begin(), large.end(), values.begin() + 10));
+        assert(written[9] == 0 && written[10] == 1 && written[109] == 1 && written[110] == 0);
+
+        h.fill(0, 10, Buffer{ 1, 2, 3 });
+        info = h.undo();
+        assert(info.readValues(0, 10, values.data()) == 10);
+        assert((Buffer(values.begin(), values.begin() + 10) == Buffer{ 1, 2, 3, 1, 2, 3, 1, 2, 3, 1 }));
+
+        assert(h.replaceAll(Buffer{ contents[4], contents[5] }, Buffer{ 0xAA, 0xBB }) > 1);
+        info = h.undo();
+        assert(info.readValues(0, 8, values.data(), written.data()) == 2);
+        assert(values[4] == 0xAA && values[5] == 0xBB && written[3] == 0 && written[6] == 0);
+
+        h.transform(0, 10, TransformOp::Xor, Buffer{ 1 });
+        info = h.undo();
+        assert(info.isTransform());
+        bool threw = false;
+        try {
+            info.readValues(0, 10, values.data());
+        } catch (std::logic_error&) {
+            threw = true;
+        }
+        assert(threw);
+        assert(!h.undo().wasSuccess());
+    }
+
+    std::filesystem::remove(path);
+}
+
+void HerixLib::test_transform_edits () {
+    Buffer contents = makeChunkTestContents();
+    std::filesystem::path path = writeTestFile("herix_test_transform_edits.bin", contents);
+
+    // = Transforms, applied to whatever is underneath them as it's read and saved
+    {
+        Buffer key{ 0x11, 0x22, 0x33 };
+        auto expected = [&] (FilePosition pos, Byte value) {
+            return static_cast<Byte>(value ^ key[pos % 3]);
+        };
+
+        Herix h(path, true, std::make_pair(0, std::nullopt), 16 * 1024, 1024);
+        h.edit(10, 0x55);
+        h.transform(0, 40000, TransformOp::Xor, key);
+        h.edit(20, 0x66);
+        assert(h.edits.getMemoryUsage() < 1024);
+        assert(h.read(5).value() == expected(5, contents[5]));
+        assert(h.read(10).value() == expected(10, 0x55));
+        assert(h.read(20).value() == 0x66);
+        assert(h.read(40000).value() == contents[40000]);
+        assert(h.isEdited(39999) && !h.isEdited(40000));
+        assert((h.getEditedRanges(0, 50000) == std::vector<EditRange>{ { 0, 40000 } }));
+
+        Buffer data(contents.size());
+        Buffer mask(contents.size(), 0);
+        assert(h.readInto(0, data.size(), data.data(), mask.data()) == contents.size());
+        for (size_t i = 0; i < data.size(); i++) {
+            Byte value = i == 10 ? expected(10, 0x55) : (i == 20 ? 0x66 : (i < 40000 ? expected(i, contents[i]) : contents[i]));
+            assert(data[i] == value);
+            assert(mask[i] == (i < 40000 ? 1 : 0));
+        }
+        assert(h.find(0, Buffer(data.begin() + 30000, data.begin() + 30040)) == std::make_optional<FilePosition>(30000));
+
+        // Undone as a single item
+        h.undo();
+        assert(h.read(20).value() == expected(20, contents[20]));
+        h.undo();
+        assert(h.read(5).value() == contents[5]);
+        assert(h.read(10).value() == 0x55);
+        assert(!h.isEdited(5));
+        h.redo();
+        h.redo();
+        assert(h.read(5).value() == expected(5, contents[5]));
+
+        // In a transaction it's undone along with the other edits
+        Byte before = h.read(0).value();
+        h.beginTransaction();
+        h.transform(0, 10, TransformOp::Add, Buffer{ 1 });
+        h.edit(0, 0x42);
+        h.transform(0, 1, TransformOp::Add, Buffer{ 1 });
+        h.commitTransaction();
+        assert(h.read(0).value() == 0x43);
+        UndoInfo transaction_info = h.undo();
+        assert(transaction_info.isTransform());
+        assert((transaction_info.getSpan() == std::make_optional<EditRange>(0, 10)));
+        assert(h.read(0).value() == before);
+        h.redo();
+        assert(h.read(0).value() == 0x43);
+        h.undo();
+
+        // Undone edits aren't saved
+        h.edit(30, 0x77);
+        h.undo();
+        h.saveHistoryDestructive();
+        Herix saved(path, false, std::make_pair(0, std::nullopt), 16 * 1024, 1024);
+        Buffer saved_data(contents.size());
+        assert(saved.readInto(0, saved_data.size(), saved_data.data()) == contents.size());
+        assert(saved_data == data);
+    }
+
+    std::filesystem::remove(path);
+}
+
+#endif
@@ -1,14 +1,30 @@
 #ifndef FILE_SEEN_HERIX
 #define FILE_SEEN_HERIX
+#include <algorithm>
 #include <optional>
 #include <ctime>
 #include <map>
+#include <limits>
 #include <chrono>
 #include <fstream>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <set>
+#include <span>
+#include <unordered_map>
 
 #include "types.hpp"
+#include "decode.hpp"
 #include "editstorage.hpp"
+#include "asyncloader.hpp"
+#include "memorygovernor.hpp"
+#include "sharedcache.hpp"
+#include "chunkpool.hpp"
+#include "slabpool.hpp"
+#include "backend.hpp"
+#include "compressedfile.hpp"
+#include "filepool.hpp"
 
 namespace HerixLib {
 
@@ -16,14 +32,31 @@ namespace HerixLib {
 
 // This is a class of if I ever need to add more undo info, it will be put here
 class UndoInfo {
+    protected:
+    /// The items that were undone (or redone) in history order, which is every item of a transaction. Their data
+    /// isn't the values they wrote: it's empty if it was spilled, just the pattern of a fill, the runs' bytes of a
+    /// group or the key of a transform. Go through readValues instead.
+    std::vector<EditStorageItem> undone;
+    /// Holds the items' data if it was spilled
+    std::shared_ptr<SpillStore> spill_store;
+
     public:
-    // If you want the raw value.
-    std::optional<EditStorageItem> undone;
     bool success = false;
 
-    UndoInfo (std::optional<EditStorageItem> t_undone);
+    UndoInfo (std::vector<EditStorageItem> t_undone, std::shared_ptr<SpillStore> t_spill_store=nullptr);
 
     bool wasSuccess ();
+    /// The range the items covered, from the first byte written to the last. nullopt if nothing was undone.
+    std::optional<EditRange> getSpan () const;
+    /// Transforms combine a key with what's underneath them rather than writing values, so readValues can't be used
+    /// if any of the items was one
+    bool isTransform () const;
+    /// The values the items wrote within [pos, pos+size) into output, with later items overwriting earlier ones,
+    /// whether their data was spilled or not. Bytes of the range they didn't write (such as the gaps in a group) are
+    /// left alone, and if written_mask isn't null they're set to 0 in it and the written ones to 1. Returns the
+    /// amount of bytes written.
+    /// Throws std::logic_error if nothing was undone, or there was a transform.
+    size_t readValues (FilePosition pos, size_t size, Byte* output, Byte* written_mask=nullptr) const;
 };
 using RedoInfo = UndoInfo;
 
@@ -31,13 +64,57 @@ using FilePositionStart = FilePosition;
 using FilePositionEnd = FilePosition;
 using ChunkSize = FilePosition;
 using ChunkID = size_t;
+using ListenerID = size_t;
+/// Called with the range [pos, pos+size) whose edited values changed.
+using ChangeCallback = std::function<void(FilePosition, size_t)>;
+
+class ChangeListener {
+    public:
+    /// Called just before the range changes, so the old values can still be read. May be empty.
+    /// This isn't called when the whole file is swapped out (such as by loadFile), only after is.
+    ChangeCallback before;
+    ChangeCallback after;
+};
+
+using AsyncRequestID = size_t;
+
+/// A range that was requested to be loaded in the background
+class AsyncRequest {
+    public:
+    FilePosition pos;
+    size_t size;
+    /// Called once every chunk in the range is cached. Can be empty.
+    ChangeCallback callback;
+    /// Starts of the chunks that haven't arrived yet
+    std::set<FilePosition> waiting;
+};
+
+/// Counters for how the chunk cache is being used, see Herix::getChunkTelemetry
+class ChunkTelemetry {
+    public:
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t bytes_loaded = 0;
+    /// Chunk size to how many chunks of that size are currently loaded
+    std::map<ChunkSize, size_t> loaded_sizes;
+    /// Chunk size to how many chunks of that size have been loaded, over the lifetime (or since the last reset)
+    std::map<ChunkSize, size_t> loads_by_size;
+};
 
 class Chunk {
     public:
     FilePositionStart start;
-    /// NOTE: data.size() may be less than size! size is the blocksize we were divvying up.
+    /// NOTE: getRealSize() may be less than size! size is the blocksize we were divvying up.
     ChunkSize size;
-    Buffer data;
+    /// The size of the block of the file this chunk is part of. Blocks are aligned to their size in the file itself,
+    /// rather than relative to the start position, so that instances viewing the same file from different starts
+    /// can share them. This is the same as size, other than for a chunk cut off by the start position.
+    ChunkSize block_size;
+    /// The data is [offset, offset+length) of block, which may be shared with other instances (see SharedChunkCache)
+    /// or be a slot of a SlabPool.
+    std::shared_ptr<const Byte> block;
+    size_t offset = 0;
+    size_t length = 0;
     /// How many times this chunk has read.
     size_t touched = 0;
     /// The time of the last time it was touched. 0 means this hasn't been set, or it's been reset due to error.
@@ -45,16 +122,44 @@ class Chunk {
 
     Chunk (FilePositionStart t_start, ChunkSize t_size, Buffer t_data);
     Chunk (FilePositionStart t_start, ChunkSize t_size);
+    Chunk (FilePositionStart t_start, ChunkSize t_size, ChunkSize t_block_size, std::shared_ptr<const Buffer> t_block, size_t t_offset, size_t t_length);
+    Chunk (FilePositionStart t_start, ChunkSize t_size, ChunkSize t_block_size, std::shared_ptr<const Byte> t_block, size_t t_offset, size_t t_length);
 
     bool isSizeEqual () const;
     void touch (size_t times=1);
     std::optional<std::chrono::milliseconds> timeElapsed ();
     size_t getRealSize () const;
+    /// Null if the chunk has no data
+    const Byte* getData () const;
 
     void updateTime ();
 };
 
-class Herix {
+/// Aligns chunks of any size, with a division
+class RuntimeChunkAlignment {
+    public:
+    static constexpr bool requires_power_of_two = false;
+
+    static AbsoluteFilePosition alignDown (AbsoluteFilePosition pos, ChunkSize size) {
+        return pos - (pos % size);
+    }
+};
+
+/// Aligns chunks with a mask, for when the chunk size is a power of two. Every size chunks grow to is then one too.
+class PowerOfTwoChunkAlignment {
+    public:
+    static constexpr bool requires_power_of_two = true;
+
+    static AbsoluteFilePosition alignDown (AbsoluteFilePosition pos, ChunkSize size) {
+        return pos & ~(size - 1);
+    }
+};
+
+/// The editor for one file. Alignment decides how positions are aligned to chunks on every access, see Herix and
+/// PowerOfTwoHerix. BackendType is what it reads through: the virtual Backend can hold any of them, while a final
+/// one such as FileBackend is called directly (see PowerOfTwoFileHerix). These are compiled into the library.
+template<typename Alignment, typename BackendType=Backend>
+class BasicHerix {
     protected:
 
     // TODO: think about moving the chunk data into it's own class (perhaps inside of this class via nested classes)
@@ -65,29 +170,131 @@ class Herix {
     /// I use this instead of a vector since I didn't want to deal with constantly modifying the
     /// current index when a chunk is removed from the vector.
     std::map<ChunkID, Chunk> chunks;
+    /// Block size to (absolute block start to id). Chunks are always aligned to their own size, so finding the chunk
+    /// holding a position is one lookup per chunk size in use rather than a walk over every chunk.
+    std::map<ChunkSize, std::unordered_map<FilePosition, ChunkID>> chunk_index;
+    /// Nodes of chunks and chunk_index left over by eraseChunk, which installChunk reuses. Loading a chunk usually
+    /// evicts one, so this keeps the bookkeeping from allocating on every load.
+    std::vector<std::map<ChunkID, Chunk>::node_type> spare_chunk_nodes;
+    std::vector<std::unordered_map<FilePosition, ChunkID>::node_type> spare_index_nodes;
+    /// Filled by getEvictionOrder, kept between calls for its capacity
+    std::vector<ChunkID> eviction_order;
+    /// Sum of the sizes of the loaded chunks
+    size_t chunk_memory = 0;
+    /// Sum of the sizes of the loaded chunks data, which is less than chunk_memory for chunks at the end of the file
+    size_t chunk_data_memory = 0;
+
+    MemoryGovernor::Membership governor_membership;
+
+    /// Fills order with the chunk ids in the order they should be removed
+    void getEvictionOrder (std::span<const ChunkID> ignore, std::vector<ChunkID>& order) const;
+    /// Removes chunks, coldest first, until at least bytes of chunk data have been freed
+    void evictChunks (size_t bytes, std::span<const ChunkID> ignore);
+    std::chrono::milliseconds getColdestTouch () const;
+    /// Tells the governor (if there is one) what's in use, and releases what it asks for
+    void reportMemory (std::span<const ChunkID> ignore);
 
     /// The max memory that can be taken by chunks. Note that this isn't overall, just the chunk storage.
-    /// If you want overall control, you will likely have to proactively mess with EditStorage and such.
+    /// For a budget covering edits, and shared between instances, see setMemoryGovernor.
     ChunkSize max_chunk_memory;
     /// Max chunk size.
     /// More chunks = more reading the file for parts, but also possibly less memory usage
     /// I rec having at least max_chunk
     ChunkSize chunk_size;
 
-    // I would have this use Byte instead of char, but read fails (sets fail and bad bit) if you use Byte.
-    // Since Byte=uint8_t=unsigned char, and the supported char_traits has char (and a few wchar things)
-    // it will fail. I could write my own char_traits for unsigned char, but I'll just cast from char
-
-    // No need to be wrapped in an optional since it can just have a file.
-    std::fstream file;
+    // == Adaptive chunking ==
+    /// The largest chunk that a sequential run can grow to. Equal to chunk_size when adaptive chunking is off.
+    ChunkSize max_extent_size;
+    /// The end of the chunk used by the last fetch. A miss here means access is sequential.
+    FilePosition last_chunk_end = std::numeric_limits<FilePosition>::max();
+    /// How many misses in a row have been right after the previous one
+    size_t sequential_run = 0;
+    ChunkTelemetry telemetry;
+
+    ChunkSize pickChunkSize () const;
+    ChunkID installChunk (Chunk chunk);
+    void eraseChunk (ChunkID id);
+    /// Drops chunks smaller than size inside of the block at block_start, before a larger chunk covering them is loaded
+    void eraseChunksWithin (AbsoluteFilePosition block_start, ChunkSize size);
+    /// The absolute start of the block of block_size which holds pos
+    AbsoluteFilePosition getBlockStart (FilePosition pos, ChunkSize block_size) const;
 
     AbsoluteFilePosition start_position = 0;
     std::optional<AbsoluteFilePosition> end_position = std::nullopt;
 
+    /// What chunks are read from and edits saved into: a FileBackend for a file opened by path, otherwise what was
+    /// given to loadBackend (or loadCompressedFile). Null while there's no file. Shared with the background readers.
+    std::shared_ptr<BackendType> backend;
+
+    /// Counts the current id for listeners
+    ListenerID l_count = 0;
+    std::map<ListenerID, ChangeListener> change_listeners;
+
+    void notifyBeforeChange (FilePosition pos, size_t size);
+    void notifyChange (FilePosition pos, size_t size);
+
+    // == Async loading ==
+    /// Null unless async loading has been enabled
+    std::unique_ptr<AsyncLoader> async_loader;
+    bool async_enabled = false;
+    size_t async_thread_count = 0;
+    /// Counts the current id for async requests
+    AsyncRequestID a_count = 0;
+    std::map<AsyncRequestID, AsyncRequest> async_requests;
+    /// Starts of chunks that have been submitted to the loader but haven't arrived
+    std::set<FilePosition> in_flight;
+    /// Bumped whenever the chunks are thrown away, such as by a save. Reads submitted before then may have the old
+    /// data, so their results are dropped.
+    uint64_t async_epoch = 0;
+
+    void resetAsync ();
+    /// If any request is waiting on the chunk at pos
+    bool isAwaited (FilePosition pos) const;
+
     void destroyChunk (ChunkID id);
-    void loadChunk (FilePosition pos, ChunkSize read_size);
-    void loadIntoChunk (FilePosition pos, ChunkSize read_size, ChunkID cid, Chunk& chunk, bool eof_handling=false);
+    /// Loads the chunk at pos, which is block_size in the file but may be cut off by the start position
+    void loadChunk (FilePosition pos, ChunkSize read_size, ChunkSize block_size);
+    /// Reads up to size bytes at the absolute position, less if it hits the end of the file
+    Buffer readAbsolute (AbsoluteFilePosition pos, size_t size);
+    /// readAbsolute into output, returning how many were read
+    size_t readAbsoluteInto (AbsoluteFilePosition pos, size_t size, Byte* output);
+    /// Loads the chunks of [pos, pos+size) that aren't loaded with a single batch read from the backend
+    void loadMissingChunks (FilePosition pos, size_t size);
+    /// Reads and writes what's stored at an absolute position (in file or the backend), for saving
+    size_t readStored (AbsoluteFilePosition pos, size_t size, Byte* output);
+    void writeStored (AbsoluteFilePosition pos, const Byte* data, size_t size);
     ChunkID getNewChunkID ();
+    /// Gets the chunk which holds pos, loading it if need be.
+    Chunk& fetchChunk (FilePosition pos);
+
+    // == Shared cache ==
+    /// Null unless this instance shares its chunks, see setSharedCache
+    SharedChunkCache* shared_cache = nullptr;
+    FileIdentity file_identity;
+    /// The generation of the shared cache the loaded chunks are from
+    uint64_t shared_generation = 0;
+
+    /// Drops the loaded chunks if the shared cache has been invalidated since they were loaded
+    void checkSharedGeneration ();
+
+    // == Compressed tier ==
+    /// Null unless the compressed tier has been enabled
+    std::unique_ptr<CompressedChunkPool> compressed_pool;
+
+    /// Keeps the chunk in the compressed tier (if it's enabled) before it's erased
+    void compressChunk (ChunkID id);
+
+    // == Slab pool ==
+    /// Null unless the slab pool has been enabled
+    std::unique_ptr<SlabPool> slab_pool;
+
+    /// Storage for a block of block_size that's about to be read into: a slot of the slab pool if it's enabled,
+    /// otherwise a new buffer
+    std::shared_ptr<Byte> allocateBlock (ChunkSize block_size, size_t size);
+    size_t getPoolMemory () const;
+
+    /// Throws if the chunk size doesn't suit the alignment
+    void checkChunkSize () const;
 
     /// Swapping is used to note that we're swapping file (such as with saveas)
     /// And should be considered to be the same, so don't clear anything
@@ -105,14 +312,33 @@ class Herix {
     /// The filename to open
     /// Ten kilobytes. This default will likely be increased once the program is in a more stable state.
     /// Having at least three chunks being inside max_chunk memory is probably the best since it will allow more buffering to hide file loading.
-    Herix (std::filesystem::path t_filename, bool t_allow_writing=true, std::pair<AbsoluteFilePosition, std::optional<AbsoluteFilePosition>> read_pos=std::make_pair(0, std::nullopt), ChunkSize t_max_chunk_memory=1024*10, ChunkSize t_chunk_size=1024);
-    Herix (bool t_allow_writing=true, std::pair<AbsoluteFilePosition, std::optional<AbsoluteFilePosition>> read_pos=std::make_pair(0, std::nullopt), ChunkSize t_max_chunk_memory=1024*10, ChunkSize t_chunk_size=1024);
+    BasicHerix (std::filesystem::path t_filename, bool t_allow_writing=true, std::pair<AbsoluteFilePosition, std::optional<AbsoluteFilePosition>> read_pos=std::make_pair(0, std::nullopt), ChunkSize t_max_chunk_memory=1024*10, ChunkSize t_chunk_size=1024);
+    BasicHerix (bool t_allow_writing=true, std::pair<AbsoluteFilePosition, std::optional<AbsoluteFilePosition>> read_pos=std::make_pair(0, std::nullopt), ChunkSize t_max_chunk_memory=1024*10, ChunkSize t_chunk_size=1024);
 
     AbsoluteFilePosition getStartPosition () const noexcept;
     std::optional<AbsoluteFilePosition> getEndPosition () const noexcept;
 
     bool hasFile () const;
     void loadFile (std::filesystem::path t_filename);
+    /// Opens a gzip or zstd seekable file and views its decompressed contents, decompressing only the frames that
+    /// cover what's read (see CompressedFile). Edits work as normal, but can't be saved into the compressed file:
+    /// saveHistoryDestructive throws, while saveAsHistoryDestructive and exportTo write them out decompressed.
+    void loadCompressedFile (std::filesystem::path t_filename, const CompressedFileOptions& options=CompressedFileOptions());
+    bool isCompressedFile () const;
+    /// Null unless the file was opened with loadCompressedFile
+    CompressedFile* getCompressedFile () const;
+    /// Views the data of backend instead of a file, with filename being its path. Positions it doesn't have (see
+    /// Backend::isPresent) read as nullopt, like those past the end of a file. Saving writes the edits into the
+    /// backend, and throws std::logic_error if it isn't writable.
+    void loadBackend (std::shared_ptr<BackendType> t_backend);
+    /// A FileBackend unless the data was opened with loadBackend (or loadCompressedFile), null while there's no file
+    BackendType* getBackend () const;
+    /// The same as getBackend, for background readers that have to keep it alive
+    std::shared_ptr<BackendType> getSharedBackend () const;
+    /// Opens the file through pool (see PooledFile), so that it only has a descriptor open while it's being read or
+    /// written. For processes with more instances open than ulimit -n allows, along with a MemoryGovernor for their
+    /// chunks. Saving as keeps the new file in the same pool.
+    void loadPooledFile (std::filesystem::path t_filename, FilePool& pool=FilePool::getGlobal());
     void closeFile ();
     /// See: getFileEnd if you're trying to figure out where the file ends. This does not handle reading from a file at an offset.
     size_t getFileSize () const;
@@ -123,9 +349,55 @@ class Herix {
     bool hasChunks () const;
     bool hasChunk (ChunkID id) const;
 
-    void cleanupChunks (std::vector<ChunkID> ignore);
+    void cleanupChunks (std::span<const ChunkID> ignore);
     void invalidateChunks ();
-
+    /// Sum of the sizes of the loaded chunks
+    size_t getChunkMemory () const;
+    /// The most memory the loaded chunks can take, not counting any governor
+    size_t getMaxChunkMemory () const;
+
+    /// Lets chunks grow for sequential access: each miss right after the previous load doubles the chunk size, up to
+    /// max_extent (also limited to a quarter of the max chunk memory). Random access stays at chunk_size.
+    void enableAdaptiveChunking (ChunkSize max_extent=1024*1024);
+    void disableAdaptiveChunking ();
+    bool isAdaptiveChunkingEnabled () const;
+    ChunkTelemetry getChunkTelemetry () const;
+    void resetChunkTelemetry ();
+
+    /// Puts this instance under a budget shared with other instances, on top of its own max_chunk_memory.
+    /// nullptr removes it from the governor it's in.
+    void setMemoryGovernor (MemoryGovernor* governor);
+    MemoryGovernor* getMemoryGovernor () const;
+    /// Releases whatever the governor has asked of this instance. Loads and edits already do this, so this is for
+    /// instances that sit idle while others are busy.
+    void releaseRequestedMemory ();
+    /// Bytes used by chunk data and edits
+    size_t getMemoryUsage () const;
+
+    /// Shares chunk data with every other instance using cache that has the same file open, whatever their start
+    /// and end positions are. Edits stay separate. Saving through one of them invalidates the file in the cache, and
+    /// the others drop their chunks on their next load. nullptr stops sharing.
+    void setSharedCache (SharedChunkCache* cache);
+    SharedChunkCache* getSharedCache () const;
+
+    /// Keeps chunks that cleanupChunks evicts LZ4 compressed in up to max_memory, so a later miss on one decompresses
+    /// it rather than reading the file again. Chunks dropped for a memory governor aren't kept, and neither are chunks
+    /// while a shared cache is in use, since it keeps recently used blocks itself.
+    void enableCompressedTier (size_t max_memory=CompressedChunkPool::default_max_memory);
+    void disableCompressedTier ();
+    bool isCompressedTierEnabled () const;
+    /// Empty statistics if it isn't enabled
+    CompressedChunkPoolStatistics getCompressedTierStatistics () const;
+
+    /// Reads chunks into slots of a SlabPool rather than new buffers, so that the slots of evicted chunks are reused
+    /// and steady scrolling doesn't go to the allocator. Blocks shared through a shared cache, and those loaded
+    /// asynchronously, still get their own buffers.
+    void enableSlabPool (SlabPoolOptions options=SlabPoolOptions());
+    /// Chunks that are loaded keep their slots until they're evicted
+    void disableSlabPool ();
+    bool isSlabPoolEnabled () const;
+    /// Empty statistics if it isn't enabled
+    SlabPoolStatistics getSlabPoolStatistics () const;
 
     std::optional<Byte> read (FilePosition pos);
     std::optional<Byte> readRaw (FilePosition pos);
@@ -133,11 +405,34 @@ class Herix {
     std::vector<std::optional<Byte>> readMultipleRaw (FilePosition pos, size_t size);
     std::vector<Byte> readMultipleCutoff (FilePosition pos, size_t size);
     // TODO: add readRawMultipleCutoff
+    size_t readInto (FilePosition pos, size_t size, Byte* output, Byte* edited_mask=nullptr);
+    size_t readRawInto (FilePosition pos, size_t size, Byte* output);
+
+    // Typed reads. These do a single span read, so a value straddling chunks costs no more than one within a chunk.
+    template<typename T, Endian E=Endian::Little>
+    std::optional<T> readValue (FilePosition pos);
+    template<typename T, Endian E=Endian::Little>
+    std::vector<T> readArray (FilePosition pos, size_t count);
+    std::optional<VarIntResult<uint64_t>> readULEB128 (FilePosition pos);
+    std::optional<VarIntResult<int64_t>> readSLEB128 (FilePosition pos);
 
     void edit (FilePosition pos, Byte value);
     void editMultiple (FilePosition pos, Buffer values);
-
+    /// Writes pattern repeated over [pos, pos+size). Only the pattern is stored, reads over it generate the bytes.
+    void fill (FilePosition pos, size_t size, Buffer pattern);
+    /// Overwrites every match of needle from pos on with replacement, as one edit (and one undo step) which stores
+    /// replacement once. Matches that overlap an earlier one are skipped. The two must be the same size, since
+    /// edits can't change the size of the file. Returns how many were replaced.
+    size_t replaceAll (const Buffer& needle, Buffer replacement, FilePosition pos=0);
+    /// Combines [pos, pos+size) with key repeated over it using op, such as XORing out an obfuscation. Only the key is
+    /// stored: the transform is applied as the bytes are read, searched or saved, and is undone like any other edit.
+    void transform (FilePosition pos, size_t size, TransformOp op, Buffer key);
+
+    /// The start of the chunk_size chunk holding pos. Chunks are aligned in the file, so the first chunk may start
+    /// before the start position, in which case this is 0.
     FilePosition getAlignedChunk (FilePosition pos) const;
+    /// The end of the chunk_size chunk holding pos
+    FilePosition getAlignedChunkEnd (FilePosition pos) const;
     FilePosition getNearestAlignedChunk (FilePosition pos) const;
 
     std::optional<ChunkID> findChunk(FilePosition pos) const;
@@ -145,15 +440,72 @@ class Herix {
     UndoInfo undo ();
     RedoInfo redo ();
 
+    /// Groups every edit until the matching commitTransaction into a single undo step, such as for a replace all.
+    /// Reads see the edits as they're made. Transactions can be nested, only the outermost one counts.
+    void beginTransaction ();
+    void commitTransaction ();
+    /// Throws away every edit since the outermost beginTransaction
+    void rollbackTransaction ();
+    bool isInTransaction () const;
+
+    /// An O(1) copy of the edits, for trying something out and going back with restoreEdits. It shares the items
+    /// with the live edits, so memory only grows with what changes after it. It never changes itself, so it can be
+    /// read on another thread while editing carries on, such as by a SequentialReader given the snapshot.
+    /// Throws std::logic_error in a transaction.
+    std::shared_ptr<const EditStorage> snapshotEdits () const;
+    /// Puts the edits back to how they were in snapshot, in O(1). Listeners are told about the edits that differ
+    /// between the two. Throws std::logic_error in a transaction.
+    void restoreEdits (const EditStorage& snapshot);
+
+    /// Listeners are told about every range whose value may have changed, through edits, undo/redo or the file changing.
+    ListenerID addChangeListener (ChangeCallback after, ChangeCallback before=nullptr);
+    void removeChangeListener (ListenerID id);
+
     bool hasUnsavedEdits () const;
+    /// If the byte at pos has been edited. This doesn't touch the file or the edits' data.
+    bool isEdited (FilePosition pos) const;
+    /// The edited ranges within [pos, pos+size), for highlighting the edited bytes in a view.
+    /// Kept up to date as edits are made and undone, so this is O(log n) plus the ranges returned.
+    std::vector<EditRange> getEditedRanges (FilePosition pos, size_t size) const;
 
     bool canUndo () const;
     bool canRedo () const;
 
     void saveHistoryDestructive ();
     void saveAsHistoryDestructive (std::string output);
+    void exportTo (std::filesystem::path output, FilePosition pos=0, std::optional<size_t> size=std::nullopt) const;
+
+    std::optional<FilePosition> find (FilePosition pos, const Buffer& needle) const;
+
+    // == Async loading ==
+    // Lets a GUI draw what is cached immediately, and fill in the rest once it arrives, rather than
+    // stalling on disk reads. Everything here (and the callbacks) happen on the thread that owns the instance.
+
+    /// thread_count is for the thread pool fallback when io_uring isn't available, 0 means one per core.
+    void enableAsyncLoading (size_t thread_count=0);
+    void disableAsyncLoading ();
+    bool isAsyncLoadingEnabled () const;
+    /// Name of the loader backend, or nullptr if async loading is disabled
+    const char* getAsyncLoaderName () const;
+
+    /// Submits every missing chunk in the range to be loaded in one batch.
+    /// callback is called (from pollAsync) once they've all arrived, immediately if they already have.
+    AsyncRequestID requestRange (FilePosition pos, size_t size, ChangeCallback callback=nullptr);
+    bool isRequestDone (AsyncRequestID id) const;
+    /// Puts loaded chunks into the cache and calls the callbacks of finished requests.
+    /// If wait is true then it blocks until at least one chunk arrives. Returns the amount of requests finished.
+    size_t pollAsync (bool wait=false);
+    /// Blocks until the request is done.
+    void waitAsync (AsyncRequestID id);
+    /// Blocks until every read in flight has finished, without putting them in the cache, which is still left to
+    /// pollAsync. Lets tests order a read finishing against other changes.
+    void waitAsyncFinished ();
+
+    bool isRangeCached (FilePosition pos, size_t size) const;
+    /// Like readInto, but never loads anything. available_mask entries are set to 1 for every byte that was cached or edited.
+    /// Returns the amount of available bytes.
+    size_t readCachedInto (FilePosition pos, size_t size, Byte* output, Byte* available_mask);
 
-    // TODO: find function that takes a position and bytes and returns the first one it finds, can then be sequentially tried
     // TODO: save function that doesn't destroy the history
     // - You will have to have a property which says it was written.
     // - There will have to be a way to undo the values other than just removing them.
@@ -163,5 +515,51 @@ class Herix {
     // TODO: function get nearest chunk, that does not have to include pos
 };
 
+/// Any chunk size
+using Herix = BasicHerix<RuntimeChunkAlignment>;
+/// Only power of two chunk sizes (the constructor throws otherwise), but finding chunks needs no division
+using PowerOfTwoHerix = BasicHerix<PowerOfTwoChunkAlignment>;
+/// PowerOfTwoHerix for files opened by path, which reads them without going through the virtual Backend. It can't
+/// load other backends (loadCompressedFile and loadPooledFile throw std::logic_error).
+using PowerOfTwoFileHerix = BasicHerix<PowerOfTwoChunkAlignment, FileBackend>;
+
+extern template class BasicHerix<RuntimeChunkAlignment>;
+extern template class BasicHerix<PowerOfTwoChunkAlignment>;
+extern template class BasicHerix<PowerOfTwoChunkAlignment, FileBackend>;
+
+void test_chunks ();
+void test_adaptive_chunks ();
+void test_power_of_two_chunks ();
+void test_edit_snapshots ();
+void test_undo_info ();
+void test_transform_edits ();
+
+/// Reads a value of type T at pos. Returns nullopt if any of its bytes are past the end.
+template<typename Alignment, typename BackendType>
+template<typename T, Endian E>
+std::optional<T> BasicHerix<Alignment, BackendType>::readValue (FilePosition pos) {
+    Byte data[sizeof(T)];
+    if (readInto(pos, sizeof(T), data) != sizeof(T)) {
+        return std::nullopt;
+    }
+    return decodeValue<T, E>(data);
+}
+
+/// Reads up to count values of type T starting at pos. The result is cut off at the last value that fully fits.
+template<typename Alignment, typename BackendType>
+template<typename T, Endian E>
+std::vector<T> BasicHerix<Alignment, BackendType>::readArray (FilePosition pos, size_t count) {
+    // Clamped to what's left of the file first, so a huge count can't overflow the size or allocate far more than
+    // could be read
+    size_t file_end = getFileEnd();
+    count = std::min(count, pos < file_end ? (file_end - pos) / sizeof(T) : 0);
+    Buffer data(count * sizeof(T));
+    size_t read_count = readInto(pos, data.size(), data.data()) / sizeof(T);
+
+    std::vector<T> result(read_count);
+    decodeArray<T, E>(data.data(), read_count, result.data());
+    return result;
+}
+
 }
 #endif
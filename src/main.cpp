@@ -2,9 +2,54 @@
 #include <filesystem>
 #include "types.hpp"
 #include "herix.hpp"
+#include "render.hpp"
+#include "statistics.hpp"
+#include "overview.hpp"
+#include "sequentialreader.hpp"
+#include "asyncloader.hpp"
+#include "tasks.hpp"
+#include "memorygovernor.hpp"
+#include "spillstore.hpp"
+#include "persistent.hpp"
+#include "sharedcache.hpp"
+#include "compression.hpp"
+#include "chunkpool.hpp"
+#include "slabpool.hpp"
+#include "compressedfile.hpp"
+#include "processmemory.hpp"
+#include "filepool.hpp"
+#include "metrics.hpp"
 
 int main () {
+#ifdef DEBUG
+    HerixLib::test_spillstore();
+    HerixLib::test_persistent();
+    HerixLib::test_rangeset();
+    HerixLib::test_transform();
     HerixLib::test_editstorage();
+    HerixLib::test_decode();
+    HerixLib::test_render();
+    HerixLib::test_statistics();
+    HerixLib::test_overview();
+    HerixLib::test_sequentialreader();
+    HerixLib::test_asyncloader();
+    HerixLib::test_tasks();
+    HerixLib::test_chunks();
+    HerixLib::test_adaptive_chunks();
+    HerixLib::test_power_of_two_chunks();
+    HerixLib::test_edit_snapshots();
+    HerixLib::test_undo_info();
+    HerixLib::test_transform_edits();
+    HerixLib::test_memorygovernor();
+    HerixLib::test_sharedcache();
+    HerixLib::test_compression();
+    HerixLib::test_chunkpool();
+    HerixLib::test_slabpool();
+    HerixLib::test_compressedfile();
+    HerixLib::test_processmemory();
+    HerixLib::test_filepool();
+    HerixLib::test_metrics();
+#endif
     HerixLib::Herix h = HerixLib::Herix(
         std::filesystem::current_path() / "test_files/text_file.txt",
         true,
@@ -53,6 +98,14 @@ int main () {
     }
     std::cout << "'\n";
 
+    // Chunk size is 8, so this straddles the first two chunks
+    std::cout << "u32 LE at 6: " << h.readValue<uint32_t>(6).value() << ", u32 BE at 6: " << h.readValue<uint32_t, HerixLib::Endian::Big>(6).value() << "\n";
+    std::cout << "u16 BE array at 0: ";
+    for (uint16_t value : h.readArray<uint16_t, HerixLib::Endian::Big>(0, 6)) {
+        std::cout << value << " ";
+    }
+    std::cout << "\n";
+
     return 0;
 }
 
@@ -0,0 +1,205 @@
+#include "memorygovernor.hpp"
+#include "herix.hpp"
+#include <cassert>
+#include <algorithm>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+using namespace HerixLib;
+
+MemoryGovernor::MemoryGovernor (size_t t_budget) : budget(t_budget) {}
+
+MemoryGovernor& MemoryGovernor::getGlobal () {
+    static MemoryGovernor governor;
+    return governor;
+}
+
+void MemoryGovernor::setBudget (size_t t_budget) {
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = t_budget;
+}
+size_t MemoryGovernor::getBudget () const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return budget;
+}
+size_t MemoryGovernor::getUsage () const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return usage;
+}
+size_t MemoryGovernor::getMemberCount () const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return members.size();
+}
+void MemoryGovernor::setPressureCallback (PressureCallback callback) {
+    std::lock_guard<std::mutex> lock(mutex);
+    on_pressure = std::move(callback);
+}
+
+GovernorMemberID MemoryGovernor::join () {
+    std::lock_guard<std::mutex> lock(mutex);
+    GovernorMemberID id = m_count++;
+    members.emplace(id, Member());
+    return id;
+}
+
+void MemoryGovernor::leave (GovernorMemberID id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = members.find(id);
+    if (iter == members.end()) {
+        return;
+    }
+    usage -= iter->second.chunk_bytes + iter->second.edit_bytes;
+    members.erase(iter);
+}
+
+size_t MemoryGovernor::distribute () {
+    for (std::pair<const GovernorMemberID, Member>& member : members) {
+        member.second.requested = 0;
+    }
+    if (usage <= budget) {
+        return 0;
+    }
+
+    std::vector<Member*> order;
+    for (std::pair<const GovernorMemberID, Member>& member : members) {
+        order.push_back(&member.second);
+    }
+    std::sort(order.begin(), order.end(), [] (const Member* a, const Member* b) {
+        return a->coldest < b->coldest;
+    });
+
+    // This asks the coldest member for everything it has before moving on. It's a rough approximation of
+    // evicting the coldest chunks process wide, without knowing the age of every chunk.
+    size_t over = usage - budget;
+    for (Member* member : order) {
+        if (over == 0) {
+            break;
+        }
+        member->requested = std::min(over, member->chunk_bytes);
+        over -= member->requested;
+    }
+    return over;
+}
+
+size_t MemoryGovernor::report (GovernorMemberID id, size_t chunk_bytes, size_t edit_bytes, std::chrono::milliseconds coldest) {
+    size_t requested = 0;
+    size_t uncovered = 0;
+    PressureCallback callback;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto iter = members.find(id);
+        if (iter == members.end()) {
+            return 0;
+        }
+
+        Member& member = iter->second;
+        usage -= member.chunk_bytes + member.edit_bytes;
+        member.chunk_bytes = chunk_bytes;
+        member.edit_bytes = edit_bytes;
+        member.coldest = coldest;
+        usage += chunk_bytes + edit_bytes;
+
+        uncovered = distribute();
+        requested = member.requested;
+        callback = on_pressure;
+    }
+
+    // Called without the lock, so that it can release memory and report in itself
+    if (uncovered > 0 && callback) {
+        callback(uncovered);
+    }
+    return requested;
+}
+
+
+// == Membership ==
+
+MemoryGovernor::Membership::Membership (MemoryGovernor& t_governor) : governor(&t_governor), id(t_governor.join()) {}
+
+MemoryGovernor::Membership::Membership (Membership&& other) noexcept : governor(std::exchange(other.governor, nullptr)), id(other.id) {}
+
+MemoryGovernor::Membership& MemoryGovernor::Membership::operator= (Membership&& other) noexcept {
+    if (this != &other) {
+        if (governor != nullptr) {
+            governor->leave(id);
+        }
+        governor = std::exchange(other.governor, nullptr);
+        id = other.id;
+    }
+    return *this;
+}
+
+MemoryGovernor::Membership::~Membership () {
+    if (governor != nullptr) {
+        governor->leave(id);
+    }
+}
+
+bool MemoryGovernor::Membership::isActive () const {
+    return governor != nullptr;
+}
+
+MemoryGovernor* MemoryGovernor::Membership::getGovernor () const {
+    return governor;
+}
+
+size_t MemoryGovernor::Membership::report (size_t chunk_bytes, size_t edit_bytes, std::chrono::milliseconds coldest) {
+    if (governor == nullptr) {
+        return 0;
+    }
+    return governor->report(id, chunk_bytes, edit_bytes, coldest);
+}
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+void HerixLib::test_memorygovernor () {
+    std::filesystem::path path = writeTestFile("herix_test_memorygovernor.bin", Buffer(64 * 1024, 7));
+
+    MemoryGovernor governor(16 * 1024);
+    size_t pressure = 0;
+    governor.setPressureCallback([&pressure] (size_t over) {
+        pressure = over;
+    });
+
+    {
+        // The instances' own limits are far above the shared budget
+        Herix a(path, false, std::make_pair(0, std::nullopt), 1024 * 1024, 1024);
+        Herix b(path, false, std::make_pair(0, std::nullopt), 1024 * 1024, 1024);
+        a.setMemoryGovernor(&governor);
+        b.setMemoryGovernor(&governor);
+        assert(governor.getMemberCount() == 2);
+
+        for (FilePosition pos = 0; pos < 12 * 1024; pos += 1024) {
+            a.read(pos);
+        }
+        assert(a.getChunkCount() == 12);
+        assert(governor.getUsage() <= governor.getBudget());
+
+        // b going over the budget takes from a, since its chunks are the coldest
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        for (FilePosition pos = 0; pos < 8 * 1024; pos += 1024) {
+            b.read(pos);
+        }
+        assert(b.getChunkCount() == 8);
+        a.releaseRequestedMemory();
+        assert(a.getChunkCount() < 12);
+        assert(governor.getUsage() <= governor.getBudget());
+        assert(pressure == 0);
+
+        // Edits can't be evicted, so they turn into pressure
+        b.editMultiple(0, Buffer(32 * 1024, 1));
+        assert(pressure > 0);
+        assert(b.getMemoryUsage() >= 32 * 1024);
+    }
+
+    assert(governor.getMemberCount() == 0);
+    assert(governor.getUsage() == 0);
+
+    std::filesystem::remove(path);
+}
+
+#endif
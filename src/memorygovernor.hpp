@@ -0,0 +1,92 @@
+#ifndef FILE_SEEN_MEMORYGOVERNOR
+#define FILE_SEEN_MEMORYGOVERNOR
+
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+
+#include "types.hpp"
+
+namespace HerixLib {
+
+using GovernorMemberID = size_t;
+/// Called with how many bytes over the budget the process is, after asking for every chunk that could be evicted.
+/// This is what's left over from memory that can't be evicted (edits), so it's the place to apply backpressure.
+using PressureCallback = std::function<void(size_t)>;
+
+/// A memory budget shared by many Herix instances (see Herix::setMemoryGovernor), covering their chunks and edits.
+/// Eviction is cooperative, since a Herix instance is only used from its own thread: when the budget is exceeded
+/// the governor asks the members with the coldest chunks to release some, and each member does so the next time
+/// it reports in (on a load or an edit, or with Herix::releaseRequestedMemory).
+/// The governor itself is thread safe.
+class MemoryGovernor {
+    protected:
+    class Member {
+        public:
+        size_t chunk_bytes = 0;
+        size_t edit_bytes = 0;
+        /// When the least recently used chunk was last touched, see Chunk::last_touched
+        std::chrono::milliseconds coldest = std::chrono::milliseconds::max();
+        /// Bytes of chunks this member has been asked to release
+        size_t requested = 0;
+    };
+
+    mutable std::mutex mutex;
+    size_t budget;
+    size_t usage = 0;
+    GovernorMemberID m_count = 0;
+    std::map<GovernorMemberID, Member> members;
+    PressureCallback on_pressure;
+
+    /// Spreads the amount over the budget across the members, coldest first. Returns what couldn't be covered.
+    size_t distribute ();
+
+    public:
+    /// Removes a member when destroyed, so that it can be held by the instance being governed.
+    class Membership {
+        protected:
+        MemoryGovernor* governor = nullptr;
+        GovernorMemberID id = 0;
+
+        public:
+        Membership () = default;
+        Membership (MemoryGovernor& t_governor);
+        Membership (Membership&& other) noexcept;
+        Membership& operator= (Membership&& other) noexcept;
+        Membership (const Membership&) = delete;
+        Membership& operator= (const Membership&) = delete;
+        ~Membership ();
+
+        bool isActive () const;
+        MemoryGovernor* getGovernor () const;
+        /// See MemoryGovernor::report
+        size_t report (size_t chunk_bytes, size_t edit_bytes, std::chrono::milliseconds coldest);
+    };
+
+    explicit MemoryGovernor (size_t t_budget=std::numeric_limits<size_t>::max());
+
+    MemoryGovernor (const MemoryGovernor&) = delete;
+    MemoryGovernor& operator= (const MemoryGovernor&) = delete;
+
+    /// One governor for the whole process. Its budget is unlimited until set.
+    static MemoryGovernor& getGlobal ();
+
+    void setBudget (size_t t_budget);
+    size_t getBudget () const;
+    size_t getUsage () const;
+    size_t getMemberCount () const;
+    void setPressureCallback (PressureCallback callback);
+
+    GovernorMemberID join ();
+    void leave (GovernorMemberID id);
+    /// Updates what a member is using. Returns how many bytes of chunks it should release now.
+    size_t report (GovernorMemberID id, size_t chunk_bytes, size_t edit_bytes, std::chrono::milliseconds coldest);
+};
+
+void test_memorygovernor ();
+
+}
+
+#endif
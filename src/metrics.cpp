@@ -0,0 +1,261 @@
+#include "metrics.hpp"
+#include <cassert>
+#include <atomic>
+#include <bit>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+using namespace HerixLib;
+
+namespace {
+    /// The counters of one thread. Only that thread writes to them, the atomics are so snapshot can read them.
+    class ThreadMetrics {
+        public:
+        std::array<std::atomic<uint64_t>, counter_count> counters{};
+        std::array<std::array<std::atomic<uint64_t>, histogram_bucket_count>, histogram_count> histograms{};
+
+        ThreadMetrics ();
+        ~ThreadMetrics ();
+
+        void addTo (MetricsSnapshot& snapshot) const;
+    };
+
+    class MetricsRegistry {
+        public:
+        std::mutex mutex;
+        std::vector<const ThreadMetrics*> threads;
+        /// What the threads that have exited recorded
+        MetricsSnapshot exited;
+        /// Subtracted from snapshots, set by reset
+        MetricsSnapshot baseline;
+    };
+
+    /// Never destroyed, since threads can exit after static destruction has started
+    MetricsRegistry& getRegistry () {
+        static MetricsRegistry* registry = new MetricsRegistry();
+        return *registry;
+    }
+
+    ThreadMetrics& getThreadMetrics () {
+        thread_local ThreadMetrics metrics;
+        return metrics;
+    }
+
+    ThreadMetrics::ThreadMetrics () {
+        MetricsRegistry& registry = getRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.threads.push_back(this);
+    }
+
+    ThreadMetrics::~ThreadMetrics () {
+        MetricsRegistry& registry = getRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        addTo(registry.exited);
+        registry.threads.erase(std::find(registry.threads.begin(), registry.threads.end(), this));
+    }
+
+    void ThreadMetrics::addTo (MetricsSnapshot& snapshot) const {
+        for (size_t i = 0; i < counter_count; i++) {
+            snapshot.counters[i] += counters[i].load(std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < histogram_count; i++) {
+            for (size_t j = 0; j < histogram_bucket_count; j++) {
+                snapshot.histograms[i][j] += histograms[i][j].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// Only the owning thread writes, so there's no need for a locked add
+    void bump (std::atomic<uint64_t>& value, uint64_t amount) {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    size_t getBucket (uint64_t value) {
+        return std::min(static_cast<size_t>(std::bit_width(value)), histogram_bucket_count - 1);
+    }
+}
+
+const char* HerixLib::getCounterName (Counter counter) {
+    switch (counter) {
+        case Counter::ChunkHits: return "chunk_hits";
+        case Counter::ChunkMisses: return "chunk_misses";
+        case Counter::ChunkEvictions: return "chunk_evictions";
+        case Counter::BytesRead: return "bytes_read";
+        case Counter::ReadCalls: return "read_calls";
+        case Counter::EditReads: return "edit_reads";
+        case Counter::Saves: return "saves";
+        case Counter::BytesSaved: return "bytes_saved";
+        case Counter::Count: break;
+    }
+    return "unknown";
+}
+
+const char* HerixLib::getHistogramName (Histogram histogram) {
+    switch (histogram) {
+        case Histogram::ChunkLoadMicroseconds: return "chunk_load_us";
+        case Histogram::EditProbeLength: return "edit_probe_length";
+        case Histogram::SaveMicroseconds: return "save_us";
+        case Histogram::Count: break;
+    }
+    return "unknown";
+}
+
+
+// == Snapshot ==
+
+uint64_t MetricsSnapshot::get (Counter counter) const {
+    return counters.at(static_cast<size_t>(counter));
+}
+
+const HistogramBuckets& MetricsSnapshot::get (Histogram histogram) const {
+    return histograms.at(static_cast<size_t>(histogram));
+}
+
+uint64_t MetricsSnapshot::getCount (Histogram histogram) const {
+    uint64_t count = 0;
+    for (uint64_t bucket : get(histogram)) {
+        count += bucket;
+    }
+    return count;
+}
+
+uint64_t MetricsSnapshot::getPercentile (Histogram histogram, double fraction) const {
+    uint64_t count = getCount(histogram);
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t target = static_cast<uint64_t>(static_cast<double>(count) * std::clamp(fraction, 0.0, 1.0));
+    uint64_t seen = 0;
+    const HistogramBuckets& buckets = get(histogram);
+    for (size_t i = 0; i < histogram_bucket_count; i++) {
+        seen += buckets[i];
+        if (seen > target || seen == count) {
+            // The top of the bucket
+            return i == 0 ? 0 : (uint64_t(1) << i) - 1;
+        }
+    }
+    return std::numeric_limits<uint64_t>::max();
+}
+
+std::string MetricsSnapshot::toJSON () const {
+    std::ostringstream out;
+    out << "{\"counters\":{";
+    for (size_t i = 0; i < counter_count; i++) {
+        out << (i == 0 ? "" : ",") << '"' << getCounterName(static_cast<Counter>(i)) << "\":" << counters[i];
+    }
+    out << "},\"histograms\":{";
+    for (size_t i = 0; i < histogram_count; i++) {
+        Histogram histogram = static_cast<Histogram>(i);
+        out << (i == 0 ? "" : ",") << '"' << getHistogramName(histogram) << "\":{"
+            << "\"count\":" << getCount(histogram)
+            << ",\"p50\":" << getPercentile(histogram, 0.5)
+            << ",\"p99\":" << getPercentile(histogram, 0.99)
+            << ",\"buckets\":[";
+        for (size_t j = 0; j < histogram_bucket_count; j++) {
+            out << (j == 0 ? "" : ",") << histograms[i][j];
+        }
+        out << "]}";
+    }
+    out << "}}";
+    return out.str();
+}
+
+
+// == Recording ==
+
+void Metrics::add (Counter counter, uint64_t amount) {
+    bump(getThreadMetrics().counters[static_cast<size_t>(counter)], amount);
+}
+
+void Metrics::record (Histogram histogram, uint64_t value) {
+    bump(getThreadMetrics().histograms[static_cast<size_t>(histogram)][getBucket(value)], 1);
+}
+
+MetricsSnapshot Metrics::snapshot () {
+    MetricsRegistry& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    MetricsSnapshot result = registry.exited;
+    for (const ThreadMetrics* thread : registry.threads) {
+        thread->addTo(result);
+    }
+
+    for (size_t i = 0; i < counter_count; i++) {
+        result.counters[i] -= std::min(result.counters[i], registry.baseline.counters[i]);
+    }
+    for (size_t i = 0; i < histogram_count; i++) {
+        for (size_t j = 0; j < histogram_bucket_count; j++) {
+            result.histograms[i][j] -= std::min(result.histograms[i][j], registry.baseline.histograms[i][j]);
+        }
+    }
+    return result;
+}
+
+void Metrics::reset () {
+    MetricsRegistry& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    // Threads only write to their own counters, so rather than zeroing them the current totals are remembered
+    MetricsSnapshot total = registry.exited;
+    for (const ThreadMetrics* thread : registry.threads) {
+        thread->addTo(total);
+    }
+    registry.baseline = total;
+}
+
+
+ScopedMetricTimer::ScopedMetricTimer (Histogram t_histogram) : histogram(t_histogram), start(std::chrono::steady_clock::now()) {}
+
+ScopedMetricTimer::~ScopedMetricTimer () {
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    Metrics::record(histogram, static_cast<uint64_t>(elapsed.count()));
+}
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+void HerixLib::test_metrics () {
+    Metrics::reset();
+    MetricsSnapshot empty = Metrics::snapshot();
+    assert(empty.get(Counter::ChunkHits) == 0);
+    assert(empty.getCount(Histogram::EditProbeLength) == 0);
+    assert(empty.getPercentile(Histogram::EditProbeLength, 0.5) == 0);
+
+    Metrics::add(Counter::ChunkHits, 3);
+    Metrics::record(Histogram::EditProbeLength, 0);
+    Metrics::record(Histogram::EditProbeLength, 5);
+    Metrics::record(Histogram::EditProbeLength, 6);
+    Metrics::record(Histogram::EditProbeLength, 1000);
+
+    // Threads that have exited still count
+    std::thread other([] () {
+        Metrics::add(Counter::ChunkHits, 2);
+    });
+    other.join();
+
+    MetricsSnapshot snapshot = Metrics::snapshot();
+    assert(snapshot.get(Counter::ChunkHits) == 5);
+    assert(snapshot.getCount(Histogram::EditProbeLength) == 4);
+    assert(snapshot.get(Histogram::EditProbeLength)[0] == 1);
+    assert(snapshot.get(Histogram::EditProbeLength)[3] == 2);
+    assert(snapshot.getPercentile(Histogram::EditProbeLength, 0.5) == 7);
+    assert(snapshot.getPercentile(Histogram::EditProbeLength, 1.0) == 1023);
+
+    std::string json = snapshot.toJSON();
+    assert(json.front() == '{' && json.back() == '}');
+    assert(json.find("\"chunk_hits\":5") != std::string::npos);
+    assert(json.find("\"edit_probe_length\":{\"count\":4") != std::string::npos);
+
+    Metrics::reset();
+    assert(Metrics::snapshot().get(Counter::ChunkHits) == 0);
+    assert(Metrics::snapshot().getCount(Histogram::EditProbeLength) == 0);
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef FILE_SEEN_METRICS
+#define FILE_SEEN_METRICS
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "types.hpp"
+
+// The hot paths are instrumented through the HERIX_METRIC macros, which compile to nothing when
+// HERIX_DISABLE_METRICS is defined. The Metrics functions themselves are always available.
+
+namespace HerixLib {
+
+enum class Counter : size_t {
+    ChunkHits,
+    ChunkMisses,
+    /// Chunks removed to stay within a memory limit
+    ChunkEvictions,
+    /// Bytes read from the disk, including by async loaders
+    BytesRead,
+    /// Calls made to read from the disk
+    ReadCalls,
+    EditReads,
+    Saves,
+    BytesSaved,
+    Count
+};
+
+enum class Histogram : size_t {
+    /// Microseconds taken by each synchronous chunk load
+    ChunkLoadMicroseconds,
+    /// How many edits EditStorage::read looked at before finding the value (or all of them, if it wasn't edited)
+    EditProbeLength,
+    /// Microseconds taken by each save
+    SaveMicroseconds,
+    Count
+};
+
+constexpr size_t counter_count = static_cast<size_t>(Counter::Count);
+constexpr size_t histogram_count = static_cast<size_t>(Histogram::Count);
+/// Buckets are powers of two: bucket 0 holds 0, and bucket i holds [2^(i-1), 2^i). The last one holds everything larger.
+constexpr size_t histogram_bucket_count = 32;
+
+using HistogramBuckets = std::array<uint64_t, histogram_bucket_count>;
+
+const char* getCounterName (Counter counter);
+const char* getHistogramName (Histogram histogram);
+
+class MetricsSnapshot {
+    public:
+    std::array<uint64_t, counter_count> counters{};
+    std::array<HistogramBuckets, histogram_count> histograms{};
+
+    uint64_t get (Counter counter) const;
+    const HistogramBuckets& get (Histogram histogram) const;
+    /// The amount of values recorded into the histogram
+    uint64_t getCount (Histogram histogram) const;
+    /// An upper bound on the value that fraction (0 to 1) of the recorded values are below, from the buckets
+    uint64_t getPercentile (Histogram histogram, double fraction) const;
+
+    /// Everything as a JSON object, for dashboards
+    std::string toJSON () const;
+};
+
+/// Process wide counters for the hot paths.
+/// Each thread updates its own set of counters, so recording never contends with other threads. snapshot sums them,
+/// along with what threads that have exited recorded.
+class Metrics {
+    public:
+#ifdef HERIX_DISABLE_METRICS
+    static constexpr bool enabled = false;
+#else
+    static constexpr bool enabled = true;
+#endif
+
+    static void add (Counter counter, uint64_t amount=1);
+    static void record (Histogram histogram, uint64_t value);
+
+    static MetricsSnapshot snapshot ();
+    /// Following snapshots only include what's recorded after this
+    static void reset ();
+};
+
+/// Records how long it lived into a histogram, in microseconds
+class ScopedMetricTimer {
+    protected:
+    Histogram histogram;
+    std::chrono::steady_clock::time_point start;
+
+    public:
+    explicit ScopedMetricTimer (Histogram t_histogram);
+    ~ScopedMetricTimer ();
+
+    ScopedMetricTimer (const ScopedMetricTimer&) = delete;
+    ScopedMetricTimer& operator= (const ScopedMetricTimer&) = delete;
+};
+
+void test_metrics ();
+
+}
+
+#ifdef HERIX_DISABLE_METRICS
+#define HERIX_METRIC_ADD(counter, amount) ((void)0)
+#define HERIX_METRIC_RECORD(histogram, value) ((void)0)
+#define HERIX_METRIC_TIME(name, histogram) ((void)0)
+#else
+#define HERIX_METRIC_ADD(counter, amount) ::HerixLib::Metrics::add(::HerixLib::Counter::counter, (amount))
+#define HERIX_METRIC_RECORD(histogram, value) ::HerixLib::Metrics::record(::HerixLib::Histogram::histogram, (value))
+#define HERIX_METRIC_TIME(name, histogram) ::HerixLib::ScopedMetricTimer name(::HerixLib::Histogram::histogram)
+#endif
+
+#endif
@@ -0,0 +1,482 @@
+#include "overview.hpp"
+#include "statistics.hpp"
+#include "sequentialreader.hpp"
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <limits>
+
+using namespace HerixLib;
+
+OverviewEntry OverviewEntry::summarize (const Byte* data, size_t size) {
+    OverviewEntry entry;
+    if (size == 0) {
+        return entry;
+    }
+
+    ByteHistogram histogram{};
+    countBytes(data, size, histogram);
+
+    uint64_t sum = 0;
+    uint64_t printable = 0;
+    uint64_t high = 0;
+    for (size_t i = 0; i < 256; i++) {
+        sum += histogram[i] * i;
+        if ((i >= 0x20 && i <= 0x7e) || i == '\t' || i == '\n' || i == '\r') {
+            printable += histogram[i];
+        } else if (i >= 0x80) {
+            high += histogram[i];
+        }
+    }
+
+    float fsize = static_cast<float>(size);
+    entry.entropy = static_cast<float>(computeEntropy(histogram));
+    entry.average = static_cast<float>(sum) / fsize;
+    entry.zero = static_cast<float>(histogram[0]) / fsize;
+    entry.printable = static_cast<float>(printable) / fsize;
+    entry.high = static_cast<float>(high) / fsize;
+    return entry;
+}
+
+/// Combines two neighbouring entries. This is the mean of the two, so entropy is an approximation of the
+/// entropy of the combined range.
+OverviewEntry OverviewEntry::merge (const OverviewEntry& a, const OverviewEntry& b) {
+    OverviewEntry entry;
+    entry.entropy = (a.entropy + b.entropy) / 2.0f;
+    entry.average = (a.average + b.average) / 2.0f;
+    entry.zero = (a.zero + b.zero) / 2.0f;
+    entry.printable = (a.printable + b.printable) / 2.0f;
+    entry.high = (a.high + b.high) / 2.0f;
+    return entry;
+}
+
+
+template<typename Alignment, typename BackendType>
+BasicOverviewIndex<Alignment, BackendType>::BasicOverviewIndex (BasicHerix<Alignment, BackendType>& t_herix, size_t t_block_size, std::optional<std::filesystem::path> t_sidecar) :
+    herix(t_herix), block_size(t_block_size) {
+    if (block_size == 0) {
+        throw std::invalid_argument("block_size must be non-zero.");
+    }
+
+    if (!t_sidecar.has_value()) {
+        sidecar = herix.filename;
+        sidecar.value() += ".hxov";
+    } else if (!t_sidecar.value().empty()) {
+        sidecar = t_sidecar;
+    }
+
+    listener = herix.addChangeListener([this] (FilePosition pos, size_t size) {
+        onChange(pos, size);
+    });
+}
+
+template<typename Alignment, typename BackendType>
+BasicOverviewIndex<Alignment, BackendType>::~BasicOverviewIndex () {
+    stopWorker();
+    herix.removeChangeListener(listener);
+}
+
+template<typename Alignment, typename BackendType>
+void BasicOverviewIndex<Alignment, BackendType>::start () {
+    stopWorker();
+    ready = false;
+    loaded_from_sidecar = false;
+    levels.clear();
+    pending_blocks.clear();
+    covered_size = herix.getFileEnd();
+
+    std::optional<std::vector<OverviewEntry>> existing = loadSidecar();
+    if (existing.has_value()) {
+        loaded_from_sidecar = true;
+        adopt(std::move(existing.value()));
+        return;
+    }
+
+    bytes_done = 0;
+    cancel = false;
+    building = true;
+    build_error = nullptr;
+    worker = std::thread(&BasicOverviewIndex::buildWorker, this, herix.getSharedBackend(), herix.getStartPosition(), covered_size);
+}
+
+template<typename Alignment, typename BackendType>
+void BasicOverviewIndex<Alignment, BackendType>::buildWorker (std::shared_ptr<Backend> backend, AbsoluteFilePosition start, size_t size) {
+    try {
+        // Keep reads a multiple of the block size so blocks never straddle reads
+        SequentialReaderOptions options;
+        options.block_size = SequentialReader::roundBlockSize(block_size, read_size);
+        SequentialReader reader(backend->getPath(), start, 0, size, nullptr, options, backend);
+
+        std::vector<OverviewEntry> result;
+        result.reserve((size + block_size - 1) / block_size);
+
+        while (!cancel) {
+            std::optional<SequentialBlock> block = reader.next();
+            if (!block.has_value()) {
+                break;
+            }
+
+            for (size_t offset = 0; offset < block.value().size; offset += block_size) {
+                result.push_back(OverviewEntry::summarize(block.value().data + offset, std::min(block_size, block.value().size - offset)));
+            }
+            bytes_done = block.value().pos + block.value().size;
+        }
+
+        built = std::move(result);
+    } catch (...) {
+        build_error = std::current_exception();
+    }
+
+    building = false;
+}
+
+template<typename Alignment, typename BackendType>
+void BasicOverviewIndex<Alignment, BackendType>::stopWorker () {
+    if (worker.joinable()) {
+        cancel = true;
+        worker.join();
+    }
+    building = false;
+}
+
+template<typename Alignment, typename BackendType>
+bool BasicOverviewIndex<Alignment, BackendType>::poll () {
+    if (!ready && worker.joinable() && !building) {
+        finishBuild();
+    }
+
+    return ready;
+}
+
+template<typename Alignment, typename BackendType>
+void BasicOverviewIndex<Alignment, BackendType>::wait () {
+    if (!ready && worker.joinable()) {
+        finishBuild();
+    }
+}
+
+template<typename Alignment, typename BackendType>
+void BasicOverviewIndex<Alignment, BackendType>::finishBuild () {
+    worker.join();
+
+    if (build_error) {
+        std::exception_ptr error = build_error;
+        build_error = nullptr;
+        std::rethrow_exception(error);
+    }
+
+    saveSidecar(built);
+    adopt(std::move(built));
+    built.clear();
+}
+
+/// Takes the level 0 of the file (without edits), builds the levels above it and patches in the current edits.
+template<typename Alignment, typename BackendType>
+void BasicOverviewIndex<Alignment, BackendType>::adopt (std::vector<OverviewEntry> level0) {
+    levels.clear();
+    levels.push_back(std::move(level0));
+    while (levels.back().size() > 1) {
+        const std::vector<OverviewEntry>& below = levels.back();
+        std::vector<OverviewEntry> level((below.size() + 1) / 2);
+        for (size_t i = 0; i < level.size(); i++) {
+            level[i] = (i * 2) + 1 < below.size() ? OverviewEntry::merge(below[i * 2], below[(i * 2) + 1]) : below[i * 2];
+        }
+        levels.push_back(std::move(level));
+    }
+
+    ready = true;
+
+    // Anything edited before or during the build has to be patched over what was read from the file. The edited
+    // ranges are already combined, so this is the same however many edits made them.
+    pending_blocks.clear();
+    herix.edits.getFilled().forEachWithin(0, covered_size, [this] (FilePosition pos, size_t size) {
+        markBlocks(pos, size);
+    });
+    herix.edits.getTransformed().forEachWithin(0, covered_size, [this] (FilePosition pos, size_t size) {
+        markBlocks(pos, size);
+    });
+}
+
+template<typename Alignment, typename BackendType>
+void BasicOverviewIndex<Alignment, BackendType>::rebuildLevelsAbove (size_t first_block, size_t last_block) {
+    for (size_t level = 1; level < levels.size(); level++) {
+        first_block /= 2;
+        last_block /= 2;
+
+        const std::vector<OverviewEntry>& below = levels[level - 1];
+        for (size_t i = first_block; i <= last_block; i++) {
+            levels[level][i] = (i * 2) + 1 < below.size() ? OverviewEntry::merge(below[i * 2], below[(i * 2) + 1]) : below[i * 2];
+        }
+    }
+}
+
+template<typename Alignment, typename BackendType>
+void BasicOverviewIndex<Alignment, BackendType>::markBlocks (FilePosition pos, size_t size) {
+    if (pos >= covered_size || size == 0) {
+        return;
+    }
+
+    size_t first_block = pos / block_size;
+    size_t last_block = (pos + std::min(size, covered_size - pos) - 1) / block_size;
+    pending_blocks.add(first_block, (last_block - first_block) + 1);
+}
+
+/// Reads straight from the backend to keep out of the chunk cache.
+template<typename Alignment, typename BackendType>
+void BasicOverviewIndex<Alignment, BackendType>::patchPending () {
+    if (!ready || pending_blocks.getCoveredBytes() == 0) {
+        return;
+    }
+    std::vector<EditRange> ranges = pending_blocks.getRanges(0, levels[0].size());
+    pending_blocks.clear();
+
+    Backend* backend = herix.getBackend();
+    Buffer buffer(block_size);
+    for (const EditRange& range : ranges) {
+        size_t first_block = range.first;
+        size_t last_block = range.first + range.second - 1;
+        for (size_t block = first_block; block <= last_block; block++) {
+            FilePosition pos = block * block_size;
+            size_t amount = std::min(block_size, covered_size - pos);
+
+            size_t read_count = backend->read(herix.getStartPosition() + pos, amount, buffer.data());
+            if (read_count != amount) {
+                throw std::runtime_error("Failed to read block for patching overview.");
+            }
+
+            herix.edits.applyTo(pos, amount, buffer.data());
+            levels[0][block] = OverviewEntry::summarize(buffer.data(), amount);
+            blocks_patched++;
+        }
+
+        rebuildLevelsAbove(first_block, last_block);
+    }
+}
+
+template<typename Alignment, typename BackendType>
+void BasicOverviewIndex<Alignment, BackendType>::onChange (FilePosition pos, size_t size) {
+    if (pos == 0 && size == std::numeric_limits<size_t>::max()) {
+        // The file was swapped out, so everything is invalid. start has to be called again.
+        stopWorker();
+        levels.clear();
+        pending_blocks.clear();
+        ready = false;
+        return;
+    }
+
+    // While building, the edits are patched in once it is done
+    if (!ready) {
+        return;
+    }
+    markBlocks(pos, size);
+}
+
+template<typename Alignment, typename BackendType>
+bool BasicOverviewIndex<Alignment, BackendType>::isReady () const {
+    return ready;
+}
+template<typename Alignment, typename BackendType>
+bool BasicOverviewIndex<Alignment, BackendType>::isBuilding () const {
+    return building;
+}
+template<typename Alignment, typename BackendType>
+bool BasicOverviewIndex<Alignment, BackendType>::wasLoadedFromSidecar () const {
+    return loaded_from_sidecar;
+}
+
+template<typename Alignment, typename BackendType>
+double BasicOverviewIndex<Alignment, BackendType>::getProgress () const {
+    if (ready) {
+        return 1.0;
+    } else if (covered_size == 0) {
+        return 0.0;
+    }
+    return static_cast<double>(bytes_done.load()) / static_cast<double>(covered_size);
+}
+
+template<typename Alignment, typename BackendType>
+size_t BasicOverviewIndex<Alignment, BackendType>::getBlockSize () const {
+    return block_size;
+}
+template<typename Alignment, typename BackendType>
+size_t BasicOverviewIndex<Alignment, BackendType>::getLevelCount () const {
+    return levels.size();
+}
+template<typename Alignment, typename BackendType>
+size_t BasicOverviewIndex<Alignment, BackendType>::getBlocksPatched () const {
+    return blocks_patched;
+}
+template<typename Alignment, typename BackendType>
+const std::vector<OverviewEntry>& BasicOverviewIndex<Alignment, BackendType>::getLevel (size_t level) {
+    patchPending();
+    return levels.at(level);
+}
+template<typename Alignment, typename BackendType>
+const std::vector<OverviewEntry>& BasicOverviewIndex<Alignment, BackendType>::getLevelFor (size_t entry_count) {
+    patchPending();
+    for (size_t level = levels.size(); level > 0; level--) {
+        if (levels[level - 1].size() >= entry_count) {
+            return levels[level - 1];
+        }
+    }
+    return levels.at(0);
+}
+
+// == Sidecar ==
+// Layout: magic, version, then the u64 header fields, then the level 0 entries as native floats.
+// Being a cache of this machine's file, it isn't meant to be portable.
+
+static const char sidecar_magic[4] = { 'H', 'X', 'O', 'V' };
+static const uint64_t sidecar_version = 1;
+static const size_t floats_per_entry = 5;
+
+template<typename Alignment, typename BackendType>
+std::optional<std::vector<OverviewEntry>> BasicOverviewIndex<Alignment, BackendType>::loadSidecar () const {
+    if (!sidecar.has_value() || !std::filesystem::exists(sidecar.value())) {
+        return std::nullopt;
+    }
+
+    std::ifstream in(sidecar.value(), std::ios_base::in | std::ios_base::binary);
+    char magic[4];
+    uint64_t header[6];
+    in.read(magic, 4);
+    in.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!in || std::memcmp(magic, sidecar_magic, 4) != 0) {
+        return std::nullopt;
+    }
+
+    uint64_t modified = static_cast<uint64_t>(std::filesystem::last_write_time(herix.filename).time_since_epoch().count());
+    size_t count = (covered_size + block_size - 1) / block_size;
+    if (header[0] != sidecar_version || header[1] != block_size || header[2] != covered_size ||
+        header[3] != herix.getStartPosition() || header[4] != modified || header[5] != count) {
+        return std::nullopt;
+    }
+
+    std::vector<float> values(count * floats_per_entry);
+    in.read(reinterpret_cast<char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(float)));
+    if (!in) {
+        return std::nullopt;
+    }
+
+    std::vector<OverviewEntry> level0(count);
+    for (size_t i = 0; i < count; i++) {
+        const float* value = values.data() + (i * floats_per_entry);
+        level0[i].entropy = value[0];
+        level0[i].average = value[1];
+        level0[i].zero = value[2];
+        level0[i].printable = value[3];
+        level0[i].high = value[4];
+    }
+    return level0;
+}
+
+/// Saving is best effort, failing to write it only means it'll be rebuilt next time.
+template<typename Alignment, typename BackendType>
+void BasicOverviewIndex<Alignment, BackendType>::saveSidecar (const std::vector<OverviewEntry>& level0) const {
+    if (!sidecar.has_value()) {
+        return;
+    }
+
+    std::ofstream out(sidecar.value(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!out.is_open()) {
+        return;
+    }
+
+    uint64_t modified = static_cast<uint64_t>(std::filesystem::last_write_time(herix.filename).time_since_epoch().count());
+    uint64_t header[6] = { sidecar_version, block_size, covered_size, herix.getStartPosition(), modified, level0.size() };
+    out.write(sidecar_magic, 4);
+    out.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    std::vector<float> values;
+    values.reserve(level0.size() * floats_per_entry);
+    for (const OverviewEntry& entry : level0) {
+        values.insert(values.end(), { entry.entropy, entry.average, entry.zero, entry.printable, entry.high });
+    }
+    out.write(reinterpret_cast<const char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(float)));
+}
+
+// Built for each instance type the library has
+template class HerixLib::BasicOverviewIndex<RuntimeChunkAlignment>;
+template class HerixLib::BasicOverviewIndex<PowerOfTwoChunkAlignment>;
+template class HerixLib::BasicOverviewIndex<PowerOfTwoChunkAlignment, FileBackend>;
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+void HerixLib::test_overview () {
+    // = Summaries
+    const Byte text[] = { 'a', 'b', 'c', 'd' };
+    OverviewEntry text_entry = OverviewEntry::summarize(text, 4);
+    assert(text_entry.printable == 1.0f);
+    assert(text_entry.entropy == 2.0f);
+    assert(text_entry.average == 98.5f);
+
+    const Byte zeroes[] = { 0, 0, 0xff, 0xff };
+    OverviewEntry zero_entry = OverviewEntry::summarize(zeroes, 4);
+    assert(zero_entry.zero == 0.5f);
+    assert(zero_entry.high == 0.5f);
+    assert(OverviewEntry::merge(text_entry, zero_entry).entropy == 1.5f);
+
+    // = Building over a file of 5 blocks
+    Buffer contents(64 * 4, 'x');
+    contents.resize(contents.size() + 10, 0);
+    std::filesystem::path path = writeTestFile("herix_test_overview.bin", contents);
+    std::filesystem::path sidecar = path.string() + ".hxov";
+
+    {
+        Herix h(path, false, std::make_pair(0, std::nullopt), 256, 64);
+        // An edit made before building has to show up
+        h.edit(64, 0);
+
+        OverviewIndex index(h, 64);
+        index.start();
+        index.wait();
+        assert(index.isReady());
+        assert(!index.wasLoadedFromSidecar());
+        assert(index.getLevelCount() == 4);
+        assert(index.getLevel(0).size() == 5);
+        assert(index.getLevel(1).size() == 3);
+        assert(index.getLevel(3).size() == 1);
+        assert(index.getLevel(0)[0].printable == 1.0f);
+        assert(index.getLevel(0)[1].zero > 0.0f);
+        assert(index.getLevel(0)[4].zero == 1.0f);
+        assert(&index.getLevelFor(2) == &index.getLevel(2));
+        assert(h.getChunkCount() == 0);
+
+        // Editing patches the blocks and the levels above it
+        h.edit(0, 0xff);
+        assert(index.getLevel(0)[0].high > 0.0f);
+        assert(index.getLevel(1)[0].high > 0.0f);
+        h.undo();
+        assert(index.getLevel(0)[0].high == 0.0f);
+        assert(index.getLevel(3)[0].high == 0.0f);
+
+        // Many edits to the same blocks only recompute each block once
+        size_t patched = index.getBlocksPatched();
+        for (FilePosition pos = 0; pos < 128; pos++) {
+            h.edit(pos, 0xff);
+        }
+        assert(index.getLevel(0)[1].high == 1.0f);
+        assert(index.getBlocksPatched() == patched + 2);
+        assert(index.getLevel(0)[0].high == 1.0f);
+        assert(index.getBlocksPatched() == patched + 2);
+    }
+
+    {
+        // Should come from the sidecar this time, and still have the edit-free data
+        Herix h(path, false, std::make_pair(0, std::nullopt), 256, 64);
+        OverviewIndex index(h, 64);
+        index.start();
+        assert(index.isReady());
+        assert(index.wasLoadedFromSidecar());
+        assert(index.getLevel(0)[1].zero == 0.0f);
+    }
+
+    std::filesystem::remove(sidecar);
+    std::filesystem::remove(path);
+}
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef FILE_SEEN_OVERVIEW
+#define FILE_SEEN_OVERVIEW
+
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "types.hpp"
+#include "herix.hpp"
+#include "rangeset.hpp"
+
+namespace HerixLib {
+
+/// Summary of a block of the file, for drawing a zoomed out view.
+class OverviewEntry {
+    public:
+    /// Shannon entropy in bits per byte
+    float entropy = 0.0f;
+    /// Mean byte value
+    float average = 0.0f;
+    // Fraction (0 to 1) of the bytes in each class. Whatever is left over are control characters.
+    float zero = 0.0f;
+    /// [0x20, 0x7e] and whitespace
+    float printable = 0.0f;
+    /// 0x80 and above
+    float high = 0.0f;
+
+    static OverviewEntry summarize (const Byte* data, size_t size);
+    static OverviewEntry merge (const OverviewEntry& a, const OverviewEntry& b);
+};
+
+/// A multi-resolution summary of the whole file (a minimap).
+/// Level 0 has an entry per block, and each level above halves the count until there is a single entry.
+/// The index is built on a background thread with large sequential reads through its own stream, so it doesn't
+/// go through (or evict anything from) the chunk cache. The result is saved to a sidecar file, and loaded from
+/// there next time if the file hasn't changed.
+/// Edits are patched in on the thread that owns the Herix instance, only recomputing the blocks they touch. The
+/// blocks are patched when the levels are next read, so each block is recomputed once however many edits touch it.
+/// It works with any BasicHerix, see OverviewIndex for the usual one.
+template<typename Alignment, typename BackendType=Backend>
+class BasicOverviewIndex {
+    protected:
+    BasicHerix<Alignment, BackendType>& herix;
+    ListenerID listener;
+    size_t block_size;
+    std::optional<std::filesystem::path> sidecar;
+
+    std::vector<std::vector<OverviewEntry>> levels;
+    /// Indices of the level 0 blocks that have been edited since they were last patched
+    RangeSet pending_blocks;
+    size_t blocks_patched = 0;
+    size_t covered_size = 0;
+    bool ready = false;
+    bool loaded_from_sidecar = false;
+
+    // == Background building ==
+    // Nothing here touches the Herix instance from the worker thread, it only reads the file.
+    std::thread worker;
+    std::atomic<bool> building{false};
+    std::atomic<bool> cancel{false};
+    std::atomic<size_t> bytes_done{0};
+    std::vector<OverviewEntry> built;
+    std::exception_ptr build_error;
+
+    void buildWorker (std::shared_ptr<Backend> backend, AbsoluteFilePosition start, size_t size);
+    void stopWorker ();
+    void finishBuild ();
+    void adopt (std::vector<OverviewEntry> level0);
+
+    void rebuildLevelsAbove (size_t first_block, size_t last_block);
+    /// Marks the blocks holding [pos, pos+size) to be patched
+    void markBlocks (FilePosition pos, size_t size);
+    /// Recomputes every pending block with the edits applied
+    void patchPending ();
+    void onChange (FilePosition pos, size_t size);
+
+    std::optional<std::vector<OverviewEntry>> loadSidecar () const;
+    void saveSidecar (const std::vector<OverviewEntry>& level0) const;
+
+    public:
+    /// The size of each read the builder does.
+    static constexpr size_t read_size = 4 * 1024 * 1024;
+
+    /// The sidecar defaults to the filename with ".hxov" appended. Pass an empty path to not use one.
+    BasicOverviewIndex (BasicHerix<Alignment, BackendType>& t_herix, size_t t_block_size=64*1024, std::optional<std::filesystem::path> t_sidecar=std::nullopt);
+    ~BasicOverviewIndex ();
+
+    BasicOverviewIndex (const BasicOverviewIndex&) = delete;
+    BasicOverviewIndex& operator= (const BasicOverviewIndex&) = delete;
+
+    /// Loads the index from the sidecar if it is up to date, otherwise starts building it in the background.
+    void start ();
+    /// Checks if the background build finished, and if so puts it to use. Returns isReady()
+    /// Call this from the thread that uses the Herix instance.
+    bool poll ();
+    /// Blocks until the background build is done. Rethrows any error from building.
+    void wait ();
+
+    bool isReady () const;
+    bool isBuilding () const;
+    bool wasLoadedFromSidecar () const;
+    /// From 0 to 1
+    double getProgress () const;
+
+    size_t getBlockSize () const;
+    size_t getLevelCount () const;
+    /// Patches in the edits made since the last call first, so these have to be called from the thread that uses
+    /// the Herix instance.
+    const std::vector<OverviewEntry>& getLevel (size_t level);
+    /// The coarsest level that still has at least entry_count entries (or level 0 if none do)
+    const std::vector<OverviewEntry>& getLevelFor (size_t entry_count);
+    /// How many blocks have been recomputed for edits
+    size_t getBlocksPatched () const;
+};
+
+/// The overview of a Herix
+using OverviewIndex = BasicOverviewIndex<RuntimeChunkAlignment>;
+
+extern template class BasicOverviewIndex<RuntimeChunkAlignment>;
+extern template class BasicOverviewIndex<PowerOfTwoChunkAlignment>;
+extern template class BasicOverviewIndex<PowerOfTwoChunkAlignment, FileBackend>;
+
+void test_overview ();
+
+}
+
+#endif
@@ -0,0 +1,119 @@
+#include "persistent.hpp"
+#include <atomic>
+#include <cassert>
+
+using namespace HerixLib;
+
+uint64_t HerixLib::newPersistentOwner () {
+    static std::atomic<uint64_t> next{ 1 };
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+#include <string>
+#include <thread>
+
+void HerixLib::test_persistent () {
+    // Against a std::vector, across several levels of the trie
+    PersistentVector<size_t> values;
+    std::vector<size_t> expected;
+    assert(values.empty());
+    assert(values.getSharedPrefix(values) == 0);
+    for (size_t i = 0; i < 40000; i++) {
+        values.push_back(i * 3);
+        expected.push_back(i * 3);
+    }
+    assert(values.size() == expected.size());
+    for (size_t i = 0; i < expected.size(); i += 7) {
+        assert(values[i] == expected[i]);
+    }
+    assert(values.back() == expected.back());
+
+    // Copies don't see each other's changes
+    PersistentVector<size_t> copy = values;
+    assert(copy.getSharedPrefix(values) == values.size());
+    for (size_t i = 0; i < 1000; i++) {
+        values.pop_back();
+    }
+    values.set(100, 1);
+    values.push_back(5);
+    assert(copy.size() == 40000);
+    assert(copy[100] == 300 && copy.back() == 39999 * 3);
+    assert(values.size() == 39001 && values[100] == 1 && values.back() == 5);
+    assert(values.getSharedPrefix(copy) == 100);
+    assert(copy.getSharedPrefix(values) == 100);
+
+    // Changing the copy leaves the original alone too
+    copy.set(0, 7);
+    assert(copy[0] == 7 && values[0] == 0);
+    assert(copy.getSharedPrefix(values) == 0);
+
+    // Shrinking back down through the levels
+    expected.resize(39000);
+    expected[100] = 1;
+    expected.push_back(5);
+    std::vector<size_t> iterated(values.begin(), values.end());
+    assert(iterated == expected);
+    while (values.size() > 10) {
+        values.pop_back();
+    }
+    assert(values.size() == 10 && values.back() == 27);
+    values.push_back(8);
+    assert(values[10] == 8);
+    assert(copy.size() == 40000 && copy[39999] == 39999 * 3);
+
+    // A copy which is taller than the other still lines up
+    PersistentVector<size_t> small;
+    for (size_t i = 0; i < 20; i++) {
+        small.push_back(i);
+    }
+    PersistentVector<size_t> large = small;
+    for (size_t i = 0; i < 5000; i++) {
+        large.push_back(i);
+    }
+    assert(large.getSharedPrefix(small) == 20);
+    assert(small.getSharedPrefix(large) == 20);
+
+    // A copy can be read on another thread while the original is changed
+    PersistentVector<std::string> strings;
+    for (size_t i = 0; i < 2000; i++) {
+        strings.push_back(std::to_string(i));
+    }
+    PersistentVector<std::string> frozen = strings;
+    std::thread reader([&frozen] () {
+        for (size_t pass = 0; pass < 20; pass++) {
+            for (size_t i = 0; i < frozen.size(); i++) {
+                assert(frozen[i] == std::to_string(i));
+            }
+        }
+    });
+    for (size_t i = 0; i < 2000; i++) {
+        strings.set(i, "changed");
+        strings.push_back("more");
+    }
+    for (size_t i = 0; i < 3000; i++) {
+        strings.pop_back();
+    }
+    reader.join();
+    assert(strings.size() == 1000 && strings[999] == "changed");
+
+    // Copy on write values
+    CopyOnWrite<std::vector<int>> original;
+    original.edit().push_back(1);
+    CopyOnWrite<std::vector<int>> shared = original;
+    assert(&shared.get() == &original.get());
+    shared.edit().push_back(2);
+    assert(original.get().size() == 1 && shared.get().size() == 2);
+    original.edit().push_back(3);
+    assert((original.get() == std::vector<int>{ 1, 3 }));
+    // Once it has its own copy, it's changed in place
+    const std::vector<int>* own = &original.get();
+    original.edit().push_back(4);
+    assert(&original.get() == own);
+}
+
+#endif
@@ -0,0 +1,364 @@
+#ifndef FILE_SEEN_PERSISTENT
+#define FILE_SEEN_PERSISTENT
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace HerixLib {
+
+/// A unique id for the owner of the nodes of a PersistentVector. Never returns the same value twice.
+uint64_t newPersistentOwner ();
+
+/// What a PersistentVector keeps next to each element in its leaves, so a scan can skip over elements without
+/// following the pointer to them. Nothing by default, specialize it with a Type and make to keep something.
+template<typename T>
+class PersistentSummary {
+    public:
+    class Type {};
+    static Type make (const T&) {
+        return Type();
+    }
+};
+
+/// A vector which copies in O(1), with the copies sharing everything until one of them changes. It's a 32 way trie
+/// (as in Clojure's vectors) with every element behind its own shared_ptr: a change copies the O(log32 n) nodes on the
+/// path to it, rather than the whole vector, so the memory used by copies grows with how far they diverge.
+/// Nodes are only changed in place by the vector that created them since it was last copied, which is tracked
+/// with an owner id instead of use counts. A copy never changes after that point, so one copy can be read on another
+/// thread while a different one is changed. Copying itself (which renews both owners) has to happen on the thread
+/// that changes the source.
+template<typename T>
+class PersistentVector {
+    public:
+    using Summary = typename PersistentSummary<T>::Type;
+
+    protected:
+    static constexpr size_t bits = 5;
+    static constexpr size_t width = size_t(1) << bits;
+    static constexpr size_t mask = width - 1;
+
+    class Node {
+        public:
+        uint64_t owner;
+        /// Only for the leaves
+        std::vector<std::shared_ptr<const T>> values;
+        std::vector<Summary> summaries;
+        /// Only for the branches
+        std::vector<std::shared_ptr<Node>> children;
+
+        explicit Node (uint64_t t_owner) : owner(t_owner) {}
+    };
+
+    std::shared_ptr<Node> root;
+    size_t count = 0;
+    /// How far the index is shifted to get the root's child, 0 when the root is a leaf
+    size_t shift = 0;
+    /// Renewed whenever this is copied, so the nodes from before then are never changed again
+    mutable uint64_t owner = newPersistentOwner();
+
+    /// node itself if this owns it, otherwise a copy of it that this does
+    std::shared_ptr<Node> owned (const std::shared_ptr<Node>& node) {
+        if (node->owner == owner) {
+            return node;
+        }
+        std::shared_ptr<Node> copy = std::make_shared<Node>(*node);
+        copy->owner = owner;
+        return copy;
+    }
+
+    const Node& getLeaf (size_t index) const {
+        const Node* node = root.get();
+        for (size_t level = shift; level > 0; level -= bits) {
+            node = node->children[(index >> level) & mask].get();
+        }
+        return *node;
+    }
+
+    /// The leaf holding index, copying the path to it so it can be changed
+    Node& getOwnedLeaf (size_t index) {
+        root = owned(root);
+        Node* node = root.get();
+        for (size_t level = shift; level > 0; level -= bits) {
+            std::shared_ptr<Node>& child = node->children[(index >> level) & mask];
+            child = owned(child);
+            node = child.get();
+        }
+        return *node;
+    }
+
+    /// Pops the last element under node, dropping any nodes it leaves empty. Node must be owned.
+    void popFrom (Node& node, size_t level) {
+        if (level == 0) {
+            node.values.pop_back();
+            node.summaries.pop_back();
+            return;
+        }
+        std::shared_ptr<Node>& child = node.children.back();
+        child = owned(child);
+        popFrom(*child, level - bits);
+        if (child->values.empty() && child->children.empty()) {
+            node.children.pop_back();
+        }
+    }
+
+    /// How many of the first elements under a and b (both at level) are the same objects
+    static size_t sharedPrefix (const Node* a, const Node* b, size_t level) {
+        if (a == b) {
+            // Everything under it, which is clipped to the sizes by the caller
+            return size_t(1) << (level + bits);
+        }
+        if (level == 0) {
+            size_t i = 0;
+            while (i < a->values.size() && i < b->values.size() && a->values[i] == b->values[i]) {
+                i++;
+            }
+            return i;
+        }
+
+        size_t total = 0;
+        size_t child_size = size_t(1) << level;
+        for (size_t i = 0; i < a->children.size() && i < b->children.size(); i++) {
+            size_t shared = sharedPrefix(a->children[i].get(), b->children[i].get(), level - bits);
+            total += shared;
+            if (shared < child_size) {
+                break;
+            }
+        }
+        return total;
+    }
+
+    public:
+    class ConstIterator {
+        protected:
+        const PersistentVector* vector;
+        size_t index;
+
+        public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        ConstIterator (const PersistentVector* t_vector, size_t t_index) : vector(t_vector), index(t_index) {}
+        const T& operator* () const { return (*vector)[index]; }
+        const T* operator-> () const { return &(*vector)[index]; }
+        ConstIterator& operator++ () { index++; return *this; }
+        bool operator== (const ConstIterator& other) const { return index == other.index; }
+        bool operator!= (const ConstIterator& other) const { return index != other.index; }
+    };
+
+    PersistentVector () = default;
+    PersistentVector (const PersistentVector& other) : root(other.root), count(other.count), shift(other.shift) {
+        other.owner = newPersistentOwner();
+    }
+    PersistentVector& operator= (const PersistentVector& other) {
+        root = other.root;
+        count = other.count;
+        shift = other.shift;
+        owner = newPersistentOwner();
+        other.owner = newPersistentOwner();
+        return *this;
+    }
+
+    size_t size () const {
+        return count;
+    }
+    bool empty () const {
+        return count == 0;
+    }
+
+    const T& operator[] (size_t index) const {
+        return *getShared(index);
+    }
+    const T& at (size_t index) const {
+        if (index >= count) {
+            throw std::out_of_range("PersistentVector index is past the end.");
+        }
+        return (*this)[index];
+    }
+    const T& back () const {
+        return (*this)[count - 1];
+    }
+    /// The element's shared_ptr, which copies that haven't changed it have too
+    const std::shared_ptr<const T>& getShared (size_t index) const {
+        return getLeaf(index).values[index & mask];
+    }
+    /// Calls callback(summary, element) for each of [first, last) in order. Walks a leaf at a time, rather than going
+    /// down the trie for every element.
+    template<typename Callback>
+    void forEachIn (size_t first, size_t last, Callback callback) const {
+        size_t index = first;
+        while (index < last) {
+            const Node& leaf = getLeaf(index);
+            size_t leaf_end = std::min(last, (index & ~mask) + width);
+            for (; index < leaf_end; index++) {
+                callback(leaf.summaries[index & mask], *leaf.values[index & mask]);
+            }
+        }
+    }
+    /// Calls callback(index, summary, element) for each of [first, last) from the last back, until it returns false
+    template<typename Callback>
+    void forEachInReverse (size_t first, size_t last, Callback callback) const {
+        size_t index = last;
+        while (index > first) {
+            const Node& leaf = getLeaf(index - 1);
+            size_t leaf_start = std::max(first, (index - 1) & ~mask);
+            for (; index > leaf_start; index--) {
+                if (!callback(index - 1, leaf.summaries[(index - 1) & mask], *leaf.values[(index - 1) & mask])) {
+                    return;
+                }
+            }
+        }
+    }
+
+    ConstIterator begin () const {
+        return ConstIterator(this, 0);
+    }
+    ConstIterator end () const {
+        return ConstIterator(this, count);
+    }
+
+    void push_back (T value) {
+        pushShared(std::make_shared<const T>(std::move(value)));
+    }
+    void pushShared (std::shared_ptr<const T> value) {
+        if (!root) {
+            root = std::make_shared<Node>(owner);
+        } else if (count == (size_t(1) << (shift + bits))) {
+            // Full, so the old root becomes the first child of a new one
+            std::shared_ptr<Node> new_root = std::make_shared<Node>(owner);
+            new_root->children.push_back(std::move(root));
+            root = std::move(new_root);
+            shift += bits;
+        }
+
+        root = owned(root);
+        Node* node = root.get();
+        for (size_t level = shift; level > 0; level -= bits) {
+            size_t child = (count >> level) & mask;
+            if (child == node->children.size()) {
+                node->children.push_back(std::make_shared<Node>(owner));
+            } else {
+                node->children[child] = owned(node->children[child]);
+            }
+            node = node->children[child].get();
+        }
+        if (node->values.empty()) {
+            // Leaves are filled up in order, so this saves growing them a step at a time
+            node->values.reserve(width);
+            node->summaries.reserve(width);
+        }
+        node->summaries.push_back(PersistentSummary<T>::make(*value));
+        node->values.push_back(std::move(value));
+        count++;
+    }
+
+    void pop_back () {
+        if (count == 0) {
+            throw std::out_of_range("Popping from an empty PersistentVector.");
+        }
+        count--;
+        if (count == 0) {
+            clear();
+            return;
+        }
+
+        root = owned(root);
+        popFrom(*root, shift);
+        // A root with a single child isn't needed
+        while (shift > 0 && root->children.size() == 1) {
+            std::shared_ptr<Node> child = root->children.front();
+            root = std::move(child);
+            shift -= bits;
+        }
+    }
+
+    void set (size_t index, T value) {
+        if (index >= count) {
+            throw std::out_of_range("PersistentVector index is past the end.");
+        }
+        Node& leaf = getOwnedLeaf(index);
+        leaf.summaries[index & mask] = PersistentSummary<T>::make(value);
+        leaf.values[index & mask] = std::make_shared<const T>(std::move(value));
+    }
+
+    void clear () {
+        root.reset();
+        count = 0;
+        shift = 0;
+    }
+
+    /// How many of the first elements are the same objects in both, such as a copy and what it was copied from.
+    /// Subtrees they share are skipped over, so this is proportional to how far they've diverged.
+    size_t getSharedPrefix (const PersistentVector& other) const {
+        size_t limit = std::min(count, other.count);
+        if (limit == 0) {
+            return 0;
+        }
+
+        // A shorter trie is the first child of the root of a taller one, for the same elements
+        const Node* a = root.get();
+        const Node* b = other.root.get();
+        size_t level = std::min(shift, other.shift);
+        for (size_t a_level = shift; a_level > level; a_level -= bits) {
+            a = a->children.front().get();
+        }
+        for (size_t b_level = other.shift; b_level > level; b_level -= bits) {
+            b = b->children.front().get();
+        }
+        return std::min(limit, sharedPrefix(a, b, level));
+    }
+
+    /// Roughly the memory used by the nodes and elements, counting shared ones as well
+    size_t getMemoryUsage () const {
+        size_t element_size = sizeof(T) + sizeof(std::shared_ptr<const T>) + sizeof(Summary) + (2 * sizeof(long));
+        return (count * element_size) + (((count / width) + 1) * (sizeof(Node) + (width * sizeof(void*))));
+    }
+};
+
+/// A value which copies in O(1), sharing it with the copy until one of them is changed through edit.
+/// As with PersistentVector, a copy can be read on another thread while the other one is changed, since edit makes
+/// its own copy rather than change a shared value.
+template<typename T>
+class CopyOnWrite {
+    protected:
+    std::shared_ptr<T> value = std::make_shared<T>();
+    /// Whether value might be in use by a copy
+    mutable bool shared = false;
+
+    public:
+    CopyOnWrite () = default;
+    CopyOnWrite (const CopyOnWrite& other) : value(other.value), shared(true) {
+        other.shared = true;
+    }
+    CopyOnWrite& operator= (const CopyOnWrite& other) {
+        value = other.value;
+        shared = true;
+        other.shared = true;
+        return *this;
+    }
+
+    const T& get () const {
+        return *value;
+    }
+    /// The value, for changing it. Copies it first if it's shared.
+    T& edit () {
+        if (shared) {
+            value = std::make_shared<T>(*value);
+            shared = false;
+        }
+        return *value;
+    }
+};
+
+void test_persistent ();
+
+}
+
+#endif
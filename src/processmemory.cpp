@@ -0,0 +1,453 @@
+#include "processmemory.hpp"
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef HERIX_HAS_PROCESS_MEMORY
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#ifdef DEBUG
+#include <memory>
+#include <thread>
+#include "herix.hpp"
+#ifdef HERIX_HAS_PROCESS_MEMORY
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
+#endif
+
+using namespace HerixLib;
+
+#ifdef HERIX_HAS_PROCESS_MEMORY
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+bool ProcessMemoryRegion::isReadable () const {
+    return !permissions.empty() && permissions[0] == 'r';
+}
+
+ProcessMemory::ProcessMemory (pid_t t_pid) : pid(t_pid) {
+    refreshRegions();
+}
+
+std::vector<ProcessMemoryRegion> ProcessMemory::readMaps (pid_t pid) {
+    std::ifstream maps("/proc/" + std::to_string(pid) + "/maps");
+    if (!maps.is_open()) {
+        throw std::runtime_error("Failed in opening the memory maps of process " + std::to_string(pid) + ".");
+    }
+
+    // Each line is "start-end perms offset dev inode name", with the name being optional and able to hold spaces
+    std::vector<ProcessMemoryRegion> regions;
+    std::string line;
+    while (std::getline(maps, line)) {
+        std::istringstream fields(line);
+        std::string range;
+        std::string offset;
+        std::string device;
+        std::string inode;
+        ProcessMemoryRegion region;
+        if (!(fields >> range >> region.permissions >> offset >> device >> inode)) {
+            continue;
+        }
+
+        size_t dash = range.find('-');
+        if (dash == std::string::npos) {
+            throw std::runtime_error("Unexpected line in the memory maps of process " + std::to_string(pid) + ".");
+        }
+        region.start = std::stoull(range.substr(0, dash), nullptr, 16);
+        region.end = std::stoull(range.substr(dash + 1), nullptr, 16);
+
+        std::getline(fields >> std::ws, region.name);
+        regions.push_back(std::move(region));
+    }
+
+    if (maps.bad()) {
+        throw std::runtime_error("Failed in reading the memory maps of process " + std::to_string(pid) + ".");
+    }
+    return regions;
+}
+
+void ProcessMemory::refreshRegions () {
+    std::vector<ProcessMemoryRegion> all = readMaps(pid);
+    std::vector<ProcessMemoryRegion> readable;
+    std::copy_if(all.begin(), all.end(), std::back_inserter(readable), [] (const ProcessMemoryRegion& region) {
+        return region.isReadable();
+    });
+
+    std::lock_guard<std::mutex> lock(mutex);
+    regions = std::move(readable);
+    // What failed before could have been remapped since
+    unreadable.clear();
+}
+
+std::vector<ProcessMemoryRegion> ProcessMemory::getRegions () const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return regions;
+}
+
+pid_t ProcessMemory::getPid () const {
+    return pid;
+}
+
+ProcessMemoryStatistics ProcessMemory::getStatistics () const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return statistics;
+}
+
+std::vector<ProcessMemoryRegion>::const_iterator ProcessMemory::findRegion (AbsoluteFilePosition pos) const {
+    return std::upper_bound(regions.begin(), regions.end(), pos, [] (AbsoluteFilePosition value, const ProcessMemoryRegion& region) {
+        return value < region.end;
+    });
+}
+
+template<typename Callback>
+void ProcessMemory::forEachPresent (AbsoluteFilePosition pos, size_t size, Callback callback) const {
+    AbsoluteFilePosition end = pos + size;
+    for (auto iter = findRegion(pos); iter != regions.end() && iter->start < end; iter++) {
+        AbsoluteFilePosition start = std::max(pos, iter->start);
+        AbsoluteFilePosition region_end = std::min(end, iter->end);
+
+        // The gaps between what failed to read
+        AbsoluteFilePosition at = start;
+        unreadable.forEachWithin(start, region_end - start, [&at, &callback] (FilePosition range_pos, size_t range_size) {
+            if (range_pos > at) {
+                callback(at, range_pos - at);
+            }
+            at = range_pos + range_size;
+        });
+        if (region_end > at) {
+            callback(at, region_end - at);
+        }
+    }
+}
+
+size_t ProcessMemory::getSize () const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return regions.empty() ? 0 : regions.back().end;
+}
+
+size_t ProcessMemory::read (AbsoluteFilePosition pos, size_t size, Byte* output) {
+    return readBatch({ BackendRead{ pos, size, output } }).front();
+}
+
+std::vector<size_t> ProcessMemory::readBatch (const std::vector<BackendRead>& reads) {
+    std::vector<size_t> counts;
+    counts.reserve(reads.size());
+    std::vector<struct iovec> local;
+    std::vector<struct iovec> remote;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t end = regions.empty() ? 0 : regions.back().end;
+        for (const BackendRead& request : reads) {
+            size_t count = request.pos < end ? std::min(request.size, end - request.pos) : 0;
+            counts.push_back(count);
+
+            // Only the present ranges are read, the holes are left as zero
+            std::memset(request.output, 0, count);
+            forEachPresent(request.pos, count, [&request, &local, &remote] (AbsoluteFilePosition range_pos, size_t range_size) {
+                local.push_back(iovec{ request.output + (range_pos - request.pos), range_size });
+                remote.push_back(iovec{ reinterpret_cast<void*>(range_pos), range_size });
+            });
+        }
+    }
+
+    size_t page_size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    size_t i = 0;
+    while (i < remote.size()) {
+        size_t count = std::min(remote.size() - i, static_cast<size_t>(IOV_MAX));
+        size_t requested = 0;
+        for (size_t j = i; j < i + count; j++) {
+            requested += remote[j].iov_len;
+        }
+
+        ssize_t got = ::process_vm_readv(pid, local.data() + i, count, remote.data() + i, count, 0);
+        // Nothing could be read from the first range
+        if (got < 0 && errno == EFAULT) {
+            got = 0;
+        } else if (got < 0) {
+            throw std::system_error(errno, std::generic_category(), "Failed to read process memory");
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            statistics.read_calls++;
+            statistics.bytes_read += static_cast<size_t>(got);
+        }
+
+        // Skip what was read
+        size_t left = static_cast<size_t>(got);
+        while (i < remote.size() && left > 0 && left >= remote[i].iov_len) {
+            left -= remote[i].iov_len;
+            i++;
+        }
+        if (static_cast<size_t>(got) == requested) {
+            continue;
+        }
+
+        // It stopped at a page that couldn't be read. That page becomes a hole, and the rest of the range is retried.
+        AbsoluteFilePosition failed = reinterpret_cast<AbsoluteFilePosition>(remote[i].iov_base) + left;
+        AbsoluteFilePosition range_end = failed - left + remote[i].iov_len;
+        AbsoluteFilePosition skip_to = std::min(range_end, ((failed / page_size) + 1) * page_size);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            unreadable.add(failed, skip_to - failed);
+        }
+
+        size_t skipped = left + (skip_to - failed);
+        if (skipped == remote[i].iov_len) {
+            i++;
+        } else {
+            remote[i].iov_base = static_cast<Byte*>(remote[i].iov_base) + skipped;
+            remote[i].iov_len -= skipped;
+            local[i].iov_base = static_cast<Byte*>(local[i].iov_base) + skipped;
+            local[i].iov_len -= skipped;
+        }
+    }
+
+    return counts;
+}
+
+bool ProcessMemory::hasHoles () const {
+    return true;
+}
+
+bool ProcessMemory::isPresent (AbsoluteFilePosition pos) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = findRegion(pos);
+    if (iter == regions.end() || iter->start > pos) {
+        return false;
+    }
+    return !unreadable.contains(pos);
+}
+
+size_t ProcessMemory::getPresentRun (AbsoluteFilePosition pos, size_t size) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    // Regions can touch, in which case the run carries on into the next
+    size_t run = 0;
+    for (auto iter = findRegion(pos); iter != regions.end() && iter->start <= pos + run && run < size; iter++) {
+        run = std::min(size, iter->end - pos);
+    }
+
+    std::vector<EditRange> failed = unreadable.getRanges(pos, run);
+    return failed.empty() ? run : failed.front().first - pos;
+}
+
+bool ProcessMemory::isWritable () const {
+    return true;
+}
+
+void ProcessMemory::write (AbsoluteFilePosition pos, const Byte* data, size_t size) {
+    if (size == 0) {
+        return;
+    }
+    if (getPresentRun(pos, size) != size) {
+        throw std::runtime_error("Failed to write to process memory, it isn't all mapped: " + std::to_string(pos));
+    }
+
+    struct iovec local{ const_cast<Byte*>(data), size };
+    struct iovec remote{ reinterpret_cast<void*>(pos), size };
+    ssize_t got = ::process_vm_writev(pid, &local, 1, &remote, 1, 0);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        statistics.write_calls++;
+        statistics.bytes_written += got > 0 ? static_cast<size_t>(got) : 0;
+    }
+
+    if (got < 0) {
+        throw std::system_error(errno, std::generic_category(), "Failed to write to process memory");
+    } else if (static_cast<size_t>(got) != size) {
+        // Such as memory that's mapped read only
+        throw std::runtime_error("Failed to write to process memory, only part was written: " + std::to_string(pos));
+    }
+}
+
+std::filesystem::path ProcessMemory::getPath () const {
+    return "/proc/" + std::to_string(pid) + "/mem";
+}
+
+const char* ProcessMemory::getName () const {
+    return "process";
+}
+
+#endif
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+#ifdef HERIX_HAS_PROCESS_MEMORY
+static Byte getTestByte (size_t i) {
+    return static_cast<Byte>((i * 7) + 1);
+}
+#endif
+
+void HerixLib::test_processmemory () {
+#ifdef HERIX_HAS_PROCESS_MEMORY
+    size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+
+    // Three pages with the middle one unmapped. It's set up before the fork, so the child has it at the same address
+    void* mapped = ::mmap(nullptr, page * 3, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(mapped != MAP_FAILED);
+    Byte* memory = static_cast<Byte*>(mapped);
+    ::munmap(memory + page, page);
+    for (size_t i = 0; i < page; i++) {
+        memory[i] = getTestByte(i);
+        memory[(2 * page) + i] = getTestByte(2 * page + i);
+    }
+    AbsoluteFilePosition base = reinterpret_cast<AbsoluteFilePosition>(memory);
+
+    int to_child[2];
+    int from_child[2];
+    assert(::pipe(to_child) == 0 && ::pipe(from_child) == 0);
+
+    pid_t child = ::fork();
+    assert(child >= 0);
+    if (child == 0) {
+        // Waits to be told that the parent saved, then reports whether its memory holds the edits
+        char command;
+        Byte result = ::read(to_child[0], &command, 1) == 1 ? 1 : 0;
+        for (size_t i = 0; i < page; i++) {
+            Byte expected = (i >= 10 && i < 15) ? 0xAA : getTestByte(i);
+            if (memory[i] != expected || memory[(2 * page) + i] != getTestByte(2 * page + i)) {
+                result = 0;
+            }
+        }
+        ssize_t written = ::write(from_child[1], &result, 1);
+        ::_exit(written == 1 ? 0 : 1);
+    }
+
+    // The parent's copy is changed, so everything after this has to be read from the child
+    std::memset(memory, 0, page);
+    std::memset(memory + (2 * page), 0, page);
+
+    {
+        ProcessMemory process(child);
+        assert(process.getPath() == "/proc/" + std::to_string(child) + "/mem");
+        assert(process.isPresent(base) && !process.isPresent(base + page) && process.isPresent(base + (2 * page)));
+        assert(process.getPresentRun(base, 3 * page) == page);
+        assert(process.getPresentRun(base + page, page) == 0);
+        std::vector<ProcessMemoryRegion> regions = process.getRegions();
+        assert(std::any_of(regions.begin(), regions.end(), [base] (const ProcessMemoryRegion& region) {
+            return region.start <= base && region.end > base && region.permissions.substr(0, 2) == "rw";
+        }));
+
+        // The hole reads as zero, and the whole thing is a single call
+        Buffer data(3 * page, 0xFF);
+        assert(process.read(base, 3 * page, data.data()) == 3 * page);
+        for (size_t i = 0; i < page; i++) {
+            assert(data[i] == getTestByte(i));
+            assert(data[page + i] == 0);
+            assert(data[(2 * page) + i] == getTestByte(2 * page + i));
+        }
+        assert(process.getStatistics().read_calls == 1);
+
+        std::vector<size_t> counts = process.readBatch({ BackendRead{ base + 5, 10, data.data() }, BackendRead{ base + (2 * page), 10, data.data() + 10 } });
+        assert((counts == std::vector<size_t>{ 10, 10 }));
+        assert(data[0] == getTestByte(5) && data[10] == getTestByte(2 * page));
+        assert(process.getStatistics().read_calls == 2);
+
+        // Unmapped memory can't be written
+        bool threw = false;
+        try {
+            process.write(base + page, data.data(), 1);
+        } catch (std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+
+        // Past the last region is past the end
+        assert(process.read(process.getSize(), 10, data.data()) == 0);
+
+        // Refreshing while another thread reads leaves the reads seeing either the old or the new regions
+        {
+            std::thread refresher([&process] () {
+                for (size_t i = 0; i < 50; i++) {
+                    process.refreshRegions();
+                }
+            });
+            Buffer page_data(page);
+            for (size_t i = 0; i < 200; i++) {
+                assert(process.isPresent(base));
+                assert(process.read(base, page, page_data.data()) == page);
+                assert(page_data[1] == getTestByte(1));
+            }
+            refresher.join();
+        }
+    }
+
+    // Through Herix, where the unmapped page reads like the end of a file
+    {
+        Herix herix(true, std::make_pair(0, std::nullopt), page * 8, page);
+        std::shared_ptr<ProcessMemory> process = std::make_shared<ProcessMemory>(child);
+        herix.loadBackend(process);
+        assert(herix.hasFile());
+        assert(herix.getBackend() == process.get());
+        assert(herix.getFileSize() == process->getSize());
+
+        // A screen across the three pages loads its chunks with one read, and stops at the hole
+        Buffer screen(3 * page);
+        assert(herix.readInto(base, 3 * page, screen.data()) == page);
+        assert(process->getStatistics().read_calls == 1);
+        assert(herix.getChunkCount() == 3);
+        for (size_t i = 0; i < page; i++) {
+            assert(screen[i] == getTestByte(i));
+        }
+
+        assert(herix.read(base) == getTestByte(0));
+        assert(!herix.read(base + page).has_value());
+        assert(herix.read(base + (2 * page) + 3) == getTestByte(2 * page + 3));
+        std::vector<std::optional<Byte>> values = herix.readMultiple(base + page - 1, 2);
+        assert(values[0] == getTestByte(page - 1) && !values[1].has_value());
+        assert(herix.readInto(base + (2 * page), page, screen.data()) == page);
+        assert(process->getStatistics().read_calls == 1);
+
+        // Edits are written into the child
+        herix.editMultiple(base + 10, Buffer(5, 0xAA));
+        herix.saveHistoryDestructive();
+        assert(!herix.hasUnsavedEdits());
+        assert(herix.read(base + 12) == 0xAA);
+        assert(process->getStatistics().write_calls == 1);
+
+        // Edits in the hole can't be saved
+        herix.edit(base + page, 0x01);
+        bool threw = false;
+        try {
+            herix.saveHistoryDestructive();
+        } catch (std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+        herix.undo();
+    }
+
+    assert(::write(to_child[1], "c", 1) == 1);
+    Byte result = 0;
+    assert(::read(from_child[0], &result, 1) == 1);
+    assert(result == 1);
+
+    int status = 0;
+    assert(::waitpid(child, &status, 0) == child);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    for (int fd : { to_child[0], to_child[1], from_child[0], from_child[1] }) {
+        ::close(fd);
+    }
+    ::munmap(memory, page);
+    ::munmap(memory + (2 * page), page);
+#endif
+}
+
+#endif
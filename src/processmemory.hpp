@@ -0,0 +1,101 @@
+#ifndef FILE_SEEN_PROCESSMEMORY
+#define FILE_SEEN_PROCESSMEMORY
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "types.hpp"
+#include "backend.hpp"
+#include "rangeset.hpp"
+
+// process_vm_readv and process_vm_writev are Linux only
+#if defined(__linux__)
+#define HERIX_HAS_PROCESS_MEMORY 1
+#include <sys/types.h>
+#endif
+
+namespace HerixLib {
+
+#ifdef HERIX_HAS_PROCESS_MEMORY
+class ProcessMemoryRegion {
+    public:
+    AbsoluteFilePosition start;
+    AbsoluteFilePosition end;
+    /// As in /proc/<pid>/maps, such as "rw-p"
+    std::string permissions;
+    /// The mapped file or a name like "[heap]", empty for anonymous memory
+    std::string name;
+
+    bool isReadable () const;
+};
+
+class ProcessMemoryStatistics {
+    public:
+    /// process_vm_readv calls, each of which can read many ranges
+    size_t read_calls = 0;
+    size_t bytes_read = 0;
+    size_t write_calls = 0;
+    size_t bytes_written = 0;
+};
+
+/// The memory of a running process, with positions being its addresses. Only the readable regions of
+/// /proc/<pid>/maps exist, everything else is a hole, and so is anything that turns out to fail reading (such as
+/// [vvar]). The regions are read when it's created, refreshRegions picks up mappings made since.
+/// Reads and writes go through process_vm_readv and process_vm_writev, which need the same permission as ptrace.
+/// Unlike writing to /proc/<pid>/mem, process_vm_writev respects page protections, so read only memory (such as code)
+/// can't be written.
+class ProcessMemory : public Backend {
+    protected:
+    pid_t pid;
+    mutable std::mutex mutex;
+    /// Sorted by address, only the readable ones. Guarded by the mutex, since refreshRegions can replace them while
+    /// the background readers use them.
+    std::vector<ProcessMemoryRegion> regions;
+    /// Parts of the regions that failed to read
+    RangeSet unreadable;
+    ProcessMemoryStatistics statistics;
+
+    /// The region holding pos, or the first one after it. Must hold the mutex.
+    std::vector<ProcessMemoryRegion>::const_iterator findRegion (AbsoluteFilePosition pos) const;
+    /// Calls callback(range_pos, range_size) for each present range within [pos, pos+size). Must hold the mutex.
+    template<typename Callback>
+    void forEachPresent (AbsoluteFilePosition pos, size_t size, Callback callback) const;
+
+    public:
+    /// Throws std::runtime_error if the process's maps can't be read
+    explicit ProcessMemory (pid_t t_pid);
+
+    /// Parses /proc/<pid>/maps
+    static std::vector<ProcessMemoryRegion> readMaps (pid_t pid);
+
+    /// Reads the maps again, for mappings that changed since
+    void refreshRegions ();
+    /// A copy, since they can be replaced by refreshRegions
+    std::vector<ProcessMemoryRegion> getRegions () const;
+    pid_t getPid () const;
+    ProcessMemoryStatistics getStatistics () const;
+
+    size_t getSize () const override;
+    size_t read (AbsoluteFilePosition pos, size_t size, Byte* output) override;
+    /// Every present range of every read goes into the same process_vm_readv calls, IOV_MAX of them at a time
+    std::vector<size_t> readBatch (const std::vector<BackendRead>& reads) override;
+
+    bool hasHoles () const override;
+    bool isPresent (AbsoluteFilePosition pos) const override;
+    size_t getPresentRun (AbsoluteFilePosition pos, size_t size) const override;
+
+    bool isWritable () const override;
+    void write (AbsoluteFilePosition pos, const Byte* data, size_t size) override;
+
+    /// /proc/<pid>/mem
+    std::filesystem::path getPath () const override;
+    const char* getName () const override;
+};
+#endif
+
+void test_processmemory ();
+
+}
+
+#endif
@@ -0,0 +1,224 @@
+#include "rangeset.hpp"
+#include <cassert>
+
+using namespace HerixLib;
+
+void RangeSet::split (FilePosition pos) {
+    auto iter = segments.upper_bound(pos);
+    if (iter == segments.begin()) {
+        return;
+    }
+    iter--;
+
+    if (iter->first < pos && iter->second.end > pos) {
+        segments.emplace_hint(std::next(iter), pos, Segment{ iter->second.end, iter->second.count });
+        iter->second.end = pos;
+    }
+}
+
+void RangeSet::join (FilePosition pos) {
+    auto iter = segments.find(pos);
+    if (iter == segments.end() || iter == segments.begin()) {
+        return;
+    }
+
+    auto before = std::prev(iter);
+    if (before->second.end == pos && before->second.count == iter->second.count) {
+        before->second.end = iter->second.end;
+        segments.erase(iter);
+    }
+}
+
+void RangeSet::add (FilePosition pos, size_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    FilePosition end = pos + size;
+    split(pos);
+    split(end);
+
+    FilePosition at = pos;
+    auto iter = segments.lower_bound(pos);
+    while (at < end) {
+        if (iter == segments.end() || iter->first > at) {
+            // A gap, which nothing covered before
+            FilePosition gap_end = (iter == segments.end() || iter->first > end) ? end : iter->first;
+            segments.emplace_hint(iter, at, Segment{ gap_end, 1 });
+            covered_bytes += gap_end - at;
+            at = gap_end;
+        } else {
+            iter->second.count++;
+            at = iter->second.end;
+            iter++;
+        }
+    }
+
+    // Inside the range the counts all went up together, so only the edges can need joining
+    join(end);
+    join(pos);
+}
+
+void RangeSet::remove (FilePosition pos, size_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    FilePosition end = pos + size;
+    split(pos);
+    split(end);
+
+    auto iter = segments.lower_bound(pos);
+    while (iter != segments.end() && iter->first < end) {
+        assert(iter->second.count > 0);
+        iter->second.count--;
+        if (iter->second.count == 0) {
+            covered_bytes -= iter->second.end - iter->first;
+            iter = segments.erase(iter);
+        } else {
+            iter++;
+        }
+    }
+
+    join(end);
+    join(pos);
+}
+
+void RangeSet::clear () {
+    segments.clear();
+    covered_bytes = 0;
+}
+
+size_t RangeSet::getCoveredBytes () const {
+    return covered_bytes;
+}
+
+bool RangeSet::contains (FilePosition pos) const {
+    auto iter = segments.upper_bound(pos);
+    if (iter == segments.begin()) {
+        return false;
+    }
+    return std::prev(iter)->second.end > pos;
+}
+
+bool RangeSet::covers (FilePosition pos, size_t size) const {
+    if (size == 0) {
+        return true;
+    }
+
+    auto iter = segments.upper_bound(pos);
+    if (iter == segments.begin()) {
+        return false;
+    }
+    iter--;
+
+    // Segments with different counts can touch, so walk along them until there's a gap
+    FilePosition end = pos + size;
+    while (iter != segments.end() && iter->first <= pos) {
+        pos = iter->second.end;
+        if (pos >= end) {
+            return true;
+        }
+        iter++;
+    }
+    return false;
+}
+
+size_t RangeSet::getMemoryUsage () const {
+    // Each node also has its parent, its children and its colour
+    return segments.size() * (sizeof(std::pair<const FilePosition, Segment>) + (4 * sizeof(void*)));
+}
+
+std::vector<EditRange> RangeSet::getRanges (FilePosition pos, size_t size) const {
+    std::vector<EditRange> ranges;
+    forEachWithin(pos, size, [&ranges] (FilePosition range_pos, size_t range_size) {
+        ranges.push_back(std::make_pair(range_pos, range_size));
+    });
+    return ranges;
+}
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+void HerixLib::test_rangeset () {
+    RangeSet set;
+    assert(set.getCoveredBytes() == 0);
+    assert(!set.contains(0));
+    assert(set.getRanges(0, 100).empty());
+
+    set.add(10, 10);
+    set.add(15, 10);
+    set.add(40, 5);
+    assert(set.getCoveredBytes() == 20);
+    assert(set.contains(10) && set.contains(24) && !set.contains(25) && !set.contains(9));
+    assert((set.getRanges(0, 100) == std::vector<EditRange>{ { 10, 15 }, { 40, 5 } }));
+    // Clipped to what was asked for
+    assert((set.getRanges(12, 30) == std::vector<EditRange>{ { 12, 13 }, { 40, 2 } }));
+
+    // The overlap is still covered by the other range
+    set.remove(10, 10);
+    assert(set.getCoveredBytes() == 15);
+    assert(!set.contains(14) && set.contains(15));
+    assert((set.getRanges(0, 100) == std::vector<EditRange>{ { 15, 10 }, { 40, 5 } }));
+
+    // The same range twice needs removing twice
+    set.add(40, 5);
+    set.remove(40, 5);
+    assert(set.contains(42));
+    set.remove(40, 5);
+    assert(!set.contains(42));
+    assert(set.getCoveredBytes() == 10);
+
+    // Touching ranges are reported as one
+    set.add(25, 5);
+    assert((set.getRanges(0, 100) == std::vector<EditRange>{ { 15, 15 } }));
+    set.add(20, 2);
+    assert(set.covers(15, 15) && set.covers(18, 10) && !set.covers(14, 2) && !set.covers(29, 2));
+    set.remove(20, 2);
+
+    set.remove(15, 10);
+    set.remove(25, 5);
+    assert(set.getCoveredBytes() == 0);
+    assert(set.getRanges(0, 100).empty());
+
+    // Against a byte by byte count
+    std::vector<size_t> counts(300, 0);
+    std::vector<EditRange> added;
+    for (size_t i = 0; i < 200; i++) {
+        EditRange range = std::make_pair((i * 37) % 250, (i * 13) % 40 + 1);
+        set.add(range.first, range.second);
+        added.push_back(range);
+        for (size_t j = 0; j < range.second; j++) {
+            counts[range.first + j]++;
+        }
+
+        if (i % 3 == 0) {
+            EditRange removed = added[i / 2];
+            set.remove(removed.first, removed.second);
+            for (size_t j = 0; j < removed.second; j++) {
+                counts[removed.first + j]--;
+            }
+            added[i / 2].second = 0;
+        }
+    }
+
+    size_t expected = 0;
+    for (size_t pos = 0; pos < counts.size(); pos++) {
+        assert(set.contains(pos) == (counts[pos] > 0));
+        expected += counts[pos] > 0 ? size_t{1} : size_t{0};
+    }
+    assert(set.getCoveredBytes() == expected);
+
+    size_t from_ranges = 0;
+    set.forEachWithin(0, counts.size(), [&from_ranges] (FilePosition, size_t size) {
+        from_ranges += size;
+    });
+    assert(from_ranges == expected);
+
+    set.clear();
+    assert(set.getCoveredBytes() == 0);
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef FILE_SEEN_RANGESET
+#define FILE_SEEN_RANGESET
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "types.hpp"
+
+namespace HerixLib {
+
+/// A range of [pos, pos+size) given as (pos, size)
+using EditRange = std::pair<FilePosition, size_t>;
+
+/// The set of bytes covered by any of the ranges added to it, kept as disjoint segments. Each segment counts how many
+/// ranges cover it, so a range can be removed again without knowing what else covers the same bytes.
+/// Adding and removing are O(log n + k) for the k segments in the range, and the covered byte count is kept as it goes.
+class RangeSet {
+    protected:
+    class Segment {
+        public:
+        FilePosition end;
+        /// How many of the added ranges cover this, never zero
+        size_t count;
+    };
+
+    /// Start of each segment to the rest of it. Neighbouring segments never have the same count.
+    std::map<FilePosition, Segment> segments;
+    size_t covered_bytes = 0;
+
+    /// Splits the segment which holds pos (if any) so that one starts at pos
+    void split (FilePosition pos);
+    /// Joins the segment starting at pos with the one before it, if they touch and have the same count
+    void join (FilePosition pos);
+
+    public:
+    void add (FilePosition pos, size_t size);
+    /// Removes a range that was added before
+    void remove (FilePosition pos, size_t size);
+    void clear ();
+
+    /// The amount of bytes covered by at least one range, in O(1)
+    size_t getCoveredBytes () const;
+    bool contains (FilePosition pos) const;
+    /// If every byte of [pos, pos+size) is covered
+    bool covers (FilePosition pos, size_t size) const;
+    /// Roughly how much memory the segments take up, including the map's own overhead
+    size_t getMemoryUsage () const;
+    /// The covered ranges within [pos, pos+size), clipped to it and with touching segments combined
+    std::vector<EditRange> getRanges (FilePosition pos, size_t size) const;
+    /// Calls callback(range_pos, range_size) for each covered range within [pos, pos+size), like getRanges but
+    /// without building the vector
+    template<typename Callback>
+    void forEachWithin (FilePosition pos, size_t size, Callback callback) const;
+};
+
+void test_rangeset ();
+
+template<typename Callback>
+void RangeSet::forEachWithin (FilePosition pos, size_t size, Callback callback) const {
+    FilePosition end = pos + size;
+    auto iter = segments.upper_bound(pos);
+    if (iter != segments.begin() && std::prev(iter)->second.end > pos) {
+        iter--;
+    }
+
+    // The start of the range being built up from touching segments
+    FilePosition start = 0;
+    FilePosition current_end = 0;
+    bool building = false;
+    for (; iter != segments.end() && iter->first < end; iter++) {
+        FilePosition segment_start = std::max(iter->first, pos);
+        FilePosition segment_end = std::min(iter->second.end, end);
+        if (building && segment_start == current_end) {
+            current_end = segment_end;
+            continue;
+        }
+        if (building) {
+            callback(start, current_end - start);
+        }
+        start = segment_start;
+        current_end = segment_end;
+        building = true;
+    }
+
+    if (building) {
+        callback(start, current_end - start);
+    }
+}
+
+}
+
+#endif
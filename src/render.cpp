@@ -0,0 +1,450 @@
+#include "render.hpp"
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <iterator>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace HerixLib;
+
+static const char hex_lower[] = "0123456789abcdef";
+static const char hex_upper[] = "0123456789ABCDEF";
+
+void HerixLib::renderHex (const Byte* data, size_t size, char* output, bool uppercase) {
+    const char* digits = uppercase ? hex_upper : hex_lower;
+    size_t i = 0;
+
+#if defined(__SSSE3__)
+    // Split each byte into its nibbles, and use them as indices into the digit table with a shuffle
+    const __m128i table = _mm_loadu_si128(reinterpret_cast<const __m128i*>(digits));
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    for (; i + 16 <= size; i += 16) {
+        __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i high = _mm_and_si128(_mm_srli_epi16(values, 4), low_mask);
+        __m128i low = _mm_and_si128(values, low_mask);
+
+        __m128i high_digits = _mm_shuffle_epi8(table, high);
+        __m128i low_digits = _mm_shuffle_epi8(table, low);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + (i * 2)), _mm_unpacklo_epi8(high_digits, low_digits));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + (i * 2) + 16), _mm_unpackhi_epi8(high_digits, low_digits));
+    }
+#endif
+
+    for (; i < size; i++) {
+        output[i * 2] = digits[data[i] >> 4];
+        output[(i * 2) + 1] = digits[data[i] & 0x0f];
+    }
+}
+
+void HerixLib::renderAscii (const Byte* data, size_t size, char* output, char unprintable) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    // Printable is [0x20, 0x7e], so after subtracting 0x20 it is printable if it's (unsigned) at most 0x5e
+    const __m128i offset = _mm_set1_epi8(0x20);
+    const __m128i limit = _mm_set1_epi8(0x5e);
+    const __m128i replacement = _mm_set1_epi8(unprintable);
+    for (; i + 16 <= size; i += 16) {
+        __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i shifted = _mm_sub_epi8(values, offset);
+        __m128i printable = _mm_cmpeq_epi8(_mm_min_epu8(shifted, limit), shifted);
+        __m128i result = _mm_or_si128(_mm_and_si128(printable, values), _mm_andnot_si128(printable, replacement));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), result);
+    }
+#endif
+
+    for (; i < size; i++) {
+        output[i] = (data[i] >= 0x20 && data[i] <= 0x7e) ? static_cast<char>(data[i]) : unprintable;
+    }
+}
+
+
+template<typename Alignment, typename BackendType>
+BasicRowRenderer<Alignment, BackendType>::BasicRowRenderer (BasicHerix<Alignment, BackendType>& t_herix, size_t t_bytes_per_row, bool t_uppercase, char t_unprintable, size_t t_max_cached_rows) :
+    herix(t_herix), bytes_per_row(t_bytes_per_row), uppercase(t_uppercase), unprintable(t_unprintable), max_cached_rows(t_max_cached_rows) {
+    if (bytes_per_row == 0) {
+        throw std::invalid_argument("bytes_per_row must be at least 1.");
+    }
+
+    listener = herix.addChangeListener([this] (FilePosition pos, size_t size) {
+        invalidate(pos, size);
+    });
+}
+
+template<typename Alignment, typename BackendType>
+BasicRowRenderer<Alignment, BackendType>::~BasicRowRenderer () {
+    herix.removeChangeListener(listener);
+}
+
+template<typename Alignment, typename BackendType>
+size_t BasicRowRenderer<Alignment, BackendType>::getBytesPerRow () const {
+    return bytes_per_row;
+}
+
+template<typename Alignment, typename BackendType>
+size_t BasicRowRenderer<Alignment, BackendType>::getRowStride () const {
+    // hex + ascii + mask
+    return bytes_per_row * 4;
+}
+
+template<typename Alignment, typename BackendType>
+size_t BasicRowRenderer<Alignment, BackendType>::getRowsRendered () const {
+    return rows_rendered;
+}
+
+template<typename Alignment, typename BackendType>
+size_t BasicRowRenderer<Alignment, BackendType>::getCachedRowCount () const {
+    return cache.size();
+}
+
+template<typename Alignment, typename BackendType>
+const char* BasicRowRenderer<Alignment, BackendType>::getHex (const char* output, size_t row) const {
+    return output + (row * getRowStride());
+}
+template<typename Alignment, typename BackendType>
+const char* BasicRowRenderer<Alignment, BackendType>::getAscii (const char* output, size_t row) const {
+    return getHex(output, row) + (bytes_per_row * 2);
+}
+template<typename Alignment, typename BackendType>
+const Byte* BasicRowRenderer<Alignment, BackendType>::getMask (const char* output, size_t row) const {
+    return reinterpret_cast<const Byte*>(getAscii(output, row) + bytes_per_row);
+}
+
+/// Renders the rows straight from Herix, with a single read for all of them, and stores them in the cache.
+template<typename Alignment, typename BackendType>
+void BasicRowRenderer<Alignment, BackendType>::renderUncached (size_t first_row, size_t row_count, char* output) {
+    size_t byte_count = row_count * bytes_per_row;
+    Buffer data(byte_count);
+    Buffer mask(byte_count, 0);
+
+    size_t read_count = herix.readInto(first_row * bytes_per_row, byte_count, data.data(), mask.data());
+    for (size_t i = read_count; i < byte_count; i++) {
+        mask[i] = RenderFlag::Unread;
+    }
+
+    size_t stride = getRowStride();
+    for (size_t row = 0; row < row_count; row++) {
+        const Byte* row_data = data.data() + (row * bytes_per_row);
+        const Byte* row_mask = mask.data() + (row * bytes_per_row);
+        char* hex = output + (row * stride);
+        char* ascii = hex + (bytes_per_row * 2);
+        Byte* out_mask = reinterpret_cast<Byte*>(ascii + bytes_per_row);
+
+        renderHex(row_data, bytes_per_row, hex, uppercase);
+        renderAscii(row_data, bytes_per_row, ascii, unprintable);
+        std::memcpy(out_mask, row_mask, bytes_per_row);
+
+        // Blank out what couldn't be read. This is only ever the tail of the last rows
+        size_t row_start = row * bytes_per_row;
+        if (read_count < row_start + bytes_per_row) {
+            size_t blank_from = read_count > row_start ? read_count - row_start : 0;
+            std::memset(hex + (blank_from * 2), ' ', (bytes_per_row - blank_from) * 2);
+            std::memset(ascii + blank_from, ' ', bytes_per_row - blank_from);
+        }
+
+        cache[first_row + row] = Buffer(reinterpret_cast<Byte*>(hex), reinterpret_cast<Byte*>(hex) + stride);
+    }
+
+    rows_rendered += row_count;
+}
+
+template<typename Alignment, typename BackendType>
+void BasicRowRenderer<Alignment, BackendType>::render (size_t first_row, size_t row_count, char* output) {
+    size_t stride = getRowStride();
+
+    // Copy the cached rows, and render each run of dirty rows in one go
+    size_t row = 0;
+    while (row < row_count) {
+        auto iter = cache.find(first_row + row);
+        if (iter != cache.end()) {
+            std::memcpy(output + (row * stride), iter->second.data(), stride);
+            row++;
+            continue;
+        }
+
+        size_t run_start = row;
+        while (row < row_count && cache.count(first_row + row) == 0) {
+            row++;
+        }
+        renderUncached(first_row + run_start, row - run_start, output + (run_start * stride));
+    }
+
+    trimCache(first_row, row_count);
+}
+
+template<typename Alignment, typename BackendType>
+bool BasicRowRenderer<Alignment, BackendType>::renderNonBlocking (size_t first_row, size_t row_count, char* output, ChangeCallback on_ready) {
+    if (!herix.isAsyncLoadingEnabled() || herix.isRangeCached(first_row * bytes_per_row, row_count * bytes_per_row)) {
+        render(first_row, row_count, output);
+        return true;
+    }
+
+    size_t stride = getRowStride();
+    bool complete = true;
+
+    size_t row = 0;
+    while (row < row_count) {
+        auto iter = cache.find(first_row + row);
+        if (iter != cache.end()) {
+            std::memcpy(output + (row * stride), iter->second.data(), stride);
+            row++;
+            continue;
+        }
+
+        size_t run_start = row;
+        while (row < row_count && cache.count(first_row + row) == 0) {
+            row++;
+        }
+
+        FilePosition run_pos = (first_row + run_start) * bytes_per_row;
+        size_t run_size = (row - run_start) * bytes_per_row;
+        if (herix.isRangeCached(run_pos, run_size)) {
+            renderUncached(first_row + run_start, row - run_start, output + (run_start * stride));
+        } else {
+            complete = false;
+            renderPartial(first_row + run_start, row - run_start, output + (run_start * stride));
+            herix.requestRange(run_pos, run_size, on_ready);
+        }
+    }
+
+    trimCache(first_row, row_count);
+    return complete;
+}
+
+/// Renders whatever of the rows is cached. These rows aren't stored in the cache, since they're incomplete.
+template<typename Alignment, typename BackendType>
+void BasicRowRenderer<Alignment, BackendType>::renderPartial (size_t first_row, size_t row_count, char* output) {
+    size_t byte_count = row_count * bytes_per_row;
+    FilePosition pos = first_row * bytes_per_row;
+    Buffer data(byte_count, 0);
+    Buffer available(byte_count, 0);
+    Buffer mask(byte_count, 0);
+
+    herix.readCachedInto(pos, byte_count, data.data(), available.data());
+    Buffer scratch(byte_count);
+    herix.edits.applyTo(pos, byte_count, scratch.data(), mask.data());
+
+    size_t file_end = herix.getFileEnd();
+    for (size_t i = 0; i < byte_count; i++) {
+        if (available[i] == 0) {
+            mask[i] |= pos + i >= file_end ? RenderFlag::Unread : RenderFlag::Pending;
+        }
+    }
+
+    size_t stride = getRowStride();
+    for (size_t row = 0; row < row_count; row++) {
+        size_t row_start = row * bytes_per_row;
+        char* hex = output + (row * stride);
+        char* ascii = hex + (bytes_per_row * 2);
+
+        renderHex(data.data() + row_start, bytes_per_row, hex, uppercase);
+        renderAscii(data.data() + row_start, bytes_per_row, ascii, unprintable);
+        std::memcpy(ascii + bytes_per_row, mask.data() + row_start, bytes_per_row);
+
+        for (size_t i = 0; i < bytes_per_row; i++) {
+            if (available[row_start + i] == 0) {
+                hex[i * 2] = ' ';
+                hex[(i * 2) + 1] = ' ';
+                ascii[i] = ' ';
+            }
+        }
+    }
+}
+
+/// Drops cached rows furthest from the current view until we're back in the limit
+template<typename Alignment, typename BackendType>
+void BasicRowRenderer<Alignment, BackendType>::trimCache (size_t first_row, size_t row_count) {
+    size_t last_row = first_row + row_count;
+    while (cache.size() > max_cached_rows) {
+        size_t front_distance = first_row > cache.begin()->first ? first_row - cache.begin()->first : 0;
+        size_t back_distance = cache.rbegin()->first >= last_row ? cache.rbegin()->first - last_row + 1 : 0;
+
+        if (front_distance == 0 && back_distance == 0) {
+            // Everything left is in view
+            break;
+        } else if (front_distance >= back_distance) {
+            cache.erase(cache.begin());
+        } else {
+            cache.erase(std::prev(cache.end()));
+        }
+    }
+}
+
+template<typename Alignment, typename BackendType>
+void BasicRowRenderer<Alignment, BackendType>::invalidate (FilePosition pos, size_t size) {
+    if (size == 0 || cache.empty()) {
+        return;
+    }
+
+    size_t first_row = pos / bytes_per_row;
+    // Avoid overflowing with ranges that cover everything
+    size_t last_row = size > std::numeric_limits<size_t>::max() - pos ?
+        std::numeric_limits<size_t>::max() :
+        (pos + size - 1) / bytes_per_row;
+
+    cache.erase(cache.lower_bound(first_row), cache.upper_bound(last_row));
+}
+
+template<typename Alignment, typename BackendType>
+void BasicRowRenderer<Alignment, BackendType>::invalidateAll () {
+    cache.clear();
+}
+
+// Built for each instance type the library has
+template class HerixLib::BasicRowRenderer<RuntimeChunkAlignment>;
+template class HerixLib::BasicRowRenderer<PowerOfTwoChunkAlignment>;
+template class HerixLib::BasicRowRenderer<PowerOfTwoChunkAlignment, FileBackend>;
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+void HerixLib::test_render () {
+    // = Hex, with enough bytes to go through the vectorized path and the remainder
+    Buffer data;
+    for (size_t i = 0; i < 40; i++) {
+        data.push_back(static_cast<Byte>(i * 7));
+    }
+    std::string hex(data.size() * 2, '\0');
+    renderHex(data.data(), data.size(), hex.data());
+    for (size_t i = 0; i < data.size(); i++) {
+        assert(hex[i * 2] == hex_lower[data[i] >> 4]);
+        assert(hex[(i * 2) + 1] == hex_lower[data[i] & 0x0f]);
+    }
+
+    const Byte upper_data[] = { 0xab, 0xcd };
+    char upper_hex[4];
+    renderHex(upper_data, 2, upper_hex, true);
+    assert(std::string(upper_hex, 4) == "ABCD");
+
+    // = Ascii
+    const Byte ascii_data[] = { 'H', 'i', 0x00, 0x7f, 0x80, 0xff, ' ', '~', 0x1f, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 0x0a };
+    char ascii[18];
+    renderAscii(ascii_data, 18, ascii, '.');
+    assert(std::string(ascii, 18) == "Hi.... ~.abcdefgh.");
+
+    // = Rows, through a Herix instance
+    const std::string text = "0123456789abcdefghij";
+    std::filesystem::path path = writeTestFile("herix_test_render.bin", Buffer(text.begin(), text.end()));
+
+    {
+        Herix h(path, false, std::make_pair(0, std::nullopt), 64, 8);
+        RowRenderer renderer(h, 8);
+        std::vector<char> output(renderer.getRowStride() * 3);
+
+        renderer.render(0, 3, output.data());
+        assert(renderer.getRowsRendered() == 3);
+        assert(std::string(renderer.getHex(output.data(), 0), 16) == "3031323334353637");
+        assert(std::string(renderer.getAscii(output.data(), 1), 8) == "89abcdef");
+        // Only 4 bytes are in the last row
+        assert(std::string(renderer.getAscii(output.data(), 2), 8) == "ghij    ");
+        assert(std::string(renderer.getHex(output.data(), 2), 16) == "6768696a        ");
+        assert(renderer.getMask(output.data(), 2)[3] == 0);
+        assert(renderer.getMask(output.data(), 2)[4] == RenderFlag::Unread);
+
+        // Rendering again should only copy from the cache
+        renderer.render(0, 3, output.data());
+        assert(renderer.getRowsRendered() == 3);
+
+        // An edit should only rerender the row it is on
+        h.edit(9, 'X');
+        renderer.render(0, 3, output.data());
+        assert(renderer.getRowsRendered() == 4);
+        assert(std::string(renderer.getAscii(output.data(), 1), 8) == "8Xabcdef");
+        assert(renderer.getMask(output.data(), 1)[1] == RenderFlag::Edited);
+        assert(renderer.getMask(output.data(), 1)[0] == 0);
+
+        h.undo();
+        renderer.render(0, 3, output.data());
+        assert(renderer.getRowsRendered() == 5);
+        assert(std::string(renderer.getAscii(output.data(), 1), 8) == "89abcdef");
+
+        // A transaction is undone in one step, and every row it touched is rerendered
+        h.beginTransaction();
+        h.edit(0, 'Y');
+        h.edit(17, 'Z');
+        h.commitTransaction();
+        renderer.render(0, 3, output.data());
+        assert(renderer.getAscii(output.data(), 0)[0] == 'Y');
+        assert(renderer.getAscii(output.data(), 2)[1] == 'Z');
+        h.undo();
+        assert(!h.canUndo());
+        renderer.render(0, 3, output.data());
+        assert(renderer.getAscii(output.data(), 0)[0] == '0');
+        assert(renderer.getAscii(output.data(), 2)[1] == 'h');
+    }
+
+    {
+        // Non-blocking renders show what's cached, and fill in once the rest arrives
+        Herix h(path, false, std::make_pair(0, std::nullopt), 64, 8);
+        h.enableAsyncLoading(1);
+        RowRenderer renderer(h, 8);
+        std::vector<char> output(renderer.getRowStride() * 3);
+
+        // Load the middle row in so it is available immediately
+        h.read(8);
+        h.edit(0, 'X');
+
+        size_t ready_count = 0;
+        bool complete = renderer.renderNonBlocking(0, 3, output.data(), [&ready_count] (FilePosition, size_t) {
+            ready_count++;
+        });
+        assert(!complete);
+        assert(std::string(renderer.getAscii(output.data(), 0), 8) == "X       ");
+        assert(renderer.getMask(output.data(), 0)[0] == RenderFlag::Edited);
+        assert(renderer.getMask(output.data(), 0)[1] == RenderFlag::Pending);
+        assert(std::string(renderer.getAscii(output.data(), 1), 8) == "89abcdef");
+        assert(renderer.getMask(output.data(), 2)[7] == RenderFlag::Unread);
+
+        while (ready_count == 0) {
+            h.pollAsync(true);
+        }
+
+        assert(renderer.renderNonBlocking(0, 3, output.data()));
+        assert(std::string(renderer.getAscii(output.data(), 0), 8) == "X1234567");
+        assert(std::string(renderer.getAscii(output.data(), 2), 8) == "ghij    ");
+    }
+
+    {
+        // Any instance type can be rendered
+        PowerOfTwoFileHerix h(path, false, std::make_pair(0, std::nullopt), 64, 8);
+        BasicRowRenderer renderer(h, 8);
+        std::vector<char> output(renderer.getRowStride());
+        h.edit(2, 'P');
+        renderer.render(1, 1, output.data());
+        assert(std::string(renderer.getAscii(output.data(), 0), 8) == "89abcdef");
+        renderer.render(0, 1, output.data());
+        assert(std::string(renderer.getAscii(output.data(), 0), 8) == "01P34567");
+        assert(renderer.getMask(output.data(), 0)[2] == RenderFlag::Edited);
+    }
+
+    {
+        // Once saved, an edit is part of the file and stops being shown as one
+        Herix h(path, true, std::make_pair(0, std::nullopt), 64, 8);
+        RowRenderer renderer(h, 8);
+        std::vector<char> output(renderer.getRowStride() * 3);
+
+        h.edit(10, 'S');
+        renderer.render(0, 3, output.data());
+        assert(renderer.getMask(output.data(), 1)[2] == RenderFlag::Edited);
+        size_t rendered = renderer.getRowsRendered();
+
+        h.saveHistoryDestructive();
+        renderer.render(0, 3, output.data());
+        // Only the saved row is rerendered
+        assert(renderer.getRowsRendered() == rendered + 1);
+        assert(std::string(renderer.getAscii(output.data(), 1), 8) == "89Sbcdef");
+        assert(renderer.getMask(output.data(), 1)[2] == 0);
+    }
+
+    std::filesystem::remove(path);
+}
+
+#endif
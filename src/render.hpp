@@ -0,0 +1,95 @@
+#ifndef FILE_SEEN_RENDER
+#define FILE_SEEN_RENDER
+
+#include <map>
+
+#include "types.hpp"
+#include "herix.hpp"
+
+namespace HerixLib {
+
+/// Flags stored in the mask of a rendered row, one per byte.
+namespace RenderFlag {
+    /// The byte has been edited. This is the same value EditStorage::applyTo writes into its mask.
+    constexpr Byte Edited = 1 << 0;
+    /// The byte could not be read (past the end of the file)
+    constexpr Byte Unread = 1 << 1;
+    /// The byte is still being loaded in the background, see RowRenderer::renderNonBlocking
+    constexpr Byte Pending = 1 << 2;
+}
+
+/// Converts bytes into hex digits, two characters per byte. output must have space for size * 2 characters.
+void renderHex (const Byte* data, size_t size, char* output, bool uppercase=false);
+/// Converts bytes into their ascii column, replacing anything that isn't printable with unprintable.
+void renderAscii (const Byte* data, size_t size, char* output, char unprintable='.');
+
+/// Renders rows of bytes into ready to draw hex and ascii text, for a GUI to display.
+/// Each row in the output is laid out as [hex: bytes_per_row * 2][ascii: bytes_per_row][mask: bytes_per_row], see getRowStride.
+/// Unread bytes are rendered as spaces.
+/// Rendered rows are cached, and the renderer listens to the Herix instance for changes so an edit only re-renders
+/// the rows it touched. It works with any BasicHerix, see RowRenderer for the usual one.
+template<typename Alignment, typename BackendType=Backend>
+class BasicRowRenderer {
+    protected:
+    BasicHerix<Alignment, BackendType>& herix;
+    ListenerID listener;
+
+    size_t bytes_per_row;
+    bool uppercase;
+    char unprintable;
+    /// The amount of rows kept in the cache once a render is finished.
+    size_t max_cached_rows;
+
+    /// Row index to its rendered data (of getRowStride() bytes). Rows that aren't in here are dirty.
+    std::map<size_t, Buffer> cache;
+
+    /// How many rows have actually been rendered (rather than copied from the cache) over the lifetime.
+    size_t rows_rendered = 0;
+
+    void renderUncached (size_t first_row, size_t row_count, char* output);
+    void renderPartial (size_t first_row, size_t row_count, char* output);
+    void trimCache (size_t first_row, size_t row_count);
+
+    public:
+    BasicRowRenderer (BasicHerix<Alignment, BackendType>& t_herix, size_t t_bytes_per_row=16, bool t_uppercase=false, char t_unprintable='.', size_t t_max_cached_rows=256);
+    ~BasicRowRenderer ();
+
+    BasicRowRenderer (const BasicRowRenderer&) = delete;
+    BasicRowRenderer& operator= (const BasicRowRenderer&) = delete;
+
+    size_t getBytesPerRow () const;
+    /// The amount of bytes each row takes up in the output buffer.
+    size_t getRowStride () const;
+    size_t getRowsRendered () const;
+    size_t getCachedRowCount () const;
+
+    /// Renders rows [first_row, first_row+row_count) into output, which must be at least row_count * getRowStride() bytes.
+    void render (size_t first_row, size_t row_count, char* output);
+    /// Like render, but doesn't wait on the disk if async loading is enabled on the Herix instance.
+    /// Bytes that aren't loaded are left blank and flagged as Pending, and are requested in the background. on_ready
+    /// is called (from Herix::pollAsync) with the range once it has arrived, so the GUI knows to render again.
+    /// Returns true if nothing was pending.
+    bool renderNonBlocking (size_t first_row, size_t row_count, char* output, ChangeCallback on_ready=nullptr);
+
+    // Accessors into a rendered output buffer
+    const char* getHex (const char* output, size_t row) const;
+    const char* getAscii (const char* output, size_t row) const;
+    const Byte* getMask (const char* output, size_t row) const;
+
+    /// Marks the rows which hold [pos, pos+size) as dirty. Called automatically on changes to the Herix instance.
+    void invalidate (FilePosition pos, size_t size);
+    void invalidateAll ();
+};
+
+/// Renders rows of a Herix
+using RowRenderer = BasicRowRenderer<RuntimeChunkAlignment>;
+
+extern template class BasicRowRenderer<RuntimeChunkAlignment>;
+extern template class BasicRowRenderer<PowerOfTwoChunkAlignment>;
+extern template class BasicRowRenderer<PowerOfTwoChunkAlignment, FileBackend>;
+
+void test_render ();
+
+}
+
+#endif
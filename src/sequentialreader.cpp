@@ -0,0 +1,380 @@
+#include "sequentialreader.hpp"
+#include "herix.hpp"
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <numeric>
+#include <iterator>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace HerixLib;
+
+void SequentialReader::AlignedDeleter::operator() (Byte* data) const {
+    std::free(data);
+}
+
+SequentialReader::SequentialReader (const std::filesystem::path& path, AbsoluteFilePosition start, FilePosition t_pos, size_t size,
+    const EditStorage* t_edits, SequentialReaderOptions t_options, std::shared_ptr<Backend> t_backend) :
+    options(t_options), edits(t_edits), backend(std::move(t_backend)), start_position(start), range_start(t_pos), pos(t_pos), end(t_pos + size) {
+    options.block_size = std::max(options.block_size, alignment);
+    options.block_size += (alignment - (options.block_size % alignment)) % alignment;
+
+    // Direct reads have to be at aligned offsets
+    if ((start_position + pos) % alignment != 0) {
+        options.direct = false;
+    }
+
+    if (backend == nullptr) {
+        open(path);
+    } else if (dynamic_cast<FileBackend*>(backend.get()) != nullptr) {
+        // Its own descriptor, so the hints don't change how the file is read for everything else
+        open(backend->getPath());
+    } else {
+        options.direct = false;
+    }
+
+    for (std::unique_ptr<Byte, AlignedDeleter>& buffer : buffers) {
+        buffer.reset(static_cast<Byte*>(std::aligned_alloc(alignment, options.block_size)));
+        if (!buffer) {
+            throw std::bad_alloc();
+        }
+    }
+
+    if (pos < end) {
+        prefetch(pos);
+    }
+}
+
+SequentialReader::~SequentialReader () {
+    if (pending.valid()) {
+        pending.wait();
+    }
+}
+
+void SequentialReader::open (const std::filesystem::path& path) {
+    std::shared_ptr<FileBackend> file = FileBackend::openSequential(path, options.direct, options.no_reuse);
+    options.direct = file->isDirect();
+    backend = std::move(file);
+}
+
+/// Reads up to size bytes at block_pos into buffer. Returns how many were read, which is only less than size at the end of the file.
+/// This is run on the prefetching thread, so it must not touch the edits.
+size_t SequentialReader::readBlock (Byte* buffer, FilePosition block_pos, size_t size) {
+    // Direct reads must also be a multiple of the alignment. The buffer is always big enough for that
+    size_t request = options.direct ? size + ((alignment - (size % alignment)) % alignment) : size;
+    return std::min(backend->read(start_position + block_pos, request, buffer), size);
+}
+
+void SequentialReader::prefetch (FilePosition block_pos) {
+    Byte* buffer = buffers[current].get();
+    size_t size = std::min(options.block_size, end - block_pos);
+    pending = std::async(std::launch::async, [this, buffer, block_pos, size] () {
+        return readBlock(buffer, block_pos, size);
+    });
+}
+
+std::optional<SequentialBlock> SequentialReader::next () {
+    if (pos >= end || !pending.valid()) {
+        return std::nullopt;
+    }
+
+    size_t index = current;
+    size_t expected = std::min(options.block_size, end - pos);
+    size_t size = pending.get();
+
+    FilePosition block_pos = pos;
+    pos += expected;
+    if (size < expected) {
+        // The file was shorter than expected, so this is the last block
+        end = block_pos + size;
+        pos = end;
+    }
+
+    // The block before this one has been used up, so let the OS drop it
+    if (options.no_reuse && !options.direct && block_pos != range_start) {
+        backend->dropCached(start_position + block_pos - options.block_size, options.block_size);
+    }
+
+    if (pos < end) {
+        current = index ^ 1;
+        prefetch(pos);
+    }
+
+    if (size == 0) {
+        return std::nullopt;
+    }
+
+    Byte* data = buffers[index].get();
+    if (edits != nullptr) {
+        edits->applyTo(block_pos, size, data);
+    }
+
+    return SequentialBlock{ block_pos, data, size };
+}
+
+bool SequentialReader::isNextReady () const {
+    return !pending.valid() || pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+size_t SequentialReader::roundBlockSize (size_t unit, size_t target) {
+    size_t multiple = std::lcm(unit, alignment);
+    return std::max(size_t(1), target / multiple) * multiple;
+}
+
+FilePosition SequentialReader::getPosition () const {
+    return pos;
+}
+FilePosition SequentialReader::getEnd () const {
+    return end;
+}
+size_t SequentialReader::getBlockSize () const {
+    return options.block_size;
+}
+bool SequentialReader::isDirect () const {
+    return options.direct;
+}
+
+
+/// Finds the first position in data that starts needle.
+static std::optional<size_t> findBytes (const Byte* data, size_t size, const Byte* needle, size_t needle_size) {
+    if (needle_size > size) {
+        return std::nullopt;
+    }
+
+    size_t start = 0;
+#if defined(__SSE2__)
+    // Checks 16 positions at a time for both the first and the last byte of the needle matching, which rules out far
+    // more candidates than the first byte alone on data with few distinct values
+    if (needle_size >= 2) {
+        const __m128i first = _mm_set1_epi8(static_cast<char>(needle[0]));
+        const __m128i last = _mm_set1_epi8(static_cast<char>(needle[needle_size - 1]));
+        for (; start + 16 + needle_size - 1 <= size; start += 16) {
+            __m128i first_block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + start));
+            __m128i last_block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + start + needle_size - 1));
+            unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, first_block), _mm_cmpeq_epi8(last, last_block))));
+            while (mask != 0) {
+                size_t candidate = start + static_cast<size_t>(__builtin_ctz(mask));
+                if (std::memcmp(data + candidate + 1, needle + 1, needle_size - 2) == 0) {
+                    return candidate;
+                }
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+
+    // memchr is vectorized, so skip to candidates with it
+    const Byte* current = data + start;
+    const Byte* last = data + (size - needle_size);
+    while (current <= last) {
+        const Byte* candidate = static_cast<const Byte*>(std::memchr(current, needle[0], static_cast<size_t>(last - current) + 1));
+        if (candidate == nullptr) {
+            return std::nullopt;
+        }
+        if (std::memcmp(candidate + 1, needle + 1, needle_size - 1) == 0) {
+            return static_cast<size_t>(candidate - data);
+        }
+        current = candidate + 1;
+    }
+    return std::nullopt;
+}
+
+BlockSearcher::BlockSearcher (Buffer t_needle) : needle(std::move(t_needle)) {
+    assert(!needle.empty());
+}
+
+size_t BlockSearcher::getMinimumBlockSize () const {
+    // The boundary handling only looks at the previous block
+    return needle.size() * 2;
+}
+
+std::optional<FilePosition> BlockSearcher::feed (const SequentialBlock& block) {
+    if (!boundary.empty()) {
+        size_t tail_size = boundary.size();
+        boundary.insert(boundary.end(), block.data, block.data + std::min(needle.size() - 1, block.size));
+        std::optional<size_t> found = findBytes(boundary.data(), boundary.size(), needle.data(), needle.size());
+        if (found.has_value()) {
+            return block.pos - tail_size + found.value();
+        }
+    }
+
+    std::optional<size_t> found = findBytes(block.data, block.size, needle.data(), needle.size());
+    if (found.has_value()) {
+        return block.pos + found.value();
+    }
+
+    size_t keep = std::min(needle.size() - 1, block.size);
+    boundary.assign(block.data + (block.size - keep), block.data + block.size);
+    return std::nullopt;
+}
+
+void BlockSearcher::findAllIn (const Byte* data, size_t size, FilePosition pos, std::vector<FilePosition>& matches) {
+    size_t offset = next_allowed > pos ? static_cast<size_t>(next_allowed - pos) : 0;
+    while (offset < size) {
+        std::optional<size_t> found = findBytes(data + offset, size - offset, needle.data(), needle.size());
+        if (!found.has_value()) {
+            return;
+        }
+
+        FilePosition match = pos + offset + found.value();
+        matches.push_back(match);
+        next_allowed = match + needle.size();
+        offset = next_allowed - pos;
+    }
+}
+
+void BlockSearcher::feedAll (const SequentialBlock& block, std::vector<FilePosition>& matches) {
+    if (!boundary.empty()) {
+        // Only matches which start before the block fit in here, so this finds just the straddling ones
+        FilePosition boundary_pos = block.pos - boundary.size();
+        boundary.insert(boundary.end(), block.data, block.data + std::min(needle.size() - 1, block.size));
+        findAllIn(boundary.data(), boundary.size(), boundary_pos, matches);
+    }
+
+    findAllIn(block.data, block.size, block.pos, matches);
+
+    size_t keep = std::min(needle.size() - 1, block.size);
+    boundary.assign(block.data + (block.size - keep), block.data + block.size);
+}
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+void HerixLib::test_sequentialreader () {
+    Buffer contents;
+    for (size_t i = 0; i < 10000; i++) {
+        contents.push_back(static_cast<Byte>(i * 31));
+    }
+    std::filesystem::path path = writeTestFile("herix_test_sequentialreader.bin", contents);
+
+    SequentialReaderOptions options;
+    options.block_size = 4096;
+
+    // = Raw, from an offset
+    {
+        SequentialReader reader(path, 100, 50, 9000, nullptr, options);
+        Buffer result;
+        size_t blocks = 0;
+        while (std::optional<SequentialBlock> block = reader.next()) {
+            assert(block.value().pos == 50 + result.size());
+            result.insert(result.end(), block.value().data, block.value().data + block.value().size);
+            blocks++;
+        }
+        // 9000 bytes requested, but only 9850 are past 150, so it isn't clipped
+        assert(blocks == 3);
+        assert(result.size() == 9000);
+        assert(std::equal(result.begin(), result.end(), contents.begin() + 150));
+    }
+
+    // = Past the end of the file gets cut off
+    {
+        SequentialReader reader(path, 0, 8000, 5000, nullptr, options);
+        size_t total = 0;
+        while (std::optional<SequentialBlock> block = reader.next()) {
+            total += block.value().size;
+        }
+        assert(total == 2000);
+    }
+
+    // = Through a Herix instance, with edits, and without touching its chunks
+    {
+        Herix h(path, false, std::make_pair(0, std::nullopt), 1024, 256);
+        h.edit(4095, 1);
+        h.edit(4096, 2);
+        options.direct = true;
+
+        SequentialReader reader(h, 0, 100000, options);
+        Buffer result;
+        while (std::optional<SequentialBlock> block = reader.next()) {
+            result.insert(result.end(), block.value().data, block.value().data + block.value().size);
+        }
+        assert(result.size() == contents.size());
+        assert(result[4095] == 1);
+        assert(result[4096] == 2);
+        assert(result[4097] == contents[4097]);
+
+        // Searching across the boundary of two blocks
+        assert(h.find(0, Buffer{ contents[4094], 1, 2 }) == std::make_optional<FilePosition>(4094));
+        assert(h.find(4095, Buffer{ contents[4094], 1, 2 }) == std::nullopt);
+        // The contents repeat every 256 bytes, so the first match is well before the end
+        assert(h.find(0, Buffer{ contents[9998], contents[9999] }) == std::make_optional<FilePosition>(9998 % 256));
+        assert(h.find(9998 - 255, Buffer{ contents[9998], contents[9999] }) == std::make_optional<FilePosition>(9998));
+        assert(h.find(0, Buffer{ contents[0] }) == std::make_optional<FilePosition>(0));
+
+        // Exporting writes the edited file
+        std::filesystem::path export_path = getTestPath("herix_test_sequentialreader_export.bin");
+        h.exportTo(export_path, 4000, 200);
+        std::ifstream exported(export_path, std::ios_base::binary);
+        Buffer exported_data((std::istreambuf_iterator<char>(exported)), std::istreambuf_iterator<char>());
+        assert(exported_data.size() == 200);
+        assert(exported_data[95] == 1);
+        assert(exported_data[96] == 2);
+        assert(exported_data[0] == contents[4000]);
+        std::filesystem::remove(export_path);
+
+        assert(h.getChunkCount() == 0);
+    }
+
+    // = Finding every match, without overlaps and across blocks
+    {
+        Buffer repeated(40, 7);
+        BlockSearcher searcher(Buffer{ 7, 7, 7 });
+        std::vector<FilePosition> matches;
+        searcher.feedAll(SequentialBlock{ 0, repeated.data(), 20 }, matches);
+        searcher.feedAll(SequentialBlock{ 20, repeated.data() + 20, 20 }, matches);
+        assert(matches.size() == 13);
+        for (size_t i = 0; i < matches.size(); i++) {
+            assert(matches[i] == i * 3);
+        }
+
+        // Long needles, found by the vectorized search on both sides of a block boundary
+        Herix h(path, false, std::make_pair(0, std::nullopt), 1024, 256);
+        assert(h.find(0, Buffer(contents.begin() + 5000, contents.begin() + 5040)) == std::make_optional<FilePosition>(5000 % 256));
+        assert(h.find(0, Buffer(contents.begin() + 4080, contents.begin() + 4110)) == std::make_optional<FilePosition>(4080 % 256));
+        assert(h.find(0, Buffer{ 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17 }) == std::nullopt);
+
+        // Replacing, where every 256th match straddles a block
+        Buffer needle(contents.begin() + 254, contents.begin() + 257);
+        assert(h.replaceAll(needle, Buffer{ 0xA, 0xB, 0xC }) == 39);
+        assert(h.read(254 + (256 * 15)) == 0xA);
+        assert(h.read(256 + (256 * 15)) == 0xC);
+        assert(h.read(257 + (256 * 15)) == contents[257]);
+        assert(!h.find(0, needle).has_value());
+        // One undo step, holding the replacement once
+        assert(h.edits.getEntryCount() == 1);
+        assert(h.edits.getBytesFilledIn() == 39 * 3);
+        assert(h.edits.edits.at(0).data.size() == 3);
+        h.undo();
+        assert(h.find(0, needle) == std::make_optional<FilePosition>(254));
+        assert(h.replaceAll(needle, Buffer{ 1, 2, 3 }, 9000) == 4);
+
+        bool threw = false;
+        try {
+            h.replaceAll(needle, Buffer{ 1 });
+        } catch (std::invalid_argument&) {
+            threw = true;
+        }
+        assert(threw);
+
+        // Filling only stores the pattern
+        h.fill(100, 5000, Buffer{ 0xDE, 0xAD, 0xBE });
+        assert(h.read(100) == 0xDE);
+        assert(h.read(104) == 0xAD);
+        assert(h.read(5099) == 0xAD);
+        assert(h.read(5100) == contents[5100]);
+        assert(h.edits.edits.back().data.size() == 3);
+        Buffer filled = h.readMultipleCutoff(98, 6);
+        assert((filled == Buffer{ contents[98], contents[99], 0xDE, 0xAD, 0xBE, 0xDE }));
+        assert(h.find(0, Buffer{ 0xBE, 0xDE, 0xAD, 0xBE }) == std::make_optional<FilePosition>(102));
+    }
+
+    std::filesystem::remove(path);
+}
+
+#endif
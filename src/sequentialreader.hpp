@@ -0,0 +1,132 @@
+#ifndef FILE_SEEN_SEQUENTIALREADER
+#define FILE_SEEN_SEQUENTIALREADER
+
+#include <algorithm>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "types.hpp"
+#include "editstorage.hpp"
+#include "backend.hpp"
+
+namespace HerixLib {
+
+template<typename Alignment, typename BackendType>
+class BasicHerix;
+
+class SequentialReaderOptions {
+    public:
+    /// Size of each block read. Rounded up to a multiple of the alignment.
+    size_t block_size = 4 * 1024 * 1024;
+    /// Use O_DIRECT to skip the page cache entirely. Falls back to normal reads if the filesystem doesn't support it,
+    /// or if the start of the range isn't aligned.
+    bool direct = false;
+    /// Tell the OS that the data won't be used again (posix_fadvise NOREUSE, and DONTNEED once consumed)
+    /// so a whole-file pass doesn't push everything else out of the page cache.
+    bool no_reuse = true;
+};
+
+/// A view of one block of the range. The data is valid until the next call to next()
+class SequentialBlock {
+    public:
+    FilePosition pos;
+    const Byte* data;
+    size_t size;
+};
+
+/// Reads a range of the file front to back in large blocks for whole-file operations (searching, exporting,
+/// statistics). A file gets its own descriptor (see FileBackend::openSequential), and there are two reusable buffers, reading the next block in the background
+/// while the current one is being used. It never touches the chunk cache of a Herix instance.
+/// Edits are applied on the calling thread when the reader was given an EditStorage.
+class SequentialReader {
+    protected:
+    SequentialReaderOptions options;
+    const EditStorage* edits;
+    std::shared_ptr<Backend> backend;
+
+    AbsoluteFilePosition start_position;
+    FilePosition range_start;
+    /// Position of the next block to hand out, and the end of the range (relative to start_position)
+    FilePosition pos;
+    FilePosition end;
+
+    class AlignedDeleter {
+        public:
+        void operator() (Byte* data) const;
+    };
+    std::unique_ptr<Byte, AlignedDeleter> buffers[2];
+    /// The buffer that the current block is in. The other one is being filled in the background.
+    size_t current = 0;
+    std::future<size_t> pending;
+
+    void open (const std::filesystem::path& path);
+    size_t readBlock (Byte* buffer, FilePosition block_pos, size_t size);
+    void prefetch (FilePosition block_pos);
+
+    public:
+    /// Alignment of buffers, block sizes and direct reads
+    static constexpr size_t alignment = 4096;
+
+    /// A block size near target that is a multiple of both unit and the alignment, so that
+    /// units (such as the blocks of BlockStatistics) never straddle two blocks.
+    static size_t roundBlockSize (size_t unit, size_t target);
+
+    /// Reads [pos, pos+size) of the file that herix has open, with its edits applied. The size is clipped to the file end.
+    template<typename Alignment, typename BackendType>
+    SequentialReader (const BasicHerix<Alignment, BackendType>& herix, FilePosition t_pos, size_t size, SequentialReaderOptions t_options=SequentialReaderOptions()) :
+        SequentialReader(herix.filename, herix.getStartPosition(), t_pos, std::min(size, herix.getFileEnd() - std::min(t_pos, herix.getFileEnd())), &herix.edits, t_options,
+            herix.getSharedBackend()) {}
+    /// Reads [pos, pos+size) of path, where positions are relative to start. If edits is null then the raw file is read.
+    /// With backend, it's read from instead of path, unless it's a FileBackend.
+    SequentialReader (const std::filesystem::path& path, AbsoluteFilePosition start, FilePosition t_pos, size_t size,
+        const EditStorage* t_edits=nullptr, SequentialReaderOptions t_options=SequentialReaderOptions(),
+        std::shared_ptr<Backend> t_backend=nullptr);
+    ~SequentialReader ();
+
+    SequentialReader (const SequentialReader&) = delete;
+    SequentialReader& operator= (const SequentialReader&) = delete;
+
+    /// Returns the next block, or nullopt once the range is finished. Every block is block_size except the last.
+    std::optional<SequentialBlock> next ();
+    /// Whether next() can return without waiting on the disk
+    bool isNextReady () const;
+
+    FilePosition getPosition () const;
+    FilePosition getEnd () const;
+    size_t getBlockSize () const;
+    bool isDirect () const;
+};
+
+/// Searches for a needle in the blocks of a SequentialReader, including matches that straddle two blocks.
+/// Blocks must be fed in order, and be at least getMinimumBlockSize() (except the last).
+class BlockSearcher {
+    protected:
+    Buffer needle;
+    /// The last needle.size()-1 bytes of the previous block
+    Buffer boundary;
+    /// Where the next match can start for feedAll, so the matches don't overlap
+    FilePosition next_allowed = 0;
+
+    /// Adds every match in data (which starts at pos) that starts at or after next_allowed
+    void findAllIn (const Byte* data, size_t size, FilePosition pos, std::vector<FilePosition>& matches);
+
+    public:
+    /// needle must not be empty
+    explicit BlockSearcher (Buffer t_needle);
+
+    size_t getMinimumBlockSize () const;
+    /// Returns the position of the first match that ends in this block
+    std::optional<FilePosition> feed (const SequentialBlock& block);
+    /// Adds every match that ends in this block to matches, in order. Matches don't overlap: one which starts
+    /// within an earlier match is skipped. Don't mix this with feed on the same searcher.
+    void feedAll (const SequentialBlock& block, std::vector<FilePosition>& matches);
+};
+
+void test_sequentialreader ();
+
+}
+
+#endif
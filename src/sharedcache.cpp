@@ -0,0 +1,254 @@
+#include "sharedcache.hpp"
+#include "herix.hpp"
+#include <cassert>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#endif
+
+using namespace HerixLib;
+
+FileIdentity FileIdentity::of (const std::filesystem::path& path) {
+    FileIdentity identity;
+#if defined(__unix__) || defined(__APPLE__)
+    struct stat info;
+    if (::stat(path.c_str(), &info) == 0) {
+        identity.device = static_cast<uint64_t>(info.st_dev);
+        identity.inode = static_cast<uint64_t>(info.st_ino);
+        return identity;
+    }
+#endif
+    std::error_code error;
+    std::filesystem::path canonical = std::filesystem::canonical(path, error);
+    identity.path = error ? path.string() : canonical.string();
+    return identity;
+}
+
+bool FileIdentity::operator< (const FileIdentity& other) const {
+    return std::tie(device, inode, path) < std::tie(other.device, other.inode, other.path);
+}
+bool FileIdentity::operator== (const FileIdentity& other) const {
+    return device == other.device && inode == other.inode && path == other.path;
+}
+
+bool SharedChunkCache::Key::operator< (const Key& other) const {
+    return std::tie(file, start, size) < std::tie(other.file, other.start, other.size);
+}
+
+
+SharedChunkCache::SharedChunkCache (size_t t_max_memory) : max_memory(t_max_memory) {}
+
+SharedChunkCache& SharedChunkCache::getGlobal () {
+    static SharedChunkCache cache;
+    return cache;
+}
+
+std::shared_ptr<const Buffer> SharedChunkCache::find (const Key& key) {
+    auto iter = entries.find(key);
+    if (iter == entries.end()) {
+        return nullptr;
+    }
+
+    std::shared_ptr<const Buffer> block = iter->second.block.lock();
+    if (!block) {
+        entries.erase(iter);
+        return nullptr;
+    }
+
+    retain(key, iter->second);
+    return block;
+}
+
+std::shared_ptr<const Buffer> SharedChunkCache::add (const Key& key, std::shared_ptr<const Buffer> block) {
+    std::shared_ptr<const Buffer> existing = find(key);
+    if (existing) {
+        return existing;
+    }
+
+    Entry& entry = entries[key];
+    entry.block = block;
+    entry.order = retained_order.end();
+    retain(key, entry);
+    trim();
+    return block;
+}
+
+/// Moves the entry to the back of the retained blocks
+void SharedChunkCache::retain (const Key& key, Entry& entry) {
+    if (entry.retained) {
+        retained_order.erase(entry.order);
+    } else {
+        entry.retained = entry.block.lock();
+        retained_memory += entry.retained->size();
+    }
+    entry.order = retained_order.insert(retained_order.end(), key);
+}
+
+/// Stops retaining the least recently used blocks until under the limit. Blocks that instances hold stay alive.
+void SharedChunkCache::trim () {
+    while (retained_memory > max_memory && !retained_order.empty()) {
+        auto iter = entries.find(retained_order.front());
+        retained_order.pop_front();
+
+        retained_memory -= iter->second.retained->size();
+        iter->second.retained.reset();
+        iter->second.order = retained_order.end();
+        if (iter->second.block.expired()) {
+            entries.erase(iter);
+        }
+    }
+}
+
+std::shared_ptr<const Buffer> SharedChunkCache::get (const FileIdentity& file, AbsoluteFilePosition start, size_t size, const std::function<Buffer()>& load) {
+    Key key{ file, start, size };
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<const Buffer> block = find(key);
+        if (block) {
+            hits++;
+            return block;
+        }
+        misses++;
+    }
+
+    std::shared_ptr<const Buffer> block = std::make_shared<const Buffer>(load());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    return add(key, std::move(block));
+}
+
+std::shared_ptr<const Buffer> SharedChunkCache::put (const FileIdentity& file, AbsoluteFilePosition start, size_t size, Buffer data) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return add(Key{ file, start, size }, std::make_shared<const Buffer>(std::move(data)));
+}
+
+void SharedChunkCache::invalidateFile (const FileIdentity& file) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto iter = entries.begin(); iter != entries.end();) {
+        if (iter->first.file == file) {
+            if (iter->second.retained) {
+                retained_memory -= iter->second.retained->size();
+                retained_order.erase(iter->second.order);
+            }
+            iter = entries.erase(iter);
+        } else {
+            iter++;
+        }
+    }
+    generation++;
+}
+
+uint64_t SharedChunkCache::getGeneration () const {
+    return generation.load();
+}
+
+void SharedChunkCache::setMaxMemory (size_t t_max_memory) {
+    std::lock_guard<std::mutex> lock(mutex);
+    max_memory = t_max_memory;
+    trim();
+}
+size_t SharedChunkCache::getMaxMemory () const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return max_memory;
+}
+
+SharedChunkCacheStatistics SharedChunkCache::getStatistics () const {
+    std::lock_guard<std::mutex> lock(mutex);
+    SharedChunkCacheStatistics statistics;
+    statistics.hits = hits;
+    statistics.misses = misses;
+    statistics.retained_memory = retained_memory;
+    for (const std::pair<const Key, Entry>& entry : entries) {
+        if (!entry.second.block.expired()) {
+            statistics.block_count++;
+        }
+    }
+    return statistics;
+}
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+void HerixLib::test_sharedcache () {
+    Buffer contents;
+    for (size_t i = 0; i < 16 * 1024; i++) {
+        contents.push_back(static_cast<Byte>((i * 31) ^ (i >> 7)));
+    }
+    std::filesystem::path path = writeTestFile("herix_test_sharedcache.bin", contents);
+
+    // = Chunks are aligned in the file, so starting part way through a block still reads correctly
+    {
+        Herix h(path, false, std::make_pair(100, 5000), 4 * 1024, 1024);
+        assert(h.getAlignedChunk(0) == 0);
+        assert(h.getAlignedChunkEnd(0) == 924);
+        assert(h.getAlignedChunk(924) == 924);
+        Buffer data(5000);
+        assert(h.readInto(0, 5000, data.data()) == 4900);
+        assert(std::equal(data.begin(), data.begin() + 4900, contents.begin() + 100));
+        assert(!h.read(4900).has_value());
+    }
+
+    SharedChunkCache cache(64 * 1024);
+    {
+        Herix a(path, true, std::make_pair(0, std::nullopt), 8 * 1024, 1024);
+        Herix b(path, false, std::make_pair(100, 5000), 8 * 1024, 1024);
+        a.setSharedCache(&cache);
+        b.setSharedCache(&cache);
+
+        for (size_t i = 0; i < 4900; i++) {
+            assert(b.read(i).value() == contents[100 + i]);
+        }
+        SharedChunkCacheStatistics statistics = cache.getStatistics();
+        assert(statistics.misses == 5);
+        assert(statistics.hits == 0);
+
+        // The other view has the blocks already, it only has its own index to fill in
+        for (size_t i = 0; i < 5000; i++) {
+            assert(a.read(i).value() == contents[i]);
+        }
+        statistics = cache.getStatistics();
+        assert(statistics.misses == 5);
+        assert(statistics.hits == 5);
+        assert(statistics.block_count == 5);
+
+        // Edits are per view, until they're saved
+        a.edit(200, 0xAB);
+        assert(b.read(100).value() == contents[200]);
+        a.saveHistoryDestructive();
+        assert(b.read(100).value() == 0xAB);
+        assert(a.read(200).value() == 0xAB);
+
+        // Blocks that are still loaded by a view stay alive past the limit
+        cache.setMaxMemory(0);
+        assert(cache.getStatistics().retained_memory == 0);
+        assert(cache.getStatistics().block_count > 0);
+        a.edit(200, static_cast<Byte>(contents[200]));
+        a.saveHistoryDestructive();
+    }
+    assert(cache.getStatistics().block_count == 0);
+
+    // = Async loads fill in the cache too
+    {
+        cache.setMaxMemory(64 * 1024);
+        Herix a(path, false, std::make_pair(0, std::nullopt), 8 * 1024, 1024);
+        Herix b(path, false, std::make_pair(1024, std::nullopt), 8 * 1024, 1024);
+        a.setSharedCache(&cache);
+        b.setSharedCache(&cache);
+        a.enableAsyncLoading(1);
+        a.waitAsync(a.requestRange(0, 4096));
+        assert(a.isRangeCached(0, 4096));
+
+        size_t misses = cache.getStatistics().misses;
+        Buffer data(3072);
+        assert(b.readInto(0, 3072, data.data()) == 3072);
+        assert(std::equal(data.begin(), data.end(), contents.begin() + 1024));
+        assert(cache.getStatistics().misses == misses);
+    }
+
+    std::filesystem::remove(path);
+}
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef FILE_SEEN_SHAREDCACHE
+#define FILE_SEEN_SHAREDCACHE
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+#include "types.hpp"
+
+namespace HerixLib {
+
+/// Identifies a file regardless of the path used to open it (device and inode where available).
+class FileIdentity {
+    public:
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    /// Only used where there's no inode
+    std::string path;
+
+    static FileIdentity of (const std::filesystem::path& path);
+
+    bool operator< (const FileIdentity& other) const;
+    bool operator== (const FileIdentity& other) const;
+};
+
+class SharedChunkCacheStatistics {
+    public:
+    size_t hits = 0;
+    size_t misses = 0;
+    /// Blocks that are alive, whether they're only held by instances or retained by the cache
+    size_t block_count = 0;
+    /// Bytes of blocks retained by the cache itself
+    size_t retained_memory = 0;
+};
+
+/// A cache of blocks of files shared by every Herix instance that uses it (see Herix::setSharedCache), so opening
+/// the same file several times (such as different windows of it, or split views) only reads and holds each block once.
+/// Blocks are keyed by the file and their absolute position, and are reference counted: a block stays alive while any
+/// instance has it loaded, and the cache keeps up to max_memory of the most recently used blocks on top of that.
+/// The cache is thread safe.
+class SharedChunkCache {
+    protected:
+    class Key {
+        public:
+        FileIdentity file;
+        AbsoluteFilePosition start;
+        size_t size;
+
+        bool operator< (const Key& other) const;
+    };
+
+    class Entry {
+        public:
+        std::weak_ptr<const Buffer> block;
+        /// Set while the cache itself holds the block
+        std::shared_ptr<const Buffer> retained;
+        std::list<Key>::iterator order;
+    };
+
+    mutable std::mutex mutex;
+    size_t max_memory;
+    size_t retained_memory = 0;
+    std::map<Key, Entry> entries;
+    /// Retained blocks, least recently used first
+    std::list<Key> retained_order;
+    size_t hits = 0;
+    size_t misses = 0;
+    /// Increased whenever a file is invalidated, so instances know to drop what they have
+    std::atomic<uint64_t> generation = 0;
+
+    /// Finds a live block. Must hold the mutex.
+    std::shared_ptr<const Buffer> find (const Key& key);
+    /// Adds the block, or gives back the existing one if it was added in the meantime. Must hold the mutex.
+    std::shared_ptr<const Buffer> add (const Key& key, std::shared_ptr<const Buffer> block);
+    void retain (const Key& key, Entry& entry);
+    void trim ();
+
+    public:
+    static constexpr size_t default_max_memory = 64 * 1024 * 1024;
+
+    explicit SharedChunkCache (size_t t_max_memory=default_max_memory);
+
+    SharedChunkCache (const SharedChunkCache&) = delete;
+    SharedChunkCache& operator= (const SharedChunkCache&) = delete;
+
+    static SharedChunkCache& getGlobal ();
+
+    /// Returns the block of file at [start, start+size), calling load to read it if it isn't alive.
+    /// load is called without holding the lock, so two threads can both read a block, but only one is kept.
+    std::shared_ptr<const Buffer> get (const FileIdentity& file, AbsoluteFilePosition start, size_t size, const std::function<Buffer()>& load);
+    /// Adds a block that was read elsewhere (such as by an async loader). Returns the one that is in the cache.
+    std::shared_ptr<const Buffer> put (const FileIdentity& file, AbsoluteFilePosition start, size_t size, Buffer data);
+
+    /// Drops every block of the file, for when it has been written to
+    void invalidateFile (const FileIdentity& file);
+    uint64_t getGeneration () const;
+
+    void setMaxMemory (size_t t_max_memory);
+    size_t getMaxMemory () const;
+    SharedChunkCacheStatistics getStatistics () const;
+};
+
+void test_sharedcache ();
+
+}
+
+#endif
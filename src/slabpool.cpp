@@ -0,0 +1,468 @@
+#include "slabpool.hpp"
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#endif
+
+#ifdef DEBUG
+#include <filesystem>
+#include <fstream>
+#include "herix.hpp"
+#endif
+
+using namespace HerixLib;
+
+/// Slots are cache line aligned, and page aligned once they're at least a page
+static size_t roundSlotSize (size_t size) {
+    size_t alignment = size >= 4096 ? 4096 : 64;
+    return std::max(size + ((alignment - (size % alignment)) % alignment), alignment);
+}
+
+size_t SlabPool::Slab::getIndex (const Byte* slot) const {
+    return static_cast<size_t>(slot - data) / slot_size;
+}
+
+SlabPool::State::~State () {
+    while (!slabs.empty()) {
+        unmapSlab(slabs.begin());
+    }
+}
+
+SlabPool::Slab& SlabPool::State::mapSlab (size_t slot_size) {
+    size_t slab_size = std::max(options.slab_size, static_cast<size_t>(4096));
+    size_t size = std::max(slot_size, slab_size);
+    size += (slab_size - (size % slab_size)) % slab_size;
+
+    Byte* data = nullptr;
+    bool huge = false;
+#if defined(__unix__) || defined(__APPLE__)
+#ifdef MAP_HUGETLB
+    if (options.huge_pages == HugePages::Explicit) {
+        // Huge page mappings are aligned to the huge page size by the kernel
+        void* mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mapping != MAP_FAILED) {
+            data = static_cast<Byte*>(mapping);
+            huge = true;
+        }
+    }
+#endif
+    if (data == nullptr) {
+        // Mapped with room to spare, which is then cut off so the slab starts at a multiple of the slab size
+        size_t mapping_size = size + slab_size;
+        void* mapping = ::mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+
+        uintptr_t start = reinterpret_cast<uintptr_t>(mapping);
+        uintptr_t aligned = start + ((slab_size - (start % slab_size)) % slab_size);
+        if (aligned > start) {
+            ::munmap(mapping, aligned - start);
+        }
+        if (start + mapping_size > aligned + size) {
+            ::munmap(reinterpret_cast<void*>(aligned + size), (start + mapping_size) - (aligned + size));
+        }
+        data = reinterpret_cast<Byte*>(aligned);
+
+#ifdef MADV_HUGEPAGE
+        if (options.huge_pages != HugePages::None) {
+            // Only a hint, it's fine if the kernel doesn't do it
+            ::madvise(data, size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+#else
+    data = static_cast<Byte*>(std::aligned_alloc(slab_size, size));
+    if (data == nullptr) {
+        throw std::bad_alloc();
+    }
+#endif
+
+    statistics.slabs_mapped++;
+    statistics.huge_slabs += huge ? 1 : 0;
+
+    // Pushed in reverse, so the lowest addresses are handed out first
+    std::vector<Byte*>& free_list = free_slots[slot_size];
+    size_t slot_count = size / slot_size;
+    for (size_t i = slot_count; i > 0; i--) {
+        free_list.push_back(data + ((i - 1) * slot_size));
+    }
+
+    statistics.memory += size;
+    return slabs.emplace(data, Slab{ data, size, slot_size, 0, huge, std::vector<bool>(slot_count, false), 0 }).first->second;
+}
+
+void SlabPool::State::unmapSlab (std::map<Byte*, Slab>::iterator iter) {
+    Slab& slab = iter->second;
+    assert(slab.in_use == 0);
+
+    std::vector<Byte*>& free_list = free_slots[slab.slot_size];
+    free_list.erase(std::remove_if(free_list.begin(), free_list.end(), [&slab] (Byte* slot) {
+        return slot >= slab.data && slot < slab.data + slab.size;
+    }), free_list.end());
+
+#if defined(__unix__) || defined(__APPLE__)
+    ::munmap(slab.data, slab.size);
+#else
+    std::free(slab.data);
+#endif
+    statistics.slabs_unmapped++;
+    statistics.memory -= slab.size;
+    touched_free_memory -= slab.touched_free * slab.slot_size;
+    slabs.erase(iter);
+}
+
+void SlabPool::State::release (Byte* slot) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = std::prev(slabs.upper_bound(slot));
+    assert(slot >= iter->second.data && slot < iter->second.data + iter->second.size);
+
+    Slab& slab = iter->second;
+    slab.in_use--;
+    slab.touched_free++;
+    touched_free_memory += slab.slot_size;
+    free_slots[slab.slot_size].push_back(slot);
+    if (slab.in_use == 0) {
+        trim(options.max_free_memory);
+    }
+}
+
+size_t SlabPool::State::trim (size_t limit) {
+    size_t free_memory = 0;
+    for (const std::pair<Byte* const, Slab>& entry : slabs) {
+        free_memory += entry.second.in_use == 0 ? entry.second.size : 0;
+    }
+
+    size_t freed = 0;
+    for (auto iter = slabs.begin(); iter != slabs.end() && free_memory > limit;) {
+        if (iter->second.in_use != 0) {
+            iter++;
+            continue;
+        }
+
+        free_memory -= iter->second.size;
+        freed += iter->second.touched_free * iter->second.slot_size;
+        auto next = std::next(iter);
+        unmapSlab(iter);
+        iter = next;
+    }
+    return freed;
+}
+
+size_t SlabPool::State::discard (size_t bytes) {
+    size_t freed = 0;
+#if defined(__unix__) || defined(__APPLE__)
+    for (std::pair<const size_t, std::vector<Byte*>>& entry : free_slots) {
+        if (entry.first % 4096 != 0) {
+            continue;
+        }
+
+        for (Byte* slot : entry.second) {
+            if (freed >= bytes) {
+                return freed;
+            }
+
+            Slab& slab = std::prev(slabs.upper_bound(slot))->second;
+            size_t index = slab.getIndex(slot);
+            if (!slab.touched[index]) {
+                continue;
+            }
+            if (::madvise(slot, slab.slot_size, MADV_DONTNEED) != 0) {
+                continue;
+            }
+            slab.touched[index] = false;
+            slab.touched_free--;
+            touched_free_memory -= slab.slot_size;
+            freed += slab.slot_size;
+        }
+    }
+#else
+    (void)bytes;
+#endif
+    return freed;
+}
+
+void* SlabPool::State::allocateControlBlock (size_t size) {
+    std::lock_guard<std::mutex> lock(control_mutex);
+    if (control_block_size == 0) {
+        control_block_size = size;
+    }
+    if (size != control_block_size) {
+        control_block_allocations++;
+        return ::operator new(size);
+    }
+
+    if (free_control_blocks.empty()) {
+        // Carved out of one allocation, with each kept to the alignment that new gives
+        const size_t batch_count = 64;
+        size_t alignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+        size_t stride = size + ((alignment - (size % alignment)) % alignment);
+        control_block_batches.push_back(std::make_unique<Byte[]>(stride * batch_count));
+        control_block_allocations++;
+        Byte* batch = control_block_batches.back().get();
+        for (size_t i = batch_count; i > 0; i--) {
+            free_control_blocks.push_back(batch + ((i - 1) * stride));
+        }
+    }
+
+    Byte* block = free_control_blocks.back();
+    free_control_blocks.pop_back();
+    return block;
+}
+
+void SlabPool::State::deallocateControlBlock (void* block, size_t size) {
+    std::lock_guard<std::mutex> lock(control_mutex);
+    if (size != control_block_size) {
+        ::operator delete(block);
+        return;
+    }
+    free_control_blocks.push_back(static_cast<Byte*>(block));
+}
+
+void SlabPool::SlotDeleter::operator() (Byte* slot) const {
+    state->release(slot);
+}
+
+template<typename T>
+class SlabPool::ControlBlockAllocator {
+    public:
+    using value_type = T;
+
+    std::shared_ptr<State> state;
+
+    explicit ControlBlockAllocator (std::shared_ptr<State> t_state) : state(std::move(t_state)) {}
+    template<typename U>
+    ControlBlockAllocator (const ControlBlockAllocator<U>& other) : state(other.state) {}
+
+    T* allocate (size_t count) {
+        return static_cast<T*>(state->allocateControlBlock(count * sizeof(T)));
+    }
+    void deallocate (T* block, size_t count) {
+        state->deallocateControlBlock(block, count * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator== (const ControlBlockAllocator<U>& other) const {
+        return state == other.state;
+    }
+};
+
+SlabPool::SlabPool (SlabPoolOptions options) : state(std::make_shared<State>()) {
+    state->options = options;
+}
+
+std::shared_ptr<Byte> SlabPool::acquire (size_t size) {
+    size_t slot_size = roundSlotSize(size);
+
+    Byte* slot;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        std::vector<Byte*>& free_list = state->free_slots[slot_size];
+        if (free_list.empty()) {
+            state->mapSlab(slot_size);
+        } else {
+            state->statistics.reused++;
+        }
+        state->statistics.acquired++;
+
+        slot = free_list.back();
+        free_list.pop_back();
+        Slab& slab = std::prev(state->slabs.upper_bound(slot))->second;
+        slab.in_use++;
+        if (slab.touched[slab.getIndex(slot)]) {
+            slab.touched_free--;
+            state->touched_free_memory -= slab.slot_size;
+        } else {
+            slab.touched[slab.getIndex(slot)] = true;
+        }
+    }
+
+    // Outside the lock, since if the control block can't be allocated the slot is released straight away
+    return std::shared_ptr<Byte>(slot, SlotDeleter{ state.get() }, ControlBlockAllocator<Byte>(state));
+}
+
+size_t SlabPool::freeMemory (size_t bytes) {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    size_t free_memory = 0;
+    for (const std::pair<Byte* const, Slab>& entry : state->slabs) {
+        free_memory += entry.second.in_use == 0 ? entry.second.size : 0;
+    }
+    size_t freed = state->trim(free_memory > bytes ? free_memory - bytes : 0);
+    if (freed < bytes) {
+        freed += state->discard(bytes - freed);
+    }
+    return freed;
+}
+
+size_t SlabPool::getMemoryUsage () const {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->statistics.memory;
+}
+
+size_t SlabPool::getFreeMemory () const {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    return state->touched_free_memory;
+}
+
+SlabPoolStatistics SlabPool::getStatistics () const {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    SlabPoolStatistics statistics = state->statistics;
+    statistics.slab_count = state->slabs.size();
+    statistics.slots_in_use = 0;
+    for (const std::pair<Byte* const, Slab>& entry : state->slabs) {
+        statistics.slots_in_use += entry.second.in_use;
+    }
+    statistics.free_memory = state->touched_free_memory;
+
+    std::lock_guard<std::mutex> control_lock(state->control_mutex);
+    statistics.control_block_allocations = state->control_block_allocations;
+    return statistics;
+}
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+void HerixLib::test_slabpool () {
+    // = The pool on its own
+    {
+        SlabPoolOptions options;
+        options.slab_size = 64 * 1024;
+        options.max_free_memory = 64 * 1024;
+        SlabPool pool(options);
+
+        std::shared_ptr<Byte> first = pool.acquire(4096);
+        std::shared_ptr<Byte> second = pool.acquire(1000);
+        // Page aligned once they're a page, cache line aligned below that
+        assert(reinterpret_cast<uintptr_t>(first.get()) % 4096 == 0);
+        assert(reinterpret_cast<uintptr_t>(second.get()) % 64 == 0);
+        // The slab itself is aligned to its size
+        assert(reinterpret_cast<uintptr_t>(first.get()) % (64 * 1024) == 0);
+        std::memset(first.get(), 0xAB, 4096);
+        std::memset(second.get(), 0xCD, 1000);
+
+        SlabPoolStatistics statistics = pool.getStatistics();
+        assert(statistics.slab_count == 2 && statistics.slots_in_use == 2);
+        assert(statistics.memory == 128 * 1024);
+
+        // A released slot is the next one handed out, as it was left
+        Byte* address = first.get();
+        first.reset();
+        std::shared_ptr<Byte> again = pool.acquire(4096);
+        assert(again.get() == address);
+        assert(again.get()[100] == 0xAB);
+        assert(pool.getStatistics().reused == 1);
+
+        // Going back and forth never maps another slab
+        std::vector<std::shared_ptr<Byte>> held;
+        for (size_t round = 0; round < 100; round++) {
+            for (size_t i = 0; i < 8; i++) {
+                held.push_back(pool.acquire(4096));
+            }
+            held.clear();
+        }
+        statistics = pool.getStatistics();
+        assert(statistics.slabs_mapped == 2);
+        assert(statistics.reused == statistics.acquired - 2);
+        // The reference counts are recycled too, so 800 slots took a single batch of them
+        assert(statistics.control_block_allocations == 1);
+
+        // Only the slots that were used count as free memory, until they're discarded
+        assert(pool.getFreeMemory() == 8 * 4096);
+        assert(pool.freeMemory(2 * 4096) == 2 * 4096);
+        assert(pool.getFreeMemory() == 6 * 4096);
+        // The most recently released slot is reused first, which wasn't discarded
+        held.push_back(pool.acquire(4096));
+        assert(pool.getFreeMemory() == 5 * 4096);
+        held.clear();
+
+        // Free slabs past the limit are unmapped, and freeMemory unmaps the rest
+        second.reset();
+        assert(pool.getStatistics().slab_count == 2);
+        assert(pool.getFreeMemory() == (6 * 4096) + 1024);
+        again.reset();
+        assert(pool.getStatistics().slab_count == 1);
+        assert(pool.freeMemory(1) > 0);
+        assert(pool.getMemoryUsage() == 0 && pool.getFreeMemory() == 0);
+
+        // Slots bigger than a slab get a slab of their own
+        std::shared_ptr<Byte> large = pool.acquire(100 * 1024);
+        assert(pool.getMemoryUsage() == 128 * 1024);
+        large.reset();
+    }
+
+    // = Slots can outlive the pool
+    {
+        std::shared_ptr<Byte> slot;
+        {
+            SlabPoolOptions options;
+            options.huge_pages = HugePages::Explicit;
+            SlabPool pool(options);
+            slot = pool.acquire(4096);
+        }
+        std::memset(slot.get(), 1, 4096);
+        slot.reset();
+    }
+
+    // = Through Herix, scrolling back and forth only recycles slots
+    Buffer contents(64 * 1024);
+    for (size_t i = 0; i < contents.size(); i++) {
+        contents[i] = static_cast<Byte>((i * 31) ^ (i >> 8));
+    }
+    std::filesystem::path path = writeTestFile("herix_test_slabpool.bin", contents);
+
+    {
+        Herix h(path, true, std::make_pair(100, std::nullopt), 8 * 1024, 1024);
+        h.enableSlabPool();
+        assert(h.isSlabPoolEnabled());
+
+        for (int pass = 0; pass < 3; pass++) {
+            for (FilePosition pos = 0; pos < contents.size() - 100; pos += 300) {
+                assert(h.read(pos).value() == contents[100 + pos]);
+            }
+            Buffer screen(2000);
+            assert(h.readInto(contents.size() - 1100, 2000, screen.data()) == 1000);
+            assert(std::equal(screen.begin(), screen.begin() + 1000, contents.end() - 1000));
+        }
+        SlabPoolStatistics statistics = h.getSlabPoolStatistics();
+        assert(statistics.slabs_mapped == 1);
+        assert(statistics.acquired > 100 && statistics.reused == statistics.acquired - 1);
+        // Only what's been used takes memory
+        assert(statistics.free_memory <= 16 * 1024);
+        assert(statistics.slots_in_use == h.getChunkCount());
+        assert(h.getMemoryUsage() >= h.getChunkMemory() + statistics.free_memory);
+
+        // Edits and saving work as normal on top of them
+        h.edit(5, 0xEE);
+        h.saveHistoryDestructive();
+        assert(h.read(5).value() == 0xEE);
+        assert(h.getSlabPoolStatistics().slots_in_use == h.getChunkCount());
+
+        h.disableSlabPool();
+        assert(!h.isSlabPoolEnabled());
+        assert(h.read(5).value() == 0xEE);
+    }
+
+    // = Under a governor the free slots are given back
+    {
+        MemoryGovernor governor(8 * 1024);
+        Herix h(path, false, std::make_pair(0, std::nullopt), 16 * 1024, 4096);
+        h.enableSlabPool();
+        h.setMemoryGovernor(&governor);
+        for (FilePosition pos = 0; pos < contents.size(); pos += 512) {
+            assert(h.read(pos).value() == contents[pos]);
+        }
+        assert(h.getMemoryUsage() <= 8 * 1024 + 4096);
+        h.setMemoryGovernor(nullptr);
+    }
+
+    std::filesystem::remove(path);
+}
+
+#endif
@@ -0,0 +1,145 @@
+#ifndef FILE_SEEN_SLABPOOL
+#define FILE_SEEN_SLABPOOL
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "types.hpp"
+
+namespace HerixLib {
+
+enum class HugePages {
+    /// Plain pages
+    None,
+    /// Asks for transparent huge pages with madvise, which the kernel uses if it can
+    Transparent,
+    /// Maps slabs with MAP_HUGETLB, which needs huge pages to have been reserved. Falls back to Transparent
+    Explicit,
+};
+
+class SlabPoolOptions {
+    public:
+    /// Slabs are a multiple of this, and aligned to it. The size of a huge page on x86-64.
+    size_t slab_size = 2 * 1024 * 1024;
+    HugePages huge_pages = HugePages::Transparent;
+    /// Completely free slabs are kept up to this much memory, the rest are unmapped
+    size_t max_free_memory = 8 * 1024 * 1024;
+};
+
+class SlabPoolStatistics {
+    public:
+    /// Slots handed out, and how many of those were recycled rather than from a new slab
+    size_t acquired = 0;
+    size_t reused = 0;
+    /// Slabs mapped over the pool's life, which is the only time it goes to the system for memory
+    size_t slabs_mapped = 0;
+    size_t slabs_unmapped = 0;
+    /// Slabs that got MAP_HUGETLB pages
+    size_t huge_slabs = 0;
+    size_t slab_count = 0;
+    size_t slots_in_use = 0;
+    /// Memory of all the slabs
+    size_t memory = 0;
+    /// Memory of the free slots that have been used before. The rest of a slab isn't touched until it's needed, so it
+    /// takes up no memory.
+    size_t free_memory = 0;
+    /// Heap allocations for the reference counts of the slots. They're made in batches and recycled, so this stays
+    /// far below acquired.
+    size_t control_block_allocations = 0;
+};
+
+/// Fixed size slots for chunk data, carved out of large aligned slabs which can be backed by huge pages. Slots of each
+/// size have their own slabs. A slot goes back to the pool when the last reference to it is dropped, and is handed out
+/// again as is: it isn't cleared, since the chunk it's for overwrites it. New slabs come straight from mmap, so they
+/// are zero filled by the kernel as they're touched.
+/// Slots can be released from any thread, and outlive the pool (the slabs are then unmapped once the last one goes).
+class SlabPool {
+    protected:
+    class Slab {
+        public:
+        Byte* data;
+        size_t size;
+        size_t slot_size;
+        size_t in_use = 0;
+        bool huge = false;
+        /// Which slots have been written to since the slab was mapped (or the slot was discarded)
+        std::vector<bool> touched;
+        /// Free slots that have been touched
+        size_t touched_free = 0;
+
+        size_t getIndex (const Byte* slot) const;
+    };
+
+    class State {
+        public:
+        SlabPoolOptions options;
+        std::mutex mutex;
+        /// By their start
+        std::map<Byte*, Slab> slabs;
+        /// Free slots of each size, the most recently released last
+        std::map<size_t, std::vector<Byte*>> free_slots;
+        SlabPoolStatistics statistics;
+        /// Memory of the free slots that have been touched, kept as it goes since it's asked for on every chunk load
+        size_t touched_free_memory = 0;
+
+        /// Guards the control blocks, which are freed after the slot has been released
+        std::mutex control_mutex;
+        size_t control_block_size = 0;
+        std::vector<Byte*> free_control_blocks;
+        std::vector<std::unique_ptr<Byte[]>> control_block_batches;
+        size_t control_block_allocations = 0;
+
+        ~State ();
+
+        Slab& mapSlab (size_t slot_size);
+        void unmapSlab (std::map<Byte*, Slab>::iterator iter);
+        void release (Byte* slot);
+        /// Unmaps slabs with nothing in use until their memory is at most limit. Returns how much of the free memory
+        /// was freed.
+        size_t trim (size_t limit);
+        /// Gives the pages of free slots back to the kernel (they're zero filled again if they're used), until bytes
+        /// have been freed. Only slots that are whole pages can be. Returns how much was freed.
+        size_t discard (size_t bytes);
+        /// A control block for a slot's shared_ptr, from the batches. Blocks of any other size come from the heap.
+        void* allocateControlBlock (size_t size);
+        void deallocateControlBlock (void* block, size_t size);
+    };
+
+    /// Gives a slot back to the pool when its last reference is dropped
+    class SlotDeleter {
+        public:
+        /// Kept alive by the allocator stored next to it in the control block
+        State* state;
+
+        void operator() (Byte* slot) const;
+    };
+
+    /// Puts the control blocks of the slots' shared_ptrs in the pool, so that loading a chunk doesn't go to the heap.
+    /// It holds the state, which keeps the slabs alive for slots that outlive the pool.
+    template<typename T>
+    class ControlBlockAllocator;
+
+    std::shared_ptr<State> state;
+
+    public:
+    explicit SlabPool (SlabPoolOptions options=SlabPoolOptions());
+
+    /// A slot of at least size bytes, whose contents are left over from whatever used it before
+    std::shared_ptr<Byte> acquire (size_t size);
+    /// Frees at least bytes of free memory (see getFreeMemory) if it can: slabs that have nothing in use are unmapped,
+    /// then the pages of free slots are discarded. Returns how much was freed.
+    size_t freeMemory (size_t bytes);
+    /// Memory mapped for slabs, including the slots in use and those that were never touched
+    size_t getMemoryUsage () const;
+    /// Memory of the slots that were used and are now free
+    size_t getFreeMemory () const;
+    SlabPoolStatistics getStatistics () const;
+};
+
+void test_slabpool ();
+
+}
+
+#endif
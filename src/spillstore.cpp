@@ -0,0 +1,191 @@
+#include "spillstore.hpp"
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+using namespace HerixLib;
+
+SpillStore::SpillStore () {
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    fd = ::memfd_create("herix-spill", MFD_CLOEXEC);
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+    if (fd == -1) {
+        file = std::tmpfile();
+        if (file != nullptr) {
+            fd = ::fileno(file);
+        }
+    }
+    if (fd == -1) {
+        throw std::runtime_error("Failed in creating file to spill edits to.");
+    }
+#else
+    file = std::tmpfile();
+    if (file == nullptr) {
+        throw std::runtime_error("Failed in creating file to spill edits to.");
+    }
+#endif
+}
+
+SpillStore::~SpillStore () {
+    if (file != nullptr) {
+        std::fclose(file);
+    }
+#if defined(__unix__) || defined(__APPLE__)
+    else if (fd != -1) {
+        ::close(fd);
+    }
+#endif
+}
+
+void SpillStore::writeAt (size_t offset, const Byte* data, size_t size) {
+#if defined(__unix__) || defined(__APPLE__)
+    size_t done = 0;
+    while (done < size) {
+        ssize_t wrote = ::pwrite(fd, data + done, size - done, static_cast<off_t>(offset + done));
+        if (wrote < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Failed to write spilled edit data.");
+        }
+        done += static_cast<size_t>(wrote);
+    }
+#else
+    if (std::fseek(file, static_cast<long>(offset), SEEK_SET) != 0 || std::fwrite(data, 1, size, file) != size) {
+        throw std::runtime_error("Failed to write spilled edit data.");
+    }
+#endif
+}
+
+void SpillStore::readAt (size_t offset, size_t size, Byte* output) const {
+#if defined(__unix__) || defined(__APPLE__)
+    size_t done = 0;
+    while (done < size) {
+        ssize_t got = ::pread(fd, output + done, size - done, static_cast<off_t>(offset + done));
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Failed to read spilled edit data.");
+        } else if (got == 0) {
+            throw std::runtime_error("Spilled edit data was cut short.");
+        }
+        done += static_cast<size_t>(got);
+    }
+#else
+    if (std::fseek(file, static_cast<long>(offset), SEEK_SET) != 0 || std::fread(output, 1, size, file) != size) {
+        throw std::runtime_error("Failed to read spilled edit data.");
+    }
+#endif
+}
+
+SpillLocation SpillStore::write (const Byte* data, size_t size) {
+    SpillLocation location{ end, size };
+    writeAt(end, data, size);
+
+    // The last page may have been cached while it was short. end is changed under the lock too, since snapshots of
+    // the edits can be reading from another thread.
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        size_t last_page = end / page_size;
+        if (cache.erase(last_page) != 0) {
+            cache_order.remove(last_page);
+        }
+        end += size;
+    }
+    return location;
+}
+
+/// Gets a page from the cache, reading it in if need be. The cache mutex must be held.
+const Buffer& SpillStore::getPage (size_t index) const {
+    auto iter = cache.find(index);
+    if (iter != cache.end()) {
+        cache_order.remove(index);
+        cache_order.push_back(index);
+        return iter->second;
+    }
+
+    if (cache.size() >= max_cached_pages) {
+        cache.erase(cache_order.front());
+        cache_order.pop_front();
+    }
+
+    size_t offset = index * page_size;
+    Buffer page(std::min(page_size, end - offset));
+    readAt(offset, page.size(), page.data());
+    cache_order.push_back(index);
+    return cache.emplace(index, std::move(page)).first->second;
+}
+
+void SpillStore::read (SpillLocation location, size_t offset, size_t size, Byte* output) const {
+    assert(offset + size <= location.size);
+    size_t start = location.offset + offset;
+
+    // Large reads (such as saving) would only thrash the cache
+    if (size >= page_size * (max_cached_pages / 2)) {
+        readAt(start, size, output);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    size_t done = 0;
+    while (done < size) {
+        size_t current = start + done;
+        const Buffer& page = getPage(current / page_size);
+        size_t page_offset = current % page_size;
+        size_t amount = std::min(size - done, page.size() - page_offset);
+        std::memcpy(output + done, page.data() + page_offset, amount);
+        done += amount;
+    }
+}
+
+size_t SpillStore::getSize () const {
+    return end;
+}
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+void HerixLib::test_spillstore () {
+    SpillStore store;
+
+    Buffer first(1024 * 1024);
+    for (size_t i = 0; i < first.size(); i++) {
+        first[i] = static_cast<Byte>(i * 3);
+    }
+    Buffer second{ 1, 2, 3 };
+
+    SpillLocation a = store.write(first.data(), first.size());
+    SpillLocation b = store.write(second.data(), second.size());
+    assert(a.offset == 0);
+    assert(b.offset == first.size());
+    assert(store.getSize() == first.size() + 3);
+
+    // Across page boundaries
+    Buffer output(1000);
+    store.read(a, SpillStore::page_size - 10, output.size(), output.data());
+    assert(std::equal(output.begin(), output.end(), first.begin() + SpillStore::page_size - 10));
+
+    store.read(b, 1, 2, output.data());
+    assert(output[0] == 2 && output[1] == 3);
+
+    // Large enough to skip the cache
+    Buffer whole(first.size());
+    store.read(a, 0, whole.size(), whole.data());
+    assert(whole == first);
+}
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef FILE_SEEN_SPILLSTORE
+#define FILE_SEEN_SPILLSTORE
+
+#include <cstdio>
+#include <list>
+#include <map>
+#include <mutex>
+
+#include "types.hpp"
+
+namespace HerixLib {
+
+/// Where a piece of data is in a SpillStore
+class SpillLocation {
+    public:
+    size_t offset;
+    size_t size;
+};
+
+/// Append only storage for large pieces of data that shouldn't be kept in memory, backed by an anonymous file
+/// (a memfd on Linux, otherwise a temporary file which is deleted on close). Data written is never modified, so a
+/// store can be shared between copies of whatever owns it.
+/// Reads go through a small cache of pages, and are safe to do from multiple threads.
+class SpillStore {
+    protected:
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = -1;
+#endif
+    /// Used instead of fd where it isn't available, and to keep a temporary file alive
+    std::FILE* file = nullptr;
+    size_t end = 0;
+
+    /// Page index to its data. Pages at the end of the store may be short.
+    mutable std::mutex cache_mutex;
+    mutable std::map<size_t, Buffer> cache;
+    /// Least recently used page first
+    mutable std::list<size_t> cache_order;
+
+    void writeAt (size_t offset, const Byte* data, size_t size);
+    void readAt (size_t offset, size_t size, Byte* output) const;
+    const Buffer& getPage (size_t index) const;
+
+    public:
+    static constexpr size_t page_size = 64 * 1024;
+    static constexpr size_t max_cached_pages = 16;
+
+    SpillStore ();
+    ~SpillStore ();
+
+    SpillStore (const SpillStore&) = delete;
+    SpillStore& operator= (const SpillStore&) = delete;
+
+    SpillLocation write (const Byte* data, size_t size);
+    /// Reads [offset, offset+size) of the data at location into output
+    void read (SpillLocation location, size_t offset, size_t size, Byte* output) const;
+
+    /// Bytes written, including data that is no longer used by anything
+    size_t getSize () const;
+};
+
+void test_spillstore ();
+
+}
+
+#endif
@@ -0,0 +1,453 @@
+#include "statistics.hpp"
+#include "sequentialreader.hpp"
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <exception>
+#include <limits>
+#include <thread>
+
+using namespace HerixLib;
+
+void HerixLib::countBytes (const Byte* data, size_t size, ByteHistogram& histogram) {
+    // Each piece is small enough that the 32 bit counts can't overflow
+    constexpr size_t piece_size = size_t(1) << 30;
+
+    while (size > 0) {
+        size_t amount = std::min(size, piece_size);
+        uint32_t tables[4][256] = {};
+
+        size_t i = 0;
+        for (; i + 8 <= amount; i += 8) {
+            uint64_t value;
+            std::memcpy(&value, data + i, 8);
+            tables[0][value & 0xff]++;
+            tables[1][(value >> 8) & 0xff]++;
+            tables[2][(value >> 16) & 0xff]++;
+            tables[3][(value >> 24) & 0xff]++;
+            tables[0][(value >> 32) & 0xff]++;
+            tables[1][(value >> 40) & 0xff]++;
+            tables[2][(value >> 48) & 0xff]++;
+            tables[3][value >> 56]++;
+        }
+        for (; i < amount; i++) {
+            tables[0][data[i]]++;
+        }
+
+        for (size_t j = 0; j < 256; j++) {
+            histogram[j] += uint64_t(tables[0][j]) + tables[1][j] + tables[2][j] + tables[3][j];
+        }
+
+        data += amount;
+        size -= amount;
+    }
+}
+
+template<typename Histogram>
+static double entropyOf (const Histogram& histogram) {
+    uint64_t total = 0;
+    for (auto count : histogram) {
+        total += count;
+    }
+    if (total == 0) {
+        return 0.0;
+    }
+
+    double result = 0.0;
+    double dtotal = static_cast<double>(total);
+    for (auto count : histogram) {
+        if (count != 0) {
+            double p = static_cast<double>(count) / dtotal;
+            result -= p * std::log2(p);
+        }
+    }
+    return result;
+}
+
+double HerixLib::computeEntropy (const ByteHistogram& histogram) {
+    return entropyOf(histogram);
+}
+double HerixLib::computeEntropy (const BlockHistogram& histogram) {
+    return entropyOf(histogram);
+}
+
+static size_t resolveThreadCount (size_t thread_count) {
+    if (thread_count == 0) {
+        thread_count = std::thread::hardware_concurrency();
+    }
+    return std::max(thread_count, size_t(1));
+}
+
+/// Splits [0, count) into thread_count contiguous partitions, running func(partition, first, last) for each on its own thread.
+/// Rethrows the first exception any of them threw.
+template<typename Func>
+static void runPartitioned (size_t count, size_t thread_count, Func func) {
+    thread_count = std::min(resolveThreadCount(thread_count), std::max(count, size_t(1)));
+    size_t per_thread = (count + thread_count - 1) / thread_count;
+
+    std::vector<std::exception_ptr> errors(thread_count);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; t++) {
+        size_t first = std::min(t * per_thread, count);
+        size_t last = std::min(first + per_thread, count);
+        threads.emplace_back([&func, &errors, t, first, last] () {
+            try {
+                func(t, first, last);
+            } catch (...) {
+                errors[t] = std::current_exception();
+            }
+        });
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    for (std::exception_ptr& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+/// Reads [pos, pos+size) of the file with a SequentialReader in read_size pieces, with edits applied, passing each to callback.
+template<typename Alignment, typename BackendType, typename Callback>
+static void scanFile (const BasicHerix<Alignment, BackendType>& herix, FilePosition pos, size_t size, size_t read_size, Callback callback) {
+    SequentialReaderOptions options;
+    options.block_size = read_size;
+
+    SequentialReader reader(herix, pos, size, options);
+    while (std::optional<SequentialBlock> block = reader.next()) {
+        callback(block.value().pos, block.value().data, block.value().size);
+    }
+}
+
+template<typename Alignment, typename BackendType>
+ByteHistogram HerixLib::computeHistogram (const BasicHerix<Alignment, BackendType>& herix, FilePosition pos, size_t size, size_t thread_count) {
+    ByteHistogram result{};
+
+    size_t file_end = herix.getFileEnd();
+    if (pos >= file_end) {
+        return result;
+    }
+    size = std::min(size, file_end - pos);
+
+    // Partition in units of a megabyte so each thread gets reasonably sized reads
+    constexpr size_t unit = 1024 * 1024;
+    size_t unit_count = (size + unit - 1) / unit;
+    std::vector<ByteHistogram> partials(resolveThreadCount(thread_count));
+
+    runPartitioned(unit_count, partials.size(), [&] (size_t partition, size_t first, size_t last) {
+        if (first == last) {
+            return;
+        }
+        ByteHistogram& partial = partials.at(partition);
+        size_t start = first * unit;
+        size_t end = std::min(last * unit, size);
+        scanFile(herix, pos + start, end - start, unit, [&partial] (FilePosition, const Byte* data, size_t amount) {
+            countBytes(data, amount, partial);
+        });
+    });
+
+    for (const ByteHistogram& partial : partials) {
+        for (size_t i = 0; i < 256; i++) {
+            result[i] += partial[i];
+        }
+    }
+    return result;
+}
+
+
+template<typename Alignment, typename BackendType>
+BasicBlockStatistics<Alignment, BackendType>::BasicBlockStatistics (BasicHerix<Alignment, BackendType>& t_herix, size_t t_block_size) : herix(t_herix), block_size(t_block_size) {
+    if (block_size == 0 || block_size > std::numeric_limits<uint32_t>::max()) {
+        throw std::invalid_argument("block_size must be non-zero and fit in 32 bits.");
+    }
+
+    listener = herix.addChangeListener(
+        [this] (FilePosition pos, size_t size) { onChange(pos, size); },
+        [this] (FilePosition pos, size_t size) { onBeforeChange(pos, size); }
+    );
+}
+
+template<typename Alignment, typename BackendType>
+BasicBlockStatistics<Alignment, BackendType>::~BasicBlockStatistics () {
+    herix.removeChangeListener(listener);
+}
+
+template<typename Alignment, typename BackendType>
+void BasicBlockStatistics<Alignment, BackendType>::build (size_t thread_count) {
+    covered_size = herix.getFileEnd();
+    size_t block_count = (covered_size + block_size - 1) / block_size;
+
+    blocks.assign(block_count, BlockHistogram{});
+    entropy.assign(block_count, 0.0f);
+    total.fill(0);
+    pending = std::nullopt;
+
+    // Read several blocks at once when they're small
+    size_t read_size = SequentialReader::roundBlockSize(block_size, 1024 * 1024);
+    runPartitioned(block_count, thread_count, [this, read_size] (size_t, size_t first, size_t last) {
+        if (first == last) {
+            return;
+        }
+        FilePosition start = first * block_size;
+        size_t size = std::min(last * block_size, covered_size) - start;
+
+        scanFile(herix, start, size, read_size, [this] (FilePosition pos, const Byte* data, size_t amount) {
+            for (size_t offset = 0; offset < amount; offset += block_size) {
+                ByteHistogram counts{};
+                size_t piece = std::min(block_size, amount - offset);
+                countBytes(data + offset, piece, counts);
+
+                BlockHistogram& block = blocks[(pos + offset) / block_size];
+                for (size_t i = 0; i < 256; i++) {
+                    block[i] = static_cast<uint32_t>(counts[i]);
+                }
+            }
+        });
+
+        updateEntropy(first, last - 1);
+    });
+
+    for (const BlockHistogram& block : blocks) {
+        for (size_t i = 0; i < 256; i++) {
+            total[i] += block[i];
+        }
+    }
+
+    stale = false;
+}
+
+template<typename Alignment, typename BackendType>
+bool BasicBlockStatistics<Alignment, BackendType>::isStale () const {
+    return stale;
+}
+
+template<typename Alignment, typename BackendType>
+size_t BasicBlockStatistics<Alignment, BackendType>::getBlockSize () const {
+    return block_size;
+}
+template<typename Alignment, typename BackendType>
+size_t BasicBlockStatistics<Alignment, BackendType>::getBlockCount () const {
+    return blocks.size();
+}
+template<typename Alignment, typename BackendType>
+size_t BasicBlockStatistics<Alignment, BackendType>::getCoveredSize () const {
+    return covered_size;
+}
+
+template<typename Alignment, typename BackendType>
+float BasicBlockStatistics<Alignment, BackendType>::getEntropy (size_t block) const {
+    return entropy.at(block);
+}
+template<typename Alignment, typename BackendType>
+const std::vector<float>& BasicBlockStatistics<Alignment, BackendType>::getEntropyMap () const {
+    return entropy;
+}
+template<typename Alignment, typename BackendType>
+const BlockHistogram& BasicBlockStatistics<Alignment, BackendType>::getHistogram (size_t block) const {
+    return blocks.at(block);
+}
+template<typename Alignment, typename BackendType>
+const ByteHistogram& BasicBlockStatistics<Alignment, BackendType>::getTotalHistogram () const {
+    return total;
+}
+
+/// Clips the range to what the statistics cover
+template<typename Alignment, typename BackendType>
+std::optional<EditRange> BasicBlockStatistics<Alignment, BackendType>::clipRange (FilePosition pos, size_t size) const {
+    if (stale || pos >= covered_size) {
+        return std::nullopt;
+    }
+    return std::make_pair(pos, std::min(size, covered_size - pos));
+}
+
+template<typename Alignment, typename BackendType>
+void BasicBlockStatistics<Alignment, BackendType>::updateEntropy (size_t first_block, size_t last_block) {
+    for (size_t block = first_block; block <= last_block; block++) {
+        entropy[block] = static_cast<float>(computeEntropy(blocks[block]));
+    }
+}
+
+/// Adds (or subtracts) the current bytes in the range to the histograms
+template<typename Alignment, typename BackendType>
+void BasicBlockStatistics<Alignment, BackendType>::applyRange (FilePosition pos, size_t size, bool subtract) {
+    Buffer data(size);
+    size_t read_count = herix.readInto(pos, size, data.data());
+    assert(read_count == size);
+
+    for (size_t i = 0; i < read_count; i++) {
+        size_t block = (pos + i) / block_size;
+        Byte value = data[i];
+        if (subtract) {
+            blocks[block][value]--;
+            total[value]--;
+        } else {
+            blocks[block][value]++;
+            total[value]++;
+        }
+    }
+}
+
+template<typename Alignment, typename BackendType>
+void BasicBlockStatistics<Alignment, BackendType>::recomputeBlocks (size_t first_block, size_t last_block) {
+    FilePosition start = first_block * block_size;
+    size_t size = std::min((last_block + 1) * block_size, covered_size) - start;
+
+    for (size_t block = first_block; block <= last_block; block++) {
+        for (size_t i = 0; i < 256; i++) {
+            total[i] -= blocks[block][i];
+        }
+        blocks[block].fill(0);
+    }
+
+    scanFile(herix, start, size, 1024 * 1024, [this] (FilePosition pos, const Byte* data, size_t amount) {
+        for (size_t i = 0; i < amount; i++) {
+            blocks[(pos + i) / block_size][data[i]]++;
+            total[data[i]]++;
+        }
+    });
+
+    updateEntropy(first_block, last_block);
+}
+
+template<typename Alignment, typename BackendType>
+void BasicBlockStatistics<Alignment, BackendType>::onBeforeChange (FilePosition pos, size_t size) {
+    pending = std::nullopt;
+
+    std::optional<EditRange> range = clipRange(pos, size);
+    if (!range.has_value() || range.value().second > max_incremental_size) {
+        return;
+    }
+
+    applyRange(range.value().first, range.value().second, true);
+    pending = range;
+}
+
+template<typename Alignment, typename BackendType>
+void BasicBlockStatistics<Alignment, BackendType>::onChange (FilePosition pos, size_t size) {
+    if (pos == 0 && size == std::numeric_limits<size_t>::max()) {
+        // The whole file was swapped out
+        stale = true;
+        pending = std::nullopt;
+        return;
+    }
+
+    std::optional<EditRange> range = clipRange(pos, size);
+    if (!range.has_value()) {
+        return;
+    }
+
+    size_t first_block = range.value().first / block_size;
+    size_t last_block = (range.value().first + range.value().second - 1) / block_size;
+
+    if (pending == range) {
+        applyRange(range.value().first, range.value().second, false);
+        updateEntropy(first_block, last_block);
+    } else {
+        recomputeBlocks(first_block, last_block);
+    }
+    pending = std::nullopt;
+}
+
+// Built for each instance type the library has
+template ByteHistogram HerixLib::computeHistogram (const BasicHerix<RuntimeChunkAlignment>&, FilePosition, size_t, size_t);
+template ByteHistogram HerixLib::computeHistogram (const BasicHerix<PowerOfTwoChunkAlignment>&, FilePosition, size_t, size_t);
+template ByteHistogram HerixLib::computeHistogram (const BasicHerix<PowerOfTwoChunkAlignment, FileBackend>&, FilePosition, size_t, size_t);
+template class HerixLib::BasicBlockStatistics<RuntimeChunkAlignment>;
+template class HerixLib::BasicBlockStatistics<PowerOfTwoChunkAlignment>;
+template class HerixLib::BasicBlockStatistics<PowerOfTwoChunkAlignment, FileBackend>;
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+void HerixLib::test_statistics () {
+    // = Counting
+    Buffer data;
+    for (size_t i = 0; i < 1000; i++) {
+        data.push_back(static_cast<Byte>(i % 10));
+    }
+    ByteHistogram histogram{};
+    countBytes(data.data(), data.size(), histogram);
+    assert(histogram[0] == 100);
+    assert(histogram[9] == 100);
+    assert(histogram[10] == 0);
+
+    // = Entropy
+    ByteHistogram uniform{};
+    uniform.fill(4);
+    assert(std::abs(computeEntropy(uniform) - 8.0) < 0.0001);
+    ByteHistogram single{};
+    single[7] = 100;
+    assert(computeEntropy(single) == 0.0);
+    assert(std::abs(computeEntropy(histogram) - std::log2(10.0)) < 0.0001);
+
+    // = Blocks over a file
+    // First block all zeroes, second block every byte value, and a partial third block
+    Buffer contents(256, 0);
+    for (size_t i = 0; i < 256; i++) {
+        contents.push_back(static_cast<Byte>(i));
+    }
+    contents.resize(contents.size() + 100, 'a');
+    std::filesystem::path path = writeTestFile("herix_test_statistics.bin", contents);
+
+    {
+        Herix h(path, false, std::make_pair(0, std::nullopt), 1024, 64);
+        BlockStatistics stats(h, 256);
+        assert(stats.isStale());
+        stats.build(2);
+        assert(!stats.isStale());
+
+        assert(stats.getBlockCount() == 3);
+        assert(stats.getEntropy(0) == 0.0f);
+        assert(std::abs(stats.getEntropy(1) - 8.0f) < 0.0001f);
+        assert(stats.getEntropy(2) == 0.0f);
+        assert(stats.getHistogram(2)['a'] == 100);
+        assert(stats.getTotalHistogram()[0] == 257);
+
+        ByteHistogram whole = computeHistogram(h, 0, 10000, 3);
+        assert(whole == stats.getTotalHistogram());
+
+        // Edits should be applied incrementally
+        h.edit(0, 1);
+        assert(stats.getHistogram(0)[0] == 255);
+        assert(stats.getHistogram(0)[1] == 1);
+        assert(stats.getEntropy(0) > 0.0f);
+        assert(stats.getTotalHistogram()[1] == 2);
+
+        // Spanning two blocks
+        h.editMultiple(255, Buffer{ 'a', 'a' });
+        assert(stats.getHistogram(0)['a'] == 1);
+        assert(stats.getHistogram(1)['a'] == 2);
+        assert(stats.getHistogram(1)[0] == 0);
+
+        h.undo();
+        h.undo();
+        assert(stats.getEntropy(0) == 0.0f);
+        assert(std::abs(stats.getEntropy(1) - 8.0f) < 0.0001f);
+        assert(stats.getTotalHistogram() == whole);
+
+        h.redo();
+        // Edits are included when rebuilding
+        std::vector<float> incremental = stats.getEntropyMap();
+        stats.build(1);
+        assert(stats.getEntropyMap() == incremental);
+    }
+
+    {
+        // The same through an instance that reads the file directly
+        PowerOfTwoFileHerix h(path, false, std::make_pair(0, std::nullopt), 1024, 64);
+        BasicBlockStatistics stats(h, 256);
+        stats.build(2);
+        h.edit(0, 1);
+        assert(stats.getHistogram(0)[1] == 1);
+        assert(computeHistogram(h, 0, 10000, 2) == stats.getTotalHistogram());
+    }
+
+    std::filesystem::remove(path);
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef FILE_SEEN_STATISTICS
+#define FILE_SEEN_STATISTICS
+
+#include <array>
+#include <vector>
+#include <optional>
+
+#include "types.hpp"
+#include "herix.hpp"
+
+namespace HerixLib {
+
+using ByteHistogram = std::array<uint64_t, 256>;
+/// Histogram of a single block. Smaller counts than ByteHistogram to keep the per-block summaries small.
+using BlockHistogram = std::array<uint32_t, 256>;
+
+/// Adds the counts of each byte in data to histogram.
+/// Counts into four separate tables so that runs of the same byte don't stall on the same counter.
+void countBytes (const Byte* data, size_t size, ByteHistogram& histogram);
+/// Shannon entropy, in bits per byte (0 to 8)
+double computeEntropy (const ByteHistogram& histogram);
+double computeEntropy (const BlockHistogram& histogram);
+
+/// Computes the histogram of the (edited) bytes in [pos, pos+size), clipped to the end of the file.
+/// Splits the range across thread_count threads (0 means one per core), each reading the file with its own stream
+/// so the chunk cache isn't touched.
+template<typename Alignment, typename BackendType>
+ByteHistogram computeHistogram (const BasicHerix<Alignment, BackendType>& herix, FilePosition pos, size_t size, size_t thread_count=0);
+
+/// Per-block byte histograms and entropy over an entire file.
+/// Once built it listens to the Herix instance, and edits/undos/redos are applied by subtracting the old bytes and
+/// adding the new ones, rather than recomputing the blocks.
+/// Memory usage is 1KiB per block (so ~1.5% of the file with the default 64KiB block size)
+/// It works with any BasicHerix, see BlockStatistics for the usual one.
+template<typename Alignment, typename BackendType=Backend>
+class BasicBlockStatistics {
+    protected:
+    BasicHerix<Alignment, BackendType>& herix;
+    ListenerID listener;
+    size_t block_size;
+
+    /// The size of the file when the statistics were built. Anything past it isn't counted.
+    size_t covered_size = 0;
+    bool stale = true;
+
+    std::vector<BlockHistogram> blocks;
+    std::vector<float> entropy;
+    ByteHistogram total{};
+
+    /// The range passed to the before listener, which has already been subtracted.
+    std::optional<EditRange> pending;
+
+    std::optional<EditRange> clipRange (FilePosition pos, size_t size) const;
+    void applyRange (FilePosition pos, size_t size, bool subtract);
+    void recomputeBlocks (size_t first_block, size_t last_block);
+    void updateEntropy (size_t first_block, size_t last_block);
+
+    void onBeforeChange (FilePosition pos, size_t size);
+    void onChange (FilePosition pos, size_t size);
+
+    public:
+    /// Ranges larger than this are recomputed from the blocks rather than applied as a difference.
+    static constexpr size_t max_incremental_size = 1024 * 1024;
+
+    BasicBlockStatistics (BasicHerix<Alignment, BackendType>& t_herix, size_t t_block_size=64*1024);
+    ~BasicBlockStatistics ();
+
+    BasicBlockStatistics (const BasicBlockStatistics&) = delete;
+    BasicBlockStatistics& operator= (const BasicBlockStatistics&) = delete;
+
+    /// (Re)computes everything from the file. See computeHistogram for thread_count
+    void build (size_t thread_count=0);
+    /// If the statistics need to be rebuilt, such as when a new file was loaded.
+    bool isStale () const;
+
+    size_t getBlockSize () const;
+    size_t getBlockCount () const;
+    size_t getCoveredSize () const;
+
+    float getEntropy (size_t block) const;
+    const std::vector<float>& getEntropyMap () const;
+    const BlockHistogram& getHistogram (size_t block) const;
+    const ByteHistogram& getTotalHistogram () const;
+};
+
+/// The statistics of a Herix
+using BlockStatistics = BasicBlockStatistics<RuntimeChunkAlignment>;
+
+extern template class BasicBlockStatistics<RuntimeChunkAlignment>;
+extern template class BasicBlockStatistics<PowerOfTwoChunkAlignment>;
+extern template class BasicBlockStatistics<PowerOfTwoChunkAlignment, FileBackend>;
+
+void test_statistics ();
+
+}
+
+#endif
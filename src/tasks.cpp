@@ -0,0 +1,345 @@
+#include "tasks.hpp"
+#include <cassert>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+using namespace HerixLib;
+
+OperationCancelled::OperationCancelled () : std::runtime_error("Operation was cancelled.") {}
+
+CancellationToken::CancellationToken () : cancelled(std::make_shared<std::atomic<bool>>(false)) {}
+
+void CancellationToken::cancel () {
+    cancelled->store(true);
+}
+
+bool CancellationToken::isCancelled () const {
+    return cancelled->load();
+}
+
+void CancellationToken::throwIfCancelled () const {
+    if (isCancelled()) {
+        throw OperationCancelled();
+    }
+}
+
+#ifdef HERIX_HAS_COROUTINES
+
+// == Executor ==
+
+void Executor::schedule (std::coroutine_handle<> handle) {
+    ready.push_back(handle);
+}
+
+void Executor::park (std::function<bool()> condition, std::coroutine_handle<> handle) {
+    waiting.push_back(Waiting{ std::move(condition), handle });
+}
+
+void Executor::watch (Herix& herix) {
+    watched.push_back(&herix);
+}
+
+void Executor::unwatch (Herix& herix) {
+    auto iter = std::find(watched.begin(), watched.end(), &herix);
+    if (iter != watched.end()) {
+        watched.erase(iter);
+    }
+}
+
+Executor::YieldAwaiter Executor::yield () {
+    return YieldAwaiter{ *this };
+}
+
+Executor::WaitAwaiter Executor::waitUntil (std::function<bool()> condition) {
+    return WaitAwaiter{ *this, std::move(condition) };
+}
+
+/// Moves the parked coroutines whose condition now holds to the ready queue
+void Executor::wake () {
+    for (Herix* herix : watched) {
+        herix->pollAsync(false);
+    }
+
+    for (auto iter = waiting.begin(); iter != waiting.end();) {
+        if (iter->condition()) {
+            ready.push_back(iter->handle);
+            iter = waiting.erase(iter);
+        } else {
+            iter++;
+        }
+    }
+}
+
+size_t Executor::run (std::chrono::microseconds budget) {
+    auto deadline = std::chrono::steady_clock::now() + budget;
+    size_t resumed = 0;
+
+    wake();
+    while (!ready.empty()) {
+        // Only the ones that are ready now, anything they schedule waits for the next pass
+        size_t count = ready.size();
+        for (size_t i = 0; i < count; i++) {
+            std::coroutine_handle<> handle = ready.front();
+            ready.pop_front();
+            handle.resume();
+            resumed++;
+        }
+
+        if (std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+        wake();
+    }
+
+    return resumed;
+}
+
+void Executor::runUntilIdle () {
+    while (hasWork()) {
+        if (run(std::chrono::milliseconds(10)) == 0) {
+            // Everything is waiting on the disk
+            for (Herix* herix : watched) {
+                herix->pollAsync(true);
+            }
+            std::this_thread::yield();
+        }
+    }
+}
+
+bool Executor::hasWork () const {
+    return !ready.empty() || !waiting.empty();
+}
+
+
+// == Herix tasks ==
+
+HerixTasks::HerixTasks (Herix& t_herix, Executor& t_executor) : herix(t_herix), executor(t_executor) {
+    if (!herix.isAsyncLoadingEnabled()) {
+        herix.enableAsyncLoading();
+    }
+    executor.watch(herix);
+}
+
+HerixTasks::~HerixTasks () {
+    executor.unwatch(herix);
+}
+
+Task<Buffer> HerixTasks::readAsync (FilePosition pos, size_t size) {
+    Buffer data(size);
+    if (!herix.isAsyncLoadingEnabled()) {
+        data.resize(herix.readInto(pos, size, data.data()));
+        co_return data;
+    }
+
+    // Requested a piece at a time, small enough that the cache can hold all of it, and each piece is copied out of
+    // the cache as soon as it's there. A piece that has been evicted again by the time we're resumed is requested
+    // again, so nothing is ever loaded synchronously.
+    Buffer available(size, 0);
+    size_t piece_size = std::max<size_t>(herix.getMaxChunkMemory() / 2, 1);
+    for (size_t offset = 0; offset < size;) {
+        size_t amount = std::min(piece_size, size - offset);
+        size_t count = herix.readCachedInto(pos + offset, amount, data.data() + offset, available.data() + offset);
+        // Bytes that still aren't available once their chunks are cached are past the end, or holes in a backend
+        if (count == amount || herix.isRangeCached(pos + offset, amount)) {
+            offset += amount;
+            continue;
+        }
+
+        AsyncRequestID id = herix.requestRange(pos + offset, amount);
+        Herix& target = herix;
+        co_await executor.waitUntil([&target, id] () { return target.isRequestDone(id); });
+    }
+
+    // Like readInto, it's cut off at the first byte that isn't available
+    data.resize(static_cast<size_t>(std::find(available.begin(), available.end(), 0) - available.begin()));
+    co_return data;
+}
+
+/// Waits (by suspending) for the next block of reader, reporting progress and checking for cancellation.
+/// The block is valid until the next call.
+Task<std::optional<SequentialBlock>> HerixTasks::nextBlock (SequentialReader& reader, FilePosition start, const CancellationToken& token, const ProgressCallback& progress) {
+    token.throwIfCancelled();
+    if (progress) {
+        progress(reader.getPosition() - start, reader.getEnd() - start);
+    }
+
+    if (!reader.isNextReady()) {
+        co_await executor.waitUntil([&reader] () { return reader.isNextReady(); });
+        token.throwIfCancelled();
+    }
+
+    co_return reader.next();
+}
+
+Task<std::optional<FilePosition>> HerixTasks::findAsync (FilePosition pos, Buffer needle, CancellationToken token, ProgressCallback progress) {
+    if (needle.empty()) {
+        co_return pos;
+    }
+
+    size_t file_end = herix.getFileEnd();
+    if (pos >= file_end) {
+        co_return std::nullopt;
+    }
+
+    BlockSearcher searcher(needle);
+    SequentialReaderOptions options;
+    options.block_size = std::max(block_size, searcher.getMinimumBlockSize());
+    SequentialReader reader(herix, pos, file_end - pos, options);
+
+    while (std::optional<SequentialBlock> block = co_await nextBlock(reader, pos, token, progress)) {
+        std::optional<FilePosition> found = searcher.feed(block.value());
+        if (found.has_value()) {
+            co_return found;
+        }
+        co_await executor.yield();
+    }
+
+    co_return std::nullopt;
+}
+
+Task<> HerixTasks::exportAsync (std::filesystem::path output, FilePosition pos, std::optional<size_t> size, CancellationToken token, ProgressCallback progress) {
+    if (!herix.hasFile()) {
+        throw std::runtime_error("No file.");
+    }
+
+    std::ofstream out(output, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!out.is_open()) {
+        throw std::runtime_error("Failed in opening file to export to.");
+    }
+
+    SequentialReaderOptions options;
+    options.block_size = block_size;
+    SequentialReader reader(herix, pos, size.value_or(herix.getFileEnd()), options);
+
+    while (std::optional<SequentialBlock> block = co_await nextBlock(reader, pos, token, progress)) {
+        out.write(reinterpret_cast<const char*>(block.value().data), static_cast<std::streamsize>(block.value().size));
+        if (out.fail()) {
+            throw std::runtime_error("Failed to write to exported file.");
+        }
+        co_await executor.yield();
+    }
+
+    if (progress) {
+        progress(reader.getEnd() - pos, reader.getEnd() - pos);
+    }
+}
+
+#endif
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+void HerixLib::test_tasks () {
+    CancellationToken token;
+    CancellationToken copy = token;
+    copy.cancel();
+    assert(token.isCancelled());
+
+#ifdef HERIX_HAS_COROUTINES
+    Buffer contents;
+    for (size_t i = 0; i < 3 * HerixTasks::block_size; i++) {
+        contents.push_back(static_cast<Byte>((i * 7) % 251));
+    }
+    std::filesystem::path path = writeTestFile("herix_test_tasks.bin", contents);
+
+    Herix h(path, false, std::make_pair(0, std::nullopt), 1024 * 64, 1024);
+    h.edit(5, 0xFF);
+    Executor executor;
+    HerixTasks tasks(h, executor);
+
+    // = Reads
+    {
+        Task<Buffer> task = tasks.readAsync(0, 3000);
+        task.start(executor);
+        assert(!task.isDone());
+        executor.runUntilIdle();
+        assert(task.isDone());
+
+        Buffer data = task.get();
+        assert(data.size() == 3000);
+        assert(data[5] == 0xFF);
+        assert(std::equal(data.begin() + 6, data.end(), contents.begin() + 6));
+
+        // Far more than the cache can hold, which is still never loaded synchronously
+        size_t misses = h.getChunkTelemetry().misses;
+        Task<Buffer> large = tasks.readAsync(100, 10 * h.getMaxChunkMemory());
+        large.start(executor);
+        executor.runUntilIdle();
+        data = large.get();
+        assert(data.size() == 10 * h.getMaxChunkMemory());
+        assert(std::equal(data.begin(), data.end(), contents.begin() + 100));
+        assert(h.getChunkTelemetry().misses == misses);
+        assert(h.getChunkMemory() <= h.getMaxChunkMemory());
+
+        // Cut off at the end of the file
+        Task<Buffer> tail = tasks.readAsync(contents.size() - 10, 100);
+        tail.start(executor);
+        executor.runUntilIdle();
+        assert(tail.get().size() == 10);
+    }
+
+    // = Tasks awaiting tasks, with searches that yield between blocks
+    {
+        Buffer needle(contents.begin() + (2 * HerixTasks::block_size) - 2, contents.begin() + (2 * HerixTasks::block_size) + 2);
+        size_t progress_calls = 0;
+        auto search = [&] () -> Task<std::optional<FilePosition>> {
+            std::optional<FilePosition> found = co_await tasks.findAsync(HerixTasks::block_size, needle, CancellationToken(), [&progress_calls] (size_t done, size_t total) {
+                assert(done <= total);
+                progress_calls++;
+            });
+            co_return found;
+        };
+
+        Task<std::optional<FilePosition>> task = search();
+        task.start(executor);
+        executor.runUntilIdle();
+        // The pattern repeats every 251 bytes, so the first match is earlier
+        FilePosition expected = (2 * HerixTasks::block_size) - 2;
+        while (expected >= HerixTasks::block_size + 251) {
+            expected -= 251;
+        }
+        assert(task.get() == std::make_optional<FilePosition>(expected));
+        assert(progress_calls >= 1);
+    }
+
+    // = Cancelling part way through
+    {
+        CancellationToken cancel;
+        std::filesystem::path export_path = getTestPath("herix_test_tasks_export.bin");
+        Task<> task = tasks.exportAsync(export_path, 0, std::nullopt, cancel, [&cancel] (size_t done, size_t) {
+            if (done > 0) {
+                cancel.cancel();
+            }
+        });
+        task.start(executor);
+        executor.runUntilIdle();
+
+        bool cancelled = false;
+        try {
+            task.get();
+        } catch (OperationCancelled&) {
+            cancelled = true;
+        }
+        assert(cancelled);
+
+        // And a full export
+        Task<> full = tasks.exportAsync(export_path);
+        full.start(executor);
+        executor.runUntilIdle();
+        full.get();
+        std::ifstream exported(export_path, std::ios_base::binary);
+        Buffer exported_data((std::istreambuf_iterator<char>(exported)), std::istreambuf_iterator<char>());
+        assert(exported_data.size() == contents.size());
+        assert(exported_data[5] == 0xFF);
+        std::filesystem::remove(export_path);
+    }
+
+    std::filesystem::remove(path);
+#endif
+}
+
+#endif
@@ -0,0 +1,268 @@
+#ifndef FILE_SEEN_TASKS
+#define FILE_SEEN_TASKS
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "types.hpp"
+#include "herix.hpp"
+#include "sequentialreader.hpp"
+
+// The awaitable API needs C++20 coroutines. Under C++17 only the cancellation and progress types are available.
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define HERIX_HAS_COROUTINES 1
+#include <coroutine>
+#endif
+#endif
+
+namespace HerixLib {
+
+class OperationCancelled : public std::runtime_error {
+    public:
+    OperationCancelled ();
+};
+
+/// Lets a long running operation be stopped from elsewhere. Copies share the same flag, so the caller keeps one
+/// and hands a copy to the operation.
+class CancellationToken {
+    protected:
+    std::shared_ptr<std::atomic<bool>> cancelled;
+
+    public:
+    CancellationToken ();
+
+    void cancel ();
+    bool isCancelled () const;
+    /// Throws OperationCancelled if cancel has been called
+    void throwIfCancelled () const;
+};
+
+/// Called with how many bytes of the operation are done out of the total
+using ProgressCallback = std::function<void(size_t, size_t)>;
+
+#ifdef HERIX_HAS_COROUTINES
+
+/// Runs coroutines on the thread that drives it, from the application's own event loop.
+/// Nothing is resumed on other threads: coroutines waiting on I/O are parked, and are resumed from run once their
+/// condition holds, so run never blocks on the disk.
+class Executor {
+    protected:
+    class Waiting {
+        public:
+        std::function<bool()> condition;
+        std::coroutine_handle<> handle;
+    };
+
+    std::deque<std::coroutine_handle<>> ready;
+    std::vector<Waiting> waiting;
+    /// Instances to poll for completed async loads
+    std::vector<Herix*> watched;
+
+    void wake ();
+
+    public:
+    class YieldAwaiter {
+        public:
+        Executor& executor;
+
+        bool await_ready () const noexcept { return false; }
+        void await_suspend (std::coroutine_handle<> handle) { executor.schedule(handle); }
+        void await_resume () const noexcept {}
+    };
+
+    class WaitAwaiter {
+        public:
+        Executor& executor;
+        std::function<bool()> condition;
+
+        bool await_ready () const { return condition(); }
+        void await_suspend (std::coroutine_handle<> handle) { executor.park(std::move(condition), handle); }
+        void await_resume () const noexcept {}
+    };
+
+    Executor () = default;
+    Executor (const Executor&) = delete;
+    Executor& operator= (const Executor&) = delete;
+
+    void schedule (std::coroutine_handle<> handle);
+    /// Resumes handle once condition returns true. The condition is checked on every pass of run.
+    void park (std::function<bool()> condition, std::coroutine_handle<> handle);
+
+    void watch (Herix& herix);
+    void unwatch (Herix& herix);
+
+    /// Lets the rest of the loop run before continuing
+    YieldAwaiter yield ();
+    /// Suspends until condition returns true
+    WaitAwaiter waitUntil (std::function<bool()> condition);
+
+    /// Polls the watched instances and resumes coroutines until nothing is ready or the budget is spent.
+    /// Meant to be called once per frame. Returns how many coroutines were resumed.
+    size_t run (std::chrono::microseconds budget);
+    /// Runs until there is nothing left, blocking on loads. For when there's no loop to return to.
+    void runUntilIdle ();
+    bool hasWork () const;
+};
+
+template<typename T>
+class Task;
+
+namespace detail {
+    class TaskPromiseBase {
+        public:
+        /// Resumed once this task finishes, if another coroutine is awaiting it
+        std::coroutine_handle<> continuation;
+        std::exception_ptr error;
+
+        class FinalAwaiter {
+            public:
+            bool await_ready () const noexcept { return false; }
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend (std::coroutine_handle<Promise> handle) noexcept {
+                std::coroutine_handle<> next = handle.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume () const noexcept {}
+        };
+
+        std::suspend_always initial_suspend () const noexcept { return {}; }
+        FinalAwaiter final_suspend () const noexcept { return {}; }
+        void unhandled_exception () { error = std::current_exception(); }
+    };
+
+    template<typename T>
+    class TaskPromise : public TaskPromiseBase {
+        public:
+        std::optional<T> value;
+
+        Task<T> get_return_object ();
+        void return_value (T t_value) { value = std::move(t_value); }
+    };
+
+    template<>
+    class TaskPromise<void> : public TaskPromiseBase {
+        public:
+        Task<void> get_return_object ();
+        void return_void () const noexcept {}
+    };
+}
+
+/// A lazily started coroutine. It is either co_awaited by another coroutine, or started on an Executor and then
+/// checked with isDone. The task must be kept alive until it's done, since the executor only holds its handle.
+template<typename T=void>
+class Task {
+    public:
+    using promise_type = detail::TaskPromise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    protected:
+    Handle handle;
+
+    public:
+    explicit Task (Handle t_handle) : handle(t_handle) {}
+    Task (Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task& operator= (Task&& other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    Task (const Task&) = delete;
+    Task& operator= (const Task&) = delete;
+    ~Task () {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    /// Starts running the task as a top level operation
+    void start (Executor& executor) {
+        executor.schedule(handle);
+    }
+
+    bool isDone () const {
+        return handle && handle.done();
+    }
+
+    /// The result of the task, rethrowing anything it threw. Only valid once isDone().
+    T get () {
+        if (handle.promise().error) {
+            std::rethrow_exception(handle.promise().error);
+        }
+        if constexpr (!std::is_void_v<T>) {
+            return std::move(handle.promise().value.value());
+        }
+    }
+
+    // Awaiting a task runs it inline, and continues the awaiting coroutine once it finishes
+    bool await_ready () const noexcept { return false; }
+    std::coroutine_handle<> await_suspend (std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+    T await_resume () { return get(); }
+};
+
+namespace detail {
+    template<typename T>
+    Task<T> TaskPromise<T>::get_return_object () {
+        return Task<T>(Task<T>::Handle::from_promise(*this));
+    }
+
+    inline Task<void> TaskPromise<void>::get_return_object () {
+        return Task<void>(Task<void>::Handle::from_promise(*this));
+    }
+}
+
+/// Awaitable versions of the operations on a Herix instance that would otherwise block a GUI.
+/// Reads go through the async loader, and whole file operations read one block per step and wait for the disk by
+/// suspending, so they only run for a short while each time the executor resumes them.
+/// Everything runs on the thread driving the executor, so the Herix instance must only be used from that thread.
+class HerixTasks {
+    protected:
+    Herix& herix;
+    Executor& executor;
+
+    Task<std::optional<SequentialBlock>> nextBlock (SequentialReader& reader, FilePosition start, const CancellationToken& token, const ProgressCallback& progress);
+
+    public:
+    /// Size of the blocks that whole file operations handle per step
+    static constexpr size_t block_size = 1024 * 1024;
+
+    /// Enables async loading on herix if it isn't already
+    HerixTasks (Herix& t_herix, Executor& t_executor);
+    ~HerixTasks ();
+
+    HerixTasks (const HerixTasks&) = delete;
+    HerixTasks& operator= (const HerixTasks&) = delete;
+
+    /// Reads [pos, pos+size) with edits applied. The result is shorter if it goes past the end of the file.
+    Task<Buffer> readAsync (FilePosition pos, size_t size);
+    /// Like Herix::find
+    Task<std::optional<FilePosition>> findAsync (FilePosition pos, Buffer needle, CancellationToken token=CancellationToken(), ProgressCallback progress=nullptr);
+    /// Like Herix::exportTo
+    Task<> exportAsync (std::filesystem::path output, FilePosition pos=0, std::optional<size_t> size=std::nullopt,
+        CancellationToken token=CancellationToken(), ProgressCallback progress=nullptr);
+};
+
+#endif
+
+void test_tasks ();
+
+}
+
+#endif
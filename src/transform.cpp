@@ -0,0 +1,146 @@
+#include "transform.hpp"
+#include <cassert>
+#include <stdexcept>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace HerixLib;
+
+template<TransformOp Op>
+static inline Byte transformByte (Byte key, Byte value) {
+    switch (Op) {
+        case TransformOp::Xor: return static_cast<Byte>(value ^ key);
+        case TransformOp::Add: return static_cast<Byte>(value + key);
+        case TransformOp::Subtract: return static_cast<Byte>(value - key);
+        case TransformOp::And: return static_cast<Byte>(value & key);
+        case TransformOp::Or: return static_cast<Byte>(value | key);
+    }
+    return value;
+}
+
+#if defined(__SSE2__)
+template<TransformOp Op>
+static inline __m128i transformBlock (__m128i key, __m128i value) {
+    switch (Op) {
+        case TransformOp::Xor: return _mm_xor_si128(value, key);
+        case TransformOp::Add: return _mm_add_epi8(value, key);
+        case TransformOp::Subtract: return _mm_sub_epi8(value, key);
+        case TransformOp::And: return _mm_and_si128(value, key);
+        case TransformOp::Or: return _mm_or_si128(value, key);
+    }
+    return value;
+}
+#endif
+
+template<TransformOp Op>
+static void transformWith (const Byte* key, size_t key_size, size_t key_offset, Byte* data, size_t size) {
+    size_t i = 0;
+    size_t k = key_offset % key_size;
+
+#if defined(__SSE2__)
+    if (size >= 16) {
+        // The key repeated out to cover 16 bytes from any starting point in it, so each block is a single load
+        Byte local[64 + 16];
+        Buffer heap;
+        Byte* expanded = local;
+        if (key_size > 64) {
+            heap.resize(key_size + 16);
+            expanded = heap.data();
+        }
+        for (size_t j = 0; j < key_size + 16; j++) {
+            expanded[j] = key[j % key_size];
+        }
+
+        for (; i + 16 <= size; i += 16) {
+            __m128i key_block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(expanded + k));
+            __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), transformBlock<Op>(key_block, values));
+            k = (k + 16) % key_size;
+        }
+    }
+#endif
+
+    for (; i < size; i++) {
+        data[i] = transformByte<Op>(key[k], data[i]);
+        k++;
+        if (k == key_size) {
+            k = 0;
+        }
+    }
+}
+
+void HerixLib::applyTransform (TransformOp op, const Byte* key, size_t key_size, size_t key_offset, Byte* data, size_t size) {
+    assert(key_size > 0);
+    switch (op) {
+        case TransformOp::Xor: transformWith<TransformOp::Xor>(key, key_size, key_offset, data, size); break;
+        case TransformOp::Add: transformWith<TransformOp::Add>(key, key_size, key_offset, data, size); break;
+        case TransformOp::Subtract: transformWith<TransformOp::Subtract>(key, key_size, key_offset, data, size); break;
+        case TransformOp::And: transformWith<TransformOp::And>(key, key_size, key_offset, data, size); break;
+        case TransformOp::Or: transformWith<TransformOp::Or>(key, key_size, key_offset, data, size); break;
+    }
+}
+
+Byte HerixLib::applyTransform (TransformOp op, Byte key, Byte value) {
+    switch (op) {
+        case TransformOp::Xor: return transformByte<TransformOp::Xor>(key, value);
+        case TransformOp::Add: return transformByte<TransformOp::Add>(key, value);
+        case TransformOp::Subtract: return transformByte<TransformOp::Subtract>(key, value);
+        case TransformOp::And: return transformByte<TransformOp::And>(key, value);
+        case TransformOp::Or: return transformByte<TransformOp::Or>(key, value);
+    }
+    throw std::invalid_argument("Unknown transform.");
+}
+
+
+// === Testing ===
+
+#ifdef DEBUG
+
+void HerixLib::test_transform () {
+    const TransformOp ops[] = { TransformOp::Xor, TransformOp::Add, TransformOp::Subtract, TransformOp::And, TransformOp::Or };
+    Buffer original(1000);
+    for (size_t i = 0; i < original.size(); i++) {
+        original[i] = static_cast<Byte>(i * 7);
+    }
+
+    // Every key size around the block size and the expanded key's limit, compared against the byte at a time version
+    for (TransformOp op : ops) {
+        for (size_t key_size : { size_t{1}, size_t{3}, size_t{15}, size_t{16}, size_t{17}, size_t{64}, size_t{65}, size_t{100} }) {
+            Buffer key(key_size);
+            for (size_t i = 0; i < key_size; i++) {
+                key[i] = static_cast<Byte>(0x5A + (i * 13));
+            }
+
+            for (size_t key_offset : { size_t{0}, size_t{5}, size_t{99} }) {
+                Buffer data = original;
+                applyTransform(op, key.data(), key.size(), key_offset, data.data(), data.size());
+                for (size_t i = 0; i < data.size(); i++) {
+                    assert(data[i] == applyTransform(op, key[(key_offset + i) % key_size], original[i]));
+                }
+            }
+
+            // In pieces is the same as all at once
+            Buffer whole = original;
+            applyTransform(op, key.data(), key.size(), 0, whole.data(), whole.size());
+            Buffer pieces = original;
+            applyTransform(op, key.data(), key.size(), 0, pieces.data(), 333);
+            applyTransform(op, key.data(), key.size(), 333, pieces.data() + 333, 667);
+            assert(whole == pieces);
+        }
+    }
+
+    // Xor and add are undone by themselves and subtract
+    Byte key[] = { 1, 2, 3 };
+    Buffer data = original;
+    applyTransform(TransformOp::Xor, key, 3, 0, data.data(), data.size());
+    assert(data != original);
+    applyTransform(TransformOp::Xor, key, 3, 0, data.data(), data.size());
+    assert(data == original);
+    applyTransform(TransformOp::Add, key, 3, 0, data.data(), data.size());
+    applyTransform(TransformOp::Subtract, key, 3, 0, data.data(), data.size());
+    assert(data == original);
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef FILE_SEEN_TRANSFORM
+#define FILE_SEEN_TRANSFORM
+
+#include "types.hpp"
+
+namespace HerixLib {
+
+/// An operation applied to each byte with the matching byte of a repeating key. Not is Xor with a key of { 0xFF }.
+enum class TransformOp {
+    Xor,
+    Add,
+    Subtract,
+    And,
+    Or,
+};
+
+/// Applies op to data in place, with key repeated over it. key_offset is how far into the repeated key data starts,
+/// so a range can be transformed in pieces and give the same result as all at once.
+/// Uses SSE2 for 16 bytes at a time where available.
+void applyTransform (TransformOp op, const Byte* key, size_t key_size, size_t key_offset, Byte* data, size_t size);
+
+/// Applies op to a single byte
+Byte applyTransform (TransformOp op, Byte key, Byte value);
+
+void test_transform ();
+
+}
+
+#endif
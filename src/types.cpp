@@ -1 +1,32 @@
 #include "types.hpp"
+
+#ifdef DEBUG
+
+#include <atomic>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+std::filesystem::path HerixLib::getTestPath (const std::string& name) {
+    // Random for each process, since the process id isn't available everywhere
+    static const uint32_t process_token = std::random_device()();
+    static std::atomic<size_t> counter(0);
+
+    std::string unique = "_" + std::to_string(process_token) + "_" + std::to_string(counter++);
+    size_t extension = name.find('.');
+    std::string filename = name;
+    filename.insert(extension == std::string::npos ? name.size() : extension, unique);
+    return std::filesystem::temp_directory_path() / filename;
+}
+
+std::filesystem::path HerixLib::writeTestFile (const std::string& name, const Buffer& contents) {
+    std::filesystem::path path = getTestPath(name);
+    std::ofstream out(path, std::ios_base::binary | std::ios_base::trunc);
+    out.write(reinterpret_cast<const char*>(contents.data()), static_cast<std::streamsize>(contents.size()));
+    if (!out) {
+        throw std::runtime_error("Failed to write the test file " + path.string());
+    }
+    return path;
+}
+
+#endif
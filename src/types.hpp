@@ -2,8 +2,14 @@
 #define FILE_SEEN_TYPES
 
 #include <cstdint>
+#include <cstddef>
 #include <vector>
 
+#ifdef DEBUG
+#include <filesystem>
+#include <string>
+#endif
+
 namespace HerixLib {
 
 using Byte = uint8_t;
@@ -12,6 +18,14 @@ using Buffer = std::vector<Byte>;
 using FilePosition = size_t;
 using AbsoluteFilePosition = size_t;
 
+#ifdef DEBUG
+/// A path in the temporary directory for a test, with name made unique (before its extension) to this call and
+/// process, so tests that run at the same time don't use each other's files
+std::filesystem::path getTestPath (const std::string& name);
+/// Writes contents to a new file at getTestPath(name), returning its path
+std::filesystem::path writeTestFile (const std::string& name, const Buffer& contents);
+#endif
+
 }
 
 #endif